@@ -0,0 +1,101 @@
+/*
+Compare the buddy allocator with the heap for medium-sized buffers:
+alloc/free throughput, internal fragmentation (usable size over requested
+size) and the address space used.
+
+Usage: bench_buddy [live buffers] [operations (thousands)] [min size] [max size]
+
+Each backend runs in a child process, so that the heap starts empty. Both
+backends see the same sequence of requests, with sizes distributed
+log-uniformly between the minimum and maximum.
+*/
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_buddy.h"
+#include "dalloc_config.h"
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void run(const char *name, bool buddy, size_t num_slots, size_t ops,
+		size_t min_size, size_t max_size) {
+	if (buddy) {
+		set_buddy_range(min_size, max_size);
+	}
+	// Keep freed memory in the heap, so that it's available for reuse.
+	set_trim_threshold(SIZE_MAX);
+
+	void **ptrs = calloc(num_slots, sizeof(void *));
+	uintptr_t base = (uintptr_t)sbrk(0);
+	double requested = 0, usable = 0;
+	uint64_t state = 88172645463325252ULL;
+	double log_range = log((double)max_size / min_size);
+
+	double start = now();
+	for (size_t i = 0; i < ops; i++) {
+		uint64_t r = next_random(&state);
+		size_t slot = r % num_slots;
+		if (ptrs[slot]) {
+			d_free(ptrs[slot]);
+			ptrs[slot] = NULL;
+		} else {
+			double u = (double)(r >> 11) / (double)(1ull << 53);
+			size_t size = (size_t)(min_size * exp(u * log_range));
+			ptrs[slot] = d_malloc(size);
+			if (!ptrs[slot]) {
+				fprintf(stderr, "d_malloc() failed\n");
+				exit(1);
+			}
+			*(char *)ptrs[slot] = 0;
+			requested += size;
+			usable += d_malloc_usable_size(ptrs[slot]);
+		}
+	}
+	double elapsed = now() - start;
+
+	size_t heap_size = (uintptr_t)sbrk(0) - base;
+	printf("%-6s %10.3f Mops/s %8.3f usable/requested %10zu KiB heap\n",
+		name, ops / elapsed / 1e6, usable / requested, heap_size / 1024);
+}
+
+int main(int argc, char **argv) {
+	size_t num_slots = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+	size_t ops = (argc > 2 ? strtoul(argv[2], NULL, 10) : 20) * 1000;
+	size_t min_size = argc > 3 ? strtoul(argv[3], NULL, 10) : 4096;
+	size_t max_size = argc > 4 ? strtoul(argv[4], NULL, 10) : 4 * 1024 * 1024;
+	if (!num_slots || !min_size || max_size <= min_size) {
+		fprintf(stderr, "usage: %s [live buffers] [operations (thousands)] [min size] [max size]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%zu buffers, %zu operations, sizes %zu to %zu\n", num_slots, ops, min_size, max_size);
+	for (int buddy = 0; buddy < 2; buddy++) {
+		fflush(stdout);
+		pid_t child = fork();
+		if (child == 0) {
+			run(buddy ? "buddy" : "heap", buddy, num_slots, ops, min_size, max_size);
+			fflush(stdout);
+			_exit(0);
+		}
+		waitpid(child, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,365 @@
+/*
+Long-running synthetic workloads which measure how much memory the heap
+uses, rather than how fast it is:
+
+- ramp: the number of live objects ramps up to a peak, holds, then drops
+  to a quarter of the peak and plateaus there. Shows whether memory is
+  given back after a peak.
+- lifetimes: most objects die young, but some live for a long time, and
+  pin the memory around them.
+- churn: the live objects are replaced with objects of a different size
+  class every phase, so the holes left by one phase may not fit the next.
+- mixed: mostly tiny objects, with occasional short-lived huge ones.
+
+Usage: bench_footprint [operations (thousands)] [max live objects] [placement policy] [samples]
+
+The placement policy is first, next, best, lifo or all (default first).
+Each workload and policy runs in a child process, so that the heap starts
+empty.
+
+Every so often the heap footprint (the size of the sbrk heap), the bytes
+requested by live objects, the RSS, the free bytes in the heap and the
+largest free chunk are printed. At the end of each workload, the peak and
+final RSS and footprint are summarised, along with the overhead of the
+chunk headers (sizeof(chunk_t) per live object) and of rounding
+(usable size over requested size).
+*/
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_frag.h"
+
+typedef struct {
+	void *ptr;
+	size_t size;
+	// Operation at which the object is freed (lifetimes only).
+	size_t death;
+} object_t;
+
+typedef struct {
+	const char *name;
+	int policy;
+} policy_t;
+
+/*
+State of a workload run. Bookkeeping is mapped directly from the OS, so
+that it doesn't share the program break with the heap.
+*/
+typedef struct {
+	object_t *objects;
+	size_t num_objects;
+	size_t max_objects;
+	size_t requested;
+	size_t usable;
+	uint64_t random;
+	uintptr_t base;
+	size_t peak_footprint;
+	size_t peak_requested;
+} state_t;
+
+typedef struct {
+	const char *name;
+	void (*step)(state_t *state, size_t op, size_t ops);
+} workload_t;
+
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/*
+Return a random double in [0, 1).
+*/
+static double random_unit(uint64_t *state) {
+	return (double)(next_random(state) >> 11) / (double)(1ull << 53);
+}
+
+/*
+Return a random size distributed log-uniformly in [min, max].
+*/
+static size_t random_size(uint64_t *state, size_t min, size_t max) {
+	return (size_t)(min * exp(random_unit(state) * log((double)max / min)));
+}
+
+/*
+Return the resident set size. Reads /proc directly rather than with
+stdio, which would allocate from (and move) the program break.
+*/
+static size_t rss() {
+	int fd = open("/proc/self/statm", O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	char buf[128];
+	ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0) {
+		return 0;
+	}
+	buf[n] = '\0';
+	// The second field is the number of resident pages.
+	char *end;
+	strtoul(buf, &end, 10);
+	return strtoul(end, NULL, 10) * sysconf(_SC_PAGESIZE);
+}
+
+static size_t footprint(state_t *state) {
+	return (uintptr_t)sbrk(0) - state->base;
+}
+
+static void allocate(state_t *state, size_t size, size_t death) {
+	void *ptr = d_malloc(size);
+	if (!ptr) {
+		fprintf(stderr, "d_malloc(%zu) failed\n", size);
+		exit(1);
+	}
+	// Touch every page, as a real program would.
+	for (size_t i = 0; i < size; i += 4096) {
+		((char *)ptr)[i] = 1;
+	}
+	object_t *object = &state->objects[state->num_objects++];
+	object->ptr = ptr;
+	object->size = size;
+	object->death = death;
+	state->requested += size;
+	state->usable += d_malloc_usable_size(ptr);
+
+	size_t heap = footprint(state);
+	if (heap > state->peak_footprint) {
+		state->peak_footprint = heap;
+	}
+	if (state->requested > state->peak_requested) {
+		state->peak_requested = state->requested;
+	}
+}
+
+static void release(state_t *state, size_t index) {
+	object_t *object = &state->objects[index];
+	state->requested -= object->size;
+	state->usable -= d_malloc_usable_size(object->ptr);
+	d_free(object->ptr);
+	*object = state->objects[--state->num_objects];
+}
+
+static void release_random(state_t *state) {
+	release(state, next_random(&state->random) % state->num_objects);
+}
+
+/*
+Allocate or free objects to move the number of live objects towards a
+target, or replace a random object if it's already there.
+*/
+static void approach(state_t *state, size_t target, size_t min_size, size_t max_size) {
+	if (state->num_objects > target) {
+		release_random(state);
+		return;
+	}
+	if (state->num_objects == target && state->num_objects) {
+		release_random(state);
+	}
+	allocate(state, random_size(&state->random, min_size, max_size), 0);
+}
+
+static void ramp_step(state_t *state, size_t op, size_t ops) {
+	double t = (double)op / ops;
+	size_t max = state->max_objects;
+	size_t target;
+	if (t < 0.3) {
+		target = (size_t)(max * t / 0.3);
+	} else if (t < 0.5) {
+		target = max;
+	} else if (t < 0.6) {
+		target = max - (size_t)(max * 0.75 * (t - 0.5) / 0.1);
+	} else {
+		target = max / 4;
+	}
+	approach(state, target, 16, 4096);
+}
+
+static void swap_objects(state_t *state, size_t i, size_t j) {
+	object_t tmp = state->objects[i];
+	state->objects[i] = state->objects[j];
+	state->objects[j] = tmp;
+}
+
+static void lifetimes_step(state_t *state, size_t op, size_t ops) {
+	// The objects are kept in a binary min-heap ordered by time of death.
+	object_t *objects = state->objects;
+	while (state->num_objects && objects[0].death <= op) {
+		release(state, 0);
+		size_t i = 0;
+		for (;;) {
+			size_t child = 2 * i + 1;
+			if (child >= state->num_objects) {
+				break;
+			}
+			if (child + 1 < state->num_objects && objects[child + 1].death < objects[child].death) {
+				child++;
+			}
+			if (objects[i].death <= objects[child].death) {
+				break;
+			}
+			swap_objects(state, i, child);
+			i = child;
+		}
+	}
+	if (state->num_objects == state->max_objects) {
+		return;
+	}
+
+	// 90% of objects live for about 10 operations; the rest for about a
+	// tenth of the run.
+	double mean = random_unit(&state->random) < 0.9 ? 10 : ops / 10.0;
+	size_t lifetime = (size_t)(-mean * log(1 - random_unit(&state->random))) + 1;
+	allocate(state, random_size(&state->random, 16, 4096), op + lifetime);
+	for (size_t i = state->num_objects - 1; i && objects[(i - 1) / 2].death > objects[i].death;
+			i = (i - 1) / 2) {
+		swap_objects(state, i, (i - 1) / 2);
+	}
+}
+
+static void churn_step(state_t *state, size_t op, size_t ops) {
+	// Ten phases, each with its own size class.
+	static const size_t phase_sizes[] = { 32, 512, 64, 4096, 128, 1024, 48, 2048, 256, 96 };
+	size_t phase = op * 10 / ops;
+	size_t size = phase_sizes[phase];
+	approach(state, state->max_objects, size, size + size / 2);
+}
+
+static void mixed_step(state_t *state, size_t op, size_t ops) {
+	if (next_random(&state->random) % 1000 == 0) {
+		// A huge object which is freed straight away, but which may have
+		// been placed among (or below) the tiny ones.
+		if (state->num_objects == state->max_objects) {
+			release_random(state);
+		}
+		allocate(state, random_size(&state->random, 256 * 1024, 4 * 1024 * 1024), 0);
+		release(state, state->num_objects - 1);
+		return;
+	}
+	approach(state, state->max_objects, 16, 64);
+}
+
+static void sample(state_t *state, const char *workload, size_t op) {
+	d_heap_frag_stats_t frag;
+	d_heap_get_frag_stats(&frag);
+	printf("%-10s %8zu %8zu %12zu %12zu %12zu %12zu %12zu\n", workload, op,
+		state->num_objects, state->requested / 1024, footprint(state) / 1024,
+		rss() / 1024, frag.free_bytes / 1024, frag.largest_free / 1024);
+}
+
+static void run(const workload_t *workload, const policy_t *policy, size_t ops,
+		size_t max_objects, size_t samples) {
+	set_placement_policy(policy->policy);
+	// Keep the default trim threshold and top pad, so that the footprint
+	// reflects what a real program would see.
+
+	state_t state;
+	memset(&state, 0, sizeof(state));
+	state.max_objects = max_objects;
+	state.random = 88172645463325252ULL;
+	state.objects = mmap(NULL, max_objects * sizeof(object_t), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (state.objects == MAP_FAILED) {
+		fprintf(stderr, "mmap() failed\n");
+		exit(1);
+	}
+	// Let stdio allocate its buffer before the heap's base is recorded.
+	printf("%s, %s\n", workload->name, policy->name);
+	printf("%-10s %8s %8s %12s %12s %12s %12s %12s\n", "workload", "op", "live",
+		"req KiB", "heap KiB", "RSS KiB", "free KiB", "largest KiB");
+	state.base = (uintptr_t)sbrk(0);
+
+	size_t interval = samples ? ops / samples : ops + 1;
+	for (size_t op = 0; op < ops; op++) {
+		if (interval && op % interval == 0) {
+			sample(&state, workload->name, op);
+		}
+		workload->step(&state, op, ops);
+	}
+	sample(&state, workload->name, ops);
+
+	size_t final_footprint = footprint(&state);
+	size_t final_rss = rss();
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	size_t headers = state.num_objects * sizeof(chunk_t);
+	double requested = state.requested ? (double)state.requested : 1;
+
+	printf("peak:  %zu KiB RSS, %zu KiB heap, %zu KiB requested\n",
+		(size_t)usage.ru_maxrss, state.peak_footprint / 1024, state.peak_requested / 1024);
+	printf("final: %zu KiB RSS, %zu KiB heap, %zu KiB requested, heap/requested %.2f\n",
+		final_rss / 1024, final_footprint / 1024, state.requested / 1024,
+		final_footprint / requested);
+	printf("overhead: %zu KiB of headers (%zu bytes per object, %.1f%% of requested), "
+		"usable/requested %.3f\n\n", headers / 1024, sizeof(chunk_t),
+		100.0 * headers / requested, state.usable / requested);
+
+	// Leave the heap as we found it.
+	while (state.num_objects) {
+		release(&state, state.num_objects - 1);
+	}
+}
+
+int main(int argc, char **argv) {
+	size_t ops = (argc > 1 ? strtoul(argv[1], NULL, 10) : 50) * 1000;
+	size_t max_objects = argc > 2 ? strtoul(argv[2], NULL, 10) : 2048;
+	const char *policy_name = argc > 3 ? argv[3] : "first";
+	size_t samples = argc > 4 ? strtoul(argv[4], NULL, 10) : 10;
+
+	const policy_t policies[] = {
+		{ "first", DALLOC_PLACEMENT_FIRST_FIT },
+		{ "next", DALLOC_PLACEMENT_NEXT_FIT },
+		{ "best", DALLOC_PLACEMENT_BEST_FIT },
+		{ "lifo", DALLOC_PLACEMENT_LIFO },
+	};
+	const workload_t workloads[] = {
+		{ "ramp", ramp_step },
+		{ "lifetimes", lifetimes_step },
+		{ "churn", churn_step },
+		{ "mixed", mixed_step },
+	};
+	size_t num_policies = sizeof(policies) / sizeof(policies[0]);
+
+	bool known_policy = !strcmp(policy_name, "all");
+	for (size_t p = 0; p < num_policies; p++) {
+		known_policy |= !strcmp(policy_name, policies[p].name);
+	}
+	if (!ops || !max_objects || !known_policy) {
+		fprintf(stderr, "usage: %s [operations (thousands)] [max live objects] "
+			"[first|next|best|lifo|all] [samples]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%zu operations, up to %zu live objects\n\n", ops, max_objects);
+	for (size_t p = 0; p < num_policies; p++) {
+		if (strcmp(policy_name, "all") && strcmp(policy_name, policies[p].name)) {
+			continue;
+		}
+		for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+			fflush(stdout);
+			pid_t child = fork();
+			if (child == 0) {
+				run(&workloads[w], &policies[p], ops, max_objects, samples);
+				fflush(stdout);
+				_exit(0);
+			}
+			waitpid(child, NULL, 0);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+Compare dTLB misses and run time of random accesses to heap and pool
+memory with and without huge pages.
+
+Usage: bench_huge_pages [heap MiB] [accesses (millions)]
+
+Each mode runs in a child process, so that the heap starts empty. TLB
+misses are counted with perf_event_open(); if that's unavailable (e.g.
+perf_event_paranoid is too strict), only times are reported.
+*/
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_pool.h"
+
+// Size of each heap buffer.
+#define BUFFER_SIZE (16 * 1024 * 1024)
+
+// Size of each pool object.
+#define OBJECT_SIZE 64
+
+typedef struct {
+	const char *name;
+	int mode;
+} huge_page_mode_t;
+
+static int open_tlb_counter() {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/*
+Run `accesses` random reads over a set of objects, and print the time
+taken and number of dTLB misses.
+*/
+static void measure(const char *mode, const char *what, char **objs, size_t num_objs,
+		size_t obj_size, size_t accesses) {
+	int counter = open_tlb_counter();
+	uint64_t state = 88172645463325252ULL;
+	uint64_t sum = 0;
+
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	double start = now();
+	for (size_t i = 0; i < accesses; i++) {
+		uint64_t r = next_random(&state);
+		sum += (unsigned char)objs[r % num_objs][(r >> 32) % obj_size];
+	}
+	double elapsed = now() - start;
+
+	long long misses = -1;
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+			misses = -1;
+		}
+		close(counter);
+	}
+
+	if (misses >= 0) {
+		printf("%-12s %-6s %10.3f s %14lld dTLB misses (checksum %llu)\n", mode, what,
+			elapsed, misses, (unsigned long long)sum);
+	} else {
+		printf("%-12s %-6s %10.3f s %14s dTLB misses (checksum %llu)\n", mode, what,
+			elapsed, "n/a", (unsigned long long)sum);
+	}
+}
+
+/*
+Print the amount of memory backed by transparent huge pages.
+*/
+static void print_huge_page_usage(const char *mode) {
+	FILE *smaps = fopen("/proc/self/smaps_rollup", "r");
+	if (!smaps) {
+		return;
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), smaps)) {
+		if (!strncmp(line, "AnonHugePages:", 14)) {
+			printf("%-12s %s", mode, line);
+		}
+	}
+	fclose(smaps);
+}
+
+static void run(const char *mode_name, int mode, size_t heap_size, size_t accesses) {
+	set_huge_pages(mode);
+
+	// Heap: a few large buffers.
+	size_t num_buffers = heap_size / BUFFER_SIZE;
+	char **buffers = malloc(num_buffers * sizeof(char *));
+	for (size_t i = 0; i < num_buffers; i++) {
+		buffers[i] = d_malloc(BUFFER_SIZE);
+		if (!buffers[i]) {
+			fprintf(stderr, "d_malloc() failed\n");
+			exit(1);
+		}
+		memset(buffers[i], (int)i, BUFFER_SIZE);
+	}
+	measure(mode_name, "heap", buffers, num_buffers, BUFFER_SIZE, accesses);
+
+	// Pool: many small objects.
+	size_t num_objs = heap_size / OBJECT_SIZE;
+	char **objs = malloc(num_objs * sizeof(char *));
+	d_pool_t *pool = d_pool_create(OBJECT_SIZE, 0);
+	for (size_t i = 0; i < num_objs; i++) {
+		objs[i] = d_pool_get(pool);
+		memset(objs[i], (int)i, OBJECT_SIZE);
+	}
+	measure(mode_name, "pool", objs, num_objs, OBJECT_SIZE, accesses);
+	print_huge_page_usage(mode_name);
+}
+
+int main(int argc, char **argv) {
+	size_t heap_mib = argc > 1 ? strtoul(argv[1], NULL, 10) : 512;
+	size_t accesses = (argc > 2 ? strtoul(argv[2], NULL, 10) : 20) * 1000000;
+	size_t heap_size = heap_mib * 1024 * 1024;
+
+	huge_page_mode_t modes[] = {
+		{ "none", DALLOC_HUGE_PAGES_NONE },
+		{ "transparent", DALLOC_HUGE_PAGES_TRANSPARENT },
+		{ "hugetlb", DALLOC_HUGE_PAGES_HUGETLB },
+	};
+	printf("%zu MiB, %zu random reads\n", heap_mib, accesses);
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		fflush(stdout);
+		pid_t child = fork();
+		if (child == 0) {
+			run(modes[i].name, modes[i].mode, heap_size, accesses);
+			fflush(stdout);
+			_exit(0);
+		}
+		waitpid(child, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+Compare placement policies on a random allocation workload: throughput,
+and how much larger the heap grows than the memory actually in use.
+
+Usage: bench_placement [live objects] [operations (thousands)] [max size]
+
+Each policy runs in a child process, so that the heap starts empty. Every
+policy sees the same sequence of requests.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_frag.h"
+
+typedef struct {
+	const char *name;
+	int policy;
+} policy_t;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void run(const policy_t *policy, size_t num_slots, size_t ops, size_t max_size) {
+	set_placement_policy(policy->policy);
+	// Keep freed memory in the heap, so that it's available for reuse.
+	set_trim_threshold(SIZE_MAX);
+
+	void **ptrs = calloc(num_slots, sizeof(void *));
+	size_t *sizes = calloc(num_slots, sizeof(size_t));
+	uintptr_t base = (uintptr_t)sbrk(0);
+	size_t live = 0, peak_live = 0;
+	uint64_t state = 88172645463325252ULL;
+
+	double start = now();
+	for (size_t i = 0; i < ops; i++) {
+		uint64_t r = next_random(&state);
+		size_t slot = r % num_slots;
+		if (ptrs[slot]) {
+			d_free(ptrs[slot]);
+			ptrs[slot] = NULL;
+			live -= sizes[slot];
+		} else {
+			// Mostly small requests, with occasional large ones.
+			size_t size = 1 + (r >> 32) % ((r >> 20) % 8 ? 256 : max_size);
+			ptrs[slot] = d_malloc(size);
+			if (!ptrs[slot]) {
+				fprintf(stderr, "d_malloc() failed\n");
+				exit(1);
+			}
+			*(char *)ptrs[slot] = 0;
+			sizes[slot] = size;
+			live += size;
+			if (live > peak_live) {
+				peak_live = live;
+			}
+		}
+	}
+	double elapsed = now() - start;
+
+	size_t heap_size = (uintptr_t)sbrk(0) - base;
+	d_heap_frag_stats_t stats;
+	d_heap_get_frag_stats(&stats);
+	printf("%-6s %8.3f Mops/s %10zu KiB heap %8.2fx peak live %8.3f fragmentation\n",
+		policy->name, ops / elapsed / 1e6, heap_size / 1024,
+		(double)heap_size / peak_live, stats.fragmentation);
+}
+
+int main(int argc, char **argv) {
+	size_t num_slots = argc > 1 ? strtoul(argv[1], NULL, 10) : 512;
+	size_t ops = (argc > 2 ? strtoul(argv[2], NULL, 10) : 50) * 1000;
+	size_t max_size = argc > 3 ? strtoul(argv[3], NULL, 10) : 16384;
+	if (!num_slots || !max_size) {
+		fprintf(stderr, "usage: %s [live objects] [operations (thousands)] [max size]\n", argv[0]);
+		return 1;
+	}
+
+	policy_t policies[] = {
+		{ "first", DALLOC_PLACEMENT_FIRST_FIT },
+		{ "next", DALLOC_PLACEMENT_NEXT_FIT },
+		{ "best", DALLOC_PLACEMENT_BEST_FIT },
+		{ "lifo", DALLOC_PLACEMENT_LIFO },
+	};
+	printf("%zu slots, %zu operations, sizes up to %zu\n", num_slots, ops, max_size);
+	for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+		fflush(stdout);
+		pid_t child = fork();
+		if (child == 0) {
+			run(&policies[i], num_slots, ops, max_size);
+			fflush(stdout);
+			_exit(0);
+		}
+		waitpid(child, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,404 @@
+/*
+Multi-threaded stress benchmarks, modelled on three classic allocator
+benchmarks, comparing dalloc with the libc allocator:
+
+- larson: each thread replaces random objects in an array of live
+  objects. Between rounds the arrays are passed to the next thread, so
+  many objects are freed by a different thread from the one that
+  allocated them.
+- threadtest: each thread repeatedly allocates a batch of objects and
+  then frees them all. Nothing is shared between threads.
+- xmalloc: threads are paired up as producers and consumers. Producers
+  allocate objects and pass them through a queue to their consumer, which
+  frees them, so every free is cross-thread.
+
+Usage: bench_threads [max threads] [object size] [operations per thread (thousands)] [lifetime]
+
+Each workload runs with 1, 2, 4, ... up to the maximum number of threads.
+Objects are between a quarter of the object size and the object size
+(threadtest uses exactly the object size). The lifetime is the number of
+objects each thread keeps live: the size of larson's arrays, threadtest's
+batches and xmalloc's queues.
+
+For each run, the throughput (allocations plus frees per second), the
+scaling relative to one thread, the number of context switches and the
+peak RSS are reported. Each run is in a child process, so that the heap
+starts empty and the RSS is its own.
+
+For dalloc, the heap lock's counters (see d_heap_get_lock_stats()) are
+reported as well: the number of calls which found the lock held, and the
+mean time (in cycles) they waited for it.
+*/
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_lock.h"
+
+// Number of times larson's arrays are passed on.
+#define LARSON_ROUNDS 8
+
+typedef struct {
+	const char *name;
+	void *(*alloc)(size_t size);
+	void (*release)(void *ptr);
+	// Get the counters of the allocator's lock, if it has one.
+	void (*lock_stats)(d_lock_stats_t *stats);
+} allocator_t;
+
+typedef struct {
+	const char *name;
+	void *(*worker)(void *arg);
+} workload_t;
+
+/*
+A single-producer, single-consumer queue of objects (for xmalloc).
+*/
+typedef struct {
+	_Atomic size_t head;
+	char pad0[64 - sizeof(size_t)];
+	_Atomic size_t tail;
+	char pad1[64 - sizeof(size_t)];
+	size_t mask;
+	void **slots;
+} queue_t;
+
+typedef struct {
+	size_t index;
+	uint64_t random;
+} thread_t;
+
+/*
+Results of a run, written by the child process into shared memory.
+*/
+typedef struct {
+	double elapsed;
+	uint64_t operations;
+	d_lock_stats_t lock;
+	long context_switches;
+	long peak_rss_kib;
+} result_t;
+
+static const allocator_t *allocator;
+static size_t num_threads;
+static size_t object_size;
+static size_t ops_per_thread;
+static size_t lifetime;
+
+static pthread_barrier_t barrier;
+static atomic_uint_fast64_t operations = 0;
+
+// larson's arrays of live objects, one per thread.
+static void ***arrays;
+
+// xmalloc's queues, one per producer.
+static queue_t *queues;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void *dalloc_alloc(size_t size) {
+	return d_malloc(size);
+}
+
+static void dalloc_release(void *ptr) {
+	d_free(ptr);
+}
+
+static void *libc_alloc(size_t size) {
+	return malloc(size);
+}
+
+static void libc_release(void *ptr) {
+	free(ptr);
+}
+
+/*
+Allocate an object and touch it, as a real program would. Exit if the
+allocation fails.
+*/
+static void *allocate(size_t size) {
+	char *ptr = allocator->alloc(size);
+	if (!ptr) {
+		fprintf(stderr, "%s: allocation of %zu bytes failed\n", allocator->name, size);
+		exit(1);
+	}
+	ptr[0] = 1;
+	ptr[size - 1] = 1;
+	return ptr;
+}
+
+/*
+Return a random object size in [object_size / 4, object_size].
+*/
+static size_t random_size(uint64_t *state) {
+	size_t min = object_size / 4 ? object_size / 4 : 1;
+	return min + next_random(state) % (object_size - min + 1);
+}
+
+static void *larson_worker(void *arg) {
+	thread_t *thread = arg;
+	uint64_t ops = 0;
+	void **slots = arrays[thread->index];
+	for (size_t i = 0; i < lifetime; i++) {
+		slots[i] = allocate(random_size(&thread->random));
+		ops++;
+	}
+
+	size_t ops_per_round = ops_per_thread / LARSON_ROUNDS;
+	for (size_t round = 0; round < LARSON_ROUNDS; round++) {
+		// Take over the next thread's array.
+		pthread_barrier_wait(&barrier);
+		slots = arrays[(thread->index + round) % num_threads];
+		for (size_t i = 0; i < ops_per_round; i++) {
+			size_t slot = next_random(&thread->random) % lifetime;
+			allocator->release(slots[slot]);
+			slots[slot] = allocate(random_size(&thread->random));
+			ops += 2;
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	slots = arrays[thread->index];
+	for (size_t i = 0; i < lifetime; i++) {
+		allocator->release(slots[i]);
+		ops++;
+	}
+	atomic_fetch_add(&operations, ops);
+	return NULL;
+}
+
+static void *threadtest_worker(void *arg) {
+	thread_t *thread = arg;
+	uint64_t ops = 0;
+	void **batch = arrays[thread->index];
+	for (size_t done = 0; done < ops_per_thread; done += lifetime) {
+		for (size_t i = 0; i < lifetime; i++) {
+			batch[i] = allocate(object_size);
+		}
+		for (size_t i = 0; i < lifetime; i++) {
+			allocator->release(batch[i]);
+		}
+		ops += 2 * lifetime;
+	}
+	atomic_fetch_add(&operations, ops);
+	return NULL;
+}
+
+static bool queue_push(queue_t *queue, void *ptr) {
+	size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	if (tail - atomic_load_explicit(&queue->head, memory_order_acquire) > queue->mask) {
+		return false;
+	}
+	queue->slots[tail & queue->mask] = ptr;
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+static void *queue_pop(queue_t *queue) {
+	size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	if (head == atomic_load_explicit(&queue->tail, memory_order_acquire)) {
+		return NULL;
+	}
+	void *ptr = queue->slots[head & queue->mask];
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+	return ptr;
+}
+
+static void *xmalloc_worker(void *arg) {
+	thread_t *thread = arg;
+	queue_t *queue = &queues[thread->index / 2];
+	bool produce = thread->index % 2 == 0;
+	// With an odd number of threads, the last one has no partner, so it
+	// frees its own objects.
+	bool consume = !produce || thread->index == num_threads - 1;
+	uint64_t ops = 0;
+
+	size_t produced = 0, consumed = 0;
+	while ((produce && produced < ops_per_thread) || (consume && consumed < ops_per_thread)) {
+		bool progress = false;
+		if (produce && produced < ops_per_thread
+				&& queue->tail - queue->head <= queue->mask) {
+			void *ptr = allocate(random_size(&thread->random));
+			while (!queue_push(queue, ptr)) {
+				sched_yield();
+			}
+			produced++;
+			ops++;
+			progress = true;
+		}
+		if (consume && consumed < ops_per_thread) {
+			void *ptr = queue_pop(queue);
+			if (ptr) {
+				allocator->release(ptr);
+				consumed++;
+				ops++;
+				progress = true;
+			}
+		}
+		if (!progress) {
+			sched_yield();
+		}
+	}
+	atomic_fetch_add(&operations, ops);
+	return NULL;
+}
+
+static size_t round_up_power_of_two(size_t x) {
+	size_t power = 1;
+	while (power < x) {
+		power <<= 1;
+	}
+	return power;
+}
+
+/*
+Run a workload in the calling (child) process, and fill in its results.
+*/
+static void run(const workload_t *workload, result_t *result) {
+	// Bookkeeping uses mmap directly, so that it doesn't perturb either
+	// allocator.
+	size_t arrays_size = num_threads * (sizeof(void **) + lifetime * sizeof(void *));
+	arrays = mmap(NULL, arrays_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	size_t queue_capacity = round_up_power_of_two(lifetime);
+	size_t num_queues = (num_threads + 1) / 2;
+	size_t queues_size = num_queues * (sizeof(queue_t) + queue_capacity * sizeof(void *));
+	queues = mmap(NULL, queues_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	thread_t *threads = mmap(NULL, num_threads * sizeof(thread_t), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	pthread_t *handles = mmap(NULL, num_threads * sizeof(pthread_t), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (arrays == MAP_FAILED || queues == MAP_FAILED || threads == MAP_FAILED
+			|| handles == MAP_FAILED) {
+		fprintf(stderr, "mmap() failed\n");
+		exit(1);
+	}
+
+	void **slots = (void **)(arrays + num_threads);
+	for (size_t i = 0; i < num_threads; i++) {
+		arrays[i] = slots + i * lifetime;
+	}
+	void **queue_slots = (void **)(queues + num_queues);
+	for (size_t i = 0; i < num_queues; i++) {
+		queues[i].mask = queue_capacity - 1;
+		queues[i].slots = queue_slots + i * queue_capacity;
+	}
+
+	pthread_barrier_init(&barrier, NULL, num_threads);
+	double start = now();
+	for (size_t i = 0; i < num_threads; i++) {
+		threads[i].index = i;
+		threads[i].random = 88172645463325252ULL + i * 0x9e3779b97f4a7c15ULL;
+		pthread_create(&handles[i], NULL, workload->worker, &threads[i]);
+	}
+	for (size_t i = 0; i < num_threads; i++) {
+		pthread_join(handles[i], NULL);
+	}
+	result->elapsed = now() - start;
+	pthread_barrier_destroy(&barrier);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	result->operations = operations;
+	if (allocator->lock_stats) {
+		allocator->lock_stats(&result->lock);
+	}
+	result->context_switches = usage.ru_nvcsw + usage.ru_nivcsw;
+	result->peak_rss_kib = usage.ru_maxrss;
+}
+
+int main(int argc, char **argv) {
+	size_t max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+	object_size = argc > 2 ? strtoul(argv[2], NULL, 10) : 64;
+	ops_per_thread = (argc > 3 ? strtoul(argv[3], NULL, 10) : 20) * 1000;
+	lifetime = argc > 4 ? strtoul(argv[4], NULL, 10) : 256;
+	if (!max_threads || !object_size || !lifetime || ops_per_thread < LARSON_ROUNDS) {
+		fprintf(stderr, "Usage: %s [max threads] [object size] [operations per thread (thousands)] [lifetime]\n",
+			argv[0]);
+		return 1;
+	}
+
+	const allocator_t allocators[] = {
+		{ "dalloc", dalloc_alloc, dalloc_release, d_heap_get_lock_stats },
+		{ "libc", libc_alloc, libc_release, NULL },
+	};
+	const workload_t workloads[] = {
+		{ "larson", larson_worker },
+		{ "threadtest", threadtest_worker },
+		{ "xmalloc", xmalloc_worker },
+	};
+
+	result_t *result = mmap(NULL, sizeof(result_t), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (result == MAP_FAILED) {
+		fprintf(stderr, "mmap() failed\n");
+		return 1;
+	}
+
+	printf("%zu-byte objects, %zu operations per thread, lifetime %zu\n",
+		object_size, ops_per_thread, lifetime);
+	printf("%-10s %-8s %7s %10s %8s %12s %10s %10s %10s\n", "workload", "alloc", "threads",
+		"Mops/s", "scaling", "contended", "wait", "csw", "peak MiB");
+	for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+		for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+			double base_throughput = 0;
+			for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+				memset(result, 0, sizeof(*result));
+				fflush(stdout);
+				pid_t child = fork();
+				if (child == 0) {
+					allocator = &allocators[a];
+					run(&workloads[w], result);
+					_exit(0);
+				}
+				int status;
+				waitpid(child, &status, 0);
+				if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !result->elapsed) {
+					printf("%-10s %-8s %7zu failed\n", workloads[w].name, allocators[a].name,
+						num_threads);
+					continue;
+				}
+
+				double throughput = result->operations / result->elapsed / 1e6;
+				if (num_threads == 1) {
+					base_throughput = throughput;
+				}
+				char contention[32] = "-";
+				char wait[32] = "-";
+				if (allocators[a].lock_stats) {
+					const d_lock_stats_t *lock = &result->lock;
+					snprintf(contention, sizeof(contention), "%llu",
+						(unsigned long long)lock->contended);
+					snprintf(wait, sizeof(wait), "%llu", (unsigned long long)(lock->contended
+						? lock->wait_cycles / lock->contended : 0));
+				}
+				printf("%-10s %-8s %7zu %10.3f %7.2fx %12s %10s %10ld %10.1f\n", workloads[w].name,
+					allocators[a].name, num_threads, throughput,
+					base_throughput ? throughput / base_throughput : 0, contention, wait,
+					result->context_switches, result->peak_rss_kib / 1024.0);
+			}
+		}
+	}
+	return 0;
+}
@@ -2,6 +2,7 @@
 #define _DALLOC_CHUNK_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 /*
 I've implemented the heap as an XOR linked list for now.
@@ -11,6 +12,18 @@ typedef struct {
 	size_t size;
 	void *iter;
 	bool in_use;
+	// Whether the chunk's whole pages have been returned to the OS since it
+	// was freed (only meaningful for unused chunks).
+	bool purged;
+	// Whether the heap was extended with memory which isn't contiguous with
+	// this chunk (e.g. because something else moved the program break), so
+	// the next chunk doesn't start at `start + size`.
+	bool gap_after;
+	// Whether the chunk is in the placement policy's free chunk index.
+	bool indexed;
+	// When the chunk was freed, in milliseconds (see decay_now()). Only
+	// meaningful for unused chunks. Fits in the header's padding.
+	uint32_t freed_ms;
 } chunk_t;
 
 /*
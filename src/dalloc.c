@@ -1,14 +1,29 @@
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "chunk.h"
 #include "dalloc.h"
+#include "dalloc_buddy.h"
 #include "dalloc_io.h"
+#include "dalloc_latency.h"
+#include "dalloc_lock.h"
+#include "dalloc_numa.h"
+#include "dalloc_os.h"
+#include "dalloc_placement.h"
+#include "dalloc_probes.h"
+#include "dalloc_profile.h"
+#include "dalloc_search_stats.h"
+#include "dalloc_snapshot.h"
 #include "dalloc_utils.h"
 #include "dalloc_config.h"
+#include "dalloc_decay.h"
+#include "dalloc_frag.h"
+#include "dalloc_guard.h"
 
 typedef struct {
 	chunk_t *start;
@@ -17,38 +32,147 @@ typedef struct {
 
 heap_t heap;
 
+// Serialises every use of the heap (and of the placement, fragmentation
+// and decay state which goes with it).
+static mutex_t heap_lock = MUTEX_INITIALIZER;
+
+static void acquire_heap_lock() {
+	mutex_acquire(&heap_lock);
+}
+
+static void release_heap_lock() {
+	mutex_release(&heap_lock);
+}
+
+/*
+Acquire every lock on the allocation path before fork(), so that the child
+doesn't inherit state which another thread was part way through changing
+(or a lock which no thread in the child will ever release). The locks are
+taken in a fixed order, with the heap lock first since the profiler's lock
+is taken while holding it, and released in reverse.
+*/
+static void fork_prepare() {
+	acquire_heap_lock();
+	buddy_fork_prepare();
+	guard_fork_prepare();
+	profile_fork_prepare();
+}
+
+static void fork_finish() {
+	profile_fork_finish();
+	guard_fork_finish();
+	buddy_fork_finish();
+	release_heap_lock();
+}
+
+__attribute__((constructor))
+static void register_fork_handlers() {
+	pthread_atfork(fork_prepare, fork_finish, fork_finish);
+}
+
 void *_sbrk(intptr_t increment) {
 	return sbrk(increment);
 }
 
-void *d_malloc(size_t size) {
-	if (size == 0) {
-		// As mandated by the spec.
-		return (void *)0;
+/*
+Shrink a chunk to the given size, and move the remaining space into a new
+unused chunk immediately after it. This is a noop if the remaining space
+is too small to hold a chunk header (and the smallest chunk allowed by the
+placement policy).
+
+@param prv: The chunk before `chunk`, or NULL if it's the first chunk.
+@param chunk: The chunk to be split.
+@param size: The new size of the chunk.
+*/
+static void split_chunk(chunk_t *prv, chunk_t *chunk, size_t size) {
+	size_t remainder = chunk->size - size;
+	if (remainder < sizeof(chunk_t) + placement_min_size(placement_policy())) {
+		return;
 	}
 
-	// Attempt to find an unused chunk on the hepa.
-	chunk_t *found = find_unused_chunk_first(heap.start, size);
-	if (found) {
-		found->in_use = true;
-		return found->start;
+	chunk->size = size;
+
+	chunk_t *new_chunk = chunk->start + size;
+	new_chunk->size = remainder - sizeof(chunk_t);
+	new_chunk->in_use = false;
+	new_chunk->indexed = false;
+	new_chunk->gap_after = chunk->gap_after;
+	chunk->gap_after = false;
+	decay_stamp(new_chunk);
+	new_chunk->start = ((void *)new_chunk) + sizeof(chunk_t);
+	append(prv, chunk, new_chunk);
+	frag_add_free(new_chunk);
+	placement_insert(new_chunk);
+	search_path(DALLOC_SEARCH_PATH_SPLIT);
+
+	if (heap.tail == chunk) {
+		heap.tail = new_chunk;
+	}
+}
+
+/*
+Request more memory from the OS, such that the chunk at the top of the
+heap is unused and can store at least `size` bytes. Return that chunk, or
+NULL on failure (in which case errno is set by sbrk).
+
+@param size: The required size of the chunk.
+*/
+static chunk_t *grow_heap(size_t size) {
+	// If the top of the heap is unused (e.g. it's padding retained by the
+	// last trim), it can be extended in place, provided nothing else has
+	// moved the program break since.
+	chunk_t *tail = heap.tail && !heap.tail->in_use ? heap.tail : NULL;
+	if (tail && _sbrk(0) != tail->start + tail->size) {
+		tail = NULL;
 	}
 
 	// The amount of storage required for the chunk + metadata.
-	size_t actual_size = size + sizeof(chunk_t);
+	size_t increment = tail ? size - tail->size : size + sizeof(chunk_t);
+	if (huge_pages()) {
+		// Grow the heap to a huge page boundary, so that it can be backed by
+		// whole huge pages.
+		uintptr_t brk = (uintptr_t)_sbrk(0);
+		increment = align_up(brk + increment + top_pad(), os_huge_page_size()) - brk;
+	} else if (top_pad()) {
+		increment = align_up(increment + top_pad(), os_page_size());
+	}
 
-	void *allocated = _sbrk(actual_size);
+	void *allocated = _sbrk(increment);
 	if (allocated == (void *)-1) {
-		// Allocation error. ERRNO is set by sbrk.
-		// Let the caller determine how this should be handled.
-		return 0;
+		return NULL;
+	}
+	search_path(DALLOC_SEARCH_PATH_SBRK);
+	usdt_probe2(heap_grow, allocated, increment);
+	if (huge_pages()) {
+		os_advise_huge(allocated, increment);
+	}
+	if (numa_interleave_threshold() && size >= numa_interleave_threshold()) {
+		// Large allocations are likely to be shared by threads on every
+		// node, so spread them out rather than relying on first touch.
+		numa_interleave(allocated, increment);
+	}
+
+	if (tail) {
+		frag_remove_free(tail);
+		placement_remove(tail);
+		tail->size += increment;
+		frag_add_free(tail);
+		placement_insert(tail);
+		return tail;
 	}
 
 	// Bookkeeping.
 	chunk_t *chunk = (chunk_t*)allocated;
 	chunk->start = allocated + sizeof(chunk_t);
-	chunk->size = size;
-	chunk->in_use = true;
+	chunk->size = increment - sizeof(chunk_t);
+	chunk->in_use = false;
+	chunk->indexed = false;
+	chunk->gap_after = false;
+	// Fresh memory from the OS isn't resident until it's touched, so
+	// there's nothing to purge.
+	decay_stamp(chunk);
+	chunk->purged = true;
+	frag_add_free(chunk);
 
 	if (!heap.start) {
 		// This is the first block of memory allocated by this process.
@@ -57,15 +181,249 @@ void *d_malloc(size_t size) {
 		chunk->iter = 0;
 	} else {
 		// Put this chunk on the end of the list.
+		heap.tail->gap_after = heap.tail->start + heap.tail->size != allocated;
 		append(prev(heap.tail, NULL), heap.tail, chunk);
 		heap.tail = chunk;
 	}
+	placement_insert(chunk);
+	return chunk;
+}
+
+/*
+Merge any unused chunks at the top of the heap into a single chunk, and
+release it to the OS if it's larger than the trim threshold. If a top pad
+is configured, that much memory (rounded up to the end of a page) is kept
+at the top of the heap. If the heap is backed by huge pages, the top of
+the heap is kept on a huge page boundary so that no huge page is split.
+Either way, the memory is released with a single call to sbrk.
+*/
+static void trim_heap() {
+	if (!heap.tail || heap.tail->in_use) {
+		return;
+	}
+
+	void *heap_end = heap.tail->start + heap.tail->size;
+
+	// Walk backwards to the first of the unused chunks at the top of the
+	// heap. `before` is the last chunk in use, or the last chunk followed by
+	// memory which isn't ours (if any). Chunks can't be merged across that.
+	chunk_t *first = heap.tail;
+	chunk_t *before = prev(first, NULL);
+	frag_remove_free(first);
+	placement_remove(first);
+	while (before && !before->in_use && !before->gap_after) {
+		search_visit();
+		search_path(DALLOC_SEARCH_PATH_COALESCE);
+		frag_remove_free(before);
+		placement_remove(before);
+		chunk_t *before_before = prev(before, first);
+		first = before;
+		before = before_before;
+	}
+
+	// Absorb the rest of the unused chunks into the first one, which
+	// becomes the last chunk in the heap.
+	first->size = heap_end - first->start;
+	first->iter = (void *)before;
+	if (first != heap.tail) {
+		decay_stamp(first);
+	}
+	heap.tail = first;
+	frag_add_free(first);
+	placement_insert(first);
+
+	size_t unused = heap_end - (void *)first;
+	if (unused <= trim_threshold()) {
+		return;
+	}
+
+	// If something else has moved the program break since the heap was
+	// last grown, lowering it would release memory which isn't ours.
+	if (_sbrk(0) != heap_end) {
+		return;
+	}
+
+	size_t to_free;
+	if (top_pad() || huge_pages()) {
+		size_t alignment = huge_pages() ? os_huge_page_size() : os_page_size();
+		uintptr_t new_end = align_up((uintptr_t)first->start + top_pad(), alignment);
+		if (new_end >= (uintptr_t)heap_end) {
+			return;
+		}
+		to_free = (uintptr_t)heap_end - new_end;
+		frag_remove_free(first);
+		placement_remove(first);
+		first->size = new_end - (uintptr_t)first->start;
+		frag_add_free(first);
+		placement_insert(first);
+	} else {
+		to_free = unused;
+		frag_remove_free(first);
+		placement_remove(first);
+		if (before) {
+			remove_after(before, first);
+		} else {
+			heap.start = NULL;
+		}
+		heap.tail = before;
+	}
+
+	// Release the memory back to the OS.
+	void *res = _sbrk(-to_free);
+
+	if (res == (void *)-1) {
+		// If this failed, it's probably a bug in our code.
+		// Let's pretend like nothing is wrong for now...
+		log_warning("Failed to free() memory. Likely a dalloc bug");
+		size_t alloc = total_allocated(heap.start);
+		log_diag("Attempted to free %d bytes. Total allocated = %d.", to_free, alloc);
+		panic("d_free(): heap corruption");
+		return;
+	}
+	search_path(DALLOC_SEARCH_PATH_TAIL_RELEASE);
+	usdt_probe2(heap_trim, res - to_free, to_free);
+}
+
+/*
+Move the start of a chunk which is being allocated forward to an
+alignment, by splitting the space in front of it off into an unused chunk.
+Return the aligned chunk, which is then in use. The chunk must be large
+enough to fit an unused chunk, a header and the alignment in front of the
+required size (see heap_malloc()).
+
+@param prv: The chunk before `chunk`. Set to the unused chunk split off.
+@param chunk: The chunk, which must be in use and not yet aligned.
+@param align: The alignment.
+*/
+static chunk_t *align_chunk(chunk_t **prv, chunk_t *chunk, size_t align) {
+	size_t min_size = placement_min_size(placement_policy());
+	uintptr_t start = align_up((uintptr_t)chunk->start + min_size + sizeof(chunk_t), align);
+	split_chunk(*prv, chunk, start - sizeof(chunk_t) - (uintptr_t)chunk->start);
+
+	// split_chunk() treats the new chunk as the unused one, so swap them.
+	chunk_t *aligned = next(chunk, *prv);
+	frag_remove_free(aligned);
+	placement_remove(aligned);
+	aligned->in_use = true;
+
+	chunk->in_use = false;
+	decay_stamp(chunk);
+	frag_add_free(chunk);
+	placement_insert(chunk);
+
+	*prv = chunk;
+	return aligned;
+}
+
+/*
+Allocate a chunk of at least `size` bytes (the body of d_malloc()). The
+caller must hold the heap lock.
+
+@param size: The required size.
+@param align: The required alignment of the chunk's memory, or 0.
+*/
+static void *heap_malloc(size_t size, size_t align) {
+	if (size == 0) {
+		// As mandated by the spec.
+		return (void *)0;
+	}
+
+	decay_tick();
+
+	size_t min_size = placement_min_size(placement_policy());
+	if (size < min_size) {
+		size = min_size;
+	}
+
+	// An aligned chunk is carved out of a larger one, leaving an unused
+	// chunk in front of it.
+	size_t search_size = size;
+	if (align > 1) {
+		search_size = size + align + sizeof(chunk_t) + min_size;
+		if (search_size < size) {
+			log_warning("Allocating %zu bytes aligned to %zu results in integer overflow", size, align);
+			return NULL;
+		}
+	}
+
+	// Attempt to find an unused chunk on the hepa.
+	chunk_t *prv = NULL;
+	chunk_t *chunk = placement_find(heap.start, heap.tail, search_size, &prv);
+	if (chunk) {
+		search_path(DALLOC_SEARCH_PATH_REUSE);
+	} else {
+		chunk = grow_heap(search_size);
+		if (!chunk) {
+			// Allocation error. ERRNO is set by sbrk.
+			// Let the caller determine how this should be handled.
+			return 0;
+		}
+		prv = prev(chunk, NULL);
+	}
+
+	chunk->in_use = true;
+	frag_remove_free(chunk);
+	placement_remove(chunk);
+	if (align > 1 && (uintptr_t)chunk->start % align) {
+		chunk = align_chunk(&prv, chunk, align);
+	}
+	split_chunk(prv, chunk, size);
 
 	// Return the address of user-writable memory.
 	return chunk->start;
 }
 
-void d_free(void *ptr) {
+// Arena used when none is given: d_malloc() chooses.
+#define DALLOC_ARENA_AUTO -1
+
+/*
+Allocate from an arena, or from wherever d_malloc() would (the body of
+d_malloc() and d_mallocx()).
+
+@param size: The required size.
+@param align: The required alignment, or 0.
+@param arena: One of DALLOC_ARENA_*.
+*/
+static void *arena_malloc(size_t size, size_t align, int arena) {
+	usdt_probe1(malloc_entry, size);
+	void *ptr = NULL;
+	if (arena == DALLOC_ARENA_AUTO && align <= 1 && (ptr = guard_malloc(size))) {
+		usdt_probe3(malloc_return, ptr, size, DALLOC_PROBE_PATH_GUARD);
+	} else if (arena == DALLOC_ARENA_BUDDY) {
+		// Blocks are aligned to their size, so a block large enough for the
+		// alignment is needed. Neither can exceed the largest block.
+		size_t block_size = size < align ? align : size;
+		ptr = size && block_size <= buddy_max_block() ? buddy_allocate(block_size) : NULL;
+		usdt_probe3(malloc_return, ptr, size, DALLOC_PROBE_PATH_BUDDY);
+	} else if (arena == DALLOC_ARENA_AUTO && align <= os_page_size()
+			&& (ptr = buddy_malloc(size))) {
+		usdt_probe3(malloc_return, ptr, size, DALLOC_PROBE_PATH_BUDDY);
+	} else {
+		search_begin();
+		acquire_heap_lock();
+		ptr = heap_malloc(size, align);
+		release_heap_lock();
+		search_end(DALLOC_SEARCH_OP_MALLOC);
+		usdt_probe3(malloc_return, ptr, size, DALLOC_PROBE_PATH_HEAP);
+	}
+	profile_malloc(ptr, size);
+	return ptr;
+}
+
+void *d_malloc(size_t size) {
+	latency_begin();
+	latency_set_size(size);
+	void *ptr = arena_malloc(size, 0, DALLOC_ARENA_AUTO);
+	latency_end(DALLOC_LATENCY_OP_MALLOC);
+	return ptr;
+}
+
+/*
+Return a chunk to the heap (the body of d_free()).
+
+@param ptr: The chunk's user memory.
+*/
+static void heap_free(void *ptr) {
 	if (!ptr) {
 		// If ptr is a null pointer, no action shall occur.
 		return;
@@ -90,39 +448,51 @@ void d_free(void *ptr) {
 		panic("free(): double free or corrupted heap");
 		return;
 	}
+	latency_set_size(chunk->size);
 
 	chunk->in_use = false;
+	decay_stamp(chunk);
+	frag_add_free(chunk);
+	placement_insert(chunk);
+	profile_free(ptr);
 
 	// todo: coalesce nearby unused chunks.
 
-	while (heap.tail && !heap.tail->in_use) {
-		chunk_t *freed_chunk = heap.tail;
-		if (heap.tail == heap.start) {
-			heap.tail = heap.start = NULL;
-		} else {
-			chunk_t *previous = prev(heap.tail, NULL);
-			remove_after(previous, freed_chunk);
-			heap.tail = previous;
-		}
-
-		// The amount of space occupied by this chunk and its metadata.
-		size_t to_free = sizeof(chunk_t) + freed_chunk->size;
-
-		// Release the memory back to the OS.
-		void *res = _sbrk(-to_free);
+	trim_heap();
+	decay_tick();
+}
 
-		if (res == (void *)-1) {
-			// If this failed, it's probably a bug in our code.
-			// Let's pretend like nothing is wrong for now...
-			log_warning("Failed to free() memory. Likely a dalloc bug");
-			size_t alloc = total_allocated(heap.start);
-			log_diag("Attempted to free %d bytes. Total allocated = %d.", to_free, alloc);
-			panic("d_free(): heap corruption");
-		}
+void d_free(void *ptr) {
+	latency_begin();
+	usdt_probe1(free_entry, ptr);
+	if (guard_owns(ptr)) {
+		latency_set_size(guard_size(ptr));
+		profile_free(ptr);
+		guard_free(ptr);
+		usdt_probe2(free_return, ptr, DALLOC_PROBE_PATH_GUARD);
+	} else if (buddy_owns(ptr)) {
+		latency_set_size(buddy_size(ptr));
+		profile_free(ptr);
+		buddy_free(ptr);
+		usdt_probe2(free_return, ptr, DALLOC_PROBE_PATH_BUDDY);
+	} else {
+		search_begin();
+		acquire_heap_lock();
+		heap_free(ptr);
+		release_heap_lock();
+		search_end(DALLOC_SEARCH_OP_FREE);
+		usdt_probe2(free_return, ptr, DALLOC_PROBE_PATH_HEAP);
 	}
+	latency_end(DALLOC_LATENCY_OP_FREE);
 }
 
-void *d_calloc(size_t nmemb, size_t size) {
+/*
+Allocate zeroed memory for an array (the body of d_calloc()).
+
+@param nmemb: The number of elements.
+@param size: The size of each element.
+*/
+static void *zeroed_malloc(size_t nmemb, size_t size) {
 	size_t total = nmemb * size;
 	if (total / nmemb != size) {
 		// Integer overflow.
@@ -142,21 +512,24 @@ void *d_calloc(size_t nmemb, size_t size) {
 	return ptr;
 }
 
-void *d_realloc(void *ptr, size_t size) {
-	if (!ptr) {
-		// If ptr is NULL, then the call is equivalent to malloc(size), for all
-		// values of size.
-		return d_malloc(size);
-	}
+void *d_calloc(size_t nmemb, size_t size) {
+	latency_begin();
+	latency_set_size(nmemb * size);
+	void *ptr = zeroed_malloc(nmemb, size);
+	latency_end(DALLOC_LATENCY_OP_CALLOC);
+	return ptr;
+}
 
-	if (size == 0 && ptr) {
-		// For compatibility with glibc malloc, if size is equal to zero, and
-		// ptr is not NULL, then the call is equivalent to free(ptr). Note that
-		// this is not required by the posix spec.
-		d_free(ptr);
-		return NULL;
-	}
+/*
+Resize a chunk in place if possible. Return its memory, or NULL if it must
+be moved (or on error). The caller must hold the heap lock.
 
+@param ptr: The chunk's user memory.
+@param size: The new size (which isn't 0).
+@param old_size: Set to the chunk's size before resizing, or 0 on error.
+*/
+static void *resize_chunk(void *ptr, size_t size, size_t *old_size) {
+	*old_size = 0;
 	if (!heap.start) {
 		// User error. Undefined behaviour.
 		panic("realloc() error: Attempted to realloc memory without first allocating");
@@ -177,6 +550,7 @@ void *d_realloc(void *ptr, size_t size) {
 		return NULL;
 	}
 
+	*old_size = chunk->size;
 	if (size == chunk->size) {
 		// realloc() to same size.
 		return chunk->start;
@@ -187,36 +561,132 @@ void *d_realloc(void *ptr, size_t size) {
 		// but for now, let's just handle this the old-fashioned way.
 		// todo: this will be extremely inefficient if the old ptr is at the top
 		// of the heap.
-		chunk = NULL;
-		void *new_ptr = d_malloc(size);
-		for (size_t i = 0; i < size; i++) {
-			((char *)new_ptr)[i] = ((char *)ptr)[i];
-		}
+		return NULL;
+	}
+
+	// We want a smaller chunk. Reduce the current chunk to the requested
+	// size and create a new unused chunk with the remaining space. If the
+	// current chunk is only slightly larger than the required size (the
+	// difference is less than the minimum required to store a header for
+	// a new chunk), it's left as is.
+	split_chunk(prv, chunk, size);
+
+	// If this was the last chunk, the remaining space may be trimmed.
+	trim_heap();
+
+	return chunk->start;
+}
+
+/*
+Resize a chunk, moving it if necessary (the body of d_realloc()).
+
+@param ptr: The chunk's user memory.
+@param size: The new size.
+*/
+static void *heap_realloc(void *ptr, size_t size) {
+	if (!ptr) {
+		// If ptr is NULL, then the call is equivalent to malloc(size), for all
+		// values of size.
+		return d_malloc(size);
+	}
+
+	if (size == 0 && ptr) {
+		// For compatibility with glibc malloc, if size is equal to zero, and
+		// ptr is not NULL, then the call is equivalent to free(ptr). Note that
+		// this is not required by the posix spec.
 		d_free(ptr);
+		return NULL;
+	}
+
+	size_t old_size;
+	acquire_heap_lock();
+	void *new_ptr = resize_chunk(ptr, size, &old_size);
+	release_heap_lock();
+	if (new_ptr || !old_size) {
 		return new_ptr;
 	}
 
-	// We want a smaller chunk.
-	size_t remainder = chunk->size - size;
-	if (remainder <= sizeof(chunk_t)) {
-		// The current chunk is slightly larger than the required size, and the
-		// difference is less than the minimum required to store a header for a
-		// new chunk. Therefore just return the pointer to the current chunk.
-		// todo: improve this (e.g. what if current chunk is at top of heap?)
+	// The chunk stays in use while it's copied, so it's safe to do this
+	// without the lock (which d_malloc() and d_free() take themselves).
+	new_ptr = d_malloc(size);
+	if (!new_ptr) {
+		return NULL;
+	}
+	memcpy(new_ptr, ptr, old_size);
+	d_free(ptr);
+	return new_ptr;
+}
+
+/*
+Resize a guarded allocation. These are always moved (unless the size is
+unchanged), so that the new allocation is sampled like any other.
+
+@param ptr: The guarded allocation.
+@param size: The new size.
+*/
+static void *guard_realloc(void *ptr, size_t size) {
+	size_t old_size = guard_size(ptr);
+	if (size == old_size) {
 		return ptr;
 	}
 
-	// Reduce the current chunk to the requested size.
-	chunk->size = size;
+	void *new_ptr = NULL;
+	if (size) {
+		new_ptr = d_malloc(size);
+		if (!new_ptr) {
+			return NULL;
+		}
+		memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+	}
+	d_free(ptr);
+	return new_ptr;
+}
 
-	// Create a new unused chunk with the remaining space.
-	chunk_t *new_chunk = chunk->start + size;
-	new_chunk->size = remainder - sizeof(chunk_t);;
-	new_chunk->in_use = false;
-	new_chunk->start = ((void *)new_chunk) + sizeof(chunk_t);
-	append(prv, chunk, new_chunk);
+/*
+Resize a buddy block. The block is kept if the new size still needs a
+block of the same order; otherwise the allocation is moved (possibly out
+of the buddy allocator, if the new size is outside its range).
+
+@param ptr: The block.
+@param size: The new size.
+*/
+static void *buddy_realloc(void *ptr, size_t size) {
+	size_t block_size = buddy_size(ptr);
+	if (size <= block_size && size > block_size / 2) {
+		return ptr;
+	}
 
-	return chunk->start;
+	void *new_ptr = NULL;
+	if (size) {
+		new_ptr = d_malloc(size);
+		if (!new_ptr) {
+			return NULL;
+		}
+		memcpy(new_ptr, ptr, size < block_size ? size : block_size);
+	}
+	d_free(ptr);
+	return new_ptr;
+}
+
+void *d_realloc(void *ptr, size_t size) {
+	latency_begin();
+	latency_set_size(size);
+	usdt_probe2(realloc_entry, ptr, size);
+	void *new_ptr;
+	if (guard_owns(ptr)) {
+		new_ptr = guard_realloc(ptr, size);
+		usdt_probe4(realloc_return, ptr, new_ptr, size, DALLOC_PROBE_PATH_GUARD);
+	} else if (buddy_owns(ptr)) {
+		new_ptr = buddy_realloc(ptr, size);
+		usdt_probe4(realloc_return, ptr, new_ptr, size, DALLOC_PROBE_PATH_BUDDY);
+	} else {
+		search_begin();
+		new_ptr = heap_realloc(ptr, size);
+		search_end(DALLOC_SEARCH_OP_REALLOC);
+		usdt_probe4(realloc_return, ptr, new_ptr, size, DALLOC_PROBE_PATH_HEAP);
+	}
+	latency_end(DALLOC_LATENCY_OP_REALLOC);
+	return new_ptr;
 }
 
 void *d_reallocarray(void *ptr, size_t nmemb, size_t size) {
@@ -228,3 +698,208 @@ void *d_reallocarray(void *ptr, size_t nmemb, size_t size) {
 	}
 	return d_realloc(ptr, total);
 }
+
+/*
+Decode the alignment and arena from d_mallocx() flags. Return false if
+they're invalid.
+
+@param flags: The flags.
+@param align: Set to the alignment, or 0.
+@param arena: Set to the arena, or DALLOC_ARENA_AUTO.
+*/
+static bool decode_flags(int flags, size_t *align, int *arena) {
+	int lg_align = flags & 0x3f;
+	*align = lg_align ? (size_t)1 << lg_align : 0;
+	*arena = ((flags >> 12) & 0xf) - 1;
+	if (*arena > DALLOC_ARENA_BUDDY) {
+		log_warning("Invalid arena %d in allocation flags", *arena);
+		return false;
+	}
+	return true;
+}
+
+/*
+Check if an allocation came from an arena. Always true for
+DALLOC_ARENA_AUTO.
+
+@param ptr: The allocation.
+@param arena: The arena.
+*/
+static bool in_arena(const void *ptr, int arena) {
+	if (arena == DALLOC_ARENA_BUDDY) {
+		return buddy_owns(ptr);
+	}
+	if (arena == DALLOC_ARENA_HEAP) {
+		return !buddy_owns(ptr) && !guard_owns(ptr);
+	}
+	return true;
+}
+
+void *d_mallocx(size_t size, int flags) {
+	size_t align;
+	int arena;
+	if (!decode_flags(flags, &align, &arena)) {
+		return NULL;
+	}
+
+	latency_begin();
+	latency_set_size(size);
+	void *ptr = arena_malloc(size, align, arena);
+	if (ptr && (flags & DALLOC_MALLOCX_ZERO)) {
+		memset(ptr, 0, size);
+	}
+	latency_end(DALLOC_LATENCY_OP_MALLOC);
+	return ptr;
+}
+
+/*
+Resize an allocation if it can be done without moving it. Return the
+allocation if so, or NULL otherwise.
+
+@param ptr: The allocation.
+@param size: The new size.
+@param old_size: Set to the allocation's usable size before resizing, or 0
+				 if the pointer is invalid.
+*/
+static void *resize_in_place(void *ptr, size_t size, size_t *old_size) {
+	if (guard_owns(ptr)) {
+		*old_size = guard_size(ptr);
+		return size == *old_size ? ptr : NULL;
+	}
+	if (buddy_owns(ptr)) {
+		*old_size = buddy_size(ptr);
+		return size <= *old_size && size > *old_size / 2 ? ptr : NULL;
+	}
+
+	search_begin();
+	acquire_heap_lock();
+	void *new_ptr = resize_chunk(ptr, size, old_size);
+	release_heap_lock();
+	search_end(DALLOC_SEARCH_OP_REALLOC);
+	return new_ptr;
+}
+
+void *d_rallocx(void *ptr, size_t size, int flags) {
+	size_t align;
+	int arena;
+	if (!decode_flags(flags, &align, &arena)) {
+		return NULL;
+	}
+	if (!ptr || !size) {
+		log_warning("d_rallocx(): pointer must not be NULL and size must not be 0");
+		return NULL;
+	}
+
+	latency_begin();
+	latency_set_size(size);
+	usdt_probe2(realloc_entry, ptr, size);
+	size_t old_size = 0;
+	void *new_ptr = NULL;
+	// An allocation which doesn't already have the alignment, or is in a
+	// different arena, has to be moved.
+	if ((!align || (uintptr_t)ptr % align == 0) && in_arena(ptr, arena)) {
+		new_ptr = resize_in_place(ptr, size, &old_size);
+	} else {
+		old_size = d_malloc_usable_size(ptr);
+	}
+
+	if (!new_ptr && old_size && !(flags & DALLOC_MALLOCX_NO_MOVE)) {
+		new_ptr = arena_malloc(size, align, arena);
+		if (new_ptr) {
+			memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+			d_free(ptr);
+		}
+	}
+	if (new_ptr && (flags & DALLOC_MALLOCX_ZERO) && size > old_size) {
+		memset(new_ptr + old_size, 0, size - old_size);
+	}
+	usdt_probe4(realloc_return, ptr, new_ptr, size, guard_owns(new_ptr) ? DALLOC_PROBE_PATH_GUARD
+		: buddy_owns(new_ptr) ? DALLOC_PROBE_PATH_BUDDY : DALLOC_PROBE_PATH_HEAP);
+	latency_end(DALLOC_LATENCY_OP_REALLOC);
+	return new_ptr;
+}
+
+void d_dallocx(void *ptr, int flags) {
+	size_t align;
+	int arena;
+	if (!ptr || !decode_flags(flags, &align, &arena)) {
+		return;
+	}
+	if (!in_arena(ptr, arena)) {
+		panic("d_dallocx(): pointer %p isn't from arena %d", ptr, arena);
+		return;
+	}
+	d_free(ptr);
+}
+
+size_t d_malloc_usable_size(void *ptr) {
+	if (!ptr) {
+		return 0;
+	}
+	if (guard_owns(ptr)) {
+		// Guarded allocations end at a guard page, so there's no slack.
+		return guard_size(ptr);
+	}
+	if (buddy_owns(ptr)) {
+		return buddy_size(ptr);
+	}
+
+	// The chunk header immediately precedes its memory, so there's no need
+	// to search the heap.
+	chunk_t *chunk = ptr - sizeof(chunk_t);
+	if (chunk->start != ptr) {
+		panic("d_malloc_usable_size(): invalid pointer");
+		return 0;
+	}
+	if (!chunk->in_use) {
+		panic("d_malloc_usable_size(): pointer has been freed");
+		return 0;
+	}
+	return chunk->size;
+}
+
+size_t d_good_size(size_t size) {
+	// Requests are only rounded up to the placement policy's minimum: a new
+	// chunk is otherwise exactly the requested size. Any slack from reusing
+	// a larger chunk depends on the state of the heap, and is only known
+	// once allocated (see d_malloc_usable_size()).
+	size_t min_size = placement_min_size(placement_policy());
+	return size && size < min_size ? min_size : size;
+}
+
+bool d_heap_snapshot(int fd) {
+	// Take a copy of the chunk map, so that the lock isn't held while
+	// writing (the reader of fd may well need to allocate).
+	heap_snapshot_t snapshot;
+	acquire_heap_lock();
+	bool ok = copy_snapshot(heap.start, &snapshot);
+	release_heap_lock();
+	if (!ok) {
+		log_warning("d_heap_snapshot(): unable to map snapshot buffer");
+		return false;
+	}
+	ok = write_snapshot(fd, &snapshot);
+	release_snapshot(&snapshot);
+	return ok;
+}
+
+size_t d_heap_purge() {
+	acquire_heap_lock();
+	size_t purged = decay_purge(true);
+	release_heap_lock();
+	return purged;
+}
+
+void d_heap_get_frag_stats(d_heap_frag_stats_t *stats) {
+	acquire_heap_lock();
+	get_frag_stats(stats);
+	release_heap_lock();
+}
+
+void d_heap_get_lock_stats(d_lock_stats_t *stats) {
+	mutex_get_stats(&heap_lock, stats);
+}
+
+void d_heap_reset_lock_stats() {
+	mutex_reset_stats(&heap_lock);
+}
@@ -9,4 +9,86 @@ void *d_calloc(size_t nmemb, size_t size);
 void *d_realloc(void *ptr, size_t size);
 void *d_reallocarray(void *ptr, size_t nmemb, size_t size);
 
+/*
+Return the number of bytes which may be used in an allocation, which may be
+more than was requested (e.g. if an unused chunk was reused without being
+split). Returns 0 for NULL.
+
+@param ptr: A pointer returned by d_malloc() and friends.
+*/
+size_t d_malloc_usable_size(void *ptr);
+
+/*
+Return the usable size of a new allocation of `size` bytes. Containers
+can use this to size their buffers to what they will actually get.
+
+@param size: The requested size.
+*/
+size_t d_good_size(size_t size);
+
+/*
+Flags for d_mallocx(), d_rallocx() and d_dallocx(), combined with `|`.
+*/
+
+// Align the allocation to 2^la bytes (0 < la < 64).
+#define DALLOC_MALLOCX_LG_ALIGN(la) ((int)(la))
+// Align the allocation to `a` bytes, which must be a power of two.
+#define DALLOC_MALLOCX_ALIGN(a) ((int)__builtin_ctzll((unsigned long long)(a)))
+// Zero the allocation (for d_rallocx(), only the bytes past the old usable
+// size).
+#define DALLOC_MALLOCX_ZERO (1 << 6)
+// Don't use a thread cache. d_malloc() doesn't have one (only pools do), so
+// this is accepted for compatibility and has no effect.
+#define DALLOC_MALLOCX_TCACHE_NONE (1 << 7)
+// d_rallocx() only: resize in place or not at all.
+#define DALLOC_MALLOCX_NO_MOVE (1 << 8)
+// Allocate from a specific arena (one of DALLOC_ARENA_*), rather than the
+// one d_malloc() would choose. This also skips guard sampling.
+#define DALLOC_MALLOCX_ARENA(a) (((int)(a) + 1) << 12)
+
+// The sbrk() heap.
+#define DALLOC_ARENA_HEAP 0
+// The buddy allocator, regardless of its configured size range (see
+// set_buddy_range()). Blocks are still limited to the maximum of the range
+// when the buddy allocator was first used, and larger sizes or alignments
+// fail.
+#define DALLOC_ARENA_BUDDY 1
+
+/*
+Allocate at least `size` bytes, as controlled by `flags` (a combination of
+DALLOC_MALLOCX_* flags, or 0 to behave like d_malloc()). Return NULL on
+failure, or if the flags are invalid.
+
+Alignments of more than a page aren't served by the buddy allocator
+unless it's selected explicitly, in which case the block is at least as
+large as the alignment.
+
+@param size: The required size.
+@param flags: The flags.
+*/
+void *d_mallocx(size_t size, int flags);
+
+/*
+Resize an allocation, as controlled by `flags` (see d_mallocx()). Return
+the resized allocation, or NULL on failure, in which case `ptr` is left
+untouched. With DALLOC_MALLOCX_NO_MOVE, NULL is also returned if the
+allocation can't be resized without moving it. If the flags name an arena
+which the allocation isn't in, it's moved to that arena (so this fails with
+DALLOC_MALLOCX_NO_MOVE).
+
+@param ptr: A pointer returned by d_malloc() and friends. Must not be NULL.
+@param size: The new size. Must not be 0.
+@param flags: The flags.
+*/
+void *d_rallocx(void *ptr, size_t size, int flags);
+
+/*
+Free an allocation. If `flags` names an arena, the allocation must have
+come from it.
+
+@param ptr: A pointer returned by d_malloc() and friends.
+@param flags: The flags the allocation was made with.
+*/
+void d_dallocx(void *ptr, int flags);
+
 #endif // _DALLOC_H_
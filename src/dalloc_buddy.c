@@ -0,0 +1,212 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dalloc_buddy.h"
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "dalloc_lock.h"
+#include "dalloc_os.h"
+
+// Number of block orders.
+#define BUDDY_NUM_ORDERS (BUDDY_MAX_ORDER - BUDDY_MIN_ORDER + 1)
+
+// Number of smallest blocks in the region.
+#define BUDDY_NUM_PAGES (BUDDY_REGION_SIZE >> BUDDY_MIN_ORDER)
+
+// Set in a block's tag if it's free.
+#define BUDDY_TAG_FREE 0x80
+
+// Set in a block's tag if it's the start of a block (free or allocated).
+#define BUDDY_TAG_HEAD 0x40
+
+#define BUDDY_TAG_ORDER_MASK 0x3f
+
+/*
+Links stored at the start of each free block.
+*/
+typedef struct buddy_block {
+	struct buddy_block *next;
+	struct buddy_block *prev;
+} buddy_block_t;
+
+atomic_uintptr_t buddy_region_start = 0;
+atomic_uintptr_t buddy_region_end = 0;
+
+static lock_t buddy_lock = LOCK_INITIALIZER;
+
+// Order of the largest block, fixed when the region is created.
+static uint32_t top_order = 0;
+
+// Free blocks of each order. Bit n of nonempty_orders is set iff
+// free_lists[n] isn't empty.
+static buddy_block_t *free_lists[BUDDY_NUM_ORDERS];
+static uint64_t nonempty_orders = 0;
+
+// Top-level blocks are only carved out of the region when the free lists
+// run dry, so the region's memory is touched in address order.
+static uintptr_t next_top_block = 0;
+
+// One tag per smallest block. The tag of the first page of each block holds
+// the block's order and whether it's free; other tags are meaningless.
+static uint8_t *tags = NULL;
+
+/*
+Return the order of the smallest block which can hold `size` bytes.
+*/
+static uint32_t order_for(size_t size) {
+	uint32_t order = BUDDY_MIN_ORDER;
+	while (order < BUDDY_MAX_ORDER && ((size_t)1 << order) < size) {
+		order++;
+	}
+	return order;
+}
+
+static size_t tag_index(uintptr_t addr) {
+	return (addr - buddy_region_start) >> BUDDY_MIN_ORDER;
+}
+
+static void push_block(uintptr_t addr, uint32_t order) {
+	buddy_block_t *block = (buddy_block_t *)addr;
+	uint32_t i = order - BUDDY_MIN_ORDER;
+	block->prev = NULL;
+	block->next = free_lists[i];
+	if (block->next) {
+		block->next->prev = block;
+	}
+	free_lists[i] = block;
+	nonempty_orders |= 1ull << i;
+	tags[tag_index(addr)] = BUDDY_TAG_HEAD | BUDDY_TAG_FREE | order;
+}
+
+static void unlink_block(uintptr_t addr, uint32_t order) {
+	buddy_block_t *block = (buddy_block_t *)addr;
+	uint32_t i = order - BUDDY_MIN_ORDER;
+	if (block->prev) {
+		block->prev->next = block->next;
+	} else {
+		free_lists[i] = block->next;
+		if (!block->next) {
+			nonempty_orders &= ~(1ull << i);
+		}
+	}
+	if (block->next) {
+		block->next->prev = block->prev;
+	}
+	tags[tag_index(addr)] = 0;
+}
+
+/*
+Reserve the region and its tags. Must be called with the lock held. Return
+false on failure.
+*/
+static bool create_region() {
+	top_order = order_for(buddy_max_size());
+	tags = os_map(BUDDY_NUM_PAGES);
+	if (!tags) {
+		return false;
+	}
+	void *region = os_map_aligned(BUDDY_REGION_SIZE, (size_t)1 << top_order);
+	if (!region) {
+		os_unmap(tags, BUDDY_NUM_PAGES);
+		tags = NULL;
+		return false;
+	}
+	atomic_store_explicit(&buddy_region_end, (uintptr_t)region + BUDDY_REGION_SIZE,
+		memory_order_relaxed);
+	atomic_store_explicit(&buddy_region_start, (uintptr_t)region, memory_order_release);
+	next_top_block = (uintptr_t)region;
+	return true;
+}
+
+void *buddy_allocate(size_t size) {
+	uint32_t order = order_for(size);
+	lock_acquire(&buddy_lock);
+	if (!buddy_region_start && !create_region()) {
+		lock_release(&buddy_lock);
+		log_info("buddy_allocate(): unable to reserve the buddy region");
+		return NULL;
+	}
+	if (size > (size_t)1 << top_order) {
+		lock_release(&buddy_lock);
+		return NULL;
+	}
+
+	// Find the smallest free block which is large enough.
+	uint64_t candidates = nonempty_orders & (~0ull << (order - BUDDY_MIN_ORDER));
+	uint32_t found;
+	uintptr_t addr;
+	if (candidates) {
+		found = BUDDY_MIN_ORDER + __builtin_ctzll(candidates);
+		addr = (uintptr_t)free_lists[found - BUDDY_MIN_ORDER];
+		unlink_block(addr, found);
+	} else if (next_top_block < buddy_region_end) {
+		found = top_order;
+		addr = next_top_block;
+		next_top_block += (size_t)1 << top_order;
+	} else {
+		lock_release(&buddy_lock);
+		return NULL;
+	}
+
+	// Split it, returning the upper halves to the free lists.
+	while (found > order) {
+		found--;
+		push_block(addr + ((size_t)1 << found), found);
+	}
+	tags[tag_index(addr)] = BUDDY_TAG_HEAD | order;
+	lock_release(&buddy_lock);
+	return (void *)addr;
+}
+
+void buddy_free(void *ptr) {
+	uintptr_t addr = (uintptr_t)ptr;
+	lock_acquire(&buddy_lock);
+	uint8_t tag = tags[tag_index(addr)];
+	if (addr & (((size_t)1 << BUDDY_MIN_ORDER) - 1) || !(tag & BUDDY_TAG_HEAD)) {
+		lock_release(&buddy_lock);
+		panic("free(): invalid pointer");
+		return;
+	}
+	if (tag & BUDDY_TAG_FREE) {
+		lock_release(&buddy_lock);
+		panic("free(): double free");
+		return;
+	}
+
+	// Merge with the block's buddy for as long as the buddy is free and
+	// whole (its head tag has the same order).
+	uint32_t order = tag & BUDDY_TAG_ORDER_MASK;
+	while (order < top_order) {
+		uintptr_t buddy = buddy_region_start + ((addr - buddy_region_start) ^ ((size_t)1 << order));
+		if (tags[tag_index(buddy)] != (BUDDY_TAG_HEAD | BUDDY_TAG_FREE | order)) {
+			break;
+		}
+		unlink_block(buddy, order);
+		tags[tag_index(addr)] = 0;
+		addr = addr < buddy ? addr : buddy;
+		order++;
+	}
+	push_block(addr, order);
+	lock_release(&buddy_lock);
+}
+
+size_t buddy_size(const void *ptr) {
+	return (size_t)1 << (tags[tag_index((uintptr_t)ptr)] & BUDDY_TAG_ORDER_MASK);
+}
+
+size_t buddy_max_block() {
+	// top_order is set before the region's start is published.
+	if (atomic_load_explicit(&buddy_region_start, memory_order_acquire)) {
+		return (size_t)1 << top_order;
+	}
+	return (size_t)1 << order_for(buddy_max_size());
+}
+
+void buddy_fork_prepare() {
+	lock_acquire(&buddy_lock);
+}
+
+void buddy_fork_finish() {
+	lock_release(&buddy_lock);
+}
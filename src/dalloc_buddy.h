@@ -0,0 +1,89 @@
+#ifndef _DALLOC_BUDDY_H_
+#define _DALLOC_BUDDY_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dalloc_config.h"
+
+// Order (log2 of the size) of the smallest block: one page.
+#define BUDDY_MIN_ORDER 12
+
+// Order of the largest possible block.
+#define BUDDY_MAX_ORDER 30
+
+// Size of the address space reserved for the buddy allocator. Pages are
+// only backed by memory once they're used.
+#define BUDDY_REGION_SIZE ((size_t)1 << BUDDY_MAX_ORDER)
+
+// Bounds of the buddy region, or 0 if it hasn't been created. The region
+// is never unmapped. The end is published first, and the start with
+// release semantics, so a nonzero start (loaded with acquire semantics)
+// means both are valid.
+extern atomic_uintptr_t buddy_region_start;
+extern atomic_uintptr_t buddy_region_end;
+
+/*
+Allocate a block of at least `size` bytes. Return NULL if the region
+couldn't be created, the request is larger than the largest block or the
+region is exhausted.
+
+@param size: The requested size.
+*/
+void *buddy_allocate(size_t size);
+
+/*
+Free a block allocated by buddy_allocate(), merging it with its buddy
+(repeatedly) if that's also free. Panics on an invalid or double free.
+
+@param ptr: The block.
+*/
+void buddy_free(void *ptr);
+
+/*
+Return the size of an allocated block.
+
+@param ptr: The block.
+*/
+size_t buddy_size(const void *ptr);
+
+/*
+Return the size of the largest block: fixed once the region is created,
+and otherwise given by the configured maximum (see set_buddy_range()).
+*/
+size_t buddy_max_block();
+
+/*
+Acquire (and release) the buddy allocator's lock around fork(), so that the
+child doesn't inherit it held by a thread which no longer exists.
+*/
+void buddy_fork_prepare();
+void buddy_fork_finish();
+
+/*
+Check if an address is in the buddy region.
+
+@param ptr: The address.
+*/
+static inline bool buddy_owns(const void *ptr) {
+	uintptr_t start = atomic_load_explicit(&buddy_region_start, memory_order_acquire);
+	return start && (uintptr_t)ptr - start
+		< atomic_load_explicit(&buddy_region_end, memory_order_relaxed) - start;
+}
+
+/*
+Allocate from the buddy allocator if the request is in the configured size
+range (see set_buddy_range()). Return NULL otherwise, or on failure.
+
+@param size: The requested size.
+*/
+static inline void *buddy_malloc(size_t size) {
+	if (size > buddy_max_size() || size < buddy_min_size() || !size) {
+		return NULL;
+	}
+	return buddy_allocate(size);
+}
+
+#endif // _DALLOC_BUDDY_H_
@@ -1,10 +1,100 @@
 #include <stdbool.h>
+#include <stddef.h>
 
+#include "dalloc_buddy.h"
 #include "dalloc_config.h"
 
+static size_t user_trim_threshold = DALLOC_DEFAULT_TRIM_THRESHOLD;
+static size_t user_top_pad = DALLOC_DEFAULT_TOP_PAD;
+static int user_huge_pages = DALLOC_HUGE_PAGES_NONE;
+static size_t user_decay_time = DALLOC_DEFAULT_DECAY_TIME;
+static int user_placement_policy = DALLOC_PLACEMENT_FIRST_FIT;
+static size_t user_pool_tcache_capacity = 0;
+static size_t user_buddy_min = 0;
+static size_t user_buddy_max = 0;
+static size_t user_numa_nodes = 0;
+static size_t user_numa_interleave_threshold = 0;
+
 bool robust_mode() {
 #if DALLOC_ROBUST_MODE == 1
 	return true;
 #endif
 	return false;
 }
+
+void set_trim_threshold(size_t threshold) {
+	user_trim_threshold = threshold;
+}
+
+size_t trim_threshold() {
+	return user_trim_threshold;
+}
+
+void set_top_pad(size_t pad) {
+	user_top_pad = pad;
+}
+
+size_t top_pad() {
+	return user_top_pad;
+}
+
+void set_huge_pages(int mode) {
+	user_huge_pages = mode;
+}
+
+int huge_pages() {
+	return user_huge_pages;
+}
+
+void set_decay_time(size_t ms) {
+	user_decay_time = ms;
+}
+
+size_t decay_time() {
+	return user_decay_time;
+}
+
+void set_placement_policy(int policy) {
+	user_placement_policy = policy;
+}
+
+int placement_policy() {
+	return user_placement_policy;
+}
+
+void set_buddy_range(size_t min, size_t max) {
+	user_buddy_min = min;
+	user_buddy_max = max > BUDDY_REGION_SIZE ? BUDDY_REGION_SIZE : max;
+}
+
+size_t buddy_min_size() {
+	return user_buddy_min;
+}
+
+size_t buddy_max_size() {
+	return user_buddy_max;
+}
+
+void set_pool_tcache_capacity(size_t capacity) {
+	user_pool_tcache_capacity = capacity;
+}
+
+size_t pool_tcache_capacity() {
+	return user_pool_tcache_capacity;
+}
+
+void set_numa_nodes(size_t nodes) {
+	user_numa_nodes = nodes;
+}
+
+size_t numa_nodes() {
+	return user_numa_nodes;
+}
+
+void set_numa_interleave_threshold(size_t threshold) {
+	user_numa_interleave_threshold = threshold;
+}
+
+size_t numa_interleave_threshold() {
+	return user_numa_interleave_threshold;
+}
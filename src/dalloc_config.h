@@ -2,6 +2,7 @@
 #define _DALLOC_CONFIG_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 // Configured options and settings for dalloc
 #define DALLOC_VERSION_MAJOR @DALLOC_VERSION_MAJOR@
@@ -12,4 +13,184 @@ Returns true iff running in robust mode.
 */
 bool robust_mode();
 
+// Default value of the trim threshold (see set_trim_threshold()).
+#define DALLOC_DEFAULT_TRIM_THRESHOLD (128 * 1024)
+
+// Default value of the top pad (see set_top_pad()).
+#define DALLOC_DEFAULT_TOP_PAD (64 * 1024)
+
+/*
+Set the trim threshold. Free memory at the top of the heap is only
+released to the OS once it exceeds this many bytes, so that a block which
+is repeatedly allocated and freed at the top of the heap doesn't cost a
+pair of syscalls each time. A threshold of 0 releases free memory as soon
+as possible.
+
+@param threshold: The threshold in bytes.
+*/
+void set_trim_threshold(size_t threshold);
+
+/*
+Get the trim threshold (see set_trim_threshold()).
+*/
+size_t trim_threshold();
+
+/*
+Set the top pad. This many extra bytes are requested from the OS whenever
+the heap grows (rounded up to a whole page), and retained at the top of
+the heap when it's trimmed. A pad of 0 means the heap only grows by the
+amount required for each allocation and is trimmed right back to the last
+chunk in use.
+
+@param pad: The pad in bytes.
+*/
+void set_top_pad(size_t pad);
+
+/*
+Get the top pad (see set_top_pad()).
+*/
+size_t top_pad();
+
+// Huge page modes (see set_huge_pages()).
+#define DALLOC_HUGE_PAGES_NONE 0
+#define DALLOC_HUGE_PAGES_TRANSPARENT 1
+#define DALLOC_HUGE_PAGES_HUGETLB 2
+
+/*
+Set whether heap regions are backed by huge pages. In transparent mode,
+the heap grows and shrinks in whole huge pages and is marked with
+madvise(MADV_HUGEPAGE), and pool slabs are packed into huge-page-aligned
+regions. In hugetlb mode, pool regions are first requested with
+MAP_HUGETLB, falling back to transparent huge pages if none are reserved
+(the sbrk heap can only use transparent huge pages).
+
+@param mode: One of the DALLOC_HUGE_PAGES_* values.
+*/
+void set_huge_pages(int mode);
+
+/*
+Get the huge page mode (see set_huge_pages()).
+*/
+int huge_pages();
+
+// Default time (in milliseconds) a free span must remain unused before its
+// pages are returned to the OS.
+#define DALLOC_DEFAULT_DECAY_TIME 10000
+
+/*
+Set the time for which free memory in the middle of the heap is kept
+resident. Whole pages of chunks which have been free for longer are
+returned to the OS with madvise(), so resident memory follows actual
+usage. Purging is driven by allocator activity, so an idle heap isn't
+purged until d_heap_purge() is called. 0 disables purging.
+
+@param ms: The decay time in milliseconds.
+*/
+void set_decay_time(size_t ms);
+
+/*
+Get the decay time (see set_decay_time()).
+*/
+size_t decay_time();
+
+// Placement policies (see set_placement_policy()).
+#define DALLOC_PLACEMENT_FIRST_FIT 0
+#define DALLOC_PLACEMENT_NEXT_FIT 1
+#define DALLOC_PLACEMENT_BEST_FIT 2
+#define DALLOC_PLACEMENT_LIFO 3
+
+/*
+Set how d_malloc() chooses between unused chunks:
+
+- First fit (the default) takes the lowest-addressed chunk which fits.
+- Next fit resumes the search just after the last chunk allocated,
+  spreading allocations over the heap instead of repeatedly walking past
+  the chunks at its start.
+- Best fit takes the smallest chunk which fits, from an index of unused
+  chunks by size class, minimising fragmentation.
+- LIFO takes the most recently freed chunk which fits from the same index,
+  reusing memory which is likely to still be in cache.
+
+Indexed policies (best fit and LIFO) store links in unused chunks, so
+they round requests up to at least 16 bytes. The policy may be changed at
+any time; the index is rebuilt by the next allocation.
+
+@param policy: One of the DALLOC_PLACEMENT_* constants.
+*/
+void set_placement_policy(int policy);
+
+/*
+Get the placement policy (see set_placement_policy()).
+*/
+int placement_policy();
+
+/*
+Set the range of request sizes served by the binary buddy allocator
+instead of the heap. Buddy blocks are powers of two of at least a page,
+and are split and merged in O(log n), so they suit medium-sized buffers
+which are allocated and freed often. The largest block size is fixed by
+the maximum at the time of the first buddy allocation. The range is empty
+(the buddy allocator is unused) by default.
+
+@param min: The smallest request served, in bytes.
+@param max: The largest request served, in bytes. 0 disables the buddy
+			allocator. Clamped to the size of the buddy region (1 GiB).
+*/
+void set_buddy_range(size_t min, size_t max);
+
+/*
+Get the smallest request served by the buddy allocator.
+*/
+size_t buddy_min_size();
+
+/*
+Get the largest request served by the buddy allocator (0 if it's
+disabled).
+*/
+size_t buddy_max_size();
+
+/*
+Set the capacity of the thread caches of new pools. If nonzero, every pool
+created by d_pool_create() has its thread cache enabled with this capacity
+(see d_pool_enable_thread_cache()). 0 (the default) leaves thread caching
+to the caller.
+
+@param capacity: The capacity, in objects.
+*/
+void set_pool_tcache_capacity(size_t capacity);
+
+/*
+Get the default pool thread cache capacity (see set_pool_tcache_capacity()).
+*/
+size_t pool_tcache_capacity();
+
+/*
+Set a fake number of NUMA nodes, so that NUMA-aware arenas can be tested
+on any machine. With a fake topology, threads are assigned to nodes by
+CPU number, and no memory policies are applied. 0 (the default) uses the
+real topology.
+
+@param nodes: The number of nodes.
+*/
+void set_numa_nodes(size_t nodes);
+
+/*
+Get the fake number of NUMA nodes (see set_numa_nodes()).
+*/
+size_t numa_nodes();
+
+/*
+Set the size above which heap growth is interleaved across all NUMA
+nodes, rather than placed on the node of the thread which first touches
+it. 0 (the default) disables interleaving.
+
+@param threshold: The threshold in bytes.
+*/
+void set_numa_interleave_threshold(size_t threshold);
+
+/*
+Get the NUMA interleave threshold (see set_numa_interleave_threshold()).
+*/
+size_t numa_interleave_threshold();
+
 #endif // _DALLOC_CONFIG_H_
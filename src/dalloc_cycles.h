@@ -0,0 +1,26 @@
+#ifndef _DALLOC_CYCLES_H_
+#define _DALLOC_CYCLES_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+Read a cheap, monotonic cycle counter. On x86 this is the TSC; elsewhere
+it falls back to the monotonic clock in nanoseconds. Only differences
+between readings on the same thread are meaningful.
+*/
+static inline uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+#endif // _DALLOC_CYCLES_H_
@@ -0,0 +1,77 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "dalloc_config.h"
+#include "dalloc_decay.h"
+#include "dalloc_frag.h"
+#include "dalloc_os.h"
+#include "dalloc_placement.h"
+
+// Fraction of the decay time between walks of the unused chunks. Chunks are
+// purged at most decay_time() / DECAY_WALKS_PER_PERIOD late.
+#define DECAY_WALKS_PER_PERIOD 4
+
+uint32_t decay_ticks = 0;
+
+// Time of the last walk of the unused chunks.
+static uint32_t last_walk_ms = 0;
+
+typedef struct {
+	uint32_t now;
+	bool all;
+	size_t alignment;
+	size_t purged;
+} purge_state_t;
+
+uint32_t decay_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+/*
+Visitor which purges an unused chunk if it has expired.
+*/
+static bool purge_chunk(const chunk_t *chunk, void *user_data) {
+	purge_state_t *state = (purge_state_t *)user_data;
+	if (chunk->purged) {
+		return true;
+	}
+	if (!state->all && state->now - chunk->freed_ms < decay_time()) {
+		return true;
+	}
+	// Only the chunk's memory is purged; its header (and the next chunk's
+	// header) lie outside it. The placement policy's and the fragmentation
+	// metrics' links at the start of the chunk are kept.
+	if (chunk->size > FRAG_LIST_MIN_SIZE) {
+		state->purged += os_purge(chunk->start + FRAG_LIST_MIN_SIZE,
+			chunk->size - FRAG_LIST_MIN_SIZE, state->alignment);
+	}
+	((chunk_t *)chunk)->purged = true;
+	return true;
+}
+
+size_t decay_purge(bool all) {
+	uint32_t now = decay_now();
+	size_t interval = decay_time() / DECAY_WALKS_PER_PERIOD;
+	if (!all && now - last_walk_ms < interval) {
+		return 0;
+	}
+	last_walk_ms = now;
+
+	purge_state_t state = {
+		.now = now,
+		.all = all,
+		// Purging part of a huge page would split it.
+		.alignment = huge_pages() ? os_huge_page_size() : os_page_size(),
+		.purged = 0,
+	};
+	// Only unused chunks large enough to contain a whole (aligned) page past
+	// their links can have anything to purge, so the rest of the heap
+	// (including every chunk in use) isn't visited.
+	frag_for_each_free(FRAG_LIST_MIN_SIZE + state.alignment, purge_chunk, &state);
+	return state.purged;
+}
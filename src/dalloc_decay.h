@@ -0,0 +1,65 @@
+#ifndef _DALLOC_DECAY_H_
+#define _DALLOC_DECAY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chunk.h"
+#include "dalloc_config.h"
+
+// Number of heap operations between checks of the clock.
+#define DECAY_TICK_INTERVAL 64
+
+/*
+Return the pages of every unused chunk in the heap to the OS, regardless
+of how long the chunks have been unused. The chunks remain in the heap
+and can still be allocated. Return the number of bytes purged.
+*/
+size_t d_heap_purge();
+
+// Number of heap operations since the clock was last checked.
+extern uint32_t decay_ticks;
+
+/*
+Return the current time in milliseconds, truncated to 32 bits. Intervals
+between two such times are computed modulo 2^32, which is fine for decay
+times of up to a few weeks.
+*/
+uint32_t decay_now();
+
+/*
+Record that a chunk has just been freed.
+
+@param chunk: The chunk.
+*/
+static inline void decay_stamp(chunk_t *chunk) {
+	chunk->purged = false;
+	chunk->freed_ms = decay_now();
+}
+
+/*
+Purge unused chunks in the heap which have been unused for longer than the
+decay time. Only the unused chunks are visited (see frag_for_each_free()),
+not the whole heap. Must be called with the heap lock held. Return the
+number of bytes purged.
+
+@param all: Purge all unused chunks, regardless of their age.
+*/
+size_t decay_purge(bool all);
+
+/*
+Count a heap operation, and purge expired chunks if enough time has passed
+since the last purge. This is cheap enough to call on every allocation.
+*/
+static inline void decay_tick() {
+	if (++decay_ticks < DECAY_TICK_INTERVAL) {
+		return;
+	}
+	decay_ticks = 0;
+	if (decay_time()) {
+		decay_purge(false);
+	}
+}
+
+#endif // _DALLOC_DECAY_H_
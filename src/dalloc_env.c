@@ -0,0 +1,253 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dalloc_buddy.h"
+#include "dalloc_config.h"
+#include "dalloc_env.h"
+#include "dalloc_guard.h"
+#include "dalloc_io.h"
+#include "dalloc_profile.h"
+
+// Longest key or value which is echoed in warnings.
+#define CONF_MAX_TOKEN 32
+
+typedef struct {
+	const char *name;
+	int value;
+} conf_name_t;
+
+static const conf_name_t log_levels[] = {
+	{ "none", DALLOC_LOG_LEVEL_NONE },
+	{ "error", DALLOC_LOG_LEVEL_ERROR },
+	{ "warning", DALLOC_LOG_LEVEL_WARNING },
+	{ "info", DALLOC_LOG_LEVEL_INFO },
+	{ "diag", DALLOC_LOG_LEVEL_DIAGNOSTIC },
+	{ "debug", DALLOC_LOG_LEVEL_DEBUG },
+	{ NULL, 0 },
+};
+
+static const conf_name_t huge_page_modes[] = {
+	{ "none", DALLOC_HUGE_PAGES_NONE },
+	{ "transparent", DALLOC_HUGE_PAGES_TRANSPARENT },
+	{ "hugetlb", DALLOC_HUGE_PAGES_HUGETLB },
+	{ NULL, 0 },
+};
+
+static const conf_name_t placement_policies[] = {
+	{ "first", DALLOC_PLACEMENT_FIRST_FIT },
+	{ "next", DALLOC_PLACEMENT_NEXT_FIT },
+	{ "best", DALLOC_PLACEMENT_BEST_FIT },
+	{ "lifo", DALLOC_PLACEMENT_LIFO },
+	{ NULL, 0 },
+};
+
+static bool env_loaded = false;
+
+/*
+Copy a token into a NUL-terminated buffer, for use in messages.
+
+@param buf: Buffer of CONF_MAX_TOKEN bytes.
+@param token: Start of the token (not NUL-terminated).
+@param len: Length of the token.
+*/
+static const char *token_str(char *buf, const char *token, size_t len) {
+	if (len >= CONF_MAX_TOKEN) {
+		len = CONF_MAX_TOKEN - 1;
+	}
+	memcpy(buf, token, len);
+	buf[len] = '\0';
+	return buf;
+}
+
+/*
+Return true iff a token equals a string.
+*/
+static bool token_eq(const char *token, size_t len, const char *str) {
+	return strlen(str) == len && !strncmp(token, str, len);
+}
+
+/*
+Parse a size with an optional k, m or g suffix. Return false if the value
+isn't a valid size.
+
+@param value: The value (not NUL-terminated).
+@param len: Length of the value.
+@param size: (out) The size.
+*/
+static bool parse_size(const char *value, size_t len, size_t *size) {
+	size_t result = 0;
+	size_t i = 0;
+	for (; i < len && value[i] >= '0' && value[i] <= '9'; i++) {
+		size_t digit = value[i] - '0';
+		if (result > (SIZE_MAX - digit) / 10) {
+			return false;
+		}
+		result = result * 10 + digit;
+	}
+	if (i == 0) {
+		return false;
+	}
+
+	if (i < len) {
+		size_t shift;
+		switch (value[i]) {
+			case 'k': case 'K': shift = 10; break;
+			case 'm': case 'M': shift = 20; break;
+			case 'g': case 'G': shift = 30; break;
+			default: return false;
+		}
+		if (i + 1 != len || result > SIZE_MAX >> shift) {
+			return false;
+		}
+		result <<= shift;
+	}
+	*size = result;
+	return true;
+}
+
+/*
+Look up a value in a table of names. Return false if it isn't found.
+
+@param names: The table, terminated by an entry with a NULL name.
+@param value: The value (not NUL-terminated).
+@param len: Length of the value.
+@param result: (out) The value of the matching entry.
+*/
+static bool parse_name(const conf_name_t *names, const char *value, size_t len, int *result) {
+	for (; names->name; names++) {
+		if (token_eq(value, len, names->name)) {
+			*result = names->value;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+Apply a single option. Return false if it's invalid.
+
+@param key: The key (not NUL-terminated).
+@param key_len: Length of the key.
+@param value: The value (not NUL-terminated).
+@param value_len: Length of the value.
+@param guard_slots: (in/out) Number of guard slots, applied later.
+@param guard_rate: (in/out) Guard sample rate, applied later.
+*/
+static bool apply_option(const char *key, size_t key_len, const char *value, size_t value_len,
+		size_t *guard_slots, size_t *guard_rate) {
+	int name;
+	size_t size;
+	if (token_eq(key, key_len, "log_level")) {
+		if (!parse_name(log_levels, value, value_len, &name)) {
+			return false;
+		}
+		set_log_level(name);
+		return true;
+	}
+	if (token_eq(key, key_len, "huge_pages")) {
+		if (!parse_name(huge_page_modes, value, value_len, &name)) {
+			return false;
+		}
+		set_huge_pages(name);
+		return true;
+	}
+	if (token_eq(key, key_len, "placement")) {
+		if (!parse_name(placement_policies, value, value_len, &name)) {
+			return false;
+		}
+		set_placement_policy(name);
+		return true;
+	}
+
+	// All other options take a size.
+	if (!parse_size(value, value_len, &size)) {
+		return false;
+	}
+	if (token_eq(key, key_len, "trim_threshold")) {
+		set_trim_threshold(size);
+	} else if (token_eq(key, key_len, "top_pad")) {
+		set_top_pad(size);
+	} else if (token_eq(key, key_len, "decay_ms")) {
+		set_decay_time(size);
+	} else if (token_eq(key, key_len, "numa_nodes")) {
+		set_numa_nodes(size);
+	} else if (token_eq(key, key_len, "numa_interleave")) {
+		set_numa_interleave_threshold(size);
+	} else if (token_eq(key, key_len, "buddy_min")) {
+		set_buddy_range(size, buddy_max_size());
+	} else if (token_eq(key, key_len, "buddy_max")) {
+		if (size > BUDDY_REGION_SIZE) {
+			return false;
+		}
+		set_buddy_range(buddy_min_size(), size);
+	} else if (token_eq(key, key_len, "pool_tcache")) {
+		set_pool_tcache_capacity(size);
+	} else if (token_eq(key, key_len, "profile")) {
+		return size && d_profile_start(size);
+	} else if (token_eq(key, key_len, "guard_slots")) {
+		*guard_slots = size;
+	} else if (token_eq(key, key_len, "guard_rate")) {
+		*guard_rate = size;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool parse_conf(const char *conf) {
+	bool valid = true;
+	size_t guard_slots = 0;
+	size_t guard_rate = 0;
+
+	const char *option = conf;
+	while (*option) {
+		size_t len = strcspn(option, ",");
+		const char *colon = memchr(option, ':', len);
+		char key_buf[CONF_MAX_TOKEN];
+		char value_buf[CONF_MAX_TOKEN];
+		if (!colon) {
+			if (len) {
+				log_warning("%s: option '%s' has no value", DALLOC_CONF_ENV,
+					token_str(key_buf, option, len));
+				valid = false;
+			}
+		} else {
+			size_t key_len = colon - option;
+			const char *value = colon + 1;
+			size_t value_len = len - key_len - 1;
+			if (!apply_option(option, key_len, value, value_len, &guard_slots, &guard_rate)) {
+				log_warning("%s: invalid option '%s' (value '%s')", DALLOC_CONF_ENV,
+					token_str(key_buf, option, key_len), token_str(value_buf, value, value_len));
+				valid = false;
+			}
+		}
+		option += len;
+		if (*option == ',') {
+			option++;
+		}
+	}
+
+	if (guard_slots || guard_rate) {
+		if (!d_guard_start(guard_slots, guard_rate)) {
+			log_warning("%s: guard_slots and guard_rate must both be nonzero", DALLOC_CONF_ENV);
+			valid = false;
+		}
+	}
+	return valid;
+}
+
+__attribute__((constructor))
+void load_env_conf() {
+	if (env_loaded) {
+		return;
+	}
+	env_loaded = true;
+
+	const char *conf = getenv(DALLOC_CONF_ENV);
+	if (conf) {
+		parse_conf(conf);
+	}
+}
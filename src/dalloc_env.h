@@ -0,0 +1,40 @@
+#ifndef _DALLOC_ENV_H_
+#define _DALLOC_ENV_H_
+
+#include <stdbool.h>
+
+// Environment variable from which options are read at startup.
+#define DALLOC_CONF_ENV "DALLOC_CONF"
+
+/*
+Apply a configuration string of comma-separated `key:value` options, e.g.
+"trim_threshold:1M,decay_ms:5000,log_level:info". Options are applied in
+order. Sizes may have a k, m or g suffix. The recognised options are:
+
+	log_level: none, error, warning, info, diag or debug
+	placement: first, next, best or lifo (see set_placement_policy())
+	trim_threshold: size (see set_trim_threshold())
+	top_pad: size (see set_top_pad())
+	decay_ms: milliseconds (see set_decay_time())
+	huge_pages: none, transparent or hugetlb (see set_huge_pages())
+	numa_nodes: fake node count (see set_numa_nodes())
+	numa_interleave: size (see set_numa_interleave_threshold())
+	buddy_min, buddy_max: size (see set_buddy_range())
+	pool_tcache: objects (see set_pool_tcache_capacity())
+	profile: mean bytes between samples (see d_profile_start())
+	guard_slots, guard_rate: both required (see d_guard_start())
+
+The string is parsed in place, without allocating. Invalid options are
+skipped with a warning. Return false if any option was invalid.
+
+@param conf: The configuration string.
+*/
+bool parse_conf(const char *conf);
+
+/*
+Apply the options in the DALLOC_CONF environment variable, if set. This
+runs automatically (once) when the library is loaded.
+*/
+void load_env_conf();
+
+#endif // _DALLOC_ENV_H_
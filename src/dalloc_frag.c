@@ -0,0 +1,178 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dalloc_frag.h"
+#include "dalloc_utils.h"
+
+static size_t class_free_chunks[DALLOC_NUM_SIZE_CLASSES];
+static size_t class_free_bytes[DALLOC_NUM_SIZE_CLASSES];
+
+// Size of the largest unused chunk in each size class, and the number of
+// unused chunks of that size. If the last chunk of that size is removed
+// while the class still has other chunks, the maximum becomes stale (but
+// remains an upper bound) until it's recalculated.
+static size_t class_max[DALLOC_NUM_SIZE_CLASSES];
+static size_t class_max_count[DALLOC_NUM_SIZE_CLASSES];
+static bool class_max_stale[DALLOC_NUM_SIZE_CLASSES];
+
+// Bit n is set iff size class n has any unused chunks.
+static uint64_t nonempty_classes = 0;
+
+// Unused chunks of at least FRAG_LIST_MIN_SIZE in each size class, and the
+// number of unused chunks of each smaller size.
+static chunk_t *class_lists[DALLOC_NUM_SIZE_CLASSES];
+static size_t small_counts[FRAG_LIST_MIN_SIZE];
+
+static free_links_t *frag_links(const chunk_t *chunk) {
+	return (free_links_t *)(chunk->start + PLACEMENT_MIN_FREE);
+}
+
+void frag_add_free(chunk_t *chunk) {
+	size_t size = chunk->size;
+	uint32_t class = size_class(size);
+	if (size < FRAG_LIST_MIN_SIZE) {
+		small_counts[size]++;
+	} else {
+		free_links_t *l = frag_links(chunk);
+		l->prev = NULL;
+		l->next = class_lists[class];
+		if (l->next) {
+			frag_links(l->next)->prev = chunk;
+		}
+		class_lists[class] = chunk;
+	}
+	class_free_chunks[class]++;
+	class_free_bytes[class] += size;
+	nonempty_classes |= 1ULL << class;
+
+	if (size > class_max[class]) {
+		class_max[class] = size;
+		class_max_count[class] = 1;
+		class_max_stale[class] = false;
+	} else if (size == class_max[class] && !class_max_stale[class]) {
+		class_max_count[class]++;
+	}
+}
+
+void frag_remove_free(chunk_t *chunk) {
+	size_t size = chunk->size;
+	uint32_t class = size_class(size);
+	if (size < FRAG_LIST_MIN_SIZE) {
+		small_counts[size]--;
+	} else {
+		free_links_t *l = frag_links(chunk);
+		if (l->prev) {
+			frag_links(l->prev)->next = l->next;
+		} else {
+			class_lists[class] = l->next;
+		}
+		if (l->next) {
+			frag_links(l->next)->prev = l->prev;
+		}
+	}
+	class_free_chunks[class]--;
+	class_free_bytes[class] -= size;
+
+	if (!class_free_chunks[class]) {
+		nonempty_classes &= ~(1ULL << class);
+		class_max[class] = 0;
+		class_max_count[class] = 0;
+		class_max_stale[class] = false;
+	} else if (size == class_max[class] && !class_max_stale[class]) {
+		if (!--class_max_count[class]) {
+			class_max_stale[class] = true;
+		}
+	}
+}
+
+/*
+Recalculate the maximum of a size class from its unused chunks.
+
+@param class: The size class.
+*/
+static void find_class_max(uint32_t class) {
+	size_t max = 0;
+	size_t count = 0;
+	if (((size_t)1 << class) < FRAG_LIST_MIN_SIZE) {
+		// Every size in the class is counted rather than listed.
+		for (size_t size = 0; size < FRAG_LIST_MIN_SIZE; size++) {
+			if (small_counts[size] && size_class(size) == class) {
+				max = size;
+				count = small_counts[size];
+			}
+		}
+	} else {
+		for (chunk_t *chunk = class_lists[class]; chunk; chunk = frag_links(chunk)->next) {
+			if (chunk->size > max) {
+				max = chunk->size;
+				count = 1;
+			} else if (chunk->size == max) {
+				count++;
+			}
+		}
+	}
+	class_max[class] = max;
+	class_max_count[class] = count;
+	class_max_stale[class] = false;
+}
+
+/*
+Return the size of the largest unused chunk, recalculating the maximum of
+its size class if it's stale.
+*/
+static size_t largest_free() {
+	if (!nonempty_classes) {
+		return 0;
+	}
+
+	uint32_t class = 63 - __builtin_clzll(nonempty_classes);
+	if (class_max_stale[class]) {
+		find_class_max(class);
+	}
+	return class_max[class];
+}
+
+bool frag_for_each_free(size_t min_size, visitor_t visitor, void *user_data) {
+	if (min_size < FRAG_LIST_MIN_SIZE) {
+		min_size = FRAG_LIST_MIN_SIZE;
+	}
+	uint32_t first = size_class(min_size);
+	uint64_t classes = nonempty_classes & (~0ULL << first);
+	while (classes) {
+		uint32_t class = __builtin_ctzll(classes);
+		classes &= classes - 1;
+		for (chunk_t *chunk = class_lists[class]; chunk; chunk = frag_links(chunk)->next) {
+			if (chunk->size >= min_size && !visitor(chunk, user_data)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void get_frag_stats(d_heap_frag_stats_t *stats) {
+	stats->free_bytes = 0;
+	stats->free_chunks = 0;
+	for (uint32_t i = 0; i < DALLOC_NUM_SIZE_CLASSES; i++) {
+		stats->class_free_chunks[i] = class_free_chunks[i];
+		stats->class_free_bytes[i] = class_free_bytes[i];
+		stats->free_bytes += class_free_bytes[i];
+		stats->free_chunks += class_free_chunks[i];
+	}
+	stats->largest_free = largest_free();
+	stats->fragmentation = stats->free_bytes
+		? 1.0 - (double)stats->largest_free / stats->free_bytes
+		: 0;
+
+	// A request in class n can only be satisfied by chunks in class n or
+	// above. Accumulate the free memory in smaller chunks from the bottom
+	// up.
+	size_t smaller = 0;
+	for (uint32_t i = 0; i < DALLOC_NUM_SIZE_CLASSES; i++) {
+		stats->class_fragmentation[i] = stats->free_bytes
+			? (double)smaller / stats->free_bytes
+			: 0;
+		smaller += class_free_bytes[i];
+	}
+}
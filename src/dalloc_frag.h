@@ -0,0 +1,89 @@
+#ifndef _DALLOC_FRAG_H_
+#define _DALLOC_FRAG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chunk.h"
+#include "dalloc_heap_traversal.h"
+#include "dalloc_placement.h"
+#include "dalloc_utils.h"
+
+// Unused chunks of at least this size are kept in one list per size class,
+// linked through the chunk's memory just after the placement policy's
+// links. Smaller chunks are only counted.
+#define FRAG_LIST_MIN_SIZE (PLACEMENT_MIN_FREE + sizeof(free_links_t))
+
+/*
+Fragmentation metrics for the heap (see d_heap_get_frag_stats()).
+*/
+typedef struct {
+	// Total size of all unused chunks.
+	size_t free_bytes;
+	// Number of unused chunks.
+	size_t free_chunks;
+	// Size of the largest unused chunk.
+	size_t largest_free;
+	// 1 - largest_free / free_bytes: 0 if all free memory is in a single
+	// chunk, approaching 1 as it's split into many small chunks.
+	double fragmentation;
+	// Number and total size of unused chunks in each size class (see
+	// size_class()).
+	size_t class_free_chunks[DALLOC_NUM_SIZE_CLASSES];
+	size_t class_free_bytes[DALLOC_NUM_SIZE_CLASSES];
+	// The fraction of free memory which is in chunks too small to satisfy
+	// a request of the smallest size in each size class. 0 when there's no
+	// free memory.
+	double class_fragmentation[DALLOC_NUM_SIZE_CLASSES];
+} d_heap_frag_stats_t;
+
+/*
+Get the heap's fragmentation metrics. These are maintained as chunks are
+allocated, freed, split and released, so this doesn't need to walk the
+heap (except occasionally to walk the unused chunks of one size class, to
+find the new largest free chunk after the previous largest was allocated).
+
+@param stats: (out) The metrics.
+*/
+void d_heap_get_frag_stats(d_heap_frag_stats_t *stats);
+
+/*
+Record that a chunk has become unused (including new chunks). The chunk's
+memory mustn't be changed (past the placement policy's links) until it's
+removed again.
+
+@param chunk: The chunk.
+*/
+void frag_add_free(chunk_t *chunk);
+
+/*
+Record that an unused chunk is about to be allocated, resized, merged into
+another chunk or released to the OS. Its size must be the same as when it
+was added.
+
+@param chunk: The chunk.
+*/
+void frag_remove_free(chunk_t *chunk);
+
+/*
+Call a function on each unused chunk of at least `min_size` bytes, in no
+particular order. Only chunks of at least FRAG_LIST_MIN_SIZE are visited.
+The visitor mustn't add or remove unused chunks. Return false if the
+traversal was stopped early by the visitor.
+
+@param min_size: The minimum size.
+@param visitor: Function called for each chunk. Returning false stops the
+				traversal.
+@param user_data: User data which will be passed to the visitor.
+*/
+bool frag_for_each_free(size_t min_size, visitor_t visitor, void *user_data);
+
+/*
+Get fragmentation metrics, walking the unused chunks of one size class if
+the largest free chunk isn't known.
+
+@param stats: (out) The metrics.
+*/
+void get_frag_stats(d_heap_frag_stats_t *stats);
+
+#endif // _DALLOC_FRAG_H_
@@ -0,0 +1,225 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "chunk.h"
+#include "dalloc_free_index.h"
+#include "dalloc_io.h"
+#include "dalloc_os.h"
+#include "dalloc_search_stats.h"
+
+// Number of entries the index is first mapped with. It doubles as needed.
+#define FREE_INDEX_INITIAL_ENTRIES 1024
+
+// The index: sizes[i] is the (saturated) size of chunks[i], and chunks are
+// in ascending order of address.
+static uint32_t *sizes = NULL;
+static chunk_t **chunks = NULL;
+static size_t count = 0;
+static size_t capacity = 0;
+
+// Number of chunks with their `indexed` flag set, including those which
+// aren't in the index because it has overflowed.
+static size_t num_indexed = 0;
+static bool overflowed = false;
+
+static uint32_t saturate(size_t size) {
+	return size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+}
+
+/*
+Double the capacity of the index. Return false on failure.
+*/
+static bool grow_index() {
+	size_t new_capacity = capacity ? capacity * 2 : FREE_INDEX_INITIAL_ENTRIES;
+	uint32_t *new_sizes = os_map(new_capacity * sizeof(uint32_t));
+	chunk_t **new_chunks = os_map(new_capacity * sizeof(chunk_t *));
+	if (!new_sizes || !new_chunks) {
+		if (new_sizes) {
+			os_unmap(new_sizes, new_capacity * sizeof(uint32_t));
+		}
+		if (new_chunks) {
+			os_unmap(new_chunks, new_capacity * sizeof(chunk_t *));
+		}
+		log_warning("Unable to grow the free chunk index to %zu entries", new_capacity);
+		return false;
+	}
+
+	if (capacity) {
+		memcpy(new_sizes, sizes, count * sizeof(uint32_t));
+		memcpy(new_chunks, chunks, count * sizeof(chunk_t *));
+		os_unmap(sizes, capacity * sizeof(uint32_t));
+		os_unmap(chunks, capacity * sizeof(chunk_t *));
+	}
+	sizes = new_sizes;
+	chunks = new_chunks;
+	capacity = new_capacity;
+	return true;
+}
+
+/*
+Return the position of the first chunk in the index whose address isn't
+below `chunk`.
+*/
+static size_t lower_bound(const chunk_t *chunk) {
+	size_t lo = 0, hi = count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ((uintptr_t)chunks[mid] < (uintptr_t)chunk) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+bool free_index_insert(chunk_t *chunk) {
+	chunk->indexed = true;
+	num_indexed++;
+	if (overflowed) {
+		return false;
+	}
+	if (count == FREE_INDEX_MAX_ENTRIES || (count == capacity && !grow_index())) {
+		log_debug("Free chunk index overflowed; first fit will walk the heap");
+		overflowed = true;
+		count = 0;
+		return false;
+	}
+
+	size_t pos = lower_bound(chunk);
+	memmove(&sizes[pos + 1], &sizes[pos], (count - pos) * sizeof(uint32_t));
+	memmove(&chunks[pos + 1], &chunks[pos], (count - pos) * sizeof(chunk_t *));
+	sizes[pos] = saturate(chunk->size);
+	chunks[pos] = chunk;
+	count++;
+	return true;
+}
+
+void free_index_remove(chunk_t *chunk) {
+	chunk->indexed = false;
+	num_indexed--;
+	if (overflowed) {
+		return;
+	}
+
+	size_t pos = lower_bound(chunk);
+	if (pos == count || chunks[pos] != chunk) {
+		panic("Free chunk index is corrupt: chunk %p isn't indexed", (void *)chunk);
+		return;
+	}
+	memmove(&sizes[pos], &sizes[pos + 1], (count - pos - 1) * sizeof(uint32_t));
+	memmove(&chunks[pos], &chunks[pos + 1], (count - pos - 1) * sizeof(chunk_t *));
+	count--;
+}
+
+bool free_index_overflowed() {
+	return overflowed;
+}
+
+bool free_index_should_rebuild() {
+	return overflowed && num_indexed <= FREE_INDEX_MAX_ENTRIES / 2;
+}
+
+void free_index_clear() {
+	count = 0;
+	num_indexed = 0;
+	overflowed = false;
+}
+
+static size_t scan_scalar(const uint32_t *sizes, size_t count, uint32_t size) {
+	for (size_t i = 0; i < count; i++) {
+		if (sizes[i] >= size) {
+			return i;
+		}
+	}
+	return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+SSE2 has no unsigned comparison, so both sides are biased into the signed
+range first.
+*/
+__attribute__((target("sse2")))
+static size_t scan_sse2(const uint32_t *sizes, size_t count, uint32_t size) {
+	const __m128i bias = _mm_set1_epi32((int32_t)0x80000000u);
+	const __m128i key = _mm_xor_si128(_mm_set1_epi32((int32_t)size), bias);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&sizes[i]), bias);
+		// Lanes which are too small.
+		int small = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(key, v)));
+		if (small != 0xf) {
+			return i + __builtin_ctz(~small & 0xf);
+		}
+	}
+	return i + scan_scalar(sizes + i, count - i, size);
+}
+
+/*
+AVX2: a lane fits iff max(lane, size) == lane. Two vectors (16 sizes) are
+compared per iteration.
+*/
+__attribute__((target("avx2")))
+static size_t scan_avx2(const uint32_t *sizes, size_t count, uint32_t size) {
+	const __m256i key = _mm256_set1_epi32((int32_t)size);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)&sizes[i]);
+		__m256i b = _mm256_loadu_si256((const __m256i *)&sizes[i + 8]);
+		__m256i fit_a = _mm256_cmpeq_epi32(_mm256_max_epu32(a, key), a);
+		__m256i fit_b = _mm256_cmpeq_epi32(_mm256_max_epu32(b, key), b);
+		uint32_t fits = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(fit_a))
+			| (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(fit_b)) << 8;
+		if (fits) {
+			return i + __builtin_ctz(fits);
+		}
+	}
+	return i + scan_sse2(sizes + i, count - i, size);
+}
+
+#endif
+
+size_t free_index_scan(const uint32_t *sizes, size_t count, uint32_t size) {
+#if defined(__x86_64__) || defined(__i386__)
+	static size_t (*scan)(const uint32_t *, size_t, uint32_t) = NULL;
+	if (!scan) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			scan = scan_avx2;
+		} else if (__builtin_cpu_supports("sse2")) {
+			scan = scan_sse2;
+		} else {
+			scan = scan_scalar;
+		}
+	}
+	return scan(sizes, count, size);
+#else
+	return scan_scalar(sizes, count, size);
+#endif
+}
+
+chunk_t *free_index_first_fit(size_t size) {
+	uint32_t key = saturate(size);
+	size_t pos = 0;
+	while (pos < count) {
+		pos += free_index_scan(sizes + pos, count - pos, key);
+		if (pos == count) {
+			break;
+		}
+		search_visit();
+		// Only a saturated size can be too small.
+		if (chunks[pos]->size >= size) {
+			return chunks[pos];
+		}
+		pos++;
+	}
+	return NULL;
+}
@@ -0,0 +1,84 @@
+#ifndef _DALLOC_FREE_INDEX_H_
+#define _DALLOC_FREE_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chunk.h"
+
+/*
+A contiguous index of the heap's unused chunks, used by the first fit
+placement policy. It's a structure of arrays, sorted by address: one
+array of chunk sizes and one of chunk headers. A first fit search is then
+a linear scan of the size array for the first size which is large enough,
+comparing 8 sizes per instruction with AVX2 or 4 with SSE2 (chosen at run
+time), rather than chasing pointers through chunk headers scattered
+across the heap.
+
+Sizes are stored as 32-bit values, saturated at UINT32_MAX. Chunks of
+4 GiB or more are rare, and are checked against their header when found.
+
+The index is meant for small to medium numbers of unused chunks, since
+keeping it sorted means moving part of it on each insertion and removal.
+It holds at most FREE_INDEX_MAX_ENTRIES; beyond that it overflows, and
+searches walk the heap until the number of unused chunks falls to half
+the maximum, when it's rebuilt.
+*/
+
+// Maximum number of chunks in the index.
+#define FREE_INDEX_MAX_ENTRIES 65536
+
+/*
+Add an unused chunk to the index, and set its `indexed` flag. Return false
+if the index has overflowed (in which case the chunk is counted, but not
+indexed).
+
+@param chunk: The chunk.
+*/
+bool free_index_insert(chunk_t *chunk);
+
+/*
+Remove a chunk from the index, and clear its `indexed` flag. The chunk's
+size must be the same as when it was inserted.
+
+@param chunk: The chunk.
+*/
+void free_index_remove(chunk_t *chunk);
+
+/*
+Return the unused chunk with the lowest address which can store `size`
+bytes, or NULL if there's none.
+
+@param size: The required size.
+*/
+chunk_t *free_index_first_fit(size_t size);
+
+/*
+Return whether the index has overflowed, and so can't be searched.
+*/
+bool free_index_overflowed();
+
+/*
+Return whether the index has overflowed, but the number of unused chunks
+has since fallen far enough that it can be rebuilt.
+*/
+bool free_index_should_rebuild();
+
+/*
+Empty the index (e.g. before rebuilding it). The `indexed` flags of the
+chunks which were in it aren't changed.
+*/
+void free_index_clear();
+
+/*
+Return the position of the first of `count` sizes which is at least
+`size`, or `count` if there's none. This is the index's search kernel.
+
+@param sizes: The sizes.
+@param count: The number of sizes.
+@param size: The required size.
+*/
+size_t free_index_scan(const uint32_t *sizes, size_t count, uint32_t size);
+
+#endif // _DALLOC_FREE_INDEX_H_
@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+#include <execinfo.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dalloc_guard.h"
+#include "dalloc_io.h"
+#include "dalloc_io_internal.h"
+#include "dalloc_lock.h"
+#include "dalloc_os.h"
+#include "dalloc_utils.h"
+
+// Number of frames recorded when a guarded allocation is made or freed.
+#define GUARD_MAX_DEPTH 16
+
+// Alignment of guarded allocations which are placed against the end of
+// their page.
+#define GUARD_ALIGNMENT 16
+
+typedef enum {
+	GUARD_SLOT_UNUSED,
+	GUARD_SLOT_ALLOCATED,
+	GUARD_SLOT_FREED,
+} guard_slot_state_t;
+
+/*
+Metadata for one slot of the guarded pool.
+*/
+typedef struct {
+	guard_slot_state_t state;
+	void *ptr;
+	size_t size;
+	pid_t alloc_tid;
+	pid_t free_tid;
+	size_t alloc_depth;
+	size_t free_depth;
+	void *alloc_trace[GUARD_MAX_DEPTH];
+	void *free_trace[GUARD_MAX_DEPTH];
+} guard_slot_t;
+
+atomic_uintptr_t guard_pool_start = 0;
+atomic_uintptr_t guard_pool_end = 0;
+atomic_size_t guard_sample_rate = 0;
+
+// Guards the slot metadata and the queue of free slots.
+static lock_t guard_lock = LOCK_INITIALIZER;
+static size_t num_slots = 0;
+static guard_slot_t *slots = NULL;
+
+// Free slots, in the order in which they were freed. Slots are allocated
+// from the head, so a freed slot stays protected for as long as possible.
+static size_t *free_queue = NULL;
+static size_t free_head = 0;
+static size_t free_count = 0;
+
+static struct sigaction previous_action;
+
+// Number of allocations the calling thread may make before the next one
+// is sampled.
+static _Thread_local size_t until_sample = 0;
+static _Thread_local uint64_t rng_state = 0;
+
+static uint64_t next_random() {
+	if (!rng_state) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		rng_state = (uint64_t)(uintptr_t)&rng_state
+			^ ((uint64_t)now.tv_nsec << 20) ^ (uint64_t)now.tv_sec;
+		rng_state |= 1;
+	}
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static pid_t current_tid() {
+	return (pid_t)syscall(SYS_gettid);
+}
+
+/*
+Return the address of a slot's page. Slot n occupies page 2n + 1 of the
+pool; even pages are guards.
+*/
+static uintptr_t slot_page(size_t slot) {
+	return guard_pool_start + (2 * slot + 1) * os_page_size();
+}
+
+/*
+Draw the number of calls until the next sample uniformly from
+[1, 2 * rate - 1], which has a mean of `rate`.
+
+@param rate: The sample rate. Must be nonzero.
+*/
+static size_t next_sample_interval(size_t rate) {
+	return 1 + next_random() % (2 * rate - 1);
+}
+
+bool guard_should_sample() {
+	size_t rate = atomic_load_explicit(&guard_sample_rate, memory_order_relaxed);
+	if (!rate) {
+		return false;
+	}
+	if (!until_sample) {
+		until_sample = next_sample_interval(rate);
+	}
+	if (--until_sample) {
+		return false;
+	}
+	until_sample = next_sample_interval(rate);
+	return true;
+}
+
+void *guard_allocate(size_t size) {
+	size_t page_size = os_page_size();
+	if (!size || size > page_size) {
+		return NULL;
+	}
+
+	lock_acquire(&guard_lock);
+	if (!free_count) {
+		lock_release(&guard_lock);
+		return NULL;
+	}
+	size_t slot = free_queue[free_head];
+	free_head = (free_head + 1) % num_slots;
+	free_count--;
+
+	uintptr_t page = slot_page(slot);
+	if (mprotect((void *)page, page_size, PROT_READ | PROT_WRITE) != 0) {
+		// Put the slot back at the head of the queue.
+		free_head = (free_head + num_slots - 1) % num_slots;
+		free_count++;
+		lock_release(&guard_lock);
+		return NULL;
+	}
+
+	// Place the allocation against the end of the page to catch overflows,
+	// or (less often) the start of the page to catch underflows.
+	void *ptr;
+	if (next_random() % 4) {
+		ptr = (void *)(page + page_size - align_up(size, GUARD_ALIGNMENT));
+	} else {
+		ptr = (void *)page;
+	}
+
+	guard_slot_t *meta = &slots[slot];
+	meta->state = GUARD_SLOT_ALLOCATED;
+	meta->ptr = ptr;
+	meta->size = size;
+	meta->alloc_tid = current_tid();
+	meta->free_tid = 0;
+	meta->free_depth = 0;
+	lock_release(&guard_lock);
+
+	// backtrace() was primed by d_guard_start(), so it won't allocate.
+	int depth = backtrace(meta->alloc_trace, GUARD_MAX_DEPTH);
+	meta->alloc_depth = depth > 0 ? depth : 0;
+	return ptr;
+}
+
+static const char *error_name(guard_error_t error) {
+	switch (error) {
+		case GUARD_ERROR_USE_AFTER_FREE:
+			return "use after free";
+		case GUARD_ERROR_BUFFER_OVERFLOW:
+			return "buffer overflow";
+		case GUARD_ERROR_BUFFER_UNDERFLOW:
+			return "buffer underflow";
+		case GUARD_ERROR_DOUBLE_FREE:
+			return "double free";
+		case GUARD_ERROR_INVALID_FREE:
+			return "invalid free";
+		default:
+			return "unknown memory error";
+	}
+}
+
+static void log_trace(const char *what, pid_t tid, void **trace, size_t depth) {
+	log_error("%s by thread %d at:", what, (int)tid);
+	for (size_t i = 0; i < depth; i++) {
+		log_error("    #%zu %p", i, trace[i]);
+	}
+}
+
+/*
+Report a memory error in the guarded pool via panic().
+
+@param error: The kind of error.
+@param slot: The slot to which the error relates, or SIZE_MAX if unknown.
+@param addr: The address which was accessed or freed.
+*/
+static void report_error(guard_error_t error, size_t slot, uintptr_t addr) {
+	if (slot == SIZE_MAX || slots[slot].state == GUARD_SLOT_UNUSED) {
+		panic("d_malloc(): %s at %p in guarded pool", error_name(error), (void *)addr);
+		return;
+	}
+
+	guard_slot_t *meta = &slots[slot];
+	log_error("d_malloc(): %s at %p, %zu-byte allocation at %p", error_name(error),
+		(void *)addr, meta->size, meta->ptr);
+	log_trace("allocated", meta->alloc_tid, meta->alloc_trace, meta->alloc_depth);
+	if (meta->state == GUARD_SLOT_FREED) {
+		log_trace("freed", meta->free_tid, meta->free_trace, meta->free_depth);
+	}
+	panic("d_malloc(): %s at %p (%zu-byte allocation at %p)", error_name(error),
+		(void *)addr, meta->size, meta->ptr);
+}
+
+void guard_free(void *ptr) {
+	size_t page_size = os_page_size();
+	size_t page = ((uintptr_t)ptr - guard_pool_start) / page_size;
+	size_t slot = page / 2;
+
+	lock_acquire(&guard_lock);
+	guard_slot_t *meta = page % 2 ? &slots[slot] : NULL;
+	if (!meta || meta->ptr != ptr || meta->state == GUARD_SLOT_UNUSED) {
+		lock_release(&guard_lock);
+		report_error(GUARD_ERROR_INVALID_FREE, meta ? slot : SIZE_MAX, (uintptr_t)ptr);
+		return;
+	}
+	if (meta->state == GUARD_SLOT_FREED) {
+		lock_release(&guard_lock);
+		report_error(GUARD_ERROR_DOUBLE_FREE, slot, (uintptr_t)ptr);
+		return;
+	}
+
+	mprotect((void *)slot_page(slot), page_size, PROT_NONE);
+	meta->state = GUARD_SLOT_FREED;
+	meta->free_tid = current_tid();
+	int depth = backtrace(meta->free_trace, GUARD_MAX_DEPTH);
+	meta->free_depth = depth > 0 ? depth : 0;
+
+	free_queue[(free_head + free_count) % num_slots] = slot;
+	free_count++;
+	lock_release(&guard_lock);
+}
+
+size_t guard_size(const void *ptr) {
+	size_t page = ((uintptr_t)ptr - guard_pool_start) / os_page_size();
+	return page % 2 ? slots[page / 2].size : 0;
+}
+
+guard_error_t guard_diagnose(uintptr_t addr, size_t *slot) {
+	if (!guard_owns((void *)addr)) {
+		return GUARD_ERROR_NONE;
+	}
+
+	size_t page = (addr - guard_pool_start) / os_page_size();
+	if (page % 2) {
+		// A slot's page only faults once it's been freed.
+		*slot = page / 2;
+		return slots[page / 2].state == GUARD_SLOT_FREED
+			? GUARD_ERROR_USE_AFTER_FREE
+			: GUARD_ERROR_UNKNOWN;
+	}
+
+	// A guard page. Blame whichever neighbouring allocation is closer: an
+	// overflow of the slot to the left, or an underflow of the slot to the
+	// right.
+	guard_slot_t *left = page > 0 ? &slots[page / 2 - 1] : NULL;
+	guard_slot_t *right = page / 2 < num_slots ? &slots[page / 2] : NULL;
+	if (left && left->state == GUARD_SLOT_UNUSED) {
+		left = NULL;
+	}
+	if (right && right->state == GUARD_SLOT_UNUSED) {
+		right = NULL;
+	}
+	if (left && right) {
+		uintptr_t left_distance = addr - ((uintptr_t)left->ptr + left->size);
+		uintptr_t right_distance = (uintptr_t)right->ptr - addr;
+		if (left_distance <= right_distance) {
+			right = NULL;
+		} else {
+			left = NULL;
+		}
+	}
+	if (left) {
+		*slot = page / 2 - 1;
+		return GUARD_ERROR_BUFFER_OVERFLOW;
+	}
+	if (right) {
+		*slot = page / 2;
+		return GUARD_ERROR_BUFFER_UNDERFLOW;
+	}
+	return GUARD_ERROR_UNKNOWN;
+}
+
+/*
+Write an error message to stderr from the SIGSEGV handler. The logging
+functions use stdio and may take locks, so this formats the message on
+the stack and writes it directly instead.
+
+@param fmt: Format string (see format_message()).
+*/
+static void fault_log(const char *fmt, ...) {
+	if (!log_enabled(DALLOC_LOG_LEVEL_ERROR)) {
+		return;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	char timestamp[DALLOC_TIMESTAMP_LEN];
+	format_timestamp(now.tv_sec, timestamp);
+
+	char message[256];
+	va_list args;
+	va_start(args, fmt);
+	format_message(message, sizeof(message), fmt, args);
+	va_end(args);
+
+	char line[320];
+	size_t len = format_string(line, sizeof(line), "dalloc %s ERROR: %s\n", timestamp, message);
+	os_write_all(STDERR_FILENO, line, len);
+}
+
+/*
+Report a fault in the guarded pool from the SIGSEGV handler, and abort.
+Only async-signal-safe functions are used, since the fault may have
+happened anywhere (including inside stdio or with a lock held).
+
+@param error: The kind of error.
+@param slot: The slot to which the error relates, or SIZE_MAX if unknown.
+@param addr: The faulting address.
+*/
+static void report_fault(guard_error_t error, size_t slot, uintptr_t addr) {
+	if (slot == SIZE_MAX || slots[slot].state == GUARD_SLOT_UNUSED) {
+		fault_log("d_malloc(): %s at %p in guarded pool", error_name(error), (void *)addr);
+		abort();
+	}
+
+	guard_slot_t *meta = &slots[slot];
+	fault_log("d_malloc(): %s at %p, %zu-byte allocation at %p", error_name(error),
+		(void *)addr, meta->size, meta->ptr);
+	fault_log("allocated by thread %d at:", (int)meta->alloc_tid);
+	for (size_t i = 0; i < meta->alloc_depth; i++) {
+		fault_log("    #%zu %p", i, meta->alloc_trace[i]);
+	}
+	if (meta->state == GUARD_SLOT_FREED) {
+		fault_log("freed by thread %d at:", (int)meta->free_tid);
+		for (size_t i = 0; i < meta->free_depth; i++) {
+			fault_log("    #%zu %p", i, meta->free_trace[i]);
+		}
+	}
+	abort();
+}
+
+/*
+SIGSEGV handler which reports faults in the guarded pool and aborts. Other
+faults are passed on to the previously installed handler, which stays
+installed underneath this one.
+*/
+static void handle_fault(int signum, siginfo_t *info, void *context) {
+	uintptr_t addr = (uintptr_t)info->si_addr;
+	size_t slot = SIZE_MAX;
+	guard_error_t error = guard_diagnose(addr, &slot);
+	if (error != GUARD_ERROR_NONE) {
+		report_fault(error, slot, addr);
+	}
+
+	if (previous_action.sa_flags & SA_SIGINFO) {
+		previous_action.sa_sigaction(signum, info, context);
+	} else if (previous_action.sa_handler != SIG_DFL && previous_action.sa_handler != SIG_IGN) {
+		previous_action.sa_handler(signum);
+	} else {
+		// The default disposition (a synchronous SIGSEGV can't be ignored):
+		// re-raise the signal so that it terminates the process.
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = SIG_DFL;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, NULL);
+		raise(SIGSEGV);
+	}
+}
+
+/*
+Map the guarded pool and its metadata. Must be called with the guard lock
+held.
+
+@param count: Number of slots.
+*/
+static bool create_pool(size_t count) {
+	size_t page_size = os_page_size();
+	size_t pool_size = (2 * count + 1) * page_size;
+	size_t slots_size = align_up(count * sizeof(guard_slot_t), page_size);
+	size_t queue_size = align_up(count * sizeof(size_t), page_size);
+
+	void *pool = mmap(NULL, pool_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (pool == MAP_FAILED) {
+		return false;
+	}
+	slots = os_map(slots_size);
+	free_queue = os_map(queue_size);
+	if (!slots || !free_queue) {
+		munmap(pool, pool_size);
+		if (slots) {
+			os_unmap(slots, slots_size);
+		}
+		if (free_queue) {
+			os_unmap(free_queue, queue_size);
+		}
+		slots = NULL;
+		free_queue = NULL;
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		free_queue[i] = i;
+	}
+	free_head = 0;
+	free_count = count;
+	num_slots = count;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = handle_fault;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, &previous_action);
+
+	atomic_store_explicit(&guard_pool_end, (uintptr_t)pool + pool_size, memory_order_relaxed);
+	atomic_store_explicit(&guard_pool_start, (uintptr_t)pool, memory_order_release);
+	return true;
+}
+
+bool d_guard_start(size_t count, size_t sample_rate) {
+	if (!count || !sample_rate) {
+		log_warning("d_guard_start(): number of slots and sample rate must be nonzero");
+		return false;
+	}
+
+	// The first call to backtrace() may load libgcc, which allocates memory.
+	void *frame;
+	backtrace(&frame, 1);
+
+	lock_acquire(&guard_lock);
+	bool ok = slots || create_pool(count);
+	lock_release(&guard_lock);
+	if (!ok) {
+		log_warning("d_guard_start(): unable to map guarded pool of %zu slots", count);
+		return false;
+	}
+
+	atomic_store(&guard_sample_rate, sample_rate);
+	return true;
+}
+
+void d_guard_stop() {
+	atomic_store(&guard_sample_rate, 0);
+}
+
+void guard_fork_prepare() {
+	lock_acquire(&guard_lock);
+}
+
+void guard_fork_finish() {
+	lock_release(&guard_lock);
+}
@@ -0,0 +1,126 @@
+#ifndef _DALLOC_GUARD_H_
+#define _DALLOC_GUARD_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Start the sampled guard-page allocator. Roughly one in every
+`sample_rate` calls to d_malloc() (for sizes up to a page) is served from
+a dedicated pool of `num_slots` pages, each surrounded by PROT_NONE guard
+pages. Allocations are placed against one end of their page (chosen at
+random), so that overflows and underflows touch a guard page, and freed
+slots are protected and only reused once every other free slot has been,
+so that later accesses fault. Faults are reported on stderr, along with
+where the allocation was made and freed, and abort the process (panic()
+isn't async-signal-safe, so can't be used from the SIGSEGV handler).
+Invalid and double frees of guarded allocations are reported via panic().
+
+The pool is created on the first call, and can't be resized. Return false
+if the arguments are invalid or the pool couldn't be created.
+
+@param num_slots: Number of guarded allocations which may be live at once.
+@param sample_rate: Mean number of d_malloc() calls per sampled call.
+*/
+bool d_guard_start(size_t num_slots, size_t sample_rate);
+
+/*
+Stop sampling allocations. Existing guarded allocations remain protected
+until they're freed.
+*/
+void d_guard_stop();
+
+// Kind of memory error diagnosed by guard_diagnose().
+typedef enum {
+	GUARD_ERROR_NONE,
+	GUARD_ERROR_USE_AFTER_FREE,
+	GUARD_ERROR_BUFFER_OVERFLOW,
+	GUARD_ERROR_BUFFER_UNDERFLOW,
+	GUARD_ERROR_DOUBLE_FREE,
+	GUARD_ERROR_INVALID_FREE,
+	GUARD_ERROR_UNKNOWN,
+} guard_error_t;
+
+// Bounds of the guarded pool, or 0 if it hasn't been created. The pool
+// is never unmapped. The end is published first, and the start with
+// release semantics, so a nonzero start (loaded with acquire semantics)
+// means both are valid.
+extern atomic_uintptr_t guard_pool_start;
+extern atomic_uintptr_t guard_pool_end;
+
+// Mean number of calls between samples, or 0 if sampling is off.
+extern atomic_size_t guard_sample_rate;
+
+/*
+Decide whether the calling thread's next allocation should be guarded.
+*/
+bool guard_should_sample();
+
+/*
+Allocate from the guarded pool. Return NULL if the size is too large or
+no slot is free, in which case the caller should use the heap.
+
+@param size: The requested size.
+*/
+void *guard_allocate(size_t size);
+
+/*
+Free a guarded allocation. Reports (via panic()) double and invalid
+frees.
+
+@param ptr: The allocation. Must be within the guarded pool.
+*/
+void guard_free(void *ptr);
+
+/*
+Return the requested size of a guarded allocation.
+
+@param ptr: The allocation. Must be within the guarded pool.
+*/
+size_t guard_size(const void *ptr);
+
+/*
+Acquire (and release) the guarded pool's lock around fork(), so that the
+child doesn't inherit it held by a thread which no longer exists.
+*/
+void guard_fork_prepare();
+void guard_fork_finish();
+
+/*
+Work out what kind of memory error caused an access to an address in the
+guarded pool, and which slot's allocation it relates to.
+
+@param addr: The faulting address.
+@param slot: (out) Index of the related slot. Unchanged if no slot could
+			 be identified.
+*/
+guard_error_t guard_diagnose(uintptr_t addr, size_t *slot);
+
+/*
+Check if an address is in the guarded pool.
+
+@param ptr: The address.
+*/
+static inline bool guard_owns(const void *ptr) {
+	uintptr_t start = atomic_load_explicit(&guard_pool_start, memory_order_acquire);
+	return start && (uintptr_t)ptr - start
+		< atomic_load_explicit(&guard_pool_end, memory_order_relaxed) - start;
+}
+
+/*
+Sample an allocation, returning a guarded allocation or NULL if it isn't
+sampled (or can't be guarded). This costs a single load when sampling is
+off.
+
+@param size: The requested size.
+*/
+static inline void *guard_malloc(size_t size) {
+	if (!atomic_load_explicit(&guard_sample_rate, memory_order_relaxed)) {
+		return NULL;
+	}
+	return guard_should_sample() ? guard_allocate(size) : NULL;
+}
+
+#endif // _DALLOC_GUARD_H_
@@ -1,10 +1,12 @@
 #include <stddef.h>
 
 #include "dalloc_heap_traversal.h"
+#include "dalloc_search_stats.h"
 
 chunk_t *find(chunk_t *start, predicate_t condition, void *user_data, chunk_t **prev) {
 	chunk_t *chunk = start;
 	while (chunk) {
+		search_visit();
 		if (condition(chunk, user_data)) {
 			return chunk;
 		}
@@ -18,8 +20,22 @@ chunk_t *find(chunk_t *start, predicate_t condition, void *user_data, chunk_t **
 	return NULL;
 }
 
-int32_t sum(chunk_t *start, aggregator_t aggregator, void *user_data) {
-	int32_t total = 0;
+bool for_each(chunk_t *start, visitor_t visitor, void *user_data) {
+	chunk_t *chunk = start;
+	chunk_t *prv = NULL;
+	while (chunk) {
+		if (!visitor(chunk, user_data)) {
+			return false;
+		}
+		chunk_t *nxt = next(chunk, prv);
+		prv = chunk;
+		chunk = nxt;
+	}
+	return true;
+}
+
+int64_t sum(chunk_t *start, aggregator_t aggregator, void *user_data) {
+	int64_t total = 0;
 	chunk_t *chunk = start;
 	chunk_t *prv = NULL;
 	while (chunk) {
@@ -34,15 +50,19 @@ int32_t sum(chunk_t *start, aggregator_t aggregator, void *user_data) {
 chunk_t *max(chunk_t *start, aggregator_t weight, void *user_data, chunk_t **prev) {
 	chunk_t *max = NULL;
 	chunk_t *max_prev = NULL;
-	int32_t max_weight = INT32_MIN;
+	int64_t max_weight = -1;
 
 	chunk_t *chunk = start;
 	while (chunk) {
-		int32_t chunk_weight = weight(chunk, user_data);
-		if (chunk_weight >= 0 && chunk_weight > max_weight) {
+		search_visit();
+		int64_t chunk_weight = weight(chunk, user_data);
+		if (chunk_weight > max_weight) {
 			max = chunk;
 			max_prev = *prev;
 			max_weight = chunk_weight;
+			if (chunk_weight == WEIGHT_MAX) {
+				break;
+			}
 		}
 		chunk_t *nxt = next(chunk, *prev);
 		*prev = chunk;
@@ -56,15 +76,20 @@ chunk_t *max(chunk_t *start, aggregator_t weight, void *user_data, chunk_t **pre
 chunk_t *min(chunk_t *start, aggregator_t weight, void *user_data, chunk_t **prev) {
 	chunk_t *min_chunk = NULL;
 	chunk_t *min_prev = NULL;
-	int32_t min_weight = INT32_MAX;
+	int64_t min_weight = INT64_MAX;
 
 	chunk_t *chunk = start;
 	while (chunk) {
-		int32_t chunk_weight = weight(chunk, user_data);
-		if (chunk_weight >= 0 && chunk_weight < min_weight) {
+		search_visit();
+		int64_t chunk_weight = weight(chunk, user_data);
+		if (chunk_weight >= 0 && (chunk_weight < min_weight || !min_chunk)) {
 			min_chunk = chunk;
 			min_prev = *prev;
 			min_weight = chunk_weight;
+			if (chunk_weight == 0) {
+				// Nothing can beat a perfect score.
+				break;
+			}
 		}
 
 		chunk_t *nxt = next(chunk, *prev);
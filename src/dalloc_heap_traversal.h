@@ -5,8 +5,15 @@
 
 #include "chunk.h"
 
+// The highest possible weight. max() stops at the first chunk with this
+// weight, since no other chunk can beat it.
+#define WEIGHT_MAX INT64_MAX
+
 typedef bool (*predicate_t)(const chunk_t *, void *user_data);
-typedef int32_t (*aggregator_t)(const chunk_t *, void *user_data);
+// Aggregators return 64-bit values, so that they can represent any chunk
+// size.
+typedef int64_t (*aggregator_t)(const chunk_t *, void *user_data);
+typedef bool (*visitor_t)(const chunk_t *, void *user_data);
 
 /*
 Find the first in the specified heap which matches a condition. Returns
@@ -20,6 +27,17 @@ NULL if no matching chunk is found.
 */
 chunk_t *find(chunk_t *start, predicate_t condition, void *user_data, chunk_t **prev);
 
+/*
+Call a function on each chunk in the heap, in order. Return false if the
+traversal was stopped early by the visitor.
+
+@param start: Starting point of the traversal.
+@param visitor: Function called for each chunk. Returning false stops the
+				traversal.
+@param user_data: User data which will be passed to the visitor.
+*/
+bool for_each(chunk_t *start, visitor_t visitor, void *user_data);
+
 /*
 Return the sum of a given function over all chunks in the heap.
 
@@ -27,11 +45,12 @@ Return the sum of a given function over all chunks in the heap.
 @param aggregator: Function which returns a value for each chunk.
 @param user_data: User data which will be passed to the aggregator.
 */
-int32_t sum(chunk_t *start, aggregator_t aggregator, void *user_data);
+int64_t sum(chunk_t *start, aggregator_t aggregator, void *user_data);
 
 /*
 Return the chunk in the heap with the maximum value given by the weight
-function.
+function (the first such chunk, if there's a tie). The search stops early
+at a chunk with weight WEIGHT_MAX.
 
 @param start: Starting point of the search.
 @param weight: Function which returns a weighting for each chunk. A
@@ -44,11 +63,12 @@ chunk_t *max(chunk_t *start, aggregator_t weight, void *user_data, chunk_t **pre
 
 /*
 Return the chunk in the heap with the minimum value given by the weight
-function.
+function (the first such chunk, if there's a tie). The search stops early
+at a chunk with weight 0, e.g. an exact fit.
 
 @param start: Starting point of the search.
 @param weight: Function which returns a weighting for each chunk. A
-			   neative return value means the chunk will be ignored.
+			   negative return value means the chunk will be ignored.
 @param user_data: User data to be passed to the weighting function.
 @param prev: (out parameter): will be set to the previous chunk in the
 			 heap, or NULL if the first chunk is returned.
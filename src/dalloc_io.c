@@ -1,6 +1,8 @@
 #include <math.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -11,6 +13,8 @@
 #include "dalloc_config.h"
 #include "dalloc_io.h"
 #include "dalloc_io_internal.h"
+#include "dalloc_log_async.h"
+#include "dalloc_probes.h"
 
 #define write_log(lvl, fmt) { \
 	va_list args; \
@@ -19,8 +23,6 @@
 	va_end(args); \
 }
 
-const size_t TIMESTAMP_LEN = 20;
-
 // Only messages equally or more important than this log level will be
 // logged. Can be set via set_log_level().
 int user_log_level = DALLOC_LOG_LEVEL_WARNING;
@@ -72,33 +74,225 @@ uint32_t pad(uint32_t x, uint16_t n, char *buf) {
 	return 0;
 }
 
-void get_timestamp(char buf[TIMESTAMP_LEN]) {
-	time_t rawtime;
-	time(&rawtime);
-	struct tm *timeinfo = localtime(&rawtime);
+void format_timestamp(int64_t seconds, char *buf) {
+	int64_t days = seconds / 86400;
+	int64_t rem = seconds % 86400;
+	if (rem < 0) {
+		rem += 86400;
+		days--;
+	}
 
-	// These buffers must be of size N + 1 (for null terminator).
-	char year[5];
-	pad(timeinfo->tm_year + 1900, 4, year);
+	// Convert days since the epoch to a civil date. See Howard Hinnant's
+	// days_from_civil()/civil_from_days() algorithms.
+	days += 719468;
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	int64_t doe = days - era * 146097;
+	int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int64_t mp = (5 * doy + 2) / 153;
+	int64_t day = doy - (153 * mp + 2) / 5 + 1;
+	int64_t month = mp < 10 ? mp + 3 : mp - 9;
+	int64_t year = yoe + era * 400 + (month <= 2);
+
+	int64_t fields[6] = { year, month, day, rem / 3600, rem / 60 % 60, rem % 60 };
+	const char separators[6] = { '-', '-', ' ', ':', ':', 0 };
+	char *out = buf;
+	for (int i = 0; i < 6; i++) {
+		int digits = i == 0 ? 4 : 2;
+		int64_t value = fields[i];
+		for (int d = digits - 1; d >= 0; d--) {
+			out[d] = '0' + value % 10;
+			value /= 10;
+		}
+		out += digits;
+		*out++ = separators[i];
+	}
+}
 
-	char month[3];
-	pad(timeinfo->tm_mon, 2, month);
+/*
+Append a character to a buffer, if there's room for it (and a null
+terminator).
+
+@param buf: The buffer.
+@param size: Size of the buffer.
+@param len: Current length of the string in the buffer. Always
+			incremented, so that truncation can be detected.
+@param c: The character.
+*/
+static void put_char(char *buf, size_t size, size_t *len, char c) {
+	if (*len + 1 < size) {
+		buf[*len] = c;
+	}
+	(*len)++;
+}
 
-	char day[3];
-	pad(timeinfo->tm_mday, 2, day);
+/*
+Convert an unsigned integer to a string of digits. Return the number of
+digits written. The output is not null-terminated.
+
+@param value: The integer.
+@param base: 10 or 16.
+@param upper: Use upper case hex digits.
+@param buf: The output buffer. Must be large enough for any 64-bit value.
+*/
+static size_t format_unsigned(unsigned long long value, unsigned base, bool upper, char *buf) {
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char reversed[24];
+	size_t n = 0;
+	do {
+		reversed[n++] = digits[value % base];
+		value /= base;
+	} while (value);
+	for (size_t i = 0; i < n; i++) {
+		buf[i] = reversed[n - i - 1];
+	}
+	return n;
+}
+
+size_t format_message(char *buf, size_t size, const char *fmt, va_list args) {
+	size_t len = 0;
+	while (*fmt) {
+		if (*fmt != '%') {
+			put_char(buf, size, &len, *fmt++);
+			continue;
+		}
+		fmt++;
+
+		bool left_align = false;
+		bool zero_pad = false;
+		for (;; fmt++) {
+			if (*fmt == '-') {
+				left_align = true;
+			} else if (*fmt == '0') {
+				zero_pad = true;
+			} else {
+				break;
+			}
+		}
 
-	char hour[3];
-	pad(timeinfo->tm_hour, 2, hour);
+		size_t width = 0;
+		while (*fmt >= '0' && *fmt <= '9') {
+			width = width * 10 + (*fmt++ - '0');
+		}
 
-	char minute[3];
-	pad(timeinfo->tm_min, 2, minute);
+		// 0 = int, 1 = long, 2 = long long, 3 = size_t.
+		int length = 0;
+		if (*fmt == 'l') {
+			length = 1;
+			if (*++fmt == 'l') {
+				length = 2;
+				fmt++;
+			}
+		} else if (*fmt == 'z') {
+			length = 3;
+			fmt++;
+		}
 
-	char second[3];
-	pad(timeinfo->tm_sec, 2, second);
+		char tmp[24];
+		const char *str = tmp;
+		size_t n = 0;
+		bool negative = false;
+		switch (*fmt) {
+			case 'd':
+			case 'i': {
+				long long value;
+				if (length == 0) {
+					value = va_arg(args, int);
+				} else if (length == 1) {
+					value = va_arg(args, long);
+				} else if (length == 2) {
+					value = va_arg(args, long long);
+				} else {
+					value = va_arg(args, ptrdiff_t);
+				}
+				negative = value < 0;
+				unsigned long long magnitude = negative ? -(unsigned long long)value : (unsigned long long)value;
+				n = format_unsigned(magnitude, 10, false, tmp);
+				break;
+			}
+			case 'u':
+			case 'x':
+			case 'X': {
+				unsigned long long value;
+				if (length == 0) {
+					value = va_arg(args, unsigned int);
+				} else if (length == 1) {
+					value = va_arg(args, unsigned long);
+				} else if (length == 2) {
+					value = va_arg(args, unsigned long long);
+				} else {
+					value = va_arg(args, size_t);
+				}
+				n = format_unsigned(value, *fmt == 'u' ? 10 : 16, *fmt == 'X', tmp);
+				break;
+			}
+			case 'p':
+				tmp[0] = '0';
+				tmp[1] = 'x';
+				n = 2 + format_unsigned((uintptr_t)va_arg(args, void *), 16, false, tmp + 2);
+				break;
+			case 's':
+				str = va_arg(args, const char *);
+				if (!str) {
+					str = "(null)";
+				}
+				n = strlen(str);
+				break;
+			case 'c':
+				tmp[0] = (char)va_arg(args, int);
+				n = 1;
+				break;
+			case '%':
+				tmp[0] = '%';
+				n = 1;
+				break;
+			default:
+				// Unknown conversion - write it out verbatim.
+				put_char(buf, size, &len, '%');
+				if (!*fmt) {
+					continue;
+				}
+				tmp[0] = *fmt;
+				n = 1;
+				break;
+		}
+		fmt++;
+
+		size_t total = n + negative;
+		size_t padding = width > total ? width - total : 0;
+		if (!left_align && !zero_pad) {
+			for (size_t i = 0; i < padding; i++) {
+				put_char(buf, size, &len, ' ');
+			}
+		}
+		if (negative) {
+			put_char(buf, size, &len, '-');
+		}
+		if (!left_align && zero_pad) {
+			for (size_t i = 0; i < padding; i++) {
+				put_char(buf, size, &len, '0');
+			}
+		}
+		for (size_t i = 0; i < n; i++) {
+			put_char(buf, size, &len, str[i]);
+		}
+		if (left_align) {
+			for (size_t i = 0; i < padding; i++) {
+				put_char(buf, size, &len, ' ');
+			}
+		}
+	}
 
-	sprintf(buf, "%s-%s-%s %s:%s:%s", year, month, day, hour, minute, second);
+	buf[len < size ? len : size - 1] = 0;
+	return len < size ? len : size - 1;
+}
 
-	buf[TIMESTAMP_LEN - 1] = 0;
+size_t format_string(char *buf, size_t size, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	size_t len = format_message(buf, size, fmt, args);
+	va_end(args);
+	return len;
 }
 
 void vlog_message(int log_level, const char *fmt, va_list args) {
@@ -106,19 +300,24 @@ void vlog_message(int log_level, const char *fmt, va_list args) {
 		return;
 	}
 
+	if (async_logging_enabled()) {
+		async_log_message(log_level, fmt, args);
+		return;
+	}
+
 	// The messsage will look like:
 	//
 	// dalloc 2022-01-31 10:30:00 ERROR: <msg>\n
 	//
 	// 'dalloc ' = 7 chars
-	// 'yyyy-MM-dd hh:mm:ss ' = 19 chars
+	// 'yyyy-MM-dd hh:mm:ss ' = 19 chars (UTC, as in the async backend)
 	// message type length = calculated
 	// ': ' = 2 chars
 	// $fmt = `strlen(fmt)` chars
 	// \n = 1 char
 
-	char timestamp[TIMESTAMP_LEN];
-	get_timestamp(timestamp);
+	char timestamp[DALLOC_TIMESTAMP_LEN];
+	format_timestamp(time(NULL), timestamp);
 
 	// 'DIAGNOSTIC' = 10 chars
 	size_t buf_len = 10;
@@ -128,7 +327,7 @@ void vlog_message(int log_level, const char *fmt, va_list args) {
 		msg_type[i] = 0;
 	}
 
-	int message_length = 7 + TIMESTAMP_LEN + msg_type_len + 2 + strlen(fmt) + 1;
+	int message_length = 7 + DALLOC_TIMESTAMP_LEN + msg_type_len + 2 + strlen(fmt) + 1;
 	char full_format[message_length];
 	sprintf(full_format, "dalloc %s %s: %s\n", timestamp, msg_type, fmt);
 
@@ -136,33 +335,37 @@ void vlog_message(int log_level, const char *fmt, va_list args) {
 	vfprintf(out, full_format, args);
 }
 
-void log_message(int log_level, const char *fmt, ...) {
+void (log_message)(int log_level, const char *fmt, ...) {
 	write_log(log_level, fmt);
 }
 
-void log_error(const char *fmt, ...) {
+void (log_error)(const char *fmt, ...) {
 	write_log(DALLOC_LOG_LEVEL_ERROR, fmt);
 }
 
-void log_warning(const char *fmt, ...) {
+void (log_warning)(const char *fmt, ...) {
 	write_log(DALLOC_LOG_LEVEL_WARNING, fmt);
 }
 
-void log_info(const char *fmt, ...) {
+void (log_info)(const char *fmt, ...) {
 	write_log(DALLOC_LOG_LEVEL_INFO, fmt);
 }
 
-void log_diag(const char *fmt, ...) {
+void (log_diag)(const char *fmt, ...) {
 	write_log(DALLOC_LOG_LEVEL_DIAGNOSTIC, fmt);
 }
 
-void log_debug(const char *fmt, ...) {
+void (log_debug)(const char *fmt, ...) {
 	write_log(DALLOC_LOG_LEVEL_DEBUG, fmt);
 }
 
 void panic(const char *fmt, ...) {
+	usdt_probe1(panic, fmt);
 	write_log(DALLOC_LOG_LEVEL_ERROR, fmt);
 
+	// Make sure the message isn't lost if we're about to crash.
+	flush_log();
+
 	if (!robust_mode()) {
 		raise(SIGILL);
 	}
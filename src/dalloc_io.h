@@ -1,6 +1,8 @@
 #ifndef _DALLOC_IO_H_
 #define _DALLOC_IO_H_
 
+#include <stdbool.h>
+
 #define DALLOC_LOG_LEVEL_DEBUG 5
 #define DALLOC_LOG_LEVEL_DIAGNOSTIC 4
 #define DALLOC_LOG_LEVEL_INFO 3
@@ -14,47 +16,125 @@ Set the log level. Only messages above this log level will be logged.
 void set_log_level(int log_level);
 
 /*
-Write a log message of the specified log level.
+Switch to the asynchronous logging backend. Log messages are formatted,
+using only stack memory, into a lock-free ring buffer owned by the calling
+thread, and later written to the given file descriptor with write(2),
+either by a background thread or by flush_log(). Logging on the allocation
+path then costs no syscalls, takes no locks and never calls back into the
+allocator. Messages from one thread are written in order, but messages
+from different threads may be interleaved arbitrarily. If a thread's ring
+buffer fills up, new messages are dropped and a count of dropped messages
+is written instead. Return false if the backend couldn't be started.
+
+@param fd: File descriptor to which log messages are written.
+@param background: If true, start a background thread which drains the
+				   ring buffers periodically. Otherwise, messages are only
+				   written by flush_log().
+*/
+bool start_async_logging(int fd, bool background);
+
+/*
+Write any buffered log messages. This is a noop unless the asynchronous
+logging backend is in use.
+*/
+void flush_log();
+
+/*
+Flush any buffered log messages, stop the background thread (if any) and
+switch back to the default (synchronous, stdio) logging backend.
+*/
+void stop_async_logging();
+
+// The most verbose log level which is compiled in. Calls to log_error()
+// ... log_debug() which are more verbose than this compile to nothing. Set
+// via the DALLOC_COMPILED_LOG_LEVEL CMake option, which only applies to
+// dalloc's own sources (code linking against it keeps every level).
+#ifndef DALLOC_COMPILED_LOG_LEVEL
+#define DALLOC_COMPILED_LOG_LEVEL DALLOC_LOG_LEVEL_DEBUG
+#endif
+
+// The current log level. Use set_log_level() to change this.
+extern int user_log_level;
+
+/*
+Check whether messages of a given log level are currently being logged.
+This is used by the logging macros to skip evaluation of their arguments.
+
+@param log_level: Log level (error/warning/...).
+*/
+static inline bool log_enabled(int log_level) {
+	return log_level <= user_log_level;
+}
+
+/*
+Write a log message of the specified log level. Messages from both the
+synchronous and the asynchronous backend are timestamped in UTC.
 
 @param log_level: Log level (error/warning/...).
 @param fmt: printf-style format string.
 */
-void log_message(int log_level, const char* fmt, ...);
+void (log_message)(int log_level, const char* fmt, ...);
 
 /*
 Write an error message. This is a wrapper around log_message().
 
 @param fmt: printf-style format string.
 */
-void log_error(const char* fmt, ...);
+void (log_error)(const char* fmt, ...);
 
 /*
 Write a warning message. This is a wrapper around log_message().
 
 @param fmt: printf-style format string.
 */
-void log_warning(const char* fmt, ...);
+void (log_warning)(const char* fmt, ...);
 
 /*
 Write an info message. This is a wrapper around log_message().
 
 @param fmt: printf-style format string.
 */
-void log_info(const char* fmt, ...);
+void (log_info)(const char* fmt, ...);
 
 /*
 Write a diagnostic message. This is a wrapper around log_message().
 
 @param fmt: printf-style format string.
 */
-void log_diag(const char* fmt, ...);
+void (log_diag)(const char* fmt, ...);
 
 /*
 Write a debug message. This is a wrapper around log_message().
 
 @param fmt: printf-style format string.
 */
-void log_debug(const char* fmt, ...);
+void (log_debug)(const char* fmt, ...);
+
+// Macro front-ends for the functions above. The log level is checked
+// inline, so that the format arguments are only evaluated (and the
+// function only called) if the message will actually be logged. Messages
+// logged via log_error() ... log_debug() which are more verbose than
+// DALLOC_COMPILED_LOG_LEVEL fail a constant check, so the whole call is
+// eliminated at compile time. log_message() is usually called with a
+// variable log level, so it's only checked at runtime.
+#define log_message(log_level, ...) do { \
+	int _dalloc_log_level = (log_level); \
+	if (log_enabled(_dalloc_log_level)) { \
+		(log_message)(_dalloc_log_level, __VA_ARGS__); \
+	} \
+} while (0)
+
+#define _dalloc_log_at(log_level, fn, ...) do { \
+	if ((log_level) <= DALLOC_COMPILED_LOG_LEVEL && log_enabled(log_level)) { \
+		(fn)(__VA_ARGS__); \
+	} \
+} while (0)
+
+#define log_error(...) _dalloc_log_at(DALLOC_LOG_LEVEL_ERROR, log_error, __VA_ARGS__)
+#define log_warning(...) _dalloc_log_at(DALLOC_LOG_LEVEL_WARNING, log_warning, __VA_ARGS__)
+#define log_info(...) _dalloc_log_at(DALLOC_LOG_LEVEL_INFO, log_info, __VA_ARGS__)
+#define log_diag(...) _dalloc_log_at(DALLOC_LOG_LEVEL_DIAGNOSTIC, log_diag, __VA_ARGS__)
+#define log_debug(...) _dalloc_log_at(DALLOC_LOG_LEVEL_DEBUG, log_debug, __VA_ARGS__)
 
 /*
 Write an error message and abort program execution. If this is being
@@ -1,8 +1,16 @@
 #ifndef _DALLOC_IO_INTERNAL_H_
 #define _DALLOC_IO_INTERNAL_H_
 
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// Length of a formatted timestamp, including the null terminator.
+#define DALLOC_TIMESTAMP_LEN 20
+
+// 'DIAGNOSTIC' (the longest message type) + null terminator.
+#define DALLOC_MSG_TYPE_LEN 11
+
 /*
 Convert the integer to a string and pad out to N digits.
 
@@ -15,4 +23,41 @@ more than n digits).
 */
 uint32_t pad(uint32_t x, uint16_t n, char *buf);
 
+/*
+Write the name of a log level (e.g. "WARNING") into a buffer. Return the
+length of the name.
+
+@param log_level: The log level.
+@param buf: The output buffer. Must be of size >= DALLOC_MSG_TYPE_LEN.
+*/
+int get_msg_type(int log_level, char *buf);
+
+/*
+Format a UTC timestamp as 'yyyy-MM-dd hh:mm:ss' without calling into libc
+(which may take locks or allocate memory).
+
+@param seconds: Seconds since the unix epoch.
+@param buf: The output buffer. Must be of size >= DALLOC_TIMESTAMP_LEN.
+*/
+void format_timestamp(int64_t seconds, char *buf);
+
+/*
+A minimal, allocation-free vsnprintf(). Supports the conversions %d, %i,
+%u, %x, %X, %p, %s, %c and %%, the length modifiers l, ll and z, the
+'-' and '0' flags and a field width. The output is always null-terminated,
+and is truncated if the buffer is too small. Return the number of
+characters written, excluding the null terminator.
+
+@param buf: The output buffer.
+@param size: Size of the output buffer. Must be nonzero.
+@param fmt: printf-style format string.
+@param args: Arguments for the format string.
+*/
+size_t format_message(char *buf, size_t size, const char *fmt, va_list args);
+
+/*
+Variadic wrapper around format_message().
+*/
+size_t format_string(char *buf, size_t size, const char *fmt, ...);
+
 #endif // _DALLOC_IO_INTERNAL_H_
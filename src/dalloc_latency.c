@@ -0,0 +1,310 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "dalloc_latency.h"
+
+#ifdef DALLOC_LATENCY_STATS
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "dalloc_cycles.h"
+#include "dalloc_io.h"
+#include "dalloc_io_internal.h"
+#include "dalloc_os.h"
+#include "dalloc_thread_block.h"
+#include "dalloc_utils.h"
+
+#define SUB_BUCKETS (1 << DALLOC_LATENCY_SUB_BITS)
+
+/*
+A thread's histograms. When a thread exits its block is simply released:
+the next thread to claim it carries on adding to the same histograms, so
+nothing recorded is lost and no lock is needed to retire a thread.
+
+Blocks are about a megabyte, but the pages of size classes which are
+never used are never touched.
+*/
+typedef struct {
+	thread_block_t header;
+	d_latency_hist_t hists[DALLOC_LATENCY_NUM_OPS][DALLOC_NUM_SIZE_CLASSES];
+} latency_block_t;
+
+static thread_block_list_t blocks = THREAD_BLOCK_LIST_INITIALIZER(latency_block_t, NULL);
+
+static _Thread_local latency_block_t *thread_block = NULL;
+static _Thread_local uint32_t latency_depth = 0;
+static _Thread_local uint64_t latency_start = 0;
+static _Thread_local size_t latency_size = 0;
+
+static const char *op_names[DALLOC_LATENCY_NUM_OPS] = {
+	"malloc", "free", "calloc", "realloc"
+};
+
+/*
+Get the calling thread's block. Return NULL on failure.
+*/
+static latency_block_t *get_thread_block() {
+	if (!thread_block) {
+		thread_block = (latency_block_t *)thread_block_get(&blocks);
+	}
+	return thread_block;
+}
+
+uint32_t latency_bucket(uint64_t cycles) {
+	if (cycles < SUB_BUCKETS) {
+		return (uint32_t)cycles;
+	}
+	uint32_t exponent = 63 - __builtin_clzll(cycles);
+	if (exponent >= DALLOC_LATENCY_MAX_BITS) {
+		return DALLOC_LATENCY_BUCKETS - 1;
+	}
+	uint32_t shift = exponent - DALLOC_LATENCY_SUB_BITS;
+	uint32_t sub_bucket = (uint32_t)(cycles >> shift) & (SUB_BUCKETS - 1);
+	return ((shift + 1) << DALLOC_LATENCY_SUB_BITS) + sub_bucket;
+}
+
+uint64_t latency_bucket_max(uint32_t bucket) {
+	if (bucket < SUB_BUCKETS) {
+		return bucket;
+	}
+	if (bucket >= DALLOC_LATENCY_BUCKETS - 1) {
+		return UINT64_MAX;
+	}
+	uint32_t shift = (bucket >> DALLOC_LATENCY_SUB_BITS) - 1;
+	uint64_t sub_bucket = bucket & (SUB_BUCKETS - 1);
+	return ((SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+void latency_record(latency_op_t op, size_t size, uint64_t cycles) {
+	latency_block_t *block = get_thread_block();
+	if (!block) {
+		return;
+	}
+	d_latency_hist_t *hist = &block->hists[op][size_class(size)];
+	hist->calls++;
+	hist->total += cycles;
+	if (cycles > hist->max) {
+		hist->max = cycles;
+	}
+	hist->buckets[latency_bucket(cycles)]++;
+}
+
+void latency_begin() {
+	if (latency_depth++) {
+		return;
+	}
+	latency_size = 0;
+	latency_start = read_cycles();
+}
+
+void latency_set_size(size_t size) {
+	if (latency_depth == 1) {
+		latency_size = size;
+	}
+}
+
+void latency_end(latency_op_t op) {
+	if (--latency_depth) {
+		return;
+	}
+	latency_record(op, latency_size, read_cycles() - latency_start);
+}
+
+/*
+Add one histogram to another.
+
+@param total: The histogram to be added to.
+@param hist: The histogram to add.
+*/
+static void add_hist(d_latency_hist_t *total, const d_latency_hist_t *hist) {
+	if (!hist->calls) {
+		return;
+	}
+	total->calls += hist->calls;
+	total->total += hist->total;
+	if (hist->max > total->max) {
+		total->max = hist->max;
+	}
+	for (uint32_t i = 0; i < DALLOC_LATENCY_BUCKETS; i++) {
+		total->buckets[i] += hist->buckets[i];
+	}
+}
+
+/*
+Return a percentile of a histogram (see d_latency_percentile()).
+
+@param hist: The histogram.
+@param percentile: The percentile, in [0, 100].
+*/
+static uint64_t hist_percentile(const d_latency_hist_t *hist, double percentile) {
+	if (!hist->calls) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)ceil(percentile / 100.0 * hist->calls);
+	if (rank < 1) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < DALLOC_LATENCY_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			uint64_t max = latency_bucket_max(i);
+			return max < hist->max ? max : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+bool d_latency_histogram(latency_op_t op, int32_t size_class, d_latency_hist_t *hist) {
+	memset(hist, 0, sizeof(*hist));
+	if (op >= DALLOC_LATENCY_NUM_OPS || size_class >= DALLOC_NUM_SIZE_CLASSES
+			|| size_class < DALLOC_LATENCY_ALL_CLASSES) {
+		return false;
+	}
+
+	thread_block_t *b = thread_block_first(&blocks);
+	for (; b; b = b->next) {
+		latency_block_t *block = (latency_block_t *)b;
+		if (size_class != DALLOC_LATENCY_ALL_CLASSES) {
+			add_hist(hist, &block->hists[op][size_class]);
+			continue;
+		}
+		for (int32_t i = 0; i < DALLOC_NUM_SIZE_CLASSES; i++) {
+			add_hist(hist, &block->hists[op][i]);
+		}
+	}
+	return true;
+}
+
+bool d_latency_percentile(latency_op_t op, int32_t size_class, double percentile,
+		uint64_t *latency) {
+	*latency = 0;
+	if (!(percentile >= 0 && percentile <= 100)) {
+		return false;
+	}
+	d_latency_hist_t hist;
+	if (!d_latency_histogram(op, size_class, &hist)) {
+		return false;
+	}
+	*latency = hist_percentile(&hist, percentile);
+	return true;
+}
+
+/*
+Format a line into a buffer and write it to a file descriptor. Return
+false if writing fails.
+*/
+static bool write_line(int fd, const char *fmt, ...) {
+	char line[256];
+	va_list args;
+	va_start(args, fmt);
+	size_t len = format_message(line, sizeof(line), fmt, args);
+	va_end(args);
+	return os_write_all(fd, line, len);
+}
+
+/*
+Write one row of the latency table.
+
+@param fd: The file descriptor to write to.
+@param op: The type of call.
+@param size: The row's label for the size of its calls.
+@param hist: The row's histogram.
+*/
+static bool write_row(int fd, latency_op_t op, const char *size, const d_latency_hist_t *hist) {
+	return write_line(fd, "%-8s %12s %12llu %10llu %10llu %10llu %10llu %10llu %12llu\n",
+		op_names[op], size,
+		(unsigned long long)hist->calls,
+		(unsigned long long)(hist->total / hist->calls),
+		(unsigned long long)hist_percentile(hist, 50),
+		(unsigned long long)hist_percentile(hist, 90),
+		(unsigned long long)hist_percentile(hist, 99),
+		(unsigned long long)hist_percentile(hist, 99.9),
+		(unsigned long long)hist->max);
+}
+
+bool d_latency_dump(int fd) {
+#if defined(__x86_64__) || defined(__i386__)
+	const char *unit = "cycles";
+#else
+	const char *unit = "ns";
+#endif
+	bool ok = write_line(fd, "# dalloc call latency (%s)\n", unit);
+	ok = ok && write_line(fd, "%-8s %12s %12s %10s %10s %10s %10s %10s %12s\n",
+		"op", "size", "calls", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+	d_latency_hist_t hist;
+	for (int32_t op = 0; ok && op < DALLOC_LATENCY_NUM_OPS; op++) {
+		for (int32_t i = 0; ok && i < DALLOC_NUM_SIZE_CLASSES; i++) {
+			d_latency_histogram(op, i, &hist);
+			if (!hist.calls) {
+				continue;
+			}
+			// Label each row with the smallest size in its class.
+			char size[24];
+			size_t smallest = i ? (size_t)1 << i : 0;
+			char *end = size + sizeof(size) - 1;
+			*end = '\0';
+			do {
+				*--end = '0' + smallest % 10;
+				smallest /= 10;
+			} while (smallest);
+			*--end = '=';
+			*--end = '>';
+			ok = write_row(fd, op, end, &hist);
+		}
+		d_latency_histogram(op, DALLOC_LATENCY_ALL_CLASSES, &hist);
+		if (ok && hist.calls) {
+			ok = write_row(fd, op, "all", &hist);
+		}
+	}
+
+	if (!ok) {
+		log_warning("d_latency_dump(): unable to write to fd %d", fd);
+	}
+	return ok;
+}
+
+void d_latency_reset() {
+	thread_block_t *b = thread_block_first(&blocks);
+	for (; b; b = b->next) {
+		latency_block_t *block = (latency_block_t *)b;
+		// Only clear histograms which have been used, so that untouched
+		// pages stay untouched.
+		for (int32_t op = 0; op < DALLOC_LATENCY_NUM_OPS; op++) {
+			for (int32_t i = 0; i < DALLOC_NUM_SIZE_CLASSES; i++) {
+				if (block->hists[op][i].calls) {
+					memset(&block->hists[op][i], 0, sizeof(d_latency_hist_t));
+				}
+			}
+		}
+	}
+}
+
+#else
+
+bool d_latency_histogram(latency_op_t op, int32_t size_class, d_latency_hist_t *hist) {
+	memset(hist, 0, sizeof(*hist));
+	return false;
+}
+
+bool d_latency_percentile(latency_op_t op, int32_t size_class, double percentile,
+		uint64_t *latency) {
+	*latency = 0;
+	return false;
+}
+
+bool d_latency_dump(int fd) {
+	return false;
+}
+
+void d_latency_reset() {
+
+}
+
+#endif // DALLOC_LATENCY_STATS
@@ -0,0 +1,146 @@
+#ifndef _DALLOC_LATENCY_H_
+#define _DALLOC_LATENCY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Per-call latency instrumentation. When dalloc is built with
+DALLOC_LATENCY_STATS, every d_malloc(), d_free(), d_calloc() and
+d_realloc() is timed with read_cycles() (the TSC on x86, nanoseconds
+elsewhere), and the time is recorded in a histogram owned by the calling
+thread, selected by the type of call and the size class of the
+allocation. Otherwise the hooks compile to nothing and the functions
+below return false.
+*/
+
+typedef enum {
+	DALLOC_LATENCY_OP_MALLOC,
+	DALLOC_LATENCY_OP_FREE,
+	DALLOC_LATENCY_OP_CALLOC,
+	DALLOC_LATENCY_OP_REALLOC,
+	DALLOC_LATENCY_NUM_OPS
+} latency_op_t;
+
+// Pass as a size class to query the calls of all sizes.
+#define DALLOC_LATENCY_ALL_CLASSES -1
+
+// Histograms are log-linear (as in HdrHistogram): each power of two is
+// split into 2^DALLOC_LATENCY_SUB_BITS equal buckets, so a value's bucket
+// is within 1/16 of the value. Values below 2^DALLOC_LATENCY_SUB_BITS have
+// a bucket each, and values of 2^DALLOC_LATENCY_MAX_BITS or more share the
+// last bucket.
+#define DALLOC_LATENCY_SUB_BITS 4
+#define DALLOC_LATENCY_MAX_BITS 40
+#define DALLOC_LATENCY_BUCKETS \
+	((DALLOC_LATENCY_MAX_BITS - DALLOC_LATENCY_SUB_BITS + 1) << DALLOC_LATENCY_SUB_BITS)
+
+typedef struct {
+	uint64_t calls;
+	// Total and maximum latency of a call.
+	uint64_t total;
+	uint64_t max;
+	uint64_t buckets[DALLOC_LATENCY_BUCKETS];
+} d_latency_hist_t;
+
+/*
+Get the latency histogram of one type of call, recorded by all threads
+(including threads which have exited). Histograms being updated
+concurrently may be slightly inconsistent. Return false if dalloc was
+built without latency instrumentation, or the arguments are invalid.
+
+@param op: The type of call.
+@param size_class: Only include calls whose allocation is in this size
+				   class (see size_class()), or DALLOC_LATENCY_ALL_CLASSES.
+@param hist: (out) The histogram.
+*/
+bool d_latency_histogram(latency_op_t op, int32_t size_class, d_latency_hist_t *hist);
+
+/*
+Get a percentile of the latency of one type of call. The result is the
+largest value which falls in the same histogram bucket as the true
+percentile (but no more than the largest recorded value), or 0 if no
+calls have been recorded. Return false if dalloc was built without
+latency instrumentation, or the arguments are invalid.
+
+@param op: The type of call.
+@param size_class: A size class, or DALLOC_LATENCY_ALL_CLASSES.
+@param percentile: The percentile, in [0, 100].
+@param latency: (out) The latency, in cycles.
+*/
+bool d_latency_percentile(latency_op_t op, int32_t size_class, double percentile,
+		uint64_t *latency);
+
+/*
+Write a table of the number of calls, mean, p50, p90, p99, p99.9 and
+maximum latency of each type of call and each size class in which calls
+have been recorded. Doesn't allocate from the heap. Return false if
+dalloc was built without latency instrumentation, or writing fails.
+
+@param fd: The file descriptor to write to.
+*/
+bool d_latency_dump(int fd);
+
+/*
+Clear the latency histograms of all threads. Calls which are recorded
+concurrently may be lost.
+*/
+void d_latency_reset();
+
+#ifdef DALLOC_LATENCY_STATS
+
+/*
+Start timing a call. Calls may be nested (e.g. d_calloc() calls
+d_malloc()), in which case only the outermost call is recorded, and
+includes the time taken by the nested calls.
+*/
+void latency_begin();
+
+/*
+Set the allocation size of the call being timed, which selects the size
+class it's recorded in. Ignored in nested calls.
+
+@param size: The allocation size.
+*/
+void latency_set_size(size_t size);
+
+/*
+Finish timing a call, and record it.
+
+@param op: The type of call.
+*/
+void latency_end(latency_op_t op);
+
+/*
+Record a call in the calling thread's histograms.
+
+@param op: The type of call.
+@param size: The allocation size.
+@param cycles: The call's latency.
+*/
+void latency_record(latency_op_t op, size_t size, uint64_t cycles);
+
+/*
+Return the histogram bucket of a latency.
+
+@param cycles: The latency.
+*/
+uint32_t latency_bucket(uint64_t cycles);
+
+/*
+Return the largest latency in a histogram bucket.
+
+@param bucket: The bucket.
+*/
+uint64_t latency_bucket_max(uint32_t bucket);
+
+#else
+
+#define latency_begin() ((void)0)
+#define latency_set_size(size) ((void)0)
+#define latency_end(op) ((void)0)
+
+#endif // DALLOC_LATENCY_STATS
+
+#endif // _DALLOC_LATENCY_H_
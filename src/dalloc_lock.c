@@ -0,0 +1,186 @@
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dalloc_cycles.h"
+#include "dalloc_lock.h"
+
+// Number of times to poll a contended lock before yielding the CPU.
+#define LOCK_SPIN_COUNT 64
+
+// Bounds on the number of times a contended mutex is polled before its
+// waiter sleeps.
+#define MUTEX_MIN_SPINS 16
+#define MUTEX_MAX_SPINS 512
+
+#define MUTEX_UNLOCKED 0
+#define MUTEX_LOCKED 1
+#define MUTEX_CONTENDED 2
+
+void lock_init(lock_t *lock) {
+	atomic_init(&lock->locked, false);
+}
+
+void lock_acquire(lock_t *lock) {
+	while (atomic_exchange_explicit(&lock->locked, true, memory_order_acquire)) {
+		// Spin on a plain load so that waiters don't keep stealing the
+		// cache line from the lock holder.
+		unsigned spins = 0;
+		while (atomic_load_explicit(&lock->locked, memory_order_relaxed)) {
+			if (++spins == LOCK_SPIN_COUNT) {
+				sched_yield();
+				spins = 0;
+			}
+		}
+	}
+}
+
+void lock_release(lock_t *lock) {
+	atomic_store_explicit(&lock->locked, false, memory_order_release);
+}
+
+/*
+Tell the CPU that this is a spin-wait loop.
+*/
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static void futex_wait(atomic_uint *addr, unsigned value) {
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr) {
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+void mutex_init(mutex_t *mutex) {
+	atomic_init(&mutex->state, MUTEX_UNLOCKED);
+	atomic_init(&mutex->spins, 0);
+	mutex->acquired_at = 0;
+	memset(&mutex->stats, 0, sizeof(mutex->stats));
+}
+
+/*
+Try to take a free mutex. Return false if it's held.
+
+@param mutex: The mutex.
+*/
+static inline bool try_acquire(mutex_t *mutex) {
+	unsigned state = MUTEX_UNLOCKED;
+	return atomic_compare_exchange_strong_explicit(&mutex->state, &state, MUTEX_LOCKED,
+		memory_order_acquire, memory_order_relaxed);
+}
+
+/*
+Acquire a mutex which was found to be held, without touching its counters.
+Return the number of times the caller slept.
+
+@param mutex: The mutex.
+*/
+static uint64_t acquire_contended(mutex_t *mutex) {
+	// Spin for up to twice as long as recent acquisitions needed to.
+	unsigned average = atomic_load_explicit(&mutex->spins, memory_order_relaxed);
+	unsigned limit = average * 2 + MUTEX_MIN_SPINS;
+	if (limit > MUTEX_MAX_SPINS) {
+		limit = MUTEX_MAX_SPINS;
+	}
+
+	uint64_t sleeps = 0;
+	unsigned spins = 0;
+	for (; spins < limit; spins++) {
+		cpu_relax();
+		unsigned state = atomic_load_explicit(&mutex->state, memory_order_relaxed);
+		if (state == MUTEX_UNLOCKED && atomic_compare_exchange_weak_explicit(&mutex->state,
+				&state, MUTEX_LOCKED, memory_order_acquire, memory_order_relaxed)) {
+			break;
+		}
+	}
+
+	if (spins == limit) {
+		// Mark the lock as contended, so that its holder knows to wake us.
+		// Having done so, we can't tell whether anyone else is still asleep,
+		// so the lock stays marked as contended once we hold it.
+		while (atomic_exchange_explicit(&mutex->state, MUTEX_CONTENDED,
+				memory_order_acquire) != MUTEX_UNLOCKED) {
+			futex_wait(&mutex->state, MUTEX_CONTENDED);
+			sleeps++;
+		}
+	}
+
+	// Only the holder updates the average (although waiters read it).
+	atomic_store_explicit(&mutex->spins, average + ((int)spins - (int)average) / 8,
+		memory_order_relaxed);
+	return sleeps;
+}
+
+/*
+Acquire a mutex without touching its counters.
+
+@param mutex: The mutex.
+*/
+static void acquire(mutex_t *mutex) {
+	if (!try_acquire(mutex)) {
+		acquire_contended(mutex);
+	}
+}
+
+static void release(mutex_t *mutex) {
+	if (atomic_exchange_explicit(&mutex->state, MUTEX_UNLOCKED,
+			memory_order_release) == MUTEX_CONTENDED) {
+		futex_wake(&mutex->state);
+	}
+}
+
+void mutex_acquire(mutex_t *mutex) {
+	d_lock_stats_t *stats = &mutex->stats;
+	if (try_acquire(mutex)) {
+		stats->acquisitions++;
+		mutex->acquired_at = read_cycles();
+		return;
+	}
+
+	uint64_t start = read_cycles();
+	uint64_t sleeps = acquire_contended(mutex);
+	uint64_t now = read_cycles();
+	uint64_t wait = now - start;
+	stats->acquisitions++;
+	stats->contended++;
+	stats->sleeps += sleeps;
+	stats->wait_cycles += wait;
+	if (wait > stats->max_wait_cycles) {
+		stats->max_wait_cycles = wait;
+	}
+	mutex->acquired_at = now;
+}
+
+void mutex_release(mutex_t *mutex) {
+	uint64_t hold = read_cycles() - mutex->acquired_at;
+	d_lock_stats_t *stats = &mutex->stats;
+	stats->hold_cycles += hold;
+	if (hold > stats->max_hold_cycles) {
+		stats->max_hold_cycles = hold;
+	}
+	release(mutex);
+}
+
+void mutex_get_stats(mutex_t *mutex, d_lock_stats_t *stats) {
+	acquire(mutex);
+	*stats = mutex->stats;
+	release(mutex);
+}
+
+void mutex_reset_stats(mutex_t *mutex) {
+	acquire(mutex);
+	memset(&mutex->stats, 0, sizeof(mutex->stats));
+	release(mutex);
+}
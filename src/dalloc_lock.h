@@ -0,0 +1,130 @@
+#ifndef _DALLOC_LOCK_H_
+#define _DALLOC_LOCK_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+A minimal spinlock. Critical sections guarded by this lock are expected
+to be very short (a handful of pointer updates).
+*/
+typedef struct {
+	atomic_bool locked;
+} lock_t;
+
+#define LOCK_INITIALIZER { false }
+
+/*
+Initialise a lock to the unlocked state.
+
+@param lock: The lock.
+*/
+void lock_init(lock_t *lock);
+
+/*
+Acquire a lock, spinning until it becomes available.
+
+@param lock: The lock.
+*/
+void lock_acquire(lock_t *lock);
+
+/*
+Release a lock previously acquired by the calling thread.
+
+@param lock: The lock.
+*/
+void lock_release(lock_t *lock);
+
+/*
+Contention counters for a mutex_t (see d_heap_get_lock_stats()). Times
+are in the units of read_cycles(): TSC cycles on x86, nanoseconds
+elsewhere.
+*/
+typedef struct {
+	// Number of times the lock was acquired.
+	uint64_t acquisitions;
+	// Number of acquisitions which found the lock already held.
+	uint64_t contended;
+	// Number of times a waiter went to sleep on the futex.
+	uint64_t sleeps;
+	// Total and longest time spent waiting for the lock.
+	uint64_t wait_cycles;
+	uint64_t max_wait_cycles;
+	// Total and longest time the lock was held for.
+	uint64_t hold_cycles;
+	uint64_t max_hold_cycles;
+} d_lock_stats_t;
+
+/*
+An adaptive lock for critical sections which may be long (e.g. a search of
+the heap). A contended acquisition spins for a while, then sleeps on a
+futex until the holder wakes it, so waiters don't burn a CPU behind a
+descheduled holder. The number of spins adapts to how long recent
+acquisitions had to wait. Neither path goes through pthreads.
+
+The lock also keeps contention counters. These are only updated by the
+lock's holder, so they cost no atomic operations.
+*/
+typedef struct {
+	// 0: unlocked, 1: locked, 2: locked with (possible) sleeping waiters.
+	atomic_uint state;
+	// Running average of spins needed by contended acquisitions.
+	atomic_uint spins;
+	uint64_t acquired_at;
+	d_lock_stats_t stats;
+} mutex_t;
+
+#define MUTEX_INITIALIZER { 0, 0, 0, { 0 } }
+
+/*
+Initialise a mutex to the unlocked state, with zeroed counters.
+
+@param mutex: The mutex.
+*/
+void mutex_init(mutex_t *mutex);
+
+/*
+Acquire a mutex, spinning and then sleeping until it becomes available.
+
+@param mutex: The mutex.
+*/
+void mutex_acquire(mutex_t *mutex);
+
+/*
+Release a mutex previously acquired by the calling thread, waking a
+sleeping waiter if there is one.
+
+@param mutex: The mutex.
+*/
+void mutex_release(mutex_t *mutex);
+
+/*
+Copy a mutex's contention counters. The copy itself isn't counted.
+
+@param mutex: The mutex.
+@param stats: Set to the counters.
+*/
+void mutex_get_stats(mutex_t *mutex, d_lock_stats_t *stats);
+
+/*
+Zero a mutex's contention counters.
+
+@param mutex: The mutex.
+*/
+void mutex_reset_stats(mutex_t *mutex);
+
+/*
+Get the contention counters of the lock which serialises d_malloc() and
+friends on the heap.
+
+@param stats: Set to the counters.
+*/
+void d_heap_get_lock_stats(d_lock_stats_t *stats);
+
+/*
+Zero the heap lock's contention counters.
+*/
+void d_heap_reset_lock_stats();
+
+#endif // _DALLOC_LOCK_H_
@@ -0,0 +1,208 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dalloc_io.h"
+#include "dalloc_io_internal.h"
+#include "dalloc_lock.h"
+#include "dalloc_log_async.h"
+#include "dalloc_os.h"
+#include "dalloc_thread_block.h"
+
+// Number of messages which can be buffered by each thread.
+#define LOG_RING_SLOTS 64
+
+// Maximum length of a log message, including the trailing newline. Longer
+// messages are truncated.
+#define LOG_RECORD_SIZE 256
+
+// Interval between drains by the background thread.
+#define LOG_DRAIN_INTERVAL_NS (10 * 1000 * 1000)
+
+typedef struct {
+	size_t len;
+	char text[LOG_RECORD_SIZE];
+} log_record_t;
+
+/*
+A single-producer, single-consumer ring buffer of formatted log messages.
+The producer is the thread which owns the ring; the consumer is whoever
+holds the drain lock. A ring released by a thread which has exited may
+still hold records, which are drained as usual.
+*/
+typedef struct {
+	thread_block_t header;
+	// Index of the next record to be written (only written by the owner).
+	atomic_size_t head;
+	// Index of the next record to be drained (only written by the drainer).
+	atomic_size_t tail;
+	// Number of messages dropped because the ring was full.
+	atomic_size_t dropped;
+	log_record_t records[LOG_RING_SLOTS];
+} log_ring_t;
+
+static atomic_bool enabled = false;
+static int log_fd = -1;
+
+static thread_block_list_t rings = THREAD_BLOCK_LIST_INITIALIZER(log_ring_t, NULL);
+static lock_t drain_lock = LOCK_INITIALIZER;
+
+static atomic_bool drainer_running = false;
+static bool has_drainer = false;
+static pthread_t drainer;
+
+static _Thread_local log_ring_t *thread_ring = NULL;
+
+// The timestamp is only reformatted when the second changes.
+static _Thread_local int64_t cached_second = -1;
+static _Thread_local char cached_timestamp[DALLOC_TIMESTAMP_LEN];
+
+/*
+Get the calling thread's ring. Return NULL on failure.
+*/
+static log_ring_t *get_thread_ring() {
+	if (!thread_ring) {
+		thread_ring = (log_ring_t *)thread_block_get(&rings);
+	}
+	return thread_ring;
+}
+
+/*
+Return the current time as a formatted timestamp.
+*/
+static const char *get_cached_timestamp() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	if (now.tv_sec != cached_second) {
+		format_timestamp(now.tv_sec, cached_timestamp);
+		cached_second = now.tv_sec;
+	}
+	return cached_timestamp;
+}
+
+/*
+Write the contents of all ring buffers to the log file descriptor,
+batching messages into as few write() calls as possible.
+*/
+static void drain_rings() {
+	char buf[4096];
+	size_t len = 0;
+
+	lock_acquire(&drain_lock);
+	thread_block_t *block = thread_block_first(&rings);
+	for (; block; block = block->next) {
+		log_ring_t *ring = (log_ring_t *)block;
+		size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		for (; tail != head; tail++) {
+			log_record_t *record = &ring->records[tail % LOG_RING_SLOTS];
+			if (len + record->len > sizeof(buf)) {
+				os_write_all(log_fd, buf, len);
+				len = 0;
+			}
+			memcpy(buf + len, record->text, record->len);
+			len += record->len;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+		size_t dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+		if (dropped) {
+			if (len + LOG_RECORD_SIZE > sizeof(buf)) {
+				os_write_all(log_fd, buf, len);
+				len = 0;
+			}
+			len += format_string(buf + len, LOG_RECORD_SIZE, "dalloc %s WARNING: %zu log messages dropped\n",
+				get_cached_timestamp(), dropped);
+		}
+	}
+
+	if (len) {
+		os_write_all(log_fd, buf, len);
+	}
+	lock_release(&drain_lock);
+}
+
+static void *drain_thread(void *arg) {
+	struct timespec interval = { 0, LOG_DRAIN_INTERVAL_NS };
+	while (atomic_load(&drainer_running)) {
+		drain_rings();
+		nanosleep(&interval, NULL);
+	}
+	return NULL;
+}
+
+bool async_logging_enabled() {
+	return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+void async_log_message(int log_level, const char *fmt, va_list args) {
+	log_ring_t *ring = get_thread_ring();
+	if (!ring) {
+		return;
+	}
+
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail >= LOG_RING_SLOTS) {
+		// Never block the caller - this may be the allocation path.
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	// The messsage will look like:
+	//
+	// dalloc 2022-01-31 10:30:00 ERROR: <msg>\n
+	log_record_t *record = &ring->records[head % LOG_RING_SLOTS];
+	char msg_type[DALLOC_MSG_TYPE_LEN];
+	get_msg_type(log_level, msg_type);
+	size_t len = format_string(record->text, LOG_RECORD_SIZE, "dalloc %s %s: ", get_cached_timestamp(), msg_type);
+
+	// Leave room for the newline.
+	len += format_message(record->text + len, LOG_RECORD_SIZE - len - 1, fmt, args);
+	record->text[len++] = '\n';
+	record->len = len;
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+bool start_async_logging(int fd, bool background) {
+	stop_async_logging();
+
+	log_fd = fd;
+	if (background) {
+		atomic_store(&drainer_running, true);
+		if (pthread_create(&drainer, NULL, drain_thread, NULL) != 0) {
+			atomic_store(&drainer_running, false);
+			return false;
+		}
+		has_drainer = true;
+	}
+	atomic_store(&enabled, true);
+	return true;
+}
+
+void flush_log() {
+	if (async_logging_enabled()) {
+		drain_rings();
+	}
+}
+
+void stop_async_logging() {
+	if (!async_logging_enabled()) {
+		return;
+	}
+
+	if (has_drainer) {
+		atomic_store(&drainer_running, false);
+		pthread_join(drainer, NULL);
+		has_drainer = false;
+	}
+	drain_rings();
+	atomic_store(&enabled, false);
+}
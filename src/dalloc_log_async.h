@@ -0,0 +1,21 @@
+#ifndef _DALLOC_LOG_ASYNC_H_
+#define _DALLOC_LOG_ASYNC_H_
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+/*
+Check whether the asynchronous logging backend is in use.
+*/
+bool async_logging_enabled();
+
+/*
+Format a log message into the calling thread's ring buffer.
+
+@param log_level: Log level (error/warning/...).
+@param fmt: printf-style format string.
+@param args: Arguments for the format string.
+*/
+void async_log_message(int log_level, const char *fmt, va_list args);
+
+#endif // _DALLOC_LOG_ASYNC_H_
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "dalloc_numa.h"
+#include "dalloc_os.h"
+#include "dalloc_utils.h"
+
+// Memory policies from <linux/mempolicy.h> (which may not be installed).
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_INTERLEAVE 3
+
+// Number of nodes reported by the kernel, or 0 if not yet read.
+static size_t detected_nodes = 0;
+
+// Node bound to the calling thread, or -1 if not yet looked up.
+static _Thread_local int32_t thread_node = -1;
+
+/*
+Read the number of online nodes from sysfs. The file holds a list of
+ranges (e.g. "0-1" or "0,2-3"); the count is the highest node id + 1.
+*/
+static size_t detect_nodes() {
+	size_t count = 1;
+	int fd = open("/sys/devices/system/node/online", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return count;
+	}
+	char buf[256];
+	ssize_t n = read(fd, buf, sizeof(buf));
+	close(fd);
+
+	size_t id = 0;
+	bool in_number = false;
+	for (ssize_t i = 0; i < n; i++) {
+		if (buf[i] >= '0' && buf[i] <= '9') {
+			id = (in_number ? id * 10 : 0) + (buf[i] - '0');
+			in_number = true;
+		} else {
+			in_number = false;
+		}
+		if (in_number && id + 1 > count) {
+			count = id + 1;
+		}
+	}
+	return count < DALLOC_NUMA_MAX_NODES ? count : DALLOC_NUMA_MAX_NODES;
+}
+
+/*
+Return the number of nodes reported by the kernel.
+*/
+static size_t real_num_nodes() {
+	if (!detected_nodes) {
+		detected_nodes = detect_nodes();
+	}
+	return detected_nodes;
+}
+
+size_t numa_num_nodes() {
+	size_t fake = numa_nodes();
+	if (fake) {
+		return fake < DALLOC_NUMA_MAX_NODES ? fake : DALLOC_NUMA_MAX_NODES;
+	}
+	return real_num_nodes();
+}
+
+void d_numa_set_thread_node(uint32_t node) {
+	thread_node = node % numa_num_nodes();
+}
+
+uint32_t numa_thread_node() {
+	if (thread_node < 0) {
+		unsigned cpu = 0, node = 0;
+		if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+			cpu = node = 0;
+		}
+		thread_node = numa_nodes() ? cpu % numa_num_nodes() : node;
+	}
+	// The node count may have been reconfigured since.
+	return (uint32_t)thread_node % numa_num_nodes();
+}
+
+/*
+Apply a memory policy to the whole pages of a region. Return false on
+failure.
+*/
+static bool set_policy(void *ptr, size_t size, int mode, unsigned long mask) {
+	uintptr_t start = align_up((uintptr_t)ptr, os_page_size());
+	uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(os_page_size() - 1);
+	if (end <= start) {
+		return true;
+	}
+	long res = syscall(SYS_mbind, (void *)start, end - start, mode, &mask,
+		sizeof(mask) * 8, 0);
+	if (res != 0) {
+		log_debug("mbind() failed for %zu bytes at %p", end - start, (void *)start);
+		return false;
+	}
+	return true;
+}
+
+void numa_bind(void *ptr, size_t size, uint32_t node) {
+	if (numa_nodes() || real_num_nodes() < 2) {
+		return;
+	}
+	set_policy(ptr, size, NUMA_MPOL_PREFERRED, 1UL << node);
+}
+
+void numa_interleave(void *ptr, size_t size) {
+	if (numa_nodes() || real_num_nodes() < 2) {
+		return;
+	}
+	_Static_assert(DALLOC_NUMA_MAX_NODES < 64, "node masks are a single unsigned long");
+	set_policy(ptr, size, NUMA_MPOL_INTERLEAVE, (1UL << real_num_nodes()) - 1);
+}
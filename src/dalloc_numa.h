@@ -0,0 +1,54 @@
+#ifndef _DALLOC_NUMA_H_
+#define _DALLOC_NUMA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of NUMA nodes with their own arenas. Nodes beyond this
+// share arenas (node ids are taken modulo this value).
+#define DALLOC_NUMA_MAX_NODES 16
+
+/*
+Bind the calling thread to a NUMA node's arenas, overriding the node it's
+running on. Useful for threads which are pinned to a node but start on
+another CPU, or to fake a topology in tests.
+
+@param node: The node. Taken modulo the number of nodes.
+*/
+void d_numa_set_thread_node(uint32_t node);
+
+/*
+Return the number of NUMA nodes: the fake node count if one is configured
+(see set_numa_nodes()), otherwise the number of nodes the kernel reports
+(at least 1, at most DALLOC_NUMA_MAX_NODES).
+*/
+size_t numa_num_nodes();
+
+/*
+Return the node whose arenas the calling thread uses. This is looked up
+(with getcpu()) on the thread's first call, and cached. With a fake
+topology, CPUs are assigned to nodes round-robin.
+*/
+uint32_t numa_thread_node();
+
+/*
+Prefer to place the pages of a region on a node. This is a noop on
+single-node machines and with a fake topology, where first-touch
+placement applies.
+
+@param ptr: Start of the region.
+@param size: Size of the region in bytes.
+@param node: The node.
+*/
+void numa_bind(void *ptr, size_t size, uint32_t node);
+
+/*
+Interleave the pages of a region across all nodes. This is a noop on
+single-node machines and with a fake topology.
+
+@param ptr: Start of the region.
+@param size: Size of the region in bytes.
+*/
+void numa_interleave(void *ptr, size_t size);
+
+#endif // _DALLOC_NUMA_H_
@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "dalloc_io.h"
+#include "dalloc_os.h"
+#include "dalloc_probes.h"
+#include "dalloc_utils.h"
+
+// Huge page size assumed if the kernel doesn't report one.
+#define OS_DEFAULT_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+size_t os_page_size() {
+	static size_t page_size = 0;
+	if (!page_size) {
+		page_size = (size_t)sysconf(_SC_PAGESIZE);
+	}
+	return page_size;
+}
+
+void *os_map(size_t size) {
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		// errno is set by mmap.
+		return NULL;
+	}
+	usdt_probe2(mmap, ptr, size);
+	return ptr;
+}
+
+void *os_map_aligned(size_t size, size_t alignment) {
+	if (alignment <= os_page_size()) {
+		return os_map(size);
+	}
+
+	// Over-allocate by the alignment, then trim the excess from both ends
+	// of the mapping.
+	size_t mapped_size = size + alignment;
+	void *mapped = os_map(mapped_size);
+	if (!mapped) {
+		return NULL;
+	}
+
+	uintptr_t start = (uintptr_t)mapped;
+	uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	size_t head = aligned - start;
+	size_t tail = mapped_size - head - size;
+	if (head) {
+		os_unmap(mapped, head);
+	}
+	if (tail) {
+		os_unmap((void *)(aligned + size), tail);
+	}
+	return (void *)aligned;
+}
+
+void os_unmap(void *ptr, size_t size) {
+	if (munmap(ptr, size) != 0) {
+		log_warning("munmap() failed to release %zu bytes at %p", size, ptr);
+		return;
+	}
+	usdt_probe2(munmap, ptr, size);
+}
+
+size_t os_huge_page_size() {
+	static size_t huge_page_size = 0;
+	if (huge_page_size) {
+		return huge_page_size;
+	}
+
+	size_t size = 0;
+	int fd = open("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		char buf[32];
+		ssize_t n = read(fd, buf, sizeof(buf));
+		for (ssize_t i = 0; i < n && buf[i] >= '0' && buf[i] <= '9'; i++) {
+			size = size * 10 + (buf[i] - '0');
+		}
+		close(fd);
+	}
+	if (!is_power_of_two(size) || size < os_page_size()) {
+		size = OS_DEFAULT_HUGE_PAGE_SIZE;
+	}
+	huge_page_size = size;
+	return huge_page_size;
+}
+
+void os_advise_huge(void *ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+	uintptr_t start = align_up((uintptr_t)ptr, os_page_size());
+	uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(os_page_size() - 1);
+	if (end > start && madvise((void *)start, end - start, MADV_HUGEPAGE) != 0) {
+		log_debug("madvise(MADV_HUGEPAGE) failed for %zu bytes at %p", end - start, (void *)start);
+	}
+#endif
+}
+
+void *os_map_huge(size_t size, bool hugetlb) {
+#ifdef MAP_HUGETLB
+	if (hugetlb) {
+		void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			usdt_probe2(mmap, ptr, size);
+			return ptr;
+		}
+		log_debug("MAP_HUGETLB mapping of %zu bytes failed; using transparent huge pages", size);
+	}
+#endif
+
+	void *ptr = os_map_aligned(size, os_huge_page_size());
+	if (ptr) {
+		os_advise_huge(ptr, size);
+	}
+	return ptr;
+}
+
+size_t os_purge(void *ptr, size_t size, size_t alignment) {
+	uintptr_t start = align_up((uintptr_t)ptr, alignment);
+	uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(alignment - 1);
+	if (end <= start) {
+		return 0;
+	}
+	if (madvise((void *)start, end - start, MADV_DONTNEED) != 0) {
+		log_debug("madvise(MADV_DONTNEED) failed for %zu bytes at %p", end - start, (void *)start);
+		return 0;
+	}
+	usdt_probe2(purge, start, end - start);
+	return end - start;
+}
+
+bool os_write_all(int fd, const void *buf, size_t len) {
+	size_t written = 0;
+	while (written < len) {
+		ssize_t n = write(fd, buf + written, len - written);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		written += n;
+	}
+	return true;
+}
@@ -0,0 +1,91 @@
+#ifndef _DALLOC_OS_H_
+#define _DALLOC_OS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+Return the size of a page of virtual memory.
+*/
+size_t os_page_size();
+
+/*
+Map a region of anonymous, zero-filled memory. Return NULL on failure.
+
+@param size: Size of the region in bytes. Should be a multiple of the
+			 page size.
+*/
+void *os_map(size_t size);
+
+/*
+Map a region of anonymous, zero-filled memory whose start address is a
+multiple of the given alignment. Return NULL on failure.
+
+@param size: Size of the region in bytes. Should be a multiple of the
+			 page size.
+@param alignment: Required alignment of the region. Must be a power of
+				  two and a multiple of the page size.
+*/
+void *os_map_aligned(size_t size, size_t alignment);
+
+/*
+Return a region of memory previously mapped with os_map() or
+os_map_aligned() to the OS.
+
+@param ptr: Start address of the region.
+@param size: Size of the region in bytes.
+*/
+void os_unmap(void *ptr, size_t size);
+
+/*
+Return the size of a (PMD-level) huge page.
+*/
+size_t os_huge_page_size();
+
+/*
+Ask the kernel to back a region with transparent huge pages where
+possible. Only the whole pages within the region are advised.
+
+@param ptr: Start address of the region.
+@param size: Size of the region in bytes.
+*/
+void os_advise_huge(void *ptr, size_t size);
+
+/*
+Map a region of anonymous, zero-filled memory backed by huge pages, and
+aligned to the huge page size. If `hugetlb` is set, reserved huge pages
+are requested with MAP_HUGETLB first; otherwise (or if that fails) the
+region is backed by transparent huge pages. Return NULL on failure.
+
+@param size: Size of the region in bytes. Must be a multiple of the huge
+			 page size.
+@param hugetlb: Whether to request reserved huge pages.
+*/
+void *os_map_huge(size_t size, bool hugetlb);
+
+/*
+Return the whole pages within a region to the OS, without unmapping them.
+The region reads as zeroes the next time it's touched.
+
+@param ptr: Start address of the region.
+@param size: Size of the region in bytes.
+@param alignment: Only pages aligned to (and whole multiples of) this
+				  alignment are purged, so that huge pages aren't split.
+				  Must be a multiple of the page size.
+
+Return the number of bytes purged.
+*/
+size_t os_purge(void *ptr, size_t size, size_t alignment);
+
+/*
+Write a buffer in full, retrying after interruptions and partial writes.
+This only calls write(2), so it's safe to use from a signal handler.
+Return false on error.
+
+@param fd: The file descriptor.
+@param buf: The buffer.
+@param len: Number of bytes to be written.
+*/
+bool os_write_all(int fd, const void *buf, size_t len);
+
+#endif // _DALLOC_OS_H_
@@ -0,0 +1,244 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chunk.h"
+#include "dalloc_config.h"
+#include "dalloc_free_index.h"
+#include "dalloc_heap_traversal.h"
+#include "dalloc_placement.h"
+#include "dalloc_search_stats.h"
+#include "dalloc_utils.h"
+
+// The policy which the index and rover were built for. If the configured
+// policy differs, they're rebuilt by the next search.
+static int active_policy = DALLOC_PLACEMENT_FIRST_FIT;
+
+// Next fit: the last chunk allocated. The next search starts after it.
+static chunk_t *rover = NULL;
+
+// First fit: unused chunks are in the free chunk index (see
+// dalloc_free_index.h).
+
+// Best fit and LIFO: unused chunks, in one list per size class (see
+// size_class()), most recently freed first. Bit n of nonempty_bins is set
+// iff bins[n] isn't empty.
+static chunk_t *bins[DALLOC_NUM_SIZE_CLASSES];
+static uint64_t nonempty_bins = 0;
+
+static free_links_t *links(chunk_t *chunk) {
+	return (free_links_t *)chunk->start;
+}
+
+static bool is_indexed(int policy) {
+	return policy == DALLOC_PLACEMENT_BEST_FIT || policy == DALLOC_PLACEMENT_LIFO;
+}
+
+size_t placement_min_size(int policy) {
+	return is_indexed(policy) ? PLACEMENT_MIN_FREE : 1;
+}
+
+chunk_t *placement_prev(chunk_t *start, chunk_t *tail, chunk_t *chunk) {
+	if (chunk == tail) {
+		return prev(chunk, NULL);
+	}
+	if (!chunk->gap_after) {
+		return prev(chunk, (chunk_t *)(chunk->start + chunk->size));
+	}
+
+	chunk_t *prv = NULL;
+	find_chunk(start, chunk->start, &prv);
+	return prv;
+}
+
+void placement_insert(chunk_t *chunk) {
+	if (active_policy == DALLOC_PLACEMENT_FIRST_FIT) {
+		free_index_insert(chunk);
+		return;
+	}
+	if (!is_indexed(active_policy) || chunk->size < PLACEMENT_MIN_FREE) {
+		// Chunks too small to hold links are never reused by indexed
+		// policies (until they're merged at the top of the heap).
+		return;
+	}
+
+	uint32_t class = size_class(chunk->size);
+	free_links_t *l = links(chunk);
+	l->prev = NULL;
+	l->next = bins[class];
+	if (bins[class]) {
+		links(bins[class])->prev = chunk;
+	}
+	bins[class] = chunk;
+	nonempty_bins |= 1ull << class;
+	chunk->indexed = true;
+}
+
+void placement_remove(chunk_t *chunk) {
+	// Chunks which are being allocated are marked in use first. Any other
+	// chunk is being absorbed into its neighbour or released, so the rover
+	// mustn't point at it.
+	if (chunk == rover && !chunk->in_use) {
+		rover = NULL;
+	}
+	if (!chunk->indexed) {
+		return;
+	}
+	if (active_policy == DALLOC_PLACEMENT_FIRST_FIT) {
+		free_index_remove(chunk);
+		return;
+	}
+
+	uint32_t class = size_class(chunk->size);
+	free_links_t *l = links(chunk);
+	if (l->prev) {
+		links(l->prev)->next = l->next;
+	} else {
+		bins[class] = l->next;
+		if (!l->next) {
+			nonempty_bins &= ~(1ull << class);
+		}
+	}
+	if (l->next) {
+		links(l->next)->prev = l->prev;
+	}
+	chunk->indexed = false;
+}
+
+/*
+Visitor which re-indexes a chunk for the active policy.
+*/
+static bool reindex_chunk(const chunk_t *chunk, void *user_data) {
+	chunk_t *c = (chunk_t *)chunk;
+	c->indexed = false;
+	if (!c->in_use) {
+		placement_insert(c);
+	}
+	return true;
+}
+
+/*
+Discard the state of the active policy, and build the state of the
+configured policy.
+
+@param start: The first chunk in the heap.
+*/
+static void switch_policy(chunk_t *start) {
+	active_policy = placement_policy();
+	rover = NULL;
+	for (size_t i = 0; i < DALLOC_NUM_SIZE_CLASSES; i++) {
+		bins[i] = NULL;
+	}
+	nonempty_bins = 0;
+	free_index_clear();
+	if (start) {
+		for_each(start, reindex_chunk, NULL);
+	}
+}
+
+/*
+Next fit: search from just after the last chunk allocated to the end of
+the heap, then wrap around to the start.
+*/
+static chunk_t *find_next_fit(chunk_t *start, chunk_t *tail, size_t size, chunk_t **prev) {
+	chunk_t *prv = NULL;
+	chunk_t *chunk = start;
+	if (rover) {
+		chunk = next(rover, placement_prev(start, tail, rover));
+		prv = rover;
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		while (chunk) {
+			search_visit();
+			if (!chunk->in_use && chunk->size >= size) {
+				*prev = prv;
+				rover = chunk;
+				return chunk;
+			}
+			if (pass == 1 && chunk == rover) {
+				break;
+			}
+			chunk_t *nxt = next(chunk, prv);
+			prv = chunk;
+			chunk = nxt;
+		}
+		if (!rover) {
+			// The first pass started at the start of the heap.
+			break;
+		}
+		chunk = start;
+		prv = NULL;
+	}
+
+	*prev = NULL;
+	return NULL;
+}
+
+/*
+Search one bin. For best fit, return the smallest chunk which can store
+`size` bytes (stopping early at an exact fit); for LIFO, return the first.
+
+@param bin: The bin.
+@param size: The required size.
+*/
+static chunk_t *search_bin(chunk_t *bin, size_t size) {
+	chunk_t *found = NULL;
+	for (chunk_t *chunk = bin; chunk; chunk = links(chunk)->next) {
+		search_visit();
+		if (chunk->size < size) {
+			continue;
+		}
+		if (active_policy == DALLOC_PLACEMENT_LIFO || chunk->size == size) {
+			return chunk;
+		}
+		if (!found || chunk->size < found->size) {
+			found = chunk;
+		}
+	}
+	return found;
+}
+
+/*
+Best fit and LIFO: chunks in the request's own size class may be too
+small, so that bin is searched first. Failing that, every chunk in a larger
+class fits, so only the first nonempty larger class is searched.
+*/
+static chunk_t *find_indexed(size_t size) {
+	uint32_t class = size_class(size);
+	chunk_t *chunk = search_bin(bins[class], size);
+	if (chunk) {
+		return chunk;
+	}
+
+	uint64_t larger = class + 1 < DALLOC_NUM_SIZE_CLASSES ? nonempty_bins & (~0ull << (class + 1)) : 0;
+	if (!larger) {
+		return NULL;
+	}
+	return search_bin(bins[__builtin_ctzll(larger)], size);
+}
+
+chunk_t *placement_find(chunk_t *start, chunk_t *tail, size_t size, chunk_t **prev) {
+	if (placement_policy() != active_policy || free_index_should_rebuild()) {
+		switch_policy(start);
+	}
+
+	chunk_t *chunk;
+	switch (active_policy) {
+		case DALLOC_PLACEMENT_NEXT_FIT:
+			return find_next_fit(start, tail, size, prev);
+		case DALLOC_PLACEMENT_BEST_FIT:
+		case DALLOC_PLACEMENT_LIFO:
+			chunk = find_indexed(size);
+			*prev = chunk ? placement_prev(start, tail, chunk) : NULL;
+			return chunk;
+		default:
+			if (free_index_overflowed()) {
+				*prev = NULL;
+				return find_unused_chunk_first(start, size, prev);
+			}
+			chunk = free_index_first_fit(size);
+			*prev = chunk ? placement_prev(start, tail, chunk) : NULL;
+			return chunk;
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef _DALLOC_PLACEMENT_H_
+#define _DALLOC_PLACEMENT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chunk.h"
+
+/*
+Links stored in the memory of each indexed free chunk.
+*/
+typedef struct {
+	chunk_t *next;
+	chunk_t *prev;
+} free_links_t;
+
+// Minimum size of a chunk under an indexed placement policy, so that it can
+// hold its free list links.
+#define PLACEMENT_MIN_FREE sizeof(free_links_t)
+
+/*
+Return the minimum size of a chunk under a placement policy. Requests for
+less are rounded up to this.
+
+@param policy: The policy (one of the DALLOC_PLACEMENT_* constants).
+*/
+size_t placement_min_size(int policy);
+
+/*
+Return the chunk before a chunk in the heap, without walking the heap in
+the common case where the chunk's successor is contiguous with it.
+
+@param start: The first chunk in the heap.
+@param tail: The last chunk in the heap.
+@param chunk: The chunk.
+*/
+chunk_t *placement_prev(chunk_t *start, chunk_t *tail, chunk_t *chunk);
+
+/*
+Find an unused chunk which can store `size` bytes, according to the
+configured placement policy (see set_placement_policy()). Return NULL if
+there's no such chunk.
+
+@param start: The first chunk in the heap.
+@param tail: The last chunk in the heap.
+@param size: The required size.
+@param prev: (out parameter): set to the chunk before the returned chunk.
+*/
+chunk_t *placement_find(chunk_t *start, chunk_t *tail, size_t size, chunk_t **prev);
+
+/*
+Record that a chunk has become unused, or that an unused chunk has
+changed size (in which case placement_remove() must have been called
+first).
+
+@param chunk: The chunk.
+*/
+void placement_insert(chunk_t *chunk);
+
+/*
+Record that an unused chunk is about to be allocated, resized or removed
+from the heap.
+
+@param chunk: The chunk.
+*/
+void placement_remove(chunk_t *chunk);
+
+#endif // _DALLOC_PLACEMENT_H_
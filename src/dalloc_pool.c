@@ -0,0 +1,666 @@
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "dalloc_lock.h"
+#include "dalloc_numa.h"
+#include "dalloc_os.h"
+#include "dalloc_pool.h"
+#include "dalloc_remote_free.h"
+#include "dalloc_utils.h"
+
+// Minimum size of the slabs from which objects are carved.
+#define POOL_MIN_SLAB_SIZE (64 * 1024)
+
+// Minimum number of objects in each slab.
+#define POOL_MIN_OBJS_PER_SLAB 8
+
+// Maximum number of pools which may have a thread cache at any one time.
+// Slots are tracked in a 64-bit bitmap.
+#define POOL_TCACHE_SLOTS 64
+
+/*
+Header at the start of every slab. Slabs are aligned to their size, so the
+slab containing an object can be found by masking the object's address.
+*/
+typedef struct pool_slab {
+	d_pool_t *pool;
+	struct pool_slab *next;
+	// NUMA node the slab was allocated for. Its objects are only ever
+	// returned to this node's free list.
+	uint32_t node;
+} pool_slab_t;
+
+/*
+The first word of each free object links to the next free object.
+*/
+typedef struct pool_obj {
+	struct pool_obj *next;
+} pool_obj_t;
+
+/*
+A thread's cache of free objects for one pool.
+*/
+typedef struct {
+	// Id of the pool which owns the cached objects. If this doesn't match
+	// the pool which is using the slot, the cache is stale (its pool has
+	// been destroyed) and must be discarded.
+	uint64_t pool_id;
+	pool_obj_t *head;
+	size_t count;
+} pool_tcache_t;
+
+/*
+A pool's free objects on one NUMA node. Threads take objects from their own
+node's list, so objects are handed out from memory local to the thread.
+*/
+typedef struct {
+	lock_t lock;
+	pool_obj_t *free_list;
+	size_t num_free;
+} pool_node_t;
+
+struct d_pool {
+	uint64_t id;
+
+	// Distance between consecutive objects in a slab.
+	size_t obj_size;
+	size_t slab_size;
+	// Offset of the first object from the start of a slab.
+	size_t first_offset;
+	size_t objs_per_slab;
+
+	// Guards the slab list.
+	lock_t lock;
+	pool_slab_t *slabs;
+
+	// Shared free lists, one per NUMA node. The node count is fixed when
+	// the pool is created.
+	size_t num_nodes;
+	pool_node_t nodes[DALLOC_NUMA_MAX_NODES];
+
+	// Whether slabs are carved from shared huge page regions (see
+	// map_slab()), rather than mapped individually.
+	bool huge_slabs;
+
+	// Index of this pool's thread cache slot, or -1 if disabled.
+	int32_t tcache_slot;
+	size_t tcache_capacity;
+
+	// Token of the owning thread, or NULL if the pool isn't owned. Only
+	// the owner touches the free lists of an owned pool, and only uses
+	// its own node's list; other threads return objects via the remote
+	// free list.
+	const void *owner;
+	uint32_t owner_node;
+	remote_free_list_t remote;
+};
+
+static _Atomic uint64_t next_pool_id = 1;
+static _Atomic uint64_t tcache_slots_in_use = 0;
+static _Thread_local pool_tcache_t tcaches[POOL_TCACHE_SLOTS];
+
+// The address of this variable identifies the calling thread.
+static _Thread_local char thread_token;
+
+// Slabs carved from huge page regions are packed together, so that hot
+// objects from many pools share a few huge pages. Such slabs are never
+// unmapped (which would split the huge pages): when their pool is
+// destroyed, they're kept for reuse, in a free list per slab size.
+//
+// Each node has its own region and free lists, so that a huge page only
+// ever holds one node's slabs and can be bound to that node as a whole.
+static lock_t huge_region_lock = LOCK_INITIALIZER;
+static void *huge_regions[DALLOC_NUMA_MAX_NODES];
+static size_t huge_region_used[DALLOC_NUMA_MAX_NODES];
+static pool_slab_t *free_huge_slabs[DALLOC_NUMA_MAX_NODES][DALLOC_NUM_SIZE_CLASSES];
+
+/*
+Map a slab for a pool on a node, aligned to the slab size. Return NULL on
+failure.
+
+@param pool: The pool.
+@param node: The node.
+*/
+static pool_slab_t *map_slab(d_pool_t *pool, uint32_t node) {
+	if (!pool->huge_slabs) {
+		pool_slab_t *slab = os_map_aligned(pool->slab_size, pool->slab_size);
+		if (slab) {
+			numa_bind(slab, pool->slab_size, node);
+		}
+		return slab;
+	}
+
+	uint32_t class = size_class(pool->slab_size);
+	size_t region_size = os_huge_page_size();
+	lock_acquire(&huge_region_lock);
+	pool_slab_t *slab = free_huge_slabs[node][class];
+	if (slab) {
+		free_huge_slabs[node][class] = slab->next;
+	} else {
+		// Huge regions are aligned to the huge page size, and slab sizes are
+		// powers of two no larger than it, so bumping the offset up to the
+		// slab size keeps the slab aligned.
+		size_t offset = align_up(huge_region_used[node], pool->slab_size);
+		if (!huge_regions[node] || offset + pool->slab_size > region_size) {
+			huge_regions[node] = os_map_huge(region_size, huge_pages() == DALLOC_HUGE_PAGES_HUGETLB);
+			offset = 0;
+			// Bind the region before any of it is touched.
+			if (huge_regions[node]) {
+				numa_bind(huge_regions[node], region_size, node);
+			}
+		}
+		if (huge_regions[node]) {
+			slab = huge_regions[node] + offset;
+			huge_region_used[node] = offset + pool->slab_size;
+		}
+	}
+	lock_release(&huge_region_lock);
+	return slab;
+}
+
+/*
+Release a slab mapped by map_slab().
+
+@param pool: The pool which owned the slab.
+@param slab: The slab.
+*/
+static void unmap_slab(d_pool_t *pool, pool_slab_t *slab) {
+	if (!pool->huge_slabs) {
+		os_unmap(slab, pool->slab_size);
+		return;
+	}
+
+	uint32_t class = size_class(pool->slab_size);
+	lock_acquire(&huge_region_lock);
+	slab->next = free_huge_slabs[slab->node][class];
+	free_huge_slabs[slab->node][class] = slab;
+	lock_release(&huge_region_lock);
+}
+
+/*
+Return the node whose free list the calling thread uses.
+
+@param pool: The pool.
+*/
+static uint32_t pool_thread_node(d_pool_t *pool) {
+	return numa_thread_node() % pool->num_nodes;
+}
+
+/*
+Return the slab containing an object.
+
+@param pool: The pool.
+@param obj: The object.
+*/
+static pool_slab_t *slab_of(d_pool_t *pool, void *obj) {
+	return (pool_slab_t *)((uintptr_t)obj & ~(uintptr_t)(pool->slab_size - 1));
+}
+
+/*
+Map a new slab on a node and push all of its objects onto the node's free
+list. Must be called with the node's lock held (or by the owner of an owned
+pool). Return false on failure.
+
+@param pool: The pool.
+@param node: The node.
+*/
+static bool pool_grow(d_pool_t *pool, uint32_t node) {
+	pool_slab_t *slab = map_slab(pool, node);
+	if (!slab) {
+		return false;
+	}
+	slab->pool = pool;
+	slab->node = node;
+	lock_acquire(&pool->lock);
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+	lock_release(&pool->lock);
+
+	// Push objects in reverse order, so that they're handed out in address
+	// order.
+	pool_node_t *pn = &pool->nodes[node];
+	void *first = (void *)slab + pool->first_offset;
+	for (size_t i = pool->objs_per_slab; i > 0; i--) {
+		pool_obj_t *obj = first + (i - 1) * pool->obj_size;
+		obj->next = pn->free_list;
+		pn->free_list = obj;
+	}
+	pn->num_free += pool->objs_per_slab;
+	return true;
+}
+
+/*
+Detach up to `count` objects from the calling thread's node's free list,
+growing the pool if the list is empty. Return the detached objects as a
+NULL-terminated chain, or NULL if the pool couldn't grow.
+
+@param pool: The pool.
+@param count: Maximum number of objects to detach. Must be nonzero.
+@param taken: (out parameter): set to the number of objects detached.
+*/
+static pool_obj_t *take_batch(d_pool_t *pool, size_t count, size_t *taken) {
+	uint32_t node = pool_thread_node(pool);
+	pool_node_t *pn = &pool->nodes[node];
+	lock_acquire(&pn->lock);
+	if (!pn->free_list && !pool_grow(pool, node)) {
+		lock_release(&pn->lock);
+		*taken = 0;
+		return NULL;
+	}
+
+	pool_obj_t *head = pn->free_list;
+	pool_obj_t *tail = head;
+	size_t n = 1;
+	while (n < count && tail->next) {
+		tail = tail->next;
+		n++;
+	}
+	pn->free_list = tail->next;
+	pn->num_free -= n;
+	lock_release(&pn->lock);
+
+	tail->next = NULL;
+	*taken = n;
+	return head;
+}
+
+/*
+Push a chain of objects from a single node onto that node's free list.
+
+@param pool: The pool.
+@param node: The node.
+@param head: First object in the chain.
+@param tail: Last object in the chain.
+@param count: Number of objects in the chain.
+*/
+static void give_node_batch(d_pool_t *pool, uint32_t node, pool_obj_t *head, pool_obj_t *tail, size_t count) {
+	pool_node_t *pn = &pool->nodes[node];
+	lock_acquire(&pn->lock);
+	tail->next = pn->free_list;
+	pn->free_list = head;
+	pn->num_free += count;
+	lock_release(&pn->lock);
+}
+
+/*
+Push a chain of objects onto the shared free lists. Each object goes back
+to the list of the node its slab was allocated for.
+
+@param pool: The pool.
+@param head: First object in the chain.
+@param tail: Last object in the chain.
+@param count: Number of objects in the chain.
+*/
+static void give_batch(d_pool_t *pool, pool_obj_t *head, pool_obj_t *tail, size_t count) {
+	if (pool->num_nodes == 1) {
+		give_node_batch(pool, 0, head, tail, count);
+		return;
+	}
+
+	// Split the chain into one chain per node.
+	pool_obj_t *heads[DALLOC_NUMA_MAX_NODES] = { NULL };
+	pool_obj_t *tails[DALLOC_NUMA_MAX_NODES];
+	size_t counts[DALLOC_NUMA_MAX_NODES] = { 0 };
+	tail->next = NULL;
+	while (head) {
+		pool_obj_t *obj = head;
+		head = obj->next;
+		uint32_t node = slab_of(pool, obj)->node;
+		if (!heads[node]) {
+			tails[node] = obj;
+		}
+		obj->next = heads[node];
+		heads[node] = obj;
+		counts[node]++;
+	}
+	for (uint32_t node = 0; node < pool->num_nodes; node++) {
+		if (heads[node]) {
+			give_node_batch(pool, node, heads[node], tails[node], counts[node]);
+		}
+	}
+}
+
+/*
+Return the calling thread's cache for a pool which has thread caching
+enabled.
+
+@param pool: The pool.
+*/
+static pool_tcache_t *thread_cache(d_pool_t *pool) {
+	pool_tcache_t *cache = &tcaches[pool->tcache_slot];
+	if (cache->pool_id != pool->id) {
+		// Any objects left in this slot belonged to a pool which has been
+		// destroyed, and were unmapped along with it.
+		cache->pool_id = pool->id;
+		cache->head = NULL;
+		cache->count = 0;
+	}
+	return cache;
+}
+
+/*
+Take an object from an owned pool. Must only be called by the owner.
+
+@param pool: The pool.
+*/
+static void *owned_get(d_pool_t *pool) {
+	pool_node_t *pn = &pool->nodes[pool->owner_node];
+	if (!pn->free_list) {
+		// Reclaim objects freed by other threads before growing the pool.
+		pool_obj_t *reclaimed = remote_free_drain(&pool->remote);
+		if (reclaimed) {
+			size_t count = 1;
+			for (pool_obj_t *obj = reclaimed; obj->next; obj = obj->next) {
+				count++;
+			}
+			pn->free_list = reclaimed;
+			pn->num_free += count;
+		} else if (!pool_grow(pool, pool->owner_node)) {
+			return NULL;
+		}
+	}
+
+	pool_obj_t *obj = pn->free_list;
+	pn->free_list = obj->next;
+	pn->num_free--;
+	return obj;
+}
+
+d_pool_t *d_pool_create(size_t obj_size, size_t align) {
+	if (align == 0) {
+		align = alignof(max_align_t);
+	}
+	if (!is_power_of_two(align)) {
+		log_warning("d_pool_create(): alignment %zu is not a power of two", align);
+		return NULL;
+	}
+	if (obj_size == 0) {
+		log_warning("d_pool_create(): object size must be nonzero");
+		return NULL;
+	}
+
+	// Free objects hold a link to the next free object, so every object
+	// must be large enough, and aligned well enough, to store a pointer.
+	if (align < alignof(pool_obj_t)) {
+		align = alignof(pool_obj_t);
+	}
+	if (obj_size < sizeof(pool_obj_t)) {
+		obj_size = sizeof(pool_obj_t);
+	}
+	if (obj_size > SIZE_MAX / 2 / POOL_MIN_OBJS_PER_SLAB - align) {
+		log_warning("d_pool_create(): object size %zu is too large", obj_size);
+		return NULL;
+	}
+	size_t stride = align_up(obj_size, align);
+	size_t first_offset = align_up(sizeof(pool_slab_t), align);
+
+	// Slab sizes must be a power of two so that an object's slab can be
+	// found by masking its address.
+	size_t slab_size = POOL_MIN_SLAB_SIZE;
+	while (slab_size < first_offset + POOL_MIN_OBJS_PER_SLAB * stride) {
+		slab_size <<= 1;
+	}
+
+	d_pool_t *pool = d_malloc(sizeof(d_pool_t));
+	if (!pool) {
+		return NULL;
+	}
+	pool->id = atomic_fetch_add(&next_pool_id, 1);
+	pool->obj_size = stride;
+	pool->slab_size = slab_size;
+	pool->first_offset = first_offset;
+	pool->objs_per_slab = (slab_size - first_offset) / stride;
+	pool->huge_slabs = huge_pages() != DALLOC_HUGE_PAGES_NONE && slab_size <= os_huge_page_size();
+	lock_init(&pool->lock);
+	pool->slabs = NULL;
+	pool->num_nodes = numa_num_nodes();
+	for (size_t i = 0; i < DALLOC_NUMA_MAX_NODES; i++) {
+		lock_init(&pool->nodes[i].lock);
+		pool->nodes[i].free_list = NULL;
+		pool->nodes[i].num_free = 0;
+	}
+	pool->tcache_slot = -1;
+	pool->tcache_capacity = 0;
+	pool->owner = NULL;
+	pool->owner_node = 0;
+	remote_free_init(&pool->remote);
+	if (pool_tcache_capacity()) {
+		// If all slots are in use, the pool works without a cache.
+		d_pool_enable_thread_cache(pool, pool_tcache_capacity());
+	}
+	return pool;
+}
+
+void *d_pool_get(d_pool_t *pool) {
+	if (pool->owner) {
+		if (pool->owner != &thread_token) {
+			panic("d_pool_get(): pool is owned by another thread");
+			return NULL;
+		}
+		return owned_get(pool);
+	}
+
+	size_t taken;
+	if (pool->tcache_slot < 0) {
+		return take_batch(pool, 1, &taken);
+	}
+
+	pool_tcache_t *cache = thread_cache(pool);
+	if (!cache->head) {
+		// Refill half of the cache, so that a thread alternating between
+		// get and put doesn't bounce objects to and from the shared list.
+		size_t refill = pool->tcache_capacity / 2;
+		cache->head = take_batch(pool, refill ? refill : 1, &taken);
+		cache->count = taken;
+		if (!cache->head) {
+			return NULL;
+		}
+	}
+
+	pool_obj_t *obj = cache->head;
+	cache->head = obj->next;
+	cache->count--;
+	return obj;
+}
+
+void d_pool_put(d_pool_t *pool, void *obj) {
+	if (!obj) {
+		return;
+	}
+
+	pool_slab_t *slab = slab_of(pool, obj);
+	if (slab->pool != pool) {
+		panic("d_pool_put(): object does not belong to this pool");
+		return;
+	}
+
+	pool_obj_t *freed = (pool_obj_t *)obj;
+	if (pool->owner) {
+		if (pool->owner == &thread_token) {
+			// The owner only uses its own node's list, wherever the object
+			// came from.
+			pool_node_t *pn = &pool->nodes[pool->owner_node];
+			freed->next = pn->free_list;
+			pn->free_list = freed;
+			pn->num_free++;
+		} else {
+			remote_free_push(&pool->remote, freed, pool->obj_size);
+		}
+		return;
+	}
+
+	if (pool->tcache_slot < 0) {
+		give_batch(pool, freed, freed, 1);
+		return;
+	}
+
+	pool_tcache_t *cache = thread_cache(pool);
+	freed->next = cache->head;
+	cache->head = freed;
+	cache->count++;
+
+	if (cache->count > pool->tcache_capacity) {
+		// Cache is full. Keep the most recently freed half of the cache
+		// (which is more likely to be hot) and return the rest to the
+		// shared free list.
+		size_t keep = pool->tcache_capacity / 2;
+		pool_obj_t *last_kept = NULL;
+		pool_obj_t *head = cache->head;
+		for (size_t i = 0; i < keep; i++) {
+			last_kept = head;
+			head = head->next;
+		}
+		pool_obj_t *tail = head;
+		while (tail->next) {
+			tail = tail->next;
+		}
+		if (last_kept) {
+			last_kept->next = NULL;
+		} else {
+			cache->head = NULL;
+		}
+		give_batch(pool, head, tail, cache->count - keep);
+		cache->count = keep;
+	}
+}
+
+bool d_pool_reserve(d_pool_t *pool, size_t count) {
+	uint32_t node = pool->owner ? pool->owner_node : pool_thread_node(pool);
+	pool_node_t *pn = &pool->nodes[node];
+	lock_acquire(&pn->lock);
+	while (pn->num_free < count) {
+		if (!pool_grow(pool, node)) {
+			lock_release(&pn->lock);
+			return false;
+		}
+	}
+	lock_release(&pn->lock);
+	return true;
+}
+
+bool d_pool_enable_thread_cache(d_pool_t *pool, size_t capacity) {
+	if (capacity == 0) {
+		log_warning("d_pool_enable_thread_cache(): capacity must be nonzero");
+		return false;
+	}
+	if (pool->tcache_slot >= 0) {
+		pool->tcache_capacity = capacity;
+		return true;
+	}
+
+	uint64_t in_use = atomic_load(&tcache_slots_in_use);
+	uint64_t slot;
+	do {
+		if (in_use == UINT64_MAX) {
+			log_info("d_pool_enable_thread_cache(): all %d thread cache slots are in use", POOL_TCACHE_SLOTS);
+			return false;
+		}
+		slot = __builtin_ctzll(~in_use);
+	} while (!atomic_compare_exchange_weak(&tcache_slots_in_use, &in_use, in_use | (1ull << slot)));
+
+	pool->tcache_slot = (int32_t)slot;
+	pool->tcache_capacity = capacity;
+	return true;
+}
+
+void d_pool_flush_thread_cache(d_pool_t *pool) {
+	if (pool->tcache_slot < 0 || pool->owner) {
+		return;
+	}
+
+	pool_tcache_t *cache = thread_cache(pool);
+	if (!cache->head) {
+		return;
+	}
+	pool_obj_t *tail = cache->head;
+	while (tail->next) {
+		tail = tail->next;
+	}
+	give_batch(pool, cache->head, tail, cache->count);
+	cache->head = NULL;
+	cache->count = 0;
+}
+
+void d_pool_set_owner(d_pool_t *pool) {
+	// Objects in the caller's thread cache would otherwise be stranded.
+	d_pool_flush_thread_cache(pool);
+
+	// The owner only uses its own node's list, so move every free object
+	// there.
+	uint32_t owner_node = pool_thread_node(pool);
+	pool_node_t *owned = &pool->nodes[owner_node];
+	lock_acquire(&owned->lock);
+	for (uint32_t node = 0; node < pool->num_nodes; node++) {
+		pool_node_t *pn = &pool->nodes[node];
+		if (node == owner_node || !pn->free_list) {
+			continue;
+		}
+		lock_acquire(&pn->lock);
+		pool_obj_t *tail = pn->free_list;
+		while (tail->next) {
+			tail = tail->next;
+		}
+		tail->next = owned->free_list;
+		owned->free_list = pn->free_list;
+		owned->num_free += pn->num_free;
+		pn->free_list = NULL;
+		pn->num_free = 0;
+		lock_release(&pn->lock);
+	}
+	pool->owner_node = owner_node;
+	pool->owner = &thread_token;
+	lock_release(&owned->lock);
+}
+
+void d_pool_get_stats(d_pool_t *pool, d_pool_stats_t *stats) {
+	lock_acquire(&pool->lock);
+	size_t num_slabs = 0;
+	for (pool_slab_t *slab = pool->slabs; slab; slab = slab->next) {
+		num_slabs++;
+	}
+	stats->num_slabs = num_slabs;
+	lock_release(&pool->lock);
+
+	stats->num_free = 0;
+	for (uint32_t node = 0; node < pool->num_nodes; node++) {
+		lock_acquire(&pool->nodes[node].lock);
+		stats->num_free += pool->nodes[node].num_free;
+		lock_release(&pool->nodes[node].lock);
+	}
+
+	stats->remote_frees = atomic_load_explicit(&pool->remote.num_frees, memory_order_relaxed);
+	stats->remote_free_bytes = atomic_load_explicit(&pool->remote.num_bytes, memory_order_relaxed);
+	stats->remote_drains = atomic_load_explicit(&pool->remote.num_drains, memory_order_relaxed);
+}
+
+void d_pool_destroy(d_pool_t *pool) {
+	if (!pool) {
+		return;
+	}
+
+	pool_slab_t *slab = pool->slabs;
+	while (slab) {
+		pool_slab_t *nxt = slab->next;
+		unmap_slab(pool, slab);
+		slab = nxt;
+	}
+
+	if (pool->tcache_slot >= 0) {
+		// Other threads' caches for this slot are discarded lazily, when
+		// their pool id no longer matches.
+		pool_tcache_t *cache = &tcaches[pool->tcache_slot];
+		if (cache->pool_id == pool->id) {
+			cache->head = NULL;
+			cache->count = 0;
+		}
+		atomic_fetch_and(&tcache_slots_in_use, ~(1ull << pool->tcache_slot));
+	}
+
+	d_free(pool);
+}
@@ -0,0 +1,119 @@
+#ifndef _DALLOC_POOL_H_
+#define _DALLOC_POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+A pool of fixed-size objects. Objects are carved out of page-aligned
+slabs obtained directly from the OS, and recycled through an intrusive
+free list, so d_pool_get() and d_pool_put() never touch the d_malloc()
+heap. On NUMA machines each node has its own slabs and free list, and
+threads take objects from their local node.
+*/
+typedef struct d_pool d_pool_t;
+
+/*
+Statistics about a pool (see d_pool_get_stats()).
+*/
+typedef struct {
+	// Number of slabs mapped by the pool.
+	size_t num_slabs;
+	// Number of free objects on the shared (or owner's) free lists, summed
+	// over all NUMA nodes. Doesn't include objects in thread caches or on
+	// the remote free list.
+	size_t num_free;
+	// Number of objects put by threads other than the pool's owner.
+	size_t remote_frees;
+	// Total size of objects put by threads other than the pool's owner.
+	size_t remote_free_bytes;
+	// Number of batches of remotely-freed objects reclaimed by the owner.
+	size_t remote_drains;
+} d_pool_stats_t;
+
+/*
+Create a pool of objects of the given size. Return NULL on failure.
+
+@param obj_size: Size of each object in bytes.
+@param align: Required alignment of each object. Must be a power of two,
+			  or 0 to use the platform's maximum fundamental alignment.
+*/
+d_pool_t *d_pool_create(size_t obj_size, size_t align);
+
+/*
+Take an object from the pool. Return NULL if the pool is exhausted and
+no more memory could be obtained from the OS.
+
+@param pool: The pool.
+*/
+void *d_pool_get(d_pool_t *pool);
+
+/*
+Return an object to the pool it was obtained from.
+
+@param pool: The pool.
+@param obj: The object. May be NULL, in which case this is a noop.
+*/
+void d_pool_put(d_pool_t *pool, void *obj);
+
+/*
+Preallocate enough slabs that at least `count` objects can be taken from
+the pool without requesting more memory from the OS. Return false if the
+memory could not be obtained.
+
+@param pool: The pool.
+@param count: Number of objects to preallocate.
+*/
+bool d_pool_reserve(d_pool_t *pool, size_t count);
+
+/*
+Enable a per-thread cache of free objects for this pool. Each thread
+which uses the pool will keep up to `capacity` free objects which it can
+get/put without synchronisation, exchanging objects with the shared free
+list in batches. Return false if no thread cache could be assigned (there
+is a fixed limit on the number of pools with thread caches).
+
+@param pool: The pool.
+@param capacity: Maximum number of objects held by each thread's cache.
+*/
+bool d_pool_enable_thread_cache(d_pool_t *pool, size_t capacity);
+
+/*
+Return all objects held by the calling thread's cache to the shared free
+list of the pool. Threads should call this before exiting, otherwise any
+objects in their cache can't be reused until the pool is destroyed.
+
+@param pool: The pool.
+*/
+void d_pool_flush_thread_cache(d_pool_t *pool);
+
+/*
+Make the calling thread the owner of a pool. The owner gets and puts
+objects without any synchronisation. Other threads may still put objects
+(e.g. a worker freeing a buffer allocated by an I/O thread); these are
+pushed onto a lock-free remote free list, which the owner reclaims in a
+single batch the next time its own free list runs dry. Only the owner may
+get objects from, reserve or destroy an owned pool. Owned pools don't use
+thread caches.
+
+@param pool: The pool.
+*/
+void d_pool_set_owner(d_pool_t *pool);
+
+/*
+Get statistics about a pool.
+
+@param pool: The pool.
+@param stats: (out parameter): the statistics.
+*/
+void d_pool_get_stats(d_pool_t *pool, d_pool_stats_t *stats);
+
+/*
+Destroy a pool, releasing all of its memory to the OS. Any objects
+obtained from the pool become invalid.
+
+@param pool: The pool.
+*/
+void d_pool_destroy(d_pool_t *pool);
+
+#endif // _DALLOC_POOL_H_
@@ -0,0 +1,58 @@
+#ifndef _DALLOC_PROBES_H_
+#define _DALLOC_PROBES_H_
+
+/*
+USDT (user-level statically defined tracing) probes, for attaching
+bpftrace, perf or SystemTap to a running process, e.g.
+
+	bpftrace -e 'usdt:./libdalloc.so:dalloc:malloc_return { @[arg2] = hist(arg1); }'
+
+When dalloc is built with DALLOC_USDT (the default when sys/sdt.h is
+available), each probe is a single nop plus an ELF note describing where
+to find its arguments, so a probe costs nothing until a tracer attaches.
+Otherwise the probes compile to nothing, and their arguments aren't
+evaluated.
+
+Probes (all in the "dalloc" provider):
+
+	malloc_entry(size)
+	malloc_return(ptr, size, path)
+	free_entry(ptr)
+	free_return(ptr, path)
+	realloc_entry(ptr, size)
+	realloc_return(old_ptr, new_ptr, size, path)
+	heap_grow(ptr, increment)       The heap was extended with sbrk.
+	heap_trim(ptr, size)            The top of the heap was released with sbrk.
+	mmap(ptr, size)                 Memory was mapped from the OS.
+	munmap(ptr, size)               Memory was unmapped.
+	purge(ptr, size)                Free pages were returned with madvise.
+	panic(fmt)                      A fatal error (e.g. heap corruption or a
+	                                double free); fmt is the message format.
+
+`path` is one of the DALLOC_PROBE_PATH_* values below.
+*/
+
+// The allocator which served a call.
+#define DALLOC_PROBE_PATH_HEAP 0
+#define DALLOC_PROBE_PATH_GUARD 1
+#define DALLOC_PROBE_PATH_BUDDY 2
+
+#ifdef DALLOC_USDT
+
+#include <sys/sdt.h>
+
+#define usdt_probe1(name, a) STAP_PROBE1(dalloc, name, a)
+#define usdt_probe2(name, a, b) STAP_PROBE2(dalloc, name, a, b)
+#define usdt_probe3(name, a, b, c) STAP_PROBE3(dalloc, name, a, b, c)
+#define usdt_probe4(name, a, b, c, d) STAP_PROBE4(dalloc, name, a, b, c, d)
+
+#else
+
+#define usdt_probe1(name, a) ((void)0)
+#define usdt_probe2(name, a, b) ((void)0)
+#define usdt_probe3(name, a, b, c) ((void)0)
+#define usdt_probe4(name, a, b, c, d) ((void)0)
+
+#endif // DALLOC_USDT
+
+#endif // _DALLOC_PROBES_H_
@@ -0,0 +1,506 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dalloc_io.h"
+#include "dalloc_io_internal.h"
+#include "dalloc_lock.h"
+#include "dalloc_os.h"
+#include "dalloc_profile.h"
+#include "dalloc_utils.h"
+
+// Maximum number of frames recorded for each sampled allocation.
+#define PROFILE_MAX_DEPTH 32
+
+// Number of extra frames captured to make room for those at the top of
+// each backtrace which are in dalloc itself (see own_frames()), and are
+// discarded.
+#define PROFILE_SKIP_FRAMES 8
+
+// Number of distinct backtraces which can be recorded. Must be a power of
+// two. Samples with a new backtrace are dropped once the table is 3/4 full.
+#define PROFILE_MAX_STACKS 2048
+
+// Number of live samples which can be tracked. Must be a power of two.
+// Samples are dropped once the table is 3/4 full.
+#define PROFILE_MAX_LIVE 16384
+
+// log2 of the number of counters in the live sample filter.
+#define PROFILE_FILTER_BITS 16
+
+/*
+Allocation statistics for one distinct backtrace.
+*/
+typedef struct {
+	uint64_t hash;
+	size_t depth;
+	void *frames[PROFILE_MAX_DEPTH];
+	size_t live_count;
+	size_t live_bytes;
+	size_t alloc_count;
+	size_t alloc_bytes;
+} profile_stack_t;
+
+/*
+A sampled allocation which hasn't yet been freed.
+*/
+typedef struct {
+	// Address of the allocation, or NULL if the slot is empty.
+	void *ptr;
+	size_t size;
+	// Index of the allocation's backtrace in the stack table.
+	size_t stack;
+} profile_live_t;
+
+atomic_size_t profile_sample_interval = 0;
+atomic_size_t profile_live_samples = 0;
+
+// Guards the stack and live tables. These are mapped directly from the OS
+// (the profiler can't allocate from the heap it's profiling), and are never
+// unmapped.
+static lock_t profile_lock = LOCK_INITIALIZER;
+static profile_stack_t *stacks = NULL;
+static size_t num_stacks = 0;
+static profile_live_t *live = NULL;
+
+// Number of live samples whose address hashes to each counter, so that
+// frees of unsampled memory (almost all of them) can be recognised without
+// taking the lock. Only changed with the lock held. There are fewer live
+// samples than a counter can hold.
+static atomic_uint_least16_t live_filter[1 << PROFILE_FILTER_BITS];
+
+// Number of samples discarded because a table was full.
+static size_t num_dropped = 0;
+
+// Sample interval of the current (or most recent) profile.
+static size_t sampled_interval = 0;
+
+// Number of bytes this thread may allocate before the next sample is taken.
+static _Thread_local int64_t bytes_until_sample = 0;
+static _Thread_local bool sampler_initialised = false;
+static _Thread_local uint64_t rng_state = 0;
+
+/*
+Return the next value from this thread's xorshift64* generator.
+*/
+static uint64_t next_random() {
+	if (!rng_state) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		rng_state = (uint64_t)(uintptr_t)&rng_state
+			^ ((uint64_t)now.tv_nsec << 20) ^ (uint64_t)now.tv_sec;
+		rng_state |= 1;
+	}
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+Draw the number of bytes until the next sample from an exponential
+distribution with the given mean. Sampling each byte with probability
+1/interval means that the gaps between samples are geometrically
+distributed, which this approximates.
+
+@param interval: Mean distance between samples, in bytes.
+*/
+static int64_t next_sample_distance(size_t interval) {
+	// Uniform in (0, 1].
+	double u = ((next_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+	double distance = -log(u) * (double)interval;
+	if (distance >= (double)INT64_MAX) {
+		return INT64_MAX;
+	}
+	return (int64_t)distance + 1;
+}
+
+static size_t hash_pointer(const void *ptr) {
+	return (size_t)(((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL);
+}
+
+static atomic_uint_least16_t *filter_counter(const void *ptr) {
+	return &live_filter[(uint64_t)hash_pointer(ptr) >> (64 - PROFILE_FILTER_BITS)];
+}
+
+static uint64_t hash_frames(void **frames, size_t depth) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < depth; i++) {
+		hash ^= (uintptr_t)frames[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+/*
+Find the stack table slot for a backtrace, inserting it if necessary.
+Return the index of the slot, or -1 if the table is full. Must be called
+with the profile lock held.
+
+@param frames: The backtrace.
+@param depth: Number of frames in the backtrace.
+*/
+static int64_t find_or_insert_stack(void **frames, size_t depth) {
+	uint64_t hash = hash_frames(frames, depth);
+	size_t mask = PROFILE_MAX_STACKS - 1;
+	for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+		profile_stack_t *stack = &stacks[i];
+		if (!stack->alloc_count) {
+			if (num_stacks >= PROFILE_MAX_STACKS / 4 * 3) {
+				return -1;
+			}
+			stack->hash = hash;
+			stack->depth = depth;
+			memcpy(stack->frames, frames, depth * sizeof(void *));
+			num_stacks++;
+			return i;
+		}
+		if (stack->hash == hash && stack->depth == depth
+				&& !memcmp(stack->frames, frames, depth * sizeof(void *))) {
+			return i;
+		}
+	}
+}
+
+/*
+Remove a live sample from the table, shifting later entries in its probe
+sequence back so that no tombstones are needed. Must be called with the
+profile lock held.
+
+@param slot: Index of the sample's slot.
+*/
+static void remove_live(size_t slot) {
+	size_t mask = PROFILE_MAX_LIVE - 1;
+	size_t i = slot;
+	for (size_t j = (i + 1) & mask; live[j].ptr; j = (j + 1) & mask) {
+		size_t home = hash_pointer(live[j].ptr) & mask;
+		// Entry j can fill the hole at i unless its home slot lies
+		// (cyclically) in (i, j].
+		bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+		if (!stays) {
+			live[i] = live[j];
+			i = j;
+		}
+	}
+	live[i].ptr = NULL;
+}
+
+/*
+Record a sampled allocation. Must be called with the profile lock held.
+
+@param ptr: The allocated memory.
+@param size: Size of the allocation.
+@param frames: Backtrace of the allocation.
+@param depth: Number of frames in the backtrace.
+*/
+static void record_sample(void *ptr, size_t size, void **frames, size_t depth) {
+	size_t count = atomic_load_explicit(&profile_live_samples, memory_order_relaxed);
+	if (count >= PROFILE_MAX_LIVE / 4 * 3) {
+		num_dropped++;
+		return;
+	}
+
+	int64_t index = find_or_insert_stack(frames, depth);
+	if (index < 0) {
+		num_dropped++;
+		return;
+	}
+	profile_stack_t *stack = &stacks[index];
+	stack->alloc_count++;
+	stack->alloc_bytes += size;
+	stack->live_count++;
+	stack->live_bytes += size;
+
+	size_t mask = PROFILE_MAX_LIVE - 1;
+	size_t i = hash_pointer(ptr) & mask;
+	while (live[i].ptr) {
+		if (live[i].ptr == ptr) {
+			// Should be impossible - the previous allocation at this
+			// address must have been freed. Treat it as such.
+			stacks[live[i].stack].live_count--;
+			stacks[live[i].stack].live_bytes -= live[i].size;
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	if (!live[i].ptr) {
+		atomic_fetch_add_explicit(&profile_live_samples, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(filter_counter(ptr), 1, memory_order_relaxed);
+	}
+	live[i].ptr = ptr;
+	live[i].size = size;
+	live[i].stack = index;
+}
+
+// Any object in dalloc, used to find the library's load address.
+static const char own_object;
+
+/*
+Return the number of frames at the top of a backtrace which are in dalloc
+itself: the profiler, and whichever entry point (d_malloc(), d_calloc(),
+d_mallocx(), ...) and helpers led to it. These differ per entry point, so
+frames are skipped until the first one outside the library. If every frame
+is in the same object (i.e. dalloc is linked statically), nothing can be
+told apart and none are skipped.
+
+@param frames: The backtrace.
+@param depth: Number of frames in the backtrace.
+*/
+static int own_frames(void **frames, int depth) {
+	static void *own_base = NULL;
+	Dl_info info;
+	if (!own_base && dladdr(&own_object, &info)) {
+		own_base = info.dli_fbase;
+	}
+
+	int skip = 0;
+	while (skip < depth && dladdr(frames[skip], &info) && info.dli_fbase == own_base) {
+		skip++;
+	}
+	return skip == depth ? 0 : skip;
+}
+
+void profile_allocation(void *ptr, size_t size) {
+	size_t interval = atomic_load_explicit(&profile_sample_interval, memory_order_relaxed);
+	if (!ptr || !interval) {
+		return;
+	}
+
+	if (!sampler_initialised) {
+		bytes_until_sample = next_sample_distance(interval);
+		sampler_initialised = true;
+	}
+	bytes_until_sample -= size > INT64_MAX ? INT64_MAX : (int64_t)size;
+	if (bytes_until_sample > 0) {
+		return;
+	}
+	bytes_until_sample = next_sample_distance(interval);
+
+	void *frames[PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES];
+	int depth = backtrace(frames, PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES);
+	int skip = own_frames(frames, depth);
+	depth -= skip;
+	if (depth > PROFILE_MAX_DEPTH) {
+		depth = PROFILE_MAX_DEPTH;
+	}
+
+	lock_acquire(&profile_lock);
+	if (stacks) {
+		record_sample(ptr, size, frames + skip, depth);
+	}
+	lock_release(&profile_lock);
+}
+
+void profile_deallocation(void *ptr) {
+	// A sample is recorded before the allocation is returned, so before it
+	// can be freed. A zero counter means this allocation wasn't sampled.
+	if (!atomic_load_explicit(filter_counter(ptr), memory_order_relaxed)) {
+		return;
+	}
+
+	lock_acquire(&profile_lock);
+	if (live) {
+		size_t mask = PROFILE_MAX_LIVE - 1;
+		for (size_t i = hash_pointer(ptr) & mask; live[i].ptr; i = (i + 1) & mask) {
+			if (live[i].ptr == ptr) {
+				profile_stack_t *stack = &stacks[live[i].stack];
+				stack->live_count--;
+				stack->live_bytes -= live[i].size;
+				remove_live(i);
+				atomic_fetch_sub_explicit(&profile_live_samples, 1, memory_order_relaxed);
+				atomic_fetch_sub_explicit(filter_counter(ptr), 1, memory_order_relaxed);
+				break;
+			}
+		}
+	}
+	lock_release(&profile_lock);
+}
+
+bool d_profile_start(size_t sample_interval) {
+	if (!sample_interval) {
+		log_warning("d_profile_start(): sample interval must be nonzero");
+		return false;
+	}
+
+	// The first call to backtrace() may load libgcc, which allocates memory.
+	// Get that out of the way before any allocations are sampled.
+	void *frame;
+	backtrace(&frame, 1);
+
+	lock_acquire(&profile_lock);
+	if (!stacks) {
+		stacks = os_map(align_up(PROFILE_MAX_STACKS * sizeof(profile_stack_t), os_page_size()));
+		live = os_map(align_up(PROFILE_MAX_LIVE * sizeof(profile_live_t), os_page_size()));
+		if (!stacks || !live) {
+			if (stacks) {
+				os_unmap(stacks, align_up(PROFILE_MAX_STACKS * sizeof(profile_stack_t), os_page_size()));
+			}
+			if (live) {
+				os_unmap(live, align_up(PROFILE_MAX_LIVE * sizeof(profile_live_t), os_page_size()));
+			}
+			stacks = NULL;
+			live = NULL;
+			lock_release(&profile_lock);
+			log_warning("d_profile_start(): unable to allocate profile tables");
+			return false;
+		}
+	} else {
+		memset(stacks, 0, PROFILE_MAX_STACKS * sizeof(profile_stack_t));
+		memset(live, 0, PROFILE_MAX_LIVE * sizeof(profile_live_t));
+	}
+	for (size_t i = 0; i < 1 << PROFILE_FILTER_BITS; i++) {
+		atomic_store_explicit(&live_filter[i], 0, memory_order_relaxed);
+	}
+	num_stacks = 0;
+	num_dropped = 0;
+	sampled_interval = sample_interval;
+	atomic_store(&profile_live_samples, 0);
+	atomic_store(&profile_sample_interval, sample_interval);
+	lock_release(&profile_lock);
+	return true;
+}
+
+void d_profile_stop() {
+	atomic_store(&profile_sample_interval, 0);
+}
+
+/*
+Output buffer for profile dumps, which are written without allocating.
+*/
+typedef struct {
+	int fd;
+	bool failed;
+	size_t len;
+	char buf[4096];
+} profile_writer_t;
+
+static void writer_flush(profile_writer_t *writer) {
+	if (!writer->failed) {
+		writer->failed = !os_write_all(writer->fd, writer->buf, writer->len);
+	}
+	writer->len = 0;
+}
+
+/*
+Append formatted text to the writer's buffer, flushing it first if the
+text might not fit. Individual writes must be shorter than 256 bytes.
+*/
+static void writer_format(profile_writer_t *writer, const char *fmt, ...) {
+	if (sizeof(writer->buf) - writer->len < 256) {
+		writer_flush(writer);
+	}
+	va_list args;
+	va_start(args, fmt);
+	writer->len += format_message(writer->buf + writer->len,
+		sizeof(writer->buf) - writer->len, fmt, args);
+	va_end(args);
+}
+
+/*
+Append the contents of /proc/self/maps, which pprof needs to map the
+recorded addresses back to symbols.
+*/
+static void writer_append_maps(profile_writer_t *writer) {
+	int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+	if (maps < 0) {
+		log_warning("d_profile_dump(): unable to read /proc/self/maps");
+		return;
+	}
+	while (!writer->failed) {
+		if (writer->len == sizeof(writer->buf)) {
+			writer_flush(writer);
+		}
+		ssize_t n = read(maps, writer->buf + writer->len,
+			sizeof(writer->buf) - writer->len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		writer->len += n;
+	}
+	close(maps);
+}
+
+bool d_profile_dump(int fd) {
+	size_t table_size = align_up(PROFILE_MAX_STACKS * sizeof(profile_stack_t), os_page_size());
+
+	// Take a copy of the stack table, so that the lock isn't held while
+	// writing (the reader of fd may well need to allocate).
+	lock_acquire(&profile_lock);
+	if (!stacks) {
+		lock_release(&profile_lock);
+		log_warning("d_profile_dump(): profiler has not been started");
+		return false;
+	}
+	profile_stack_t *snapshot = os_map(table_size);
+	if (snapshot) {
+		memcpy(snapshot, stacks, PROFILE_MAX_STACKS * sizeof(profile_stack_t));
+	}
+	size_t dropped = num_dropped;
+	size_t interval = sampled_interval;
+	lock_release(&profile_lock);
+	if (!snapshot) {
+		log_warning("d_profile_dump(): unable to allocate snapshot");
+		return false;
+	}
+
+	size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+	for (size_t i = 0; i < PROFILE_MAX_STACKS; i++) {
+		live_count += snapshot[i].live_count;
+		live_bytes += snapshot[i].live_bytes;
+		alloc_count += snapshot[i].alloc_count;
+		alloc_bytes += snapshot[i].alloc_bytes;
+	}
+	if (dropped) {
+		log_warning("d_profile_dump(): %zu samples were dropped because the profile tables are full", dropped);
+	}
+
+	// pprof uses the sample interval to scale the sampled values up to
+	// estimates of the true totals.
+	profile_writer_t writer = { .fd = fd, .failed = false, .len = 0 };
+	writer_format(&writer, "heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n",
+		live_count, live_bytes, alloc_count, alloc_bytes, interval);
+	for (size_t i = 0; i < PROFILE_MAX_STACKS; i++) {
+		profile_stack_t *stack = &snapshot[i];
+		if (!stack->alloc_count) {
+			continue;
+		}
+		writer_format(&writer, "%6zu: %8zu [%6zu: %8zu] @",
+			stack->live_count, stack->live_bytes,
+			stack->alloc_count, stack->alloc_bytes);
+		for (size_t j = 0; j < stack->depth; j++) {
+			writer_format(&writer, " %p", stack->frames[j]);
+		}
+		writer_format(&writer, "\n");
+	}
+	writer_format(&writer, "\nMAPPED_LIBRARIES:\n");
+	writer_append_maps(&writer);
+	writer_flush(&writer);
+
+	os_unmap(snapshot, table_size);
+	if (writer.failed) {
+		log_warning("d_profile_dump(): unable to write profile");
+	}
+	return !writer.failed;
+}
+
+void profile_fork_prepare() {
+	lock_acquire(&profile_lock);
+}
+
+void profile_fork_finish() {
+	lock_release(&profile_lock);
+}
@@ -0,0 +1,100 @@
+#ifndef _DALLOC_PROFILE_H_
+#define _DALLOC_PROFILE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+Start the sampling heap profiler. On average, one allocation is sampled
+for every `sample_interval` bytes allocated (the distance between samples
+is drawn from an exponential distribution, so that every byte has the same
+chance of being sampled regardless of allocation size). A backtrace is
+captured for each sampled allocation, which is then tracked until it's
+freed. Return false if the profiler's tables couldn't be allocated.
+
+Calling this while the profiler is running changes the sample interval
+and discards all existing samples.
+
+@param sample_interval: Mean number of bytes between samples. Must be
+						nonzero.
+*/
+bool d_profile_start(size_t sample_interval);
+
+/*
+Stop sampling new allocations. Allocations which have already been sampled
+are still tracked until they're freed, so a profile can still be dumped.
+*/
+void d_profile_stop();
+
+/*
+Write a heap profile in the legacy (gperftools heap_v2) format understood
+by pprof. Each record includes both the live heap (sampled allocations not
+yet freed) and the cumulative allocations since the profiler was started;
+use pprof's -inuse_space or -alloc_space options to choose between them.
+The process' memory map is appended so that pprof can symbolise the
+backtraces. Return false if the profile couldn't be written.
+
+@param fd: File descriptor to which the profile is written.
+*/
+bool d_profile_dump(int fd);
+
+// Mean number of bytes between samples, or 0 if the profiler isn't
+// running. Use d_profile_start() to change this.
+extern atomic_size_t profile_sample_interval;
+
+// Number of sampled allocations which haven't been freed.
+extern atomic_size_t profile_live_samples;
+
+/*
+Record an allocation, if it's selected for sampling. Should only be
+called while the profiler is running.
+
+@param ptr: The allocated memory.
+@param size: The requested size of the allocation.
+*/
+void profile_allocation(void *ptr, size_t size);
+
+/*
+Stop tracking a freed allocation, if it was sampled. The profile lock is
+only taken if the allocation might have been.
+
+@param ptr: The freed memory.
+*/
+void profile_deallocation(void *ptr);
+
+/*
+Acquire (and release) the profiler's lock around fork(), so that the child
+doesn't inherit it held by a thread which no longer exists.
+*/
+void profile_fork_prepare();
+void profile_fork_finish();
+
+/*
+Record an allocation if the profiler is running. This is always inlined
+into the allocation path, so that it costs a single load when the
+profiler is off.
+
+@param ptr: The allocated memory.
+@param size: The requested size of the allocation.
+*/
+__attribute__((always_inline))
+static inline void profile_malloc(void *ptr, size_t size) {
+	if (atomic_load_explicit(&profile_sample_interval, memory_order_relaxed)) {
+		profile_allocation(ptr, size);
+	}
+}
+
+/*
+Stop tracking a freed allocation if any allocations are being tracked.
+
+@param ptr: The freed memory.
+*/
+__attribute__((always_inline))
+static inline void profile_free(void *ptr) {
+	if (atomic_load_explicit(&profile_live_samples, memory_order_relaxed)) {
+		profile_deallocation(ptr);
+	}
+}
+
+#endif // _DALLOC_PROFILE_H_
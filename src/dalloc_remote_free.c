@@ -0,0 +1,33 @@
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "dalloc_remote_free.h"
+
+void remote_free_init(remote_free_list_t *list) {
+	atomic_init(&list->head, NULL);
+	atomic_init(&list->num_frees, 0);
+	atomic_init(&list->num_bytes, 0);
+	atomic_init(&list->num_drains, 0);
+}
+
+void remote_free_push(remote_free_list_t *list, void *block, size_t size) {
+	void *head = atomic_load_explicit(&list->head, memory_order_relaxed);
+	do {
+		*(void **)block = head;
+	} while (!atomic_compare_exchange_weak_explicit(&list->head, &head, block,
+		memory_order_release, memory_order_relaxed));
+
+	atomic_fetch_add_explicit(&list->num_frees, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&list->num_bytes, size, memory_order_relaxed);
+}
+
+void *remote_free_drain(remote_free_list_t *list) {
+	// Cheap check first, so that an owner with nothing to reclaim doesn't
+	// take the cache line exclusively.
+	if (!atomic_load_explicit(&list->head, memory_order_relaxed)) {
+		return NULL;
+	}
+	void *head = atomic_exchange_explicit(&list->head, NULL, memory_order_acquire);
+	atomic_fetch_add_explicit(&list->num_drains, 1, memory_order_relaxed);
+	return head;
+}
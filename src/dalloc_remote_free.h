@@ -0,0 +1,51 @@
+#ifndef _DALLOC_REMOTE_FREE_H_
+#define _DALLOC_REMOTE_FREE_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+A lock-free, multiple-producer single-consumer list of blocks which have
+been freed by threads other than the one which owns them. Any thread may
+push a block; only the owner may drain the list. Blocks are linked through
+their first word, so each block must be at least the size of a pointer.
+
+Because the owner always takes the entire list at once, pushes can't
+suffer from the ABA problem.
+*/
+typedef struct {
+	_Atomic(void *) head;
+
+	// Statistics. Updated with relaxed atomics, so they're only
+	// approximate while other threads are pushing.
+	atomic_size_t num_frees;
+	atomic_size_t num_bytes;
+	atomic_size_t num_drains;
+} remote_free_list_t;
+
+/*
+Initialise a remote free list to the empty state.
+
+@param list: The list.
+*/
+void remote_free_init(remote_free_list_t *list);
+
+/*
+Push a block onto a remote free list. May be called from any thread.
+
+@param list: The list.
+@param block: The freed block.
+@param size: Size of the block in bytes (used for statistics only).
+*/
+void remote_free_push(remote_free_list_t *list, void *block, size_t size);
+
+/*
+Detach every block from a remote free list. Must only be called by the
+owner of the list. Return the blocks as a NULL-terminated chain linked
+through their first word, or NULL if the list is empty.
+
+@param list: The list.
+*/
+void *remote_free_drain(remote_free_list_t *list);
+
+#endif // _DALLOC_REMOTE_FREE_H_
@@ -0,0 +1,177 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "dalloc_search_stats.h"
+
+#ifdef DALLOC_SEARCH_STATS
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dalloc_cycles.h"
+#include "dalloc_lock.h"
+#include "dalloc_thread_block.h"
+#include "dalloc_utils.h"
+
+/*
+A thread's statistics. When a thread exits, its statistics are folded
+into the retired totals before its block is released.
+*/
+typedef struct {
+	thread_block_t header;
+	d_search_stats_t stats;
+} search_block_t;
+
+static void retire_block(thread_block_t *block);
+
+static thread_block_list_t blocks = THREAD_BLOCK_LIST_INITIALIZER(search_block_t, retire_block);
+
+// Statistics of threads which have exited.
+static lock_t retired_lock = LOCK_INITIALIZER;
+static d_search_stats_t retired;
+
+static _Thread_local search_block_t *thread_block = NULL;
+static _Thread_local uint32_t search_depth = 0;
+static _Thread_local uint64_t search_start = 0;
+_Thread_local uint64_t search_visits = 0;
+_Thread_local uint32_t search_paths = 0;
+
+/*
+Add one set of statistics to another.
+
+@param total: The statistics to be added to.
+@param stats: The statistics to add.
+*/
+static void add_stats(d_search_stats_t *total, const d_search_stats_t *stats) {
+	for (int32_t i = 0; i < DALLOC_SEARCH_NUM_OPS; i++) {
+		d_search_op_stats_t *dst = &total->ops[i];
+		const d_search_op_stats_t *src = &stats->ops[i];
+		dst->calls += src->calls;
+		dst->visits += src->visits;
+		dst->cycles += src->cycles;
+		if (src->max_visits > dst->max_visits) {
+			dst->max_visits = src->max_visits;
+		}
+		for (int32_t j = 0; j < DALLOC_SEARCH_HIST_BUCKETS; j++) {
+			dst->visits_hist[j] += src->visits_hist[j];
+			dst->cycles_hist[j] += src->cycles_hist[j];
+		}
+		for (int32_t j = 0; j < DALLOC_SEARCH_NUM_PATH_SETS; j++) {
+			dst->path_calls[j] += src->path_calls[j];
+			dst->path_cycles[j] += src->path_cycles[j];
+		}
+	}
+}
+
+/*
+Fold a block's statistics into the retired totals when its thread exits.
+
+@param block: The block.
+*/
+static void retire_block(thread_block_t *block) {
+	search_block_t *b = (search_block_t *)block;
+	lock_acquire(&retired_lock);
+	add_stats(&retired, &b->stats);
+	memset(&b->stats, 0, sizeof(b->stats));
+	lock_release(&retired_lock);
+}
+
+/*
+Get the calling thread's block. Return NULL on failure.
+*/
+static search_block_t *get_thread_block() {
+	if (!thread_block) {
+		thread_block = (search_block_t *)thread_block_get(&blocks);
+	}
+	return thread_block;
+}
+
+/*
+Return the histogram bucket of a value (see DALLOC_SEARCH_HIST_BUCKETS).
+*/
+static uint32_t hist_bucket(uint64_t value) {
+	return value ? size_class(value) + 1 : 0;
+}
+
+void search_begin() {
+	if (search_depth++) {
+		return;
+	}
+	search_visits = 0;
+	search_paths = 0;
+	search_start = read_cycles();
+}
+
+void search_end(search_op_t op) {
+	if (--search_depth) {
+		return;
+	}
+	uint64_t cycles = read_cycles() - search_start;
+
+	search_block_t *block = get_thread_block();
+	if (!block) {
+		return;
+	}
+	d_search_op_stats_t *stats = &block->stats.ops[op];
+	stats->calls++;
+	stats->visits += search_visits;
+	stats->cycles += cycles;
+	if (search_visits > stats->max_visits) {
+		stats->max_visits = search_visits;
+	}
+	stats->visits_hist[hist_bucket(search_visits)]++;
+	stats->cycles_hist[hist_bucket(cycles)]++;
+	stats->path_calls[search_paths]++;
+	stats->path_cycles[search_paths] += cycles;
+}
+
+bool d_search_stats_thread(d_search_stats_t *stats) {
+	memset(stats, 0, sizeof(*stats));
+	if (thread_block) {
+		add_stats(stats, &thread_block->stats);
+	}
+	return true;
+}
+
+bool d_search_stats_total(d_search_stats_t *stats) {
+	memset(stats, 0, sizeof(*stats));
+	lock_acquire(&retired_lock);
+	add_stats(stats, &retired);
+	lock_release(&retired_lock);
+
+	thread_block_t *block = thread_block_first(&blocks);
+	for (; block; block = block->next) {
+		add_stats(stats, &((search_block_t *)block)->stats);
+	}
+	return true;
+}
+
+void d_search_stats_reset() {
+	lock_acquire(&retired_lock);
+	memset(&retired, 0, sizeof(retired));
+	lock_release(&retired_lock);
+
+	thread_block_t *block = thread_block_first(&blocks);
+	for (; block; block = block->next) {
+		memset(&((search_block_t *)block)->stats, 0, sizeof(d_search_stats_t));
+	}
+}
+
+#else
+
+bool d_search_stats_thread(d_search_stats_t *stats) {
+	memset(stats, 0, sizeof(*stats));
+	return false;
+}
+
+bool d_search_stats_total(d_search_stats_t *stats) {
+	memset(stats, 0, sizeof(*stats));
+	return false;
+}
+
+void d_search_stats_reset() {
+
+}
+
+#endif // DALLOC_SEARCH_STATS
@@ -0,0 +1,118 @@
+#ifndef _DALLOC_SEARCH_STATS_H_
+#define _DALLOC_SEARCH_STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+Search-cost instrumentation. When dalloc is built with
+DALLOC_SEARCH_STATS, every d_malloc(), d_free() and d_realloc() records
+the number of chunks it visited, the path it took and the number of
+cycles it took into histograms owned by the calling thread. Otherwise the
+hooks compile to nothing and the functions below return false.
+*/
+
+typedef enum {
+	DALLOC_SEARCH_OP_MALLOC,
+	DALLOC_SEARCH_OP_FREE,
+	DALLOC_SEARCH_OP_REALLOC,
+	DALLOC_SEARCH_NUM_OPS
+} search_op_t;
+
+// Paths which may be taken by a call. A call may take several (e.g. a
+// d_malloc() which reuses and splits a chunk), so calls are counted for
+// each combination of paths.
+#define DALLOC_SEARCH_PATH_REUSE 0x1
+#define DALLOC_SEARCH_PATH_SBRK 0x2
+#define DALLOC_SEARCH_PATH_SPLIT 0x4
+#define DALLOC_SEARCH_PATH_COALESCE 0x8
+#define DALLOC_SEARCH_PATH_TAIL_RELEASE 0x10
+#define DALLOC_SEARCH_NUM_PATH_SETS 32
+
+// Histogram bucket 0 counts zeroes; bucket n > 0 counts values in
+// [2^(n-1), 2^n).
+#define DALLOC_SEARCH_HIST_BUCKETS 65
+
+typedef struct {
+	uint64_t calls;
+	// Total and maximum number of chunks visited by a call.
+	uint64_t visits;
+	uint64_t max_visits;
+	uint64_t cycles;
+	uint64_t visits_hist[DALLOC_SEARCH_HIST_BUCKETS];
+	uint64_t cycles_hist[DALLOC_SEARCH_HIST_BUCKETS];
+	// Number of calls and total cycles for each combination of paths,
+	// indexed by the bitwise or of DALLOC_SEARCH_PATH_* values.
+	uint64_t path_calls[DALLOC_SEARCH_NUM_PATH_SETS];
+	uint64_t path_cycles[DALLOC_SEARCH_NUM_PATH_SETS];
+} d_search_op_stats_t;
+
+typedef struct {
+	d_search_op_stats_t ops[DALLOC_SEARCH_NUM_OPS];
+} d_search_stats_t;
+
+/*
+Get the search statistics recorded by the calling thread. Return false
+if dalloc was built without search-cost instrumentation.
+
+@param stats: (out) The statistics.
+*/
+bool d_search_stats_thread(d_search_stats_t *stats);
+
+/*
+Get the search statistics recorded by all threads (including threads
+which have exited). Statistics being updated concurrently may be slightly
+inconsistent. Return false if dalloc was built without search-cost
+instrumentation.
+
+@param stats: (out) The statistics.
+*/
+bool d_search_stats_total(d_search_stats_t *stats);
+
+/*
+Clear the search statistics of all threads.
+*/
+void d_search_stats_reset();
+
+#ifdef DALLOC_SEARCH_STATS
+
+/*
+Start timing a call. Calls may be nested (e.g. d_realloc() calls
+d_malloc()), in which case only the outermost call is recorded, and
+includes the costs of the nested calls.
+*/
+void search_begin();
+
+/*
+Finish timing a call, and record it.
+
+@param op: The type of call.
+*/
+void search_end(search_op_t op);
+
+// Per-thread state of the call being timed.
+extern _Thread_local uint64_t search_visits;
+extern _Thread_local uint32_t search_paths;
+
+/*
+Record a visit to a chunk during a search.
+*/
+#define search_visit() (search_visits++)
+
+/*
+Record that the current call took a path.
+
+@param path: One of the DALLOC_SEARCH_PATH_* values.
+*/
+#define search_path(path) (search_paths |= (path))
+
+#else
+
+#define search_begin() ((void)0)
+#define search_end(op) ((void)0)
+#define search_visit() ((void)0)
+#define search_path(path) ((void)0)
+
+#endif // DALLOC_SEARCH_STATS
+
+#endif // _DALLOC_SEARCH_STATS_H_
@@ -0,0 +1,71 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "dalloc_heap_traversal.h"
+#include "dalloc_io.h"
+#include "dalloc_os.h"
+#include "dalloc_snapshot.h"
+#include "dalloc_utils.h"
+
+static size_t records_size(size_t count) {
+	return align_up(count * sizeof(d_snapshot_chunk_t), os_page_size());
+}
+
+static bool count_chunk(const chunk_t *chunk, void *user_data) {
+	(void)chunk;
+	(*(size_t *)user_data)++;
+	return true;
+}
+
+static bool add_record(const chunk_t *chunk, void *user_data) {
+	heap_snapshot_t *snapshot = user_data;
+	d_snapshot_chunk_t *record = &snapshot->records[snapshot->count++];
+	record->address = (uintptr_t)chunk->start;
+	record->info = (chunk->size & DALLOC_SNAPSHOT_SIZE_MASK)
+		| ((uint64_t)size_class(chunk->size) << DALLOC_SNAPSHOT_CLASS_SHIFT)
+		| (chunk->in_use ? DALLOC_SNAPSHOT_IN_USE : 0);
+	return true;
+}
+
+bool copy_snapshot(chunk_t *start, heap_snapshot_t *snapshot) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	memset(snapshot, 0, sizeof(*snapshot));
+	memcpy(snapshot->header.magic, DALLOC_SNAPSHOT_MAGIC, sizeof(snapshot->header.magic));
+	snapshot->header.version = DALLOC_SNAPSHOT_VERSION;
+	snapshot->header.timestamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	snapshot->header.header_size = sizeof(chunk_t);
+
+	size_t count = 0;
+	for_each(start, count_chunk, &count);
+	if (!count) {
+		return true;
+	}
+	snapshot->records = os_map(records_size(count));
+	if (!snapshot->records) {
+		return false;
+	}
+	for_each(start, add_record, snapshot);
+	return true;
+}
+
+bool write_snapshot(int fd, const heap_snapshot_t *snapshot) {
+	bool ok = os_write_all(fd, &snapshot->header, sizeof(snapshot->header))
+		&& os_write_all(fd, snapshot->records, snapshot->count * sizeof(d_snapshot_chunk_t));
+	if (!ok) {
+		log_warning("d_heap_snapshot(): unable to write snapshot");
+	}
+	return ok;
+}
+
+void release_snapshot(heap_snapshot_t *snapshot) {
+	if (snapshot->records) {
+		os_unmap(snapshot->records, records_size(snapshot->count));
+		snapshot->records = NULL;
+	}
+	snapshot->count = 0;
+}
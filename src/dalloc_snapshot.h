@@ -0,0 +1,94 @@
+#ifndef _DALLOC_SNAPSHOT_H_
+#define _DALLOC_SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chunk.h"
+
+/*
+Heap snapshot file format. All fields are in host byte order. A snapshot
+is a header followed by one record per chunk, in heap order, up to the end
+of the file.
+*/
+
+#define DALLOC_SNAPSHOT_MAGIC "DHSN"
+#define DALLOC_SNAPSHOT_VERSION 1
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	// Time at which the snapshot was taken, in nanoseconds since the
+	// unix epoch.
+	uint64_t timestamp;
+	// Size of the metadata which precedes each chunk's memory.
+	uint64_t header_size;
+} d_snapshot_header_t;
+
+typedef struct {
+	// Address of the chunk's user-writable memory.
+	uint64_t address;
+	// Bit 63: in use. Bits 56-62: size class. Bits 0-55: size.
+	uint64_t info;
+} d_snapshot_chunk_t;
+
+#define DALLOC_SNAPSHOT_IN_USE (1ULL << 63)
+#define DALLOC_SNAPSHOT_CLASS_SHIFT 56
+#define DALLOC_SNAPSHOT_SIZE_MASK ((1ULL << DALLOC_SNAPSHOT_CLASS_SHIFT) - 1)
+
+static inline uint64_t snapshot_chunk_size(const d_snapshot_chunk_t *chunk) {
+	return chunk->info & DALLOC_SNAPSHOT_SIZE_MASK;
+}
+
+static inline uint32_t snapshot_chunk_class(const d_snapshot_chunk_t *chunk) {
+	return (chunk->info >> DALLOC_SNAPSHOT_CLASS_SHIFT) & 0x7f;
+}
+
+static inline bool snapshot_chunk_in_use(const d_snapshot_chunk_t *chunk) {
+	return chunk->info & DALLOC_SNAPSHOT_IN_USE;
+}
+
+/*
+Write a snapshot of the heap's chunk map to a file descriptor. The chunk
+map is copied while holding the heap lock, and written once it has been
+released, so this is cheap enough to call on a live process (even if
+writing to fd blocks). Return false if the snapshot couldn't be taken or
+written.
+
+@param fd: The file descriptor.
+*/
+bool d_heap_snapshot(int fd);
+
+typedef struct {
+	d_snapshot_header_t header;
+	// Mapped with os_map(), or NULL if there are no records.
+	d_snapshot_chunk_t *records;
+	size_t count;
+} heap_snapshot_t;
+
+/*
+Copy the chunks in a heap into a snapshot. The heap mustn't be modified
+while this runs. Return false if the record buffer couldn't be mapped.
+
+@param start: First chunk in the heap. May be NULL if the heap is empty.
+@param snapshot: (out) The snapshot. Release it with release_snapshot().
+*/
+bool copy_snapshot(chunk_t *start, heap_snapshot_t *snapshot);
+
+/*
+Write a snapshot to a file descriptor. Return false if the snapshot
+couldn't be written.
+
+@param fd: The file descriptor.
+@param snapshot: The snapshot.
+*/
+bool write_snapshot(int fd, const heap_snapshot_t *snapshot);
+
+/*
+Unmap a snapshot's records.
+
+@param snapshot: The snapshot.
+*/
+void release_snapshot(heap_snapshot_t *snapshot);
+
+#endif // _DALLOC_SNAPSHOT_H_
@@ -0,0 +1,95 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dalloc_os.h"
+#include "dalloc_thread_block.h"
+#include "dalloc_utils.h"
+
+// Used to release a thread's blocks when the thread exits. One key serves
+// every list, so a thread calls pthread_setspecific() at most once.
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+// Blocks owned by the calling thread, linked through thread_next.
+static _Thread_local thread_block_t *owned = NULL;
+
+/*
+Thread-exit destructor which retires and releases all of a thread's
+blocks.
+
+@param unused: The value associated with exit_key (unused).
+*/
+static void release_blocks(void *unused) {
+	thread_block_t *block = owned;
+	owned = NULL;
+	while (block) {
+		thread_block_t *next = block->thread_next;
+		if (block->list->retire) {
+			block->list->retire(block);
+		}
+		atomic_store_explicit(&block->in_use, false, memory_order_release);
+		block = next;
+	}
+}
+
+static void create_exit_key() {
+	pthread_key_create(&exit_key, release_blocks);
+}
+
+/*
+Claim a block which has been released, or map a new one. Return NULL on
+failure.
+
+@param list: The list.
+*/
+static thread_block_t *claim_block(thread_block_list_t *list) {
+	thread_block_t *block = thread_block_first(list);
+	for (; block; block = block->next) {
+		bool expected = false;
+		if (atomic_compare_exchange_strong(&block->in_use, &expected, true)) {
+			return block;
+		}
+	}
+
+	block = os_map(align_up(list->size, os_page_size()));
+	if (!block) {
+		return NULL;
+	}
+	block->list = list;
+	atomic_store_explicit(&block->in_use, true, memory_order_relaxed);
+	thread_block_t *head = atomic_load_explicit(&list->blocks, memory_order_relaxed);
+	do {
+		block->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&list->blocks, &head, block,
+		memory_order_release, memory_order_relaxed));
+	return block;
+}
+
+thread_block_t *thread_block_get(thread_block_list_t *list) {
+	for (thread_block_t *block = owned; block; block = block->thread_next) {
+		if (block->list == list) {
+			return block;
+		}
+	}
+
+	pthread_once(&exit_key_once, create_exit_key);
+
+	thread_block_t *block = claim_block(list);
+	if (!block) {
+		return NULL;
+	}
+	bool first = !owned;
+	block->thread_next = owned;
+	owned = block;
+
+	// Only register for release once the block is owned. pthread_setspecific()
+	// may calloc() storage for the key, which under LD_PRELOAD comes back into
+	// dalloc (and possibly into the logging path), and the nested call must
+	// find this block rather than claim another one.
+	if (first) {
+		pthread_setspecific(exit_key, block);
+	}
+	return block;
+}
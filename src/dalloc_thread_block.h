@@ -0,0 +1,68 @@
+#ifndef _DALLOC_THREAD_BLOCK_H_
+#define _DALLOC_THREAD_BLOCK_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+struct thread_block_list;
+
+/*
+Header of a per-thread block: a block of memory owned by a single thread,
+for state which can't live in the heap (statistics about the heap itself,
+or log buffers written from inside the allocator). Blocks are mapped
+directly from the OS and are never unmapped. When a thread exits, its
+blocks are released for reuse by other threads, so the number of blocks
+is bounded by the peak number of live threads.
+
+A block type embeds this as its first member.
+*/
+typedef struct thread_block {
+	// Next block in the list of all blocks of the same type.
+	struct thread_block *next;
+	// Next block owned by the same thread.
+	struct thread_block *thread_next;
+	// The list which the block belongs to.
+	struct thread_block_list *list;
+	atomic_bool in_use;
+} thread_block_t;
+
+/*
+All the blocks of one type. Blocks are only ever pushed onto the list, so
+it may be walked without a lock, but blocks owned by other threads may be
+written to concurrently.
+*/
+typedef struct thread_block_list {
+	// Size of a block, including its header.
+	size_t size;
+	// Called with a thread's block when the thread exits, before the block
+	// is released. May be NULL.
+	void (*retire)(thread_block_t *block);
+	_Atomic(thread_block_t *) blocks;
+} thread_block_list_t;
+
+#define THREAD_BLOCK_LIST_INITIALIZER(type, retire) { sizeof(type), (retire), NULL }
+
+/*
+Get the calling thread's block from a list, claiming a block released by
+a thread which has exited or mapping a new, zero-filled one if necessary.
+A reused block keeps whatever its previous owner (and the retire callback)
+left in it. Return NULL on failure.
+
+This is the slow path: callers are expected to cache the result in a
+_Thread_local.
+
+@param list: The list.
+*/
+thread_block_t *thread_block_get(thread_block_list_t *list);
+
+/*
+Return the most recently created block in a list, or NULL if the list is
+empty. The rest of the list is reached through the blocks' next fields.
+
+@param list: The list.
+*/
+static inline thread_block_t *thread_block_first(thread_block_list_t *list) {
+	return atomic_load_explicit(&list->blocks, memory_order_acquire);
+}
+
+#endif // _DALLOC_THREAD_BLOCK_H_
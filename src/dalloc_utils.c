@@ -31,23 +31,24 @@ chunk_t *find_chunk(chunk_t *start, void *user_mem, chunk_t **prev) {
 	return find(start, is_chunk, user_mem, prev);
 }
 
-chunk_t *find_unused_chunk_first(chunk_t *start, size_t size) {
-	chunk_t *prev = NULL;
-	return find(start, can_store, &size, &prev);
+chunk_t *find_unused_chunk_first(chunk_t *start, size_t size, chunk_t **prev) {
+	return find(start, can_store, &size, prev);
 }
 
 /*
 Return the difference between the size of the chunk and the size
-specified by user_data.
+specified by user_data, or -1 if the chunk is in use or too small.
 
 @param chunk: The chunk.
 @param user_data: Pointer to size_t. The size used for comparison.
 */
-int32_t chunk_size_difference(const chunk_t *chunk, void *user_data) {
-	if (chunk->in_use) {
+int64_t chunk_size_difference(const chunk_t *chunk, void *user_data) {
+	size_t size = *(size_t *)user_data;
+	if (chunk->in_use || chunk->size < size) {
 		return -1;
 	}
-	return chunk->size - *(size_t *)user_data;
+	size_t difference = chunk->size - size;
+	return difference > INT64_MAX ? INT64_MAX : (int64_t)difference;
 }
 
 chunk_t *find_unused_chunk_bestfit(chunk_t *start, size_t size) {
@@ -55,7 +56,7 @@ chunk_t *find_unused_chunk_bestfit(chunk_t *start, size_t size) {
 	return min(start, chunk_size_difference, &size, &prev);
 }
 
-int32_t get_allocation(const chunk_t *chunk, void *user_data) {
+int64_t get_allocation(const chunk_t *chunk, void *user_data) {
 	return chunk->size + sizeof(chunk_t);
 }
 
@@ -66,3 +67,18 @@ size_t total_allocated(chunk_t* start) {
 bool is_contiguous(chunk_t *x, chunk_t *y) {
 	return x->start + x->size == y;
 }
+
+bool is_power_of_two(size_t x) {
+	return x && !(x & (x - 1));
+}
+
+size_t align_up(size_t x, size_t alignment) {
+	return (x + alignment - 1) & ~(alignment - 1);
+}
+
+uint32_t size_class(size_t size) {
+	if (size <= 1) {
+		return 0;
+	}
+	return 63 - __builtin_clzll((unsigned long long)size);
+}
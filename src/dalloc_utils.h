@@ -2,10 +2,14 @@
 #define _DALLOC_UTIL_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stddef.h>
 
 #include "chunk.h"
 
+// Number of distinct size classes (see size_class()).
+#define DALLOC_NUM_SIZE_CLASSES 64
+
 /*
 Find metadata for a particular chunk in the heap, return 0 if not
 found.
@@ -25,8 +29,11 @@ size. Return 0 if none found.
 
 @param start: The starting point of the search.
 @param size: Desired size of the chunk.
+@param prev: This will be set to the address of the previous chunk in
+			 the list. If no chunk or the 1st chunk is found, this will
+			 be NULL.
 */
-chunk_t *find_unused_chunk_first(chunk_t *start, size_t size);
+chunk_t *find_unused_chunk_first(chunk_t *start, size_t size, chunk_t **prev);
 
 /*
 Find the chunk which is unused and closest in size to the required
@@ -52,4 +59,27 @@ Check if two chunks are contiguous.
 */
 bool is_contiguous(chunk_t *x, chunk_t *y);
 
+/*
+Check if a number is a power of two.
+
+@param x: The number.
+*/
+bool is_power_of_two(size_t x);
+
+/*
+Round a number up to the nearest multiple of an alignment.
+
+@param x: The number.
+@param alignment: The alignment. Must be a power of two.
+*/
+size_t align_up(size_t x, size_t alignment);
+
+/*
+Return the size class of an allocation size. Size class n holds sizes in
+the range [2^n, 2^(n+1)); sizes 0 and 1 are both in class 0.
+
+@param size: The allocation size.
+*/
+uint32_t size_class(size_t size);
+
 #endif // _DALLOC_UTIL_H_
@@ -4,18 +4,34 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "test_decay.h"
+#include "test_env.h"
+#include "test_frag.h"
 #include "test_free.h"
+#include "test_free_index.h"
+#include "test_guard.h"
 #include "test_heap_manip.h"
 #include "test_heap_traversal.h"
 #include "test_io.h"
+#include "test_latency.h"
+#include "test_lock.h"
+#include "test_buddy.h"
 #include "test_calloc.h"
 #include "test_malloc.h"
+#include "test_mallocx.h"
+#include "test_numa.h"
+#include "test_placement.h"
+#include "test_pool.h"
+#include "test_probes.h"
+#include "test_profile.h"
 #include "test_realloc.h"
 #include "test_reallocarray.h"
+#include "test_search_stats.h"
+#include "test_snapshot.h"
 #include "test_utils.h"
 
 Suite **build_test_suite(size_t *num_suites) {
-    *num_suites = 9;
+    *num_suites = 25;
     Suite **test_suites = (Suite **)malloc(*num_suites * sizeof(Suite *));
     test_suites[0] = d_calloc_test_suite();
     test_suites[1] = d_malloc_test_suite();
@@ -26,6 +42,22 @@ Suite **build_test_suite(size_t *num_suites) {
     test_suites[6] = d_heap_traversal_test_suite();
     test_suites[7] = d_utils_test_suite();
     test_suites[8] = d_io_test_suite();
+    test_suites[9] = d_pool_test_suite();
+    test_suites[10] = d_profile_test_suite();
+    test_suites[11] = d_snapshot_test_suite();
+    test_suites[12] = d_frag_test_suite();
+    test_suites[13] = d_search_stats_test_suite();
+    test_suites[14] = d_guard_test_suite();
+    test_suites[15] = d_numa_test_suite();
+    test_suites[16] = d_decay_test_suite();
+    test_suites[17] = d_env_test_suite();
+    test_suites[18] = d_placement_test_suite();
+    test_suites[19] = d_buddy_test_suite();
+    test_suites[20] = d_latency_test_suite();
+    test_suites[21] = d_free_index_test_suite();
+    test_suites[22] = d_lock_test_suite();
+    test_suites[23] = d_mallocx_test_suite();
+    test_suites[24] = d_probes_test_suite();
 
     return test_suites;
 }
@@ -0,0 +1,175 @@
+#include <check.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dalloc.h"
+#include "dalloc_buddy.h"
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "test_buddy.h"
+#include "test_util.h"
+
+#define BUDDY_TEST_MIN 4096
+#define BUDDY_TEST_MAX (4 * 1024 * 1024)
+
+static bool sigill_raised;
+
+void _buddy_sigill_handler(int32_t signum) {
+	ck_assert_int_eq(SIGILL, signum);
+	sigill_raised = true;
+}
+
+void buddy_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	set_buddy_range(BUDDY_TEST_MIN, BUDDY_TEST_MAX);
+	sigill_raised = false;
+}
+
+void buddy_tests_teardown() {
+	set_buddy_range(0, 0);
+}
+
+START_TEST(test_buddy_disabled) {
+	set_buddy_range(0, 0);
+	void *ptr = d_malloc(BUDDY_TEST_MIN);
+	ck_assert_ptr_nonnull(ptr);
+	ck_assert(!buddy_owns(ptr));
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_buddy_allocate) {
+	size_t size = BUDDY_TEST_MIN + _i * 7919;
+	size_t block_size = BUDDY_TEST_MIN;
+	while (block_size < size) {
+		block_size <<= 1;
+	}
+
+	void *ptr = d_malloc(size);
+	ck_assert_ptr_nonnull(ptr);
+	ck_assert(buddy_owns(ptr));
+	ck_assert_uint_eq(0, (uintptr_t)ptr % block_size);
+	ck_assert_uint_eq(block_size, d_malloc_usable_size(ptr));
+	fill_memory(block_size, ptr);
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_buddy_out_of_range) {
+	void *small = d_malloc(BUDDY_TEST_MIN - 1);
+	void *large = d_malloc(BUDDY_TEST_MAX + 1);
+	ck_assert(!buddy_owns(small));
+	ck_assert(!buddy_owns(large));
+	d_free(small);
+	d_free(large);
+}
+END_TEST
+
+START_TEST(test_buddy_split_merge) {
+	// The first allocations split a fresh top-level block, so they're
+	// buddies.
+	char *ptr0 = d_malloc(BUDDY_TEST_MIN);
+	char *ptr1 = d_malloc(BUDDY_TEST_MIN);
+	char *ptr2 = d_malloc(2 * BUDDY_TEST_MIN);
+	ck_assert_ptr_eq(ptr0 + BUDDY_TEST_MIN, ptr1);
+	ck_assert_ptr_eq(ptr0 + 2 * BUDDY_TEST_MIN, ptr2);
+
+	// Freed blocks are reused before larger blocks are split.
+	d_free(ptr1);
+	ck_assert_ptr_eq(ptr1, d_malloc(BUDDY_TEST_MIN));
+
+	// Once everything is freed, the blocks merge back into a whole
+	// top-level block.
+	d_free(ptr0);
+	d_free(ptr1);
+	d_free(ptr2);
+	ck_assert_ptr_eq(ptr0, d_malloc(BUDDY_TEST_MAX));
+	d_free(ptr0);
+}
+END_TEST
+
+START_TEST(test_buddy_no_merge_with_split_buddy) {
+	// ptr0's buddy is split, with half of it in use, so ptr0 can't merge.
+	char *ptr0 = d_malloc(2 * BUDDY_TEST_MIN);
+	char *ptr1 = d_malloc(BUDDY_TEST_MIN);
+	ck_assert_ptr_eq(ptr0 + 2 * BUDDY_TEST_MIN, ptr1);
+	d_free(ptr0);
+	ck_assert_ptr_eq(ptr0, d_malloc(2 * BUDDY_TEST_MIN));
+	ck_assert_ptr_ne(ptr0, d_malloc(4 * BUDDY_TEST_MIN));
+}
+END_TEST
+
+START_TEST(test_buddy_invalid_free) {
+	attach_signal_handler(SIGILL, _buddy_sigill_handler);
+	char *ptr = d_malloc(2 * BUDDY_TEST_MIN);
+	d_free(ptr + BUDDY_TEST_MIN);
+	ck_assert(sigill_raised);
+
+	sigill_raised = false;
+	d_free(ptr);
+	d_free(ptr);
+	ck_assert(sigill_raised);
+	detach_signal_handlers(SIGILL);
+}
+END_TEST
+
+START_TEST(test_buddy_realloc) {
+	unsigned char *ptr = d_malloc(5000);
+	memset(ptr, 0xab, 5000);
+
+	// Sizes needing the same block keep it.
+	ck_assert_ptr_eq(ptr, d_realloc(ptr, 8192));
+	ck_assert_ptr_eq(ptr, d_realloc(ptr, 4097));
+
+	// Larger sizes move, keeping the contents.
+	unsigned char *grown = d_realloc(ptr, 3 * BUDDY_TEST_MIN);
+	ck_assert(buddy_owns(grown));
+	ck_assert_uint_eq(4 * BUDDY_TEST_MIN, d_malloc_usable_size(grown));
+	for (size_t i = 0; i < 4097; i++) {
+		ck_assert_uint_eq(0xab, grown[i]);
+	}
+
+	// Sizes outside the range move back to the heap.
+	unsigned char *shrunk = d_realloc(grown, 100);
+	ck_assert(!buddy_owns(shrunk));
+	for (size_t i = 0; i < 100; i++) {
+		ck_assert_uint_eq(0xab, shrunk[i]);
+	}
+	d_free(shrunk);
+}
+END_TEST
+
+START_TEST(test_buddy_too_large) {
+	// The range is clamped to the region, and requests larger than the
+	// largest block fail rather than getting a smaller block.
+	set_buddy_range(BUDDY_TEST_MIN, (size_t)4 << 30);
+	ck_assert_uint_eq(BUDDY_REGION_SIZE, buddy_max_size());
+
+	// This is the first allocation, so a whole top block is free.
+	ck_assert_ptr_null(buddy_allocate((size_t)3 << 29));
+	ck_assert_ptr_null(buddy_allocate(BUDDY_REGION_SIZE + 1));
+	void *ptr = d_malloc(BUDDY_TEST_MIN);
+	ck_assert(buddy_owns(ptr));
+	d_free(ptr);
+}
+END_TEST
+
+Suite *d_buddy_test_suite() {
+	TCase *test_case = tcase_create("buddy test case");
+	tcase_add_checked_fixture(test_case, buddy_tests_setup, buddy_tests_teardown);
+
+	tcase_add_test(test_case, test_buddy_disabled);
+	tcase_add_loop_test(test_case, test_buddy_allocate, 0, 8);
+	tcase_add_test(test_case, test_buddy_out_of_range);
+	tcase_add_test(test_case, test_buddy_too_large);
+	tcase_add_test(test_case, test_buddy_split_merge);
+	tcase_add_test(test_case, test_buddy_no_merge_with_split_buddy);
+	tcase_add_test(test_case, test_buddy_invalid_free);
+	tcase_add_test(test_case, test_buddy_realloc);
+
+	Suite *suite = suite_create("buddy tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
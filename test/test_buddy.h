@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_BUDDY_H_
+#define _DALLOC_TEST_BUDDY_H_
+
+#include <check.h>
+
+Suite *d_buddy_test_suite();
+
+#endif // _DALLOC_TEST_BUDDY_H_
@@ -0,0 +1,159 @@
+#include <check.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_decay.h"
+#include "dalloc_io.h"
+#include "dalloc_os.h"
+#include "dalloc_utils.h"
+#include "test_decay.h"
+#include "test_util.h"
+
+// Size of the hole left in the middle of the heap.
+#define DECAY_TEST_HOLE_SIZE (8 * 1024 * 1024)
+
+// Size of the allocation which keeps the hole off the top of the heap. It's
+// larger than the hole so that it can't be placed before it.
+#define DECAY_TEST_PIN_SIZE (16 * 1024 * 1024)
+
+void decay_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	set_trim_threshold(0);
+	set_top_pad(0);
+}
+
+void decay_tests_teardown() {
+	set_decay_time(DALLOC_DEFAULT_DECAY_TIME);
+}
+
+/*
+Return a byte in the middle of a page which is entirely within a chunk.
+*/
+static volatile unsigned char *probe(void *ptr) {
+	return (unsigned char *)align_up((uintptr_t)ptr, os_page_size()) + os_page_size() / 2;
+}
+
+/*
+Allocate a hole and the allocation which pins it, and fill the hole. A
+small allocation is made before the hole, to be recycled by tick_heap().
+*/
+static void *make_hole(void **small, void **pin) {
+	*small = d_malloc(64);
+	ck_assert_ptr_nonnull(*small);
+	void *hole = d_malloc(DECAY_TEST_HOLE_SIZE);
+	*pin = d_malloc(DECAY_TEST_PIN_SIZE);
+	ck_assert_ptr_nonnull(hole);
+	ck_assert_ptr_nonnull(*pin);
+	memset(hole, 0xab, DECAY_TEST_HOLE_SIZE);
+	return hole;
+}
+
+/*
+Perform enough heap operations to tick the decay clock, without touching
+the hole: the small allocation is freed and reallocated in place, since
+first fit finds it before the hole.
+*/
+static void tick_heap(void *small) {
+	for (size_t i = 0; i < DECAY_TICK_INTERVAL * 2; i++) {
+		d_free(small);
+		ck_assert_ptr_eq(small, d_malloc(64));
+	}
+}
+
+START_TEST(test_heap_purge) {
+	void *small, *pin;
+	void *hole = make_hole(&small, &pin);
+	d_free(hole);
+	ck_assert_uint_eq(0xab, *probe(hole));
+
+	// Only whole pages are purged.
+	ck_assert_uint_ge(d_heap_purge(), DECAY_TEST_HOLE_SIZE - 2 * os_page_size());
+	ck_assert_uint_eq(0, *probe(hole));
+
+	// Purged chunks aren't purged again.
+	ck_assert_uint_lt(d_heap_purge(), DECAY_TEST_HOLE_SIZE / 2);
+
+	// The purged memory can be reused.
+	void *ptr = d_malloc(DECAY_TEST_HOLE_SIZE);
+	ck_assert_ptr_eq(hole, ptr);
+	fill_memory(DECAY_TEST_HOLE_SIZE, ptr);
+	d_free(ptr);
+	d_free(pin);
+	d_free(small);
+}
+END_TEST
+
+START_TEST(test_decay_expired) {
+	set_decay_time(1);
+	void *small, *pin;
+	void *hole = make_hole(&small, &pin);
+	d_free(hole);
+
+	struct timespec wait = { 0, 20 * 1000 * 1000 };
+	nanosleep(&wait, NULL);
+	tick_heap(small);
+	ck_assert_uint_eq(0, *probe(hole));
+	d_free(pin);
+	d_free(small);
+}
+END_TEST
+
+START_TEST(test_decay_not_expired) {
+	set_decay_time(60 * 1000);
+	void *small, *pin;
+	void *hole = make_hole(&small, &pin);
+	d_free(hole);
+
+	tick_heap(small);
+	ck_assert_uint_eq(0xab, *probe(hole));
+	d_free(pin);
+	d_free(small);
+}
+END_TEST
+
+START_TEST(test_decay_disabled) {
+	set_decay_time(0);
+	void *small, *pin;
+	void *hole = make_hole(&small, &pin);
+	d_free(hole);
+
+	struct timespec wait = { 0, 20 * 1000 * 1000 };
+	nanosleep(&wait, NULL);
+	tick_heap(small);
+	ck_assert_uint_eq(0xab, *probe(hole));
+	d_free(pin);
+	d_free(small);
+}
+END_TEST
+
+START_TEST(test_decay_in_use_not_purged) {
+	set_decay_time(1);
+	void *small, *pin;
+	void *hole = make_hole(&small, &pin);
+
+	d_heap_purge();
+	ck_assert_uint_eq(0xab, *probe(hole));
+	d_free(hole);
+	d_free(pin);
+	d_free(small);
+}
+END_TEST
+
+Suite *d_decay_test_suite() {
+	TCase *test_case = tcase_create("decay test case");
+	tcase_add_checked_fixture(test_case, decay_tests_setup, decay_tests_teardown);
+
+	tcase_add_test(test_case, test_heap_purge);
+	tcase_add_test(test_case, test_decay_expired);
+	tcase_add_test(test_case, test_decay_not_expired);
+	tcase_add_test(test_case, test_decay_disabled);
+	tcase_add_test(test_case, test_decay_in_use_not_purged);
+
+	Suite *suite = suite_create("decay tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_DECAY_H_
+#define _DALLOC_TEST_DECAY_H_
+
+#include <check.h>
+
+Suite *d_decay_test_suite();
+
+#endif // _DALLOC_TEST_DECAY_H_
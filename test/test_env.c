@@ -0,0 +1,124 @@
+#include <check.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_env.h"
+#include "dalloc_guard.h"
+#include "dalloc_io.h"
+#include "dalloc_pool.h"
+#include "test_env.h"
+
+void env_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+}
+
+void env_tests_teardown() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	set_trim_threshold(DALLOC_DEFAULT_TRIM_THRESHOLD);
+	set_top_pad(DALLOC_DEFAULT_TOP_PAD);
+	set_decay_time(DALLOC_DEFAULT_DECAY_TIME);
+	set_huge_pages(DALLOC_HUGE_PAGES_NONE);
+	set_numa_nodes(0);
+	set_numa_interleave_threshold(0);
+	set_pool_tcache_capacity(0);
+	set_placement_policy(DALLOC_PLACEMENT_FIRST_FIT);
+	d_guard_stop();
+}
+
+START_TEST(test_conf_empty) {
+	ck_assert(parse_conf(""));
+	ck_assert(parse_conf(","));
+	ck_assert_uint_eq(DALLOC_DEFAULT_TRIM_THRESHOLD, trim_threshold());
+}
+END_TEST
+
+START_TEST(test_conf_sizes) {
+	ck_assert(parse_conf("trim_threshold:1000,top_pad:4k,numa_interleave:2M,decay_ms:0"));
+	ck_assert_uint_eq(1000, trim_threshold());
+	ck_assert_uint_eq(4096, top_pad());
+	ck_assert_uint_eq(2 * 1024 * 1024, numa_interleave_threshold());
+	ck_assert_uint_eq(0, decay_time());
+
+	ck_assert(parse_conf("buddy_min:4k,buddy_max:4M"));
+	ck_assert_uint_eq(4096, buddy_min_size());
+	ck_assert_uint_eq(4 * 1024 * 1024, buddy_max_size());
+	ck_assert(!parse_conf("buddy_max:2G"));
+	ck_assert_uint_eq(4 * 1024 * 1024, buddy_max_size());
+	set_buddy_range(0, 0);
+
+	ck_assert(parse_conf("trim_threshold:1G"));
+	ck_assert_uint_eq((size_t)1 << 30, trim_threshold());
+}
+END_TEST
+
+START_TEST(test_conf_names) {
+	ck_assert(parse_conf("huge_pages:transparent,log_level:none"));
+	ck_assert_int_eq(DALLOC_HUGE_PAGES_TRANSPARENT, huge_pages());
+	ck_assert(parse_conf("huge_pages:none"));
+	ck_assert_int_eq(DALLOC_HUGE_PAGES_NONE, huge_pages());
+	ck_assert(parse_conf("placement:best"));
+	ck_assert_int_eq(DALLOC_PLACEMENT_BEST_FIT, placement_policy());
+	ck_assert(!parse_conf("placement:worst"));
+}
+END_TEST
+
+START_TEST(test_conf_invalid) {
+	// Valid options are applied even if others are invalid.
+	ck_assert(!parse_conf("bogus:1,top_pad:8k"));
+	ck_assert_uint_eq(8192, top_pad());
+
+	ck_assert(!parse_conf("top_pad"));
+	ck_assert(!parse_conf("top_pad:"));
+	ck_assert(!parse_conf("top_pad:12q"));
+	ck_assert(!parse_conf("top_pad:4kk"));
+	ck_assert(!parse_conf("top_pad:99999999999999999999999"));
+	ck_assert(!parse_conf("huge_pages:sometimes"));
+	ck_assert(!parse_conf("guard_slots:4"));
+	ck_assert_uint_eq(8192, top_pad());
+}
+END_TEST
+
+START_TEST(test_conf_pool_tcache) {
+	ck_assert(parse_conf("pool_tcache:16"));
+	ck_assert_uint_eq(16, pool_tcache_capacity());
+
+	// Objects put by the thread stay in its cache, rather than returning
+	// to the shared free list.
+	d_pool_t *pool = d_pool_create(32, 0);
+	ck_assert_ptr_nonnull(pool);
+	void *obj = d_pool_get(pool);
+	d_pool_stats_t before;
+	d_pool_get_stats(pool, &before);
+	d_pool_put(pool, obj);
+	d_pool_stats_t after;
+	d_pool_get_stats(pool, &after);
+	ck_assert_uint_eq(before.num_free, after.num_free);
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_conf_guard) {
+	ck_assert(parse_conf("guard_slots:4,guard_rate:1"));
+	void *ptr = d_malloc(32);
+	ck_assert(guard_owns(ptr));
+	d_free(ptr);
+}
+END_TEST
+
+Suite *d_env_test_suite() {
+	TCase *test_case = tcase_create("env test case");
+	tcase_add_checked_fixture(test_case, env_tests_setup, env_tests_teardown);
+
+	tcase_add_test(test_case, test_conf_empty);
+	tcase_add_test(test_case, test_conf_sizes);
+	tcase_add_test(test_case, test_conf_names);
+	tcase_add_test(test_case, test_conf_invalid);
+	tcase_add_test(test_case, test_conf_pool_tcache);
+	tcase_add_test(test_case, test_conf_guard);
+
+	Suite *suite = suite_create("env tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_ENV_H_
+#define _DALLOC_TEST_ENV_H_
+
+#include <check.h>
+
+Suite *d_env_test_suite();
+
+#endif // _DALLOC_TEST_ENV_H_
@@ -0,0 +1,206 @@
+#include <check.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_frag.h"
+#include "dalloc_io.h"
+#include "dalloc_snapshot.h"
+#include "dalloc_utils.h"
+#include "test_frag.h"
+
+#define FRAG_TEST_NUM_PTRS 64
+#define FRAG_TEST_ITERATIONS 2000
+
+void frag_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	set_trim_threshold(0);
+	set_top_pad(0);
+}
+
+void frag_tests_teardown() {
+
+}
+
+/*
+Calculate the fragmentation metrics the slow way, by walking a snapshot
+of the heap.
+
+@param expected: (out) The metrics. Fragmentation indices aren't set.
+*/
+static void walk_heap(d_heap_frag_stats_t *expected) {
+	memset(expected, 0, sizeof(*expected));
+
+	FILE *file = tmpfile();
+	ck_assert_ptr_nonnull(file);
+	int fd = fileno(file);
+	ck_assert(d_heap_snapshot(fd));
+	lseek(fd, sizeof(d_snapshot_header_t), SEEK_SET);
+
+	d_snapshot_chunk_t chunk;
+	while (read(fd, &chunk, sizeof(chunk)) == sizeof(chunk)) {
+		if (snapshot_chunk_in_use(&chunk)) {
+			continue;
+		}
+		size_t size = snapshot_chunk_size(&chunk);
+		uint32_t class = snapshot_chunk_class(&chunk);
+		expected->free_chunks++;
+		expected->free_bytes += size;
+		expected->class_free_chunks[class]++;
+		expected->class_free_bytes[class] += size;
+		if (size > expected->largest_free) {
+			expected->largest_free = size;
+		}
+	}
+	fclose(file);
+}
+
+static void assert_stats_match_heap() {
+	d_heap_frag_stats_t expected, actual;
+	walk_heap(&expected);
+	d_heap_get_frag_stats(&actual);
+
+	ck_assert_uint_eq(expected.free_chunks, actual.free_chunks);
+	ck_assert_uint_eq(expected.free_bytes, actual.free_bytes);
+	ck_assert_uint_eq(expected.largest_free, actual.largest_free);
+	for (uint32_t i = 0; i < DALLOC_NUM_SIZE_CLASSES; i++) {
+		ck_assert_uint_eq(expected.class_free_chunks[i], actual.class_free_chunks[i]);
+		ck_assert_uint_eq(expected.class_free_bytes[i], actual.class_free_bytes[i]);
+	}
+}
+
+START_TEST(test_frag_empty_heap) {
+	d_heap_frag_stats_t stats;
+	d_heap_get_frag_stats(&stats);
+	ck_assert_uint_eq(0, stats.free_chunks);
+	ck_assert_uint_eq(0, stats.free_bytes);
+	ck_assert_uint_eq(0, stats.largest_free);
+	ck_assert(stats.fragmentation == 0);
+}
+END_TEST
+
+START_TEST(test_frag_free_chunks) {
+	void *small = d_malloc(100);
+	void *ptr0 = d_malloc(16);
+	void *large = d_malloc(1000);
+	void *ptr1 = d_malloc(16);
+
+	d_free(small);
+	d_free(large);
+
+	d_heap_frag_stats_t stats;
+	d_heap_get_frag_stats(&stats);
+	ck_assert_uint_eq(2, stats.free_chunks);
+	ck_assert_uint_eq(1100, stats.free_bytes);
+	ck_assert_uint_eq(1000, stats.largest_free);
+	ck_assert(stats.fragmentation == 1.0 - 1000.0 / 1100.0);
+	ck_assert_uint_eq(1, stats.class_free_chunks[size_class(100)]);
+	ck_assert_uint_eq(100, stats.class_free_bytes[size_class(100)]);
+	ck_assert_uint_eq(1, stats.class_free_chunks[size_class(1000)]);
+
+	// A 1000-byte request can't use the 100-byte chunk, but a small request
+	// can use either.
+	ck_assert(stats.class_fragmentation[size_class(1000)] == 100.0 / 1100.0);
+	ck_assert(stats.class_fragmentation[size_class(64)] == 0);
+	ck_assert(stats.class_fragmentation[size_class(4096)] == 1);
+
+	// Allocating from the largest chunk means the new largest must be found.
+	void *reused = d_malloc(1000);
+	ck_assert_ptr_eq(large, reused);
+	d_heap_get_frag_stats(&stats);
+	ck_assert_uint_eq(1, stats.free_chunks);
+	ck_assert_uint_eq(100, stats.largest_free);
+	ck_assert(stats.fragmentation == 0);
+
+	d_free(reused);
+	d_free(ptr0);
+	d_free(ptr1);
+}
+END_TEST
+
+static bool count_visited(const chunk_t *chunk, void *user_data) {
+	ck_assert(!chunk->in_use);
+	(*(size_t *)user_data)++;
+	return true;
+}
+
+START_TEST(test_frag_for_each_free) {
+	size_t sizes[4] = { 8192, 16, 100, 16 };
+	void *ptrs[4];
+	for (int32_t i = 0; i < 4; i++) {
+		ptrs[i] = d_malloc(sizes[i]);
+	}
+	d_free(ptrs[0]);
+	d_free(ptrs[2]);
+
+	// Only the unused chunks of at least the minimum size are visited.
+	size_t visited = 0;
+	ck_assert(frag_for_each_free(4096, count_visited, &visited));
+	ck_assert_uint_eq(1, visited);
+	visited = 0;
+	ck_assert(frag_for_each_free(0, count_visited, &visited));
+	ck_assert_uint_eq(2, visited);
+
+	d_free(ptrs[1]);
+	d_free(ptrs[3]);
+}
+END_TEST
+
+START_TEST(test_frag_matches_heap) {
+	// Loop index selects the trim settings, so that both the trimming and
+	// top pad paths are exercised, and the placement policy.
+	set_trim_threshold(_i & 1 ? 4096 : 0);
+	set_top_pad(_i & 2 ? 8192 : 0);
+	set_placement_policy(_i >> 2);
+
+	srand(_i);
+	void *ptrs[FRAG_TEST_NUM_PTRS] = { NULL };
+	for (int32_t i = 0; i < FRAG_TEST_ITERATIONS; i++) {
+		int32_t index = rand() % FRAG_TEST_NUM_PTRS;
+		size_t size = 1 + rand() % 2048;
+		switch (rand() % 3) {
+			case 0:
+				d_free(ptrs[index]);
+				ptrs[index] = d_malloc(size);
+				break;
+			case 1:
+				d_free(ptrs[index]);
+				ptrs[index] = NULL;
+				break;
+			default:
+				if (ptrs[index]) {
+					ptrs[index] = d_realloc(ptrs[index], size);
+				}
+				break;
+		}
+		if (i % 100 == 0) {
+			assert_stats_match_heap();
+		}
+	}
+	assert_stats_match_heap();
+
+	for (int32_t i = 0; i < FRAG_TEST_NUM_PTRS; i++) {
+		d_free(ptrs[i]);
+	}
+	assert_stats_match_heap();
+}
+END_TEST
+
+Suite *d_frag_test_suite() {
+	TCase *test_case = tcase_create("frag test case");
+	tcase_add_checked_fixture(test_case, frag_tests_setup, frag_tests_teardown);
+
+	tcase_add_test(test_case, test_frag_empty_heap);
+	tcase_add_test(test_case, test_frag_free_chunks);
+	tcase_add_test(test_case, test_frag_for_each_free);
+	tcase_add_loop_test(test_case, test_frag_matches_heap, 0, 16);
+
+	Suite *suite = suite_create("frag tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
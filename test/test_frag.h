@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_FRAG_H_
+#define _DALLOC_TEST_FRAG_H_
+
+#include <check.h>
+
+Suite *d_frag_test_suite();
+
+#endif // _DALLOC_TEST_FRAG_H_
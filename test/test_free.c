@@ -5,22 +5,45 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "chunk.h"
 #include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_frag.h"
+#include "dalloc_os.h"
 #include "dalloc_io.h"
 #include "test_free.h"
 #include "test_util.h"
 
 bool _test_free_sigill_raised;
 
+// Number of calls made to counting_sbrk() which moved the break.
+static int32_t sbrk_calls;
+
 void *custom_sbrk(intptr_t increment) {
+	if (!increment) {
+		// Let queries of the break through.
+		return sbrk(0);
+	}
 	sbrk(increment);
 	return (void *)-1;
 }
 
+void *counting_sbrk(intptr_t increment) {
+	if (increment) {
+		sbrk_calls++;
+	}
+	return sbrk(increment);
+}
+
 void free_tests_setup() {
 	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	// These tests check the position of the program break, so memory must
+	// be requested from and released to the OS exactly when it's needed.
+	set_trim_threshold(0);
+	set_top_pad(0);
 	_test_free_sigill_raised = false;
 }
 
@@ -175,12 +198,141 @@ START_TEST(test_free_unused_chunk) {
 }
 END_TEST
 
+START_TEST(test_free_trim_stops_at_gap) {
+	void *pbrk_initial = sbrk(0);
+	void *ptr0 = d_malloc(256);
+	void *ptr1 = d_malloc(256);
+
+	// Something else moves the break, so the next chunk isn't contiguous.
+	void *foreign = sbrk(4096);
+	void *ptr2 = d_malloc(256);
+	ck_assert_ptr_eq(foreign + 4096 + sizeof(chunk_t), ptr2);
+
+	// The top chunk is released, but the one below the foreign region
+	// isn't merged with it.
+	d_free(ptr1);
+	d_free(ptr2);
+	ck_assert_ptr_eq(foreign + 4096, sbrk(0));
+	d_heap_frag_stats_t stats;
+	d_heap_get_frag_stats(&stats);
+	ck_assert_uint_eq(1, stats.free_chunks);
+	ck_assert_uint_eq(256, stats.free_bytes);
+	memset(foreign, 1, 4096);
+
+	// Once the foreign region is gone, the rest of the heap can go too.
+	sbrk(-4096);
+	d_free(ptr0);
+	ck_assert_ptr_eq(pbrk_initial, sbrk(0));
+	d_heap_get_frag_stats(&stats);
+	ck_assert_uint_eq(0, stats.free_chunks);
+}
+END_TEST
+
 START_TEST(test_free_null) {
 	d_free(NULL);
 	// A crash will cause test failure. Any other behaviour is acceptable.
 }
 END_TEST
 
+START_TEST(test_free_below_trim_threshold) {
+	// Freeing a chunk at the top of the heap should not release it to the
+	// OS while it's smaller than the trim threshold, so repeatedly
+	// allocating and freeing it shouldn't need any syscalls.
+	set_trim_threshold(1024);
+	void *ptr0 = d_malloc(64);
+	void *ptr1 = d_malloc(64);
+	void *pbrk0 = sbrk(0);
+
+	attach_sbrk_handler(counting_sbrk);
+	for (int32_t i = 0; i < 16; i++) {
+		d_free(ptr1);
+		ck_assert_ptr_eq(pbrk0, sbrk(0));
+		ptr1 = d_malloc(64);
+	}
+	remove_sbrk_handlers();
+	ck_assert_int_eq(0, sbrk_calls);
+
+	d_free(ptr1);
+	d_free(ptr0);
+}
+END_TEST
+
+START_TEST(test_free_above_trim_threshold) {
+	// Once the unused memory at the top of the heap exceeds the trim
+	// threshold, it should all be released with a single call to sbrk.
+	size_t threshold = 1024;
+	set_trim_threshold(threshold);
+	void *pbrk_initial = sbrk(0);
+
+	// The first four frees take the unused memory over the threshold.
+	// The last two don't.
+	void *ptrs[6];
+	for (int32_t i = 0; i < 6; i++) {
+		ptrs[i] = d_malloc(threshold / 4);
+	}
+
+	attach_sbrk_handler(counting_sbrk);
+	for (int32_t i = 5; i >= 0; i--) {
+		d_free(ptrs[i]);
+	}
+	remove_sbrk_handlers();
+
+	ck_assert_int_eq(1, sbrk_calls);
+
+	// The remaining free chunks are below the threshold. Lowering the
+	// threshold releases them on the next free.
+	set_trim_threshold(0);
+	void *ptr = d_malloc(8);
+	d_free(ptr);
+	ck_assert_ptr_eq(pbrk_initial, sbrk(0));
+}
+END_TEST
+
+START_TEST(test_free_retains_top_pad) {
+	// With a top pad, trimming the heap should keep the pad (rounded up to
+	// the end of a page) for reuse.
+	size_t pad = 4096;
+	set_top_pad(pad);
+	void *pbrk_initial = sbrk(0);
+
+	void *ptr = d_malloc(1 << 16);
+	void *pbrk0 = sbrk(0);
+	ck_assert_uint_ge((uintptr_t)pbrk0, (uintptr_t)ptr + (1 << 16) + pad);
+	d_free(ptr);
+
+	void *pbrk1 = sbrk(0);
+	ck_assert_uint_lt((uintptr_t)pbrk1, (uintptr_t)pbrk0);
+	ck_assert_uint_ge((uintptr_t)pbrk1, (uintptr_t)pbrk_initial + pad);
+	ck_assert_uint_eq(0, (uintptr_t)pbrk1 % getpagesize());
+
+	// An allocation which fits in the pad shouldn't move the break.
+	ptr = d_malloc(pad / 2);
+	ck_assert_ptr_eq(pbrk1, sbrk(0));
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_free_huge_pages) {
+	// With huge pages, trimming the heap mustn't split a huge page, so the
+	// break should stay on a huge page boundary.
+	set_huge_pages(DALLOC_HUGE_PAGES_TRANSPARENT);
+	size_t huge_page_size = os_huge_page_size();
+
+	void *ptr0 = d_malloc(64);
+	void *ptr1 = d_malloc(huge_page_size * 2);
+	void *pbrk0 = sbrk(0);
+	d_free(ptr1);
+
+	void *pbrk1 = sbrk(0);
+	ck_assert_uint_lt((uintptr_t)pbrk1, (uintptr_t)pbrk0);
+	ck_assert_uint_gt((uintptr_t)pbrk1, (uintptr_t)ptr0 + 64);
+	ck_assert_uint_eq(0, (uintptr_t)pbrk1 % huge_page_size);
+
+	d_free(ptr0);
+	set_huge_pages(DALLOC_HUGE_PAGES_NONE);
+}
+END_TEST
+
 Suite *d_free_test_suite() {
 	// Freed in srunner_free().
     TCase* test_case = tcase_create("d_free test case");
@@ -192,7 +344,12 @@ Suite *d_free_test_suite() {
 	tcase_add_test(test_case, test_greedy_free);
 	tcase_add_test(test_case, test_free_sbrk_failure);
 	tcase_add_test(test_case, test_free_unused_chunk);
+	tcase_add_test(test_case, test_free_trim_stops_at_gap);
 	tcase_add_test(test_case, test_free_null);
+	tcase_add_test(test_case, test_free_below_trim_threshold);
+	tcase_add_test(test_case, test_free_above_trim_threshold);
+	tcase_add_test(test_case, test_free_retains_top_pad);
+	tcase_add_test(test_case, test_free_huge_pages);
 
 	// Freed in srunner_free().
     Suite *suite = suite_create("free tests");
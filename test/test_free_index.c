@@ -0,0 +1,190 @@
+#include <check.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "chunk.h"
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_free_index.h"
+#include "dalloc_io.h"
+#include "test_free_index.h"
+
+#define NUM_CHUNKS 64
+
+// Fake chunks, in ascending order of address.
+static chunk_t chunks[NUM_CHUNKS];
+
+void free_index_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	free_index_clear();
+	for (size_t i = 0; i < NUM_CHUNKS; i++) {
+		chunks[i].size = 16 * (i % 8 + 1);
+		chunks[i].in_use = false;
+		chunks[i].indexed = false;
+	}
+}
+
+void free_index_tests_teardown() {
+	free_index_clear();
+}
+
+static size_t scan_reference(const uint32_t *sizes, size_t count, uint32_t size) {
+	for (size_t i = 0; i < count; i++) {
+		if (sizes[i] >= size) {
+			return i;
+		}
+	}
+	return count;
+}
+
+START_TEST(test_free_index_scan) {
+	// Every length and position of the first fit, at every alignment, so
+	// that each vector width and the scalar tail are all exercised.
+	uint32_t sizes[64 + 8];
+	for (size_t offset = 0; offset < 8; offset++) {
+		for (size_t count = 0; count <= 64; count++) {
+			for (size_t fit = 0; fit <= count; fit++) {
+				uint32_t *s = sizes + offset;
+				for (size_t i = 0; i < count; i++) {
+					s[i] = i < fit ? 100 : 200;
+				}
+				ck_assert_uint_eq(fit, free_index_scan(s, count, 101));
+				ck_assert_uint_eq(0, free_index_scan(s, count, 100));
+			}
+		}
+	}
+
+	// Comparisons are unsigned.
+	uint32_t big[20];
+	for (size_t i = 0; i < 20; i++) {
+		big[i] = 0x7fffffffu;
+	}
+	big[17] = 0x80000000u;
+	big[19] = UINT32_MAX;
+	ck_assert_uint_eq(17, free_index_scan(big, 20, 0x80000000u));
+	ck_assert_uint_eq(19, free_index_scan(big, 20, UINT32_MAX));
+	ck_assert_uint_eq(0, free_index_scan(big, 20, 1));
+}
+END_TEST
+
+START_TEST(test_free_index_scan_random) {
+	uint32_t sizes[1000];
+	uint64_t state = 88172645463325252ULL;
+	for (int round = 0; round < 100; round++) {
+		for (size_t i = 0; i < 1000; i++) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			sizes[i] = (uint32_t)(state >> 32);
+		}
+		uint32_t size = (uint32_t)state | 0xfff00000u;
+		ck_assert_uint_eq(scan_reference(sizes, 1000, size), free_index_scan(sizes, 1000, size));
+	}
+}
+END_TEST
+
+START_TEST(test_free_index_first_fit) {
+	// Insert out of order; the index keeps address order.
+	for (size_t i = NUM_CHUNKS; i-- > 0; ) {
+		ck_assert(free_index_insert(&chunks[i]));
+		ck_assert(chunks[i].indexed);
+	}
+	ck_assert_ptr_eq(&chunks[0], free_index_first_fit(16));
+	ck_assert_ptr_eq(&chunks[2], free_index_first_fit(33));
+	ck_assert_ptr_eq(&chunks[7], free_index_first_fit(128));
+	ck_assert_ptr_null(free_index_first_fit(129));
+
+	free_index_remove(&chunks[7]);
+	ck_assert(!chunks[7].indexed);
+	ck_assert_ptr_eq(&chunks[15], free_index_first_fit(128));
+	free_index_remove(&chunks[0]);
+	ck_assert_ptr_eq(&chunks[1], free_index_first_fit(1));
+
+	// Resizing a chunk means removing and reinserting it.
+	free_index_remove(&chunks[3]);
+	chunks[3].size = 1000;
+	free_index_insert(&chunks[3]);
+	ck_assert_ptr_eq(&chunks[3], free_index_first_fit(129));
+}
+END_TEST
+
+START_TEST(test_free_index_saturated) {
+	// Sizes of 4 GiB and more are saturated, so the headers of candidates
+	// are checked.
+	chunks[1].size = (size_t)UINT32_MAX + 100;
+	chunks[2].size = (size_t)UINT32_MAX + 1000;
+	for (size_t i = 0; i < 4; i++) {
+		free_index_insert(&chunks[i]);
+	}
+	ck_assert_ptr_eq(&chunks[1], free_index_first_fit(4096));
+	ck_assert_ptr_eq(&chunks[2], free_index_first_fit((size_t)UINT32_MAX + 101));
+	ck_assert_ptr_null(free_index_first_fit((size_t)UINT32_MAX + 1001));
+}
+END_TEST
+
+START_TEST(test_free_index_overflow) {
+	size_t num = FREE_INDEX_MAX_ENTRIES + 1;
+	chunk_t *many = calloc(num, sizeof(chunk_t));
+	for (size_t i = 0; i < FREE_INDEX_MAX_ENTRIES; i++) {
+		many[i].size = 64;
+		ck_assert(free_index_insert(&many[i]));
+	}
+	ck_assert(!free_index_overflowed());
+	ck_assert_ptr_eq(&many[0], free_index_first_fit(64));
+
+	// One more chunk overflows the index, but is still counted.
+	many[num - 1].size = 64;
+	ck_assert(!free_index_insert(&many[num - 1]));
+	ck_assert(many[num - 1].indexed);
+	ck_assert(free_index_overflowed());
+	ck_assert(!free_index_should_rebuild());
+
+	// Once half the chunks have gone it can be rebuilt.
+	for (size_t i = 0; i <= FREE_INDEX_MAX_ENTRIES / 2; i++) {
+		free_index_remove(&many[i]);
+	}
+	ck_assert(free_index_should_rebuild());
+	free_index_clear();
+	ck_assert(!free_index_overflowed());
+	free(many);
+}
+END_TEST
+
+START_TEST(test_free_index_heap) {
+	set_placement_policy(DALLOC_PLACEMENT_FIRST_FIT);
+	set_trim_threshold(SIZE_MAX);
+
+	// Free every other allocation, then check that each hole is reused in
+	// address order.
+	void *ptrs[32];
+	for (int i = 0; i < 32; i++) {
+		ptrs[i] = d_malloc(100 + i);
+	}
+	for (int i = 0; i < 32; i += 2) {
+		d_free(ptrs[i]);
+	}
+	for (int i = 0; i < 32; i += 2) {
+		ck_assert_ptr_eq(ptrs[i], d_malloc(100));
+	}
+	for (int i = 0; i < 32; i++) {
+		d_free(ptrs[i]);
+	}
+}
+END_TEST
+
+Suite *d_free_index_test_suite() {
+	TCase *test_case = tcase_create("free index test case");
+	tcase_add_checked_fixture(test_case, free_index_tests_setup, free_index_tests_teardown);
+
+	tcase_add_test(test_case, test_free_index_scan);
+	tcase_add_test(test_case, test_free_index_scan_random);
+	tcase_add_test(test_case, test_free_index_first_fit);
+	tcase_add_test(test_case, test_free_index_saturated);
+	tcase_add_test(test_case, test_free_index_overflow);
+	tcase_add_test(test_case, test_free_index_heap);
+
+	Suite *suite = suite_create("free index tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_FREE_INDEX_H_
+#define _DALLOC_TEST_FREE_INDEX_H_
+
+#include <check.h>
+
+Suite *d_free_index_test_suite();
+
+#endif // _DALLOC_TEST_FREE_INDEX_H_
@@ -0,0 +1,282 @@
+#include <check.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_guard.h"
+#include "dalloc_io.h"
+#include "dalloc_utils.h"
+#include "test_guard.h"
+#include "test_util.h"
+
+static bool sigill_raised;
+
+void guard_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	sigill_raised = false;
+}
+
+void guard_tests_teardown() {
+	d_guard_stop();
+}
+
+void _guard_sigill_handler(int32_t signum) {
+	ck_assert_int_eq(SIGILL, signum);
+	sigill_raised = true;
+}
+
+static uintptr_t page_of(const void *ptr) {
+	return (uintptr_t)ptr & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+}
+
+/*
+Run a function which faults in a child process, with stderr redirected to
+a pipe, and check that the fault was reported and the child aborted.
+
+@param fault: The function.
+@param expected: Text which the report must contain.
+*/
+static void check_fault_report(void (*fault)(), const char *expected) {
+	int fds[2];
+	ck_assert_int_eq(0, pipe(fds));
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		dup2(fds[1], STDERR_FILENO);
+		set_log_level(DALLOC_LOG_LEVEL_ERROR);
+		fault();
+		_exit(0);
+	}
+	close(fds[1]);
+
+	char output[4096];
+	size_t len = 0;
+	ssize_t n;
+	while ((n = read(fds[0], output + len, sizeof(output) - 1 - len)) > 0) {
+		len += n;
+	}
+	output[len] = 0;
+	close(fds[0]);
+
+	int status;
+	ck_assert_int_eq(pid, waitpid(pid, &status, 0));
+	ck_assert(WIFSIGNALED(status));
+	ck_assert_int_eq(SIGABRT, WTERMSIG(status));
+	ck_assert_ptr_nonnull(strstr(output, expected));
+}
+
+static void use_after_free() {
+	volatile char *ptr = d_malloc(32);
+	d_free((void *)ptr);
+	ptr[0] = 1;
+}
+
+static void overflow() {
+	volatile char *ptr = d_malloc(32);
+	uintptr_t page_end = page_of((void *)ptr) + sysconf(_SC_PAGESIZE);
+	*(volatile char *)page_end = 1;
+}
+
+static int unrelated_faults = 0;
+
+/*
+SIGSEGV handler installed before the guard's, which makes the faulting
+page accessible so that the access succeeds when retried.
+*/
+static void unrelated_fault_handler(int signum, siginfo_t *info, void *context) {
+	unrelated_faults++;
+	mprotect((void *)page_of(info->si_addr), sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE);
+}
+
+static void unrelated_fault_then_use_after_free() {
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = unrelated_fault_handler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, NULL);
+	if (!d_guard_start(4, 1)) {
+		_exit(1);
+	}
+
+	volatile char *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	page[0] = 1;
+	page[1] = 1;
+	// The previous handler is called once, and the guard's handler stays
+	// installed.
+	if (unrelated_faults != 1 || page[0] != 1) {
+		_exit(2);
+	}
+	use_after_free();
+}
+
+START_TEST(test_guard_invalid_args) {
+	ck_assert(!d_guard_start(0, 1));
+	ck_assert(!d_guard_start(1, 0));
+}
+END_TEST
+
+START_TEST(test_guard_allocate) {
+	// With a sample rate of 1, every allocation is guarded.
+	ck_assert(d_guard_start(4, 1));
+	size_t size = 1 + _i * 37;
+	char *ptr = d_malloc(size);
+	ck_assert_ptr_nonnull(ptr);
+	ck_assert(guard_owns(ptr));
+	ck_assert_uint_eq(size, d_malloc_usable_size(ptr));
+
+	// The allocation is against one end of its page.
+	uintptr_t page = page_of(ptr);
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	ck_assert((uintptr_t)ptr == page
+		|| (uintptr_t)ptr + align_up(size, 16) == page + page_size);
+
+	memset(ptr, 0xab, size);
+	ptr = d_realloc(ptr, size + 100);
+	ck_assert(guard_owns(ptr));
+	for (size_t i = 0; i < size; i++) {
+		ck_assert_uint_eq(0xab, (unsigned char)ptr[i]);
+	}
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_guard_too_large) {
+	ck_assert(d_guard_start(4, 1));
+	void *ptr = d_malloc(sysconf(_SC_PAGESIZE) + 1);
+	ck_assert_ptr_nonnull(ptr);
+	ck_assert(!guard_owns(ptr));
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_guard_pool_exhausted) {
+	ck_assert(d_guard_start(2, 1));
+	void *ptr0 = d_malloc(32);
+	void *ptr1 = d_malloc(32);
+	void *ptr2 = d_malloc(32);
+	ck_assert(guard_owns(ptr0));
+	ck_assert(guard_owns(ptr1));
+	ck_assert(!guard_owns(ptr2));
+	d_free(ptr0);
+	d_free(ptr1);
+	d_free(ptr2);
+}
+END_TEST
+
+START_TEST(test_guard_freed_slots_quarantined) {
+	// A freed slot is only reused once every other free slot has been.
+	ck_assert(d_guard_start(3, 1));
+	void *ptr0 = d_malloc(32);
+	d_free(ptr0);
+	void *ptr1 = d_malloc(32);
+	void *ptr2 = d_malloc(32);
+	ck_assert_uint_ne(page_of(ptr0), page_of(ptr1));
+	ck_assert_uint_ne(page_of(ptr0), page_of(ptr2));
+	void *ptr3 = d_malloc(32);
+	ck_assert_uint_eq(page_of(ptr0), page_of(ptr3));
+	d_free(ptr1);
+	d_free(ptr2);
+	d_free(ptr3);
+}
+END_TEST
+
+START_TEST(test_guard_sample_rate) {
+	// Roughly 1 in 16 allocations should be guarded.
+	ck_assert(d_guard_start(1024, 16));
+	int32_t guarded = 0;
+	for (int32_t i = 0; i < 4096; i++) {
+		void *ptr = d_malloc(16);
+		guarded += guard_owns(ptr);
+		d_free(ptr);
+	}
+	ck_assert_int_gt(guarded, 128);
+	ck_assert_int_lt(guarded, 512);
+}
+END_TEST
+
+START_TEST(test_guard_diagnose) {
+	ck_assert(d_guard_start(4, 1));
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	char *ptr = d_malloc(64);
+	uintptr_t page = page_of(ptr);
+
+	size_t slot = SIZE_MAX;
+	ck_assert_int_eq(GUARD_ERROR_BUFFER_OVERFLOW, guard_diagnose(page + page_size, &slot));
+	size_t overflow_slot = slot;
+	ck_assert_int_eq(GUARD_ERROR_BUFFER_UNDERFLOW, guard_diagnose(page - 1, &slot));
+	ck_assert_uint_eq(overflow_slot, slot);
+
+	d_free(ptr);
+	ck_assert_int_eq(GUARD_ERROR_USE_AFTER_FREE, guard_diagnose((uintptr_t)ptr, &slot));
+	ck_assert_uint_eq(overflow_slot, slot);
+
+	ck_assert_int_eq(GUARD_ERROR_NONE, guard_diagnose((uintptr_t)&slot, &slot));
+}
+END_TEST
+
+START_TEST(test_guard_double_free) {
+	attach_signal_handler(SIGILL, _guard_sigill_handler);
+	ck_assert(d_guard_start(4, 1));
+	void *ptr = d_malloc(32);
+	d_free(ptr);
+	ck_assert(!sigill_raised);
+	d_free(ptr);
+	ck_assert(sigill_raised);
+}
+END_TEST
+
+START_TEST(test_guard_invalid_free) {
+	attach_signal_handler(SIGILL, _guard_sigill_handler);
+	ck_assert(d_guard_start(4, 1));
+	char *ptr = d_malloc(32);
+	d_free(ptr + 1);
+	ck_assert(sigill_raised);
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_guard_use_after_free_fault) {
+	ck_assert(d_guard_start(4, 1));
+	check_fault_report(use_after_free, "use after free");
+}
+END_TEST
+
+START_TEST(test_guard_overflow_fault) {
+	ck_assert(d_guard_start(4, 1));
+	check_fault_report(overflow, "buffer overflow");
+}
+END_TEST
+
+START_TEST(test_guard_chains_unrelated_faults) {
+	check_fault_report(unrelated_fault_then_use_after_free, "use after free");
+}
+END_TEST
+
+Suite *d_guard_test_suite() {
+	TCase *test_case = tcase_create("guard test case");
+	tcase_add_checked_fixture(test_case, guard_tests_setup, guard_tests_teardown);
+
+	tcase_add_test(test_case, test_guard_invalid_args);
+	tcase_add_loop_test(test_case, test_guard_allocate, 0, 8);
+	tcase_add_test(test_case, test_guard_too_large);
+	tcase_add_test(test_case, test_guard_pool_exhausted);
+	tcase_add_test(test_case, test_guard_freed_slots_quarantined);
+	tcase_add_test(test_case, test_guard_sample_rate);
+	tcase_add_test(test_case, test_guard_diagnose);
+	tcase_add_test(test_case, test_guard_double_free);
+	tcase_add_test(test_case, test_guard_invalid_free);
+	tcase_add_test(test_case, test_guard_use_after_free_fault);
+	tcase_add_test(test_case, test_guard_overflow_fault);
+	tcase_add_test(test_case, test_guard_chains_unrelated_faults);
+
+	Suite *suite = suite_create("guard tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_GUARD_H_
+#define _DALLOC_TEST_GUARD_H_
+
+#include <check.h>
+
+Suite *d_guard_test_suite();
+
+#endif // _DALLOC_TEST_GUARD_H_
@@ -119,18 +119,52 @@ END_TEST
 Get the size of a chunk. This function signature is compatible with the
 chunk traversal API.
 */
-int32_t get_size(const chunk_t * chunk, void *user_data) {
+int64_t get_size(const chunk_t * chunk, void *user_data) {
 	return chunk->size;
 }
 
-int32_t distance_from(const chunk_t *chunk, void *user_data) {
+int64_t distance_from(const chunk_t *chunk, void *user_data) {
 	size_t *size = (size_t *)user_data;
 	return *size - chunk->size;
 }
 
+int64_t distance_from_below(const chunk_t *chunk, void *user_data) {
+	size_t *size = (size_t *)user_data;
+	return chunk->size >= *size ? (int64_t)(chunk->size - *size) : -1;
+}
+
+typedef struct {
+	size_t visited;
+	size_t limit;
+} visit_counter_t;
+
+bool count_visits(const chunk_t *chunk, void *user_data) {
+	visit_counter_t *counter = (visit_counter_t *)user_data;
+	counter->visited++;
+	return counter->visited < counter->limit;
+}
+
+START_TEST(test_for_each) {
+	visit_counter_t counter = { 0, SIZE_MAX };
+	ck_assert(for_each(&first, count_visits, &counter));
+	ck_assert_uint_eq(4, counter.visited);
+
+	counter.visited = 0;
+	ck_assert(for_each(NULL, count_visits, &counter));
+	ck_assert_uint_eq(0, counter.visited);
+}
+END_TEST
+
+START_TEST(test_for_each_stops_early) {
+	visit_counter_t counter = { 0, _i };
+	ck_assert(!for_each(&first, count_visits, &counter));
+	ck_assert_uint_eq(_i, counter.visited);
+}
+END_TEST
+
 START_TEST(test_sum) {
-	int32_t size_expected = first.size + second.size + third.size + fourth.size;
-	int32_t size_actual = sum(&first, get_size, NULL);
+	int64_t size_expected = first.size + second.size + third.size + fourth.size;
+	int64_t size_actual = sum(&first, get_size, NULL);
 	ck_assert_int_eq(size_expected, size_actual);
 }
 END_TEST
@@ -158,7 +192,7 @@ START_TEST(test_min_sets_prev) {
 END_TEST
 
 // Return the chunk's size, or -1 if the chunk is unused.
-int32_t get_weight(const chunk_t *chunk, void *user_data) {
+int64_t get_weight(const chunk_t *chunk, void *user_data) {
 	return chunk->in_use ? chunk->size : -1;
 }
 
@@ -173,7 +207,7 @@ START_TEST(test_min_negative_weight) {
 }
 END_TEST
 
-int32_t return_negative(const chunk_t *chunk, void *user_data) {
+int64_t return_negative(const chunk_t *chunk, void *user_data) {
 	return -1;
 }
 
@@ -187,6 +221,75 @@ START_TEST(test_min_all_negative_weights) {
 }
 END_TEST
 
+START_TEST(test_sum_large_chunks) {
+	// Chunks over 2 GiB don't overflow the sum.
+	second.size = (size_t)3 << 30;
+	fourth.size = (size_t)5 << 30;
+	int64_t size_expected = first.size + second.size + third.size + fourth.size;
+	ck_assert_int_eq(size_expected, sum(&first, get_size, NULL));
+}
+END_TEST
+
+/*
+Weight function which counts the chunks it's called for, and returns the
+distance from a size.
+*/
+typedef struct {
+	size_t size;
+	size_t calls;
+} counting_distance_t;
+
+int64_t counting_distance(const chunk_t *chunk, void *user_data) {
+	counting_distance_t *data = (counting_distance_t *)user_data;
+	data->calls++;
+	return chunk->size >= data->size ? (int64_t)(chunk->size - data->size) : -1;
+}
+
+START_TEST(test_min_stops_at_exact_fit) {
+	// The second chunk is an exact fit, so the rest of the heap isn't
+	// searched.
+	counting_distance_t data = { 96, 0 };
+	chunk_t *prv = NULL;
+	ck_assert_ptr_eq(&second, min(&first, counting_distance, &data, &prv));
+	ck_assert_ptr_eq(&first, prv);
+	ck_assert_uint_eq(2, data.calls);
+
+	// Without an exact fit, every chunk is visited.
+	data.size = 40;
+	data.calls = 0;
+	prv = NULL;
+	ck_assert_ptr_eq(&fourth, min(&first, counting_distance, &data, &prv));
+	ck_assert_ptr_eq(&third, prv);
+	ck_assert_uint_eq(4, data.calls);
+}
+END_TEST
+
+START_TEST(test_min_large_chunks) {
+	// Differences of more than 2 GiB aren't truncated.
+	second.size = ((size_t)5 << 30) + 64;
+	fourth.size = ((size_t)3 << 30) + 64;
+	size_t size = 64;
+	chunk_t *prv = NULL;
+	ck_assert_ptr_eq(&fourth, min(&first, distance_from_below, &size, &prv));
+	ck_assert_ptr_eq(&third, prv);
+}
+END_TEST
+
+int64_t weight_max_if_unused(const chunk_t *chunk, void *user_data) {
+	size_t *calls = (size_t *)user_data;
+	(*calls)++;
+	return chunk->in_use ? (int64_t)chunk->size : WEIGHT_MAX;
+}
+
+START_TEST(test_max_stops_at_weight_max) {
+	size_t calls = 0;
+	chunk_t *prv = NULL;
+	ck_assert_ptr_eq(&second, max(&first, weight_max_if_unused, &calls, &prv));
+	ck_assert_ptr_eq(&first, prv);
+	ck_assert_uint_eq(2, calls);
+}
+END_TEST
+
 START_TEST(test_max) {
 	// Ensure that max() works in the happy code path.
 	// This should return the largest chunk (which is the 2nd chunk).
@@ -228,26 +331,36 @@ Suite *d_heap_traversal_test_suite() {
 	tcase_add_test(find_tests, test_no_match);
 	tcase_add_loop_test(find_tests, test_find_i, 0, 4);
 
+	TCase *for_each_tests = tcase_create("for_each() tests");
+	tcase_add_test(for_each_tests, test_for_each);
+	tcase_add_loop_test(for_each_tests, test_for_each_stops_early, 1, 5);
+
 	TCase *sum_tests = tcase_create("sum() tests");
 	tcase_add_test(sum_tests, test_sum);
+	tcase_add_test(sum_tests, test_sum_large_chunks);
 
 	TCase *min_tests = tcase_create("min() tests");
 	tcase_add_test(min_tests, test_min);
 	tcase_add_loop_test(min_tests, test_min_sets_prev, 0, 4);
 	tcase_add_test(min_tests, test_min_negative_weight);
 	tcase_add_test(min_tests, test_min_all_negative_weights);
+	tcase_add_test(min_tests, test_min_stops_at_exact_fit);
+	tcase_add_test(min_tests, test_min_large_chunks);
 
 	TCase *max_tests = tcase_create("max() tests");
 	tcase_add_test(max_tests, test_max);
 	tcase_add_loop_test(max_tests, test_max_negative_weight, 0, 4);
 	tcase_add_test(max_tests, test_max_all_negative_weights);
+	tcase_add_test(max_tests, test_max_stops_at_weight_max);
 
     tcase_add_checked_fixture(find_tests, heap_traversal_tests_setup, heap_traversal_tests_teardown);
+    tcase_add_checked_fixture(for_each_tests, heap_traversal_tests_setup, heap_traversal_tests_teardown);
     tcase_add_checked_fixture(sum_tests, heap_traversal_tests_setup, heap_traversal_tests_teardown);
     tcase_add_checked_fixture(min_tests, heap_traversal_tests_setup, heap_traversal_tests_teardown);
     tcase_add_checked_fixture(max_tests, heap_traversal_tests_setup, heap_traversal_tests_teardown);
 
     suite_add_tcase(suite, find_tests);
+    suite_add_tcase(suite, for_each_tests);
     suite_add_tcase(suite, sum_tests);
 	suite_add_tcase(suite, min_tests);
 	suite_add_tcase(suite, max_tests);
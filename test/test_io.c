@@ -3,11 +3,16 @@
 
 #include <stdbool.h>
 #include <check.h>
+#include <fcntl.h>
 #include <regex.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "dalloc_io.h"
 #include "dalloc_io_internal.h"
@@ -295,6 +300,223 @@ START_TEST(test_panic) {
 }
 END_TEST
 
+START_TEST(test_log_args_not_evaluated) {
+	// Arguments to a message which won't be logged shouldn't be evaluated.
+	int32_t evaluated = 0;
+	set_log_level(DALLOC_LOG_LEVEL_WARNING);
+	log_debug("%d", evaluated++);
+	log_info("%d", evaluated++);
+	log_message(DALLOC_LOG_LEVEL_DIAGNOSTIC, "%d", evaluated++);
+	ck_assert_int_eq(0, evaluated);
+
+	log_warning("%d", evaluated++);
+	ck_assert_int_eq(1, evaluated);
+	validate_log_message("0", DALLOC_LOG_LEVEL_WARNING);
+}
+END_TEST
+
+START_TEST(test_log_compiled_out) {
+	// Messages more verbose than the compiled log level should be
+	// eliminated, regardless of the runtime log level.
+	int32_t evaluated = 0;
+#pragma push_macro("DALLOC_COMPILED_LOG_LEVEL")
+#undef DALLOC_COMPILED_LOG_LEVEL
+#define DALLOC_COMPILED_LOG_LEVEL DALLOC_LOG_LEVEL_INFO
+	log_debug("%d", evaluated++);
+	log_diag("%d", evaluated++);
+	log_info("%d", evaluated++);
+#pragma pop_macro("DALLOC_COMPILED_LOG_LEVEL")
+	ck_assert_int_eq(1, evaluated);
+	validate_log_message("0", DALLOC_LOG_LEVEL_INFO);
+}
+END_TEST
+
+/*
+Format a message with format_message(), and check the result.
+*/
+void assert_formats_to(const char *expected, size_t size, const char *fmt, ...) {
+	char buf[256];
+	va_list args;
+	va_start(args, fmt);
+	size_t len = format_message(buf, size, fmt, args);
+	va_end(args);
+	ck_assert_str_eq(expected, buf);
+	ck_assert_uint_eq(strlen(expected), len);
+}
+
+START_TEST(test_format_message) {
+	assert_formats_to("plain text", 256, "plain text");
+	assert_formats_to("int -42 7", 256, "int %d %i", -42, 7);
+	assert_formats_to("unsigned 4294967295", 256, "unsigned %u", UINT32_MAX);
+	assert_formats_to("long -9223372036854775808", 256, "long %ld", INT64_MIN);
+	assert_formats_to("size 18446744073709551615", 256, "size %zu", SIZE_MAX);
+	assert_formats_to("hex ff FF", 256, "hex %x %X", 255, 255);
+	assert_formats_to("ptr 0x1234", 256, "ptr %p", (void *)0x1234);
+	assert_formats_to("str abc (null)", 256, "str %s %s", "abc", (char *)NULL);
+	assert_formats_to("char x 100%", 256, "char %c 100%%", 'x');
+	assert_formats_to("[  42] [42  ] [0042] [-042]", 256, "[%4d] [%-4d] [%04d] [%04d]", 42, 42, 42, -42);
+	assert_formats_to("unknown %q", 256, "unknown %q");
+}
+END_TEST
+
+START_TEST(test_format_message_truncates) {
+	assert_formats_to("abcd", 5, "abcdefgh");
+	assert_formats_to("12", 3, "%d", 12345);
+	assert_formats_to("", 1, "%s", "abc");
+}
+END_TEST
+
+START_TEST(test_format_timestamp) {
+	int64_t times[4] = { 0, 951782400, 1643625000, 4102444799 };
+	const char *expected[4] = {
+		"1970-01-01 00:00:00",
+		"2000-02-29 00:00:00",
+		"2022-01-31 10:30:00",
+		"2099-12-31 23:59:59",
+	};
+	char buf[DALLOC_TIMESTAMP_LEN];
+	format_timestamp(times[_i], buf);
+	ck_assert_str_eq(expected[_i], buf);
+}
+END_TEST
+
+START_TEST(test_log_timestamp_utc) {
+	// The synchronous backend should use the same (UTC) timestamps as the
+	// asynchronous one, whatever the local time zone.
+	setenv("TZ", "UTC+5", 1);
+	tzset();
+
+	char before[DALLOC_TIMESTAMP_LEN];
+	char after[DALLOC_TIMESTAMP_LEN];
+	format_timestamp(time(NULL), before);
+	log_warning("utc");
+	format_timestamp(time(NULL), after);
+
+	char *output = get_test_stdout();
+	ck_assert_int_eq(0, strncmp("dalloc ", output, 7));
+	char *timestamp = strndup(output + 7, DALLOC_TIMESTAMP_LEN - 1);
+	ck_assert(!strcmp(before, timestamp) || !strcmp(after, timestamp));
+	free(timestamp);
+	free(output);
+}
+END_TEST
+
+/*
+Read everything currently buffered in a pipe into a null-terminated string.
+The string is owned by the caller.
+*/
+char *read_pipe(int fd) {
+	size_t size = 1 << 16;
+	char *buf = malloc(size);
+	size_t len = 0;
+	ssize_t n;
+	while ((n = read(fd, buf + len, size - len - 1)) > 0) {
+		len += n;
+	}
+	buf[len] = 0;
+	return buf;
+}
+
+/*
+Create a pipe whose read end doesn't block.
+*/
+void open_log_pipe(int fds[2]) {
+	ck_assert_int_eq(0, pipe(fds));
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+}
+
+START_TEST(test_async_log) {
+	int fds[2];
+	open_log_pipe(fds);
+	ck_assert(start_async_logging(fds[1], false));
+
+	log_warning("async %d %s", 42, "message");
+
+	// Nothing should be written until the ring buffer is drained.
+	char *output = read_pipe(fds[0]);
+	ck_assert_str_eq("", output);
+	free(output);
+
+	flush_log();
+	output = read_pipe(fds[0]);
+	assert_regex_match(output, "^dalloc [0-9]{4}-[0-9]{2}-[0-9]{2} [0-9:]{8} WARNING: async 42 message\n$");
+	free(output);
+
+	// Nothing should go through stdio.
+	stop_async_logging();
+	char *out = get_test_stdout();
+	ck_assert_str_eq("", out);
+	free(out);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_async_log_background) {
+	// Stopping the backend should drain any messages which haven't yet
+	// been written by the background thread.
+	int fds[2];
+	open_log_pipe(fds);
+	ck_assert(start_async_logging(fds[1], true));
+	log_info("first");
+	log_error("second");
+	stop_async_logging();
+
+	char *output = read_pipe(fds[0]);
+	assert_regex_match(output, "^dalloc .+ INFO: first\ndalloc .+ ERROR: second\n$");
+	free(output);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_async_log_dropped) {
+	// Messages which don't fit in the ring buffer should be dropped, and
+	// counted.
+	int fds[2];
+	open_log_pipe(fds);
+	ck_assert(start_async_logging(fds[1], false));
+	for (int32_t i = 0; i < 100; i++) {
+		log_debug("message %d", i);
+	}
+	flush_log();
+
+	char *output = read_pipe(fds[0]);
+	int32_t lines = 0;
+	for (char *c = output; *c; c++) {
+		lines += *c == '\n';
+	}
+	ck_assert_int_eq(65, lines);
+	assert_regex_match(output, "DEBUG: message 63\n");
+	assert_regex_match(output, "WARNING: 36 log messages dropped\n$");
+	free(output);
+
+	stop_async_logging();
+	close(fds[0]);
+	close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_async_log_panic) {
+	// panic() should flush the log before (potentially) crashing.
+	int fds[2];
+	open_log_pipe(fds);
+	ck_assert(start_async_logging(fds[1], false));
+	robust = true;
+	panic("fatal");
+
+	char *output = read_pipe(fds[0]);
+	assert_regex_match(output, "ERROR: fatal\n$");
+	free(output);
+
+	stop_async_logging();
+	close(fds[0]);
+	close(fds[1]);
+}
+END_TEST
+
 Suite *d_io_test_suite() {
 	
     TCase* test_case = tcase_create("d_io test case");
@@ -306,6 +528,16 @@ Suite *d_io_test_suite() {
 	tcase_add_test(test_case, test_pad);
 	tcase_add_test(test_case, test_panic);
 	tcase_add_test(test_case, test_pad_large_number);
+	tcase_add_test(test_case, test_log_args_not_evaluated);
+	tcase_add_test(test_case, test_log_compiled_out);
+	tcase_add_test(test_case, test_format_message);
+	tcase_add_test(test_case, test_format_message_truncates);
+	tcase_add_loop_test(test_case, test_format_timestamp, 0, 4);
+	tcase_add_test(test_case, test_log_timestamp_utc);
+	tcase_add_test(test_case, test_async_log);
+	tcase_add_test(test_case, test_async_log_background);
+	tcase_add_test(test_case, test_async_log_dropped);
+	tcase_add_test(test_case, test_async_log_panic);
 
     Suite* suite = suite_create("io tests");
 	suite_add_tcase(suite, test_case);
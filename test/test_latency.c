@@ -0,0 +1,198 @@
+#include <check.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "dalloc_latency.h"
+#include "dalloc_utils.h"
+#include "test_latency.h"
+
+void latency_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	d_latency_reset();
+}
+
+void latency_tests_teardown() {
+
+}
+
+#ifdef DALLOC_LATENCY_STATS
+
+START_TEST(test_latency_buckets) {
+	// Small values have a bucket each.
+	for (uint64_t i = 0; i < 32; i++) {
+		ck_assert_uint_eq(i, latency_bucket(i));
+		ck_assert_uint_eq(i, latency_bucket_max(i));
+	}
+
+	// Larger values are within 1/16 of the largest value in their bucket,
+	// and buckets are contiguous.
+	for (uint64_t value = 32; value < ((uint64_t)1 << 36); value += value / 7 + 1) {
+		uint32_t bucket = latency_bucket(value);
+		uint64_t max = latency_bucket_max(bucket);
+		ck_assert_uint_ge(max, value);
+		ck_assert_uint_le(max - value, value / 16);
+		ck_assert_uint_eq(bucket, latency_bucket(max));
+		ck_assert_uint_eq(bucket + 1, latency_bucket(max + 1));
+	}
+
+	// Huge values share the last bucket.
+	ck_assert_uint_eq(DALLOC_LATENCY_BUCKETS - 1, latency_bucket(UINT64_MAX));
+	ck_assert_uint_eq(DALLOC_LATENCY_BUCKETS - 1, latency_bucket((uint64_t)1 << 50));
+}
+END_TEST
+
+START_TEST(test_latency_percentiles) {
+	// 100 calls taking 1..100 cycles, plus one outlier.
+	for (uint64_t i = 1; i <= 100; i++) {
+		latency_record(DALLOC_LATENCY_OP_MALLOC, 64, i);
+	}
+	latency_record(DALLOC_LATENCY_OP_MALLOC, 4096, 1000000);
+
+	uint64_t latency;
+	ck_assert(d_latency_percentile(DALLOC_LATENCY_OP_MALLOC, 6, 50, &latency));
+	ck_assert_uint_eq(51, latency);
+	ck_assert(d_latency_percentile(DALLOC_LATENCY_OP_MALLOC, 6, 90, &latency));
+	ck_assert_uint_eq(91, latency);
+	ck_assert(d_latency_percentile(DALLOC_LATENCY_OP_MALLOC, 6, 100, &latency));
+	ck_assert_uint_eq(100, latency);
+	ck_assert(d_latency_percentile(DALLOC_LATENCY_OP_MALLOC, 6, 0, &latency));
+	ck_assert_uint_eq(1, latency);
+
+	// The outlier is only in its own size class, and is reported exactly
+	// as the maximum.
+	ck_assert(d_latency_percentile(DALLOC_LATENCY_OP_MALLOC,
+		DALLOC_LATENCY_ALL_CLASSES, 100, &latency));
+	ck_assert_uint_eq(1000000, latency);
+	// 100 is in the bucket [100, 103].
+	ck_assert(d_latency_percentile(DALLOC_LATENCY_OP_MALLOC,
+		DALLOC_LATENCY_ALL_CLASSES, 99, &latency));
+	ck_assert_uint_eq(103, latency);
+
+	d_latency_hist_t hist;
+	ck_assert(d_latency_histogram(DALLOC_LATENCY_OP_MALLOC, 6, &hist));
+	ck_assert_uint_eq(100, hist.calls);
+	ck_assert_uint_eq(5050, hist.total);
+	ck_assert_uint_eq(100, hist.max);
+
+	// Nothing recorded.
+	ck_assert(d_latency_percentile(DALLOC_LATENCY_OP_FREE, 6, 50, &latency));
+	ck_assert_uint_eq(0, latency);
+
+	// Invalid arguments.
+	ck_assert(!d_latency_percentile(DALLOC_LATENCY_OP_MALLOC, 6, 101, &latency));
+	ck_assert(!d_latency_percentile(DALLOC_LATENCY_OP_MALLOC, DALLOC_NUM_SIZE_CLASSES, 50, &latency));
+	ck_assert(!d_latency_histogram(DALLOC_LATENCY_NUM_OPS, 6, &hist));
+}
+END_TEST
+
+START_TEST(test_latency_calls) {
+	void *ptr = d_malloc(100);
+	ptr = d_realloc(ptr, 5000);
+	d_free(ptr);
+	d_free(d_calloc(10, 10));
+
+	// Nested calls (e.g. the d_malloc() in d_calloc()) aren't recorded.
+	d_latency_hist_t hist;
+	ck_assert(d_latency_histogram(DALLOC_LATENCY_OP_MALLOC, DALLOC_LATENCY_ALL_CLASSES, &hist));
+	ck_assert_uint_eq(1, hist.calls);
+	ck_assert(d_latency_histogram(DALLOC_LATENCY_OP_MALLOC, 6, &hist));
+	ck_assert_uint_eq(1, hist.calls);
+	ck_assert_uint_gt(hist.max, 0);
+	d_latency_histogram(DALLOC_LATENCY_OP_REALLOC, 12, &hist);
+	ck_assert_uint_eq(1, hist.calls);
+	d_latency_histogram(DALLOC_LATENCY_OP_CALLOC, 6, &hist);
+	ck_assert_uint_eq(1, hist.calls);
+
+	// Frees are recorded in the size class of the freed allocation.
+	d_latency_histogram(DALLOC_LATENCY_OP_FREE, DALLOC_LATENCY_ALL_CLASSES, &hist);
+	ck_assert_uint_eq(2, hist.calls);
+	d_latency_histogram(DALLOC_LATENCY_OP_FREE, 12, &hist);
+	ck_assert_uint_eq(1, hist.calls);
+
+	d_latency_reset();
+	d_latency_histogram(DALLOC_LATENCY_OP_FREE, DALLOC_LATENCY_ALL_CLASSES, &hist);
+	ck_assert_uint_eq(0, hist.calls);
+}
+END_TEST
+
+static void *allocate_in_thread(void *arg) {
+	d_free(d_malloc(32));
+	return NULL;
+}
+
+START_TEST(test_latency_threads) {
+	d_free(d_malloc(32));
+
+	// The other thread's calls are still counted after it exits.
+	pthread_t thread;
+	pthread_create(&thread, NULL, allocate_in_thread, NULL);
+	pthread_join(thread, NULL);
+
+	d_latency_hist_t hist;
+	d_latency_histogram(DALLOC_LATENCY_OP_MALLOC, 5, &hist);
+	ck_assert_uint_eq(2, hist.calls);
+	d_latency_histogram(DALLOC_LATENCY_OP_FREE, DALLOC_LATENCY_ALL_CLASSES, &hist);
+	ck_assert_uint_eq(2, hist.calls);
+}
+END_TEST
+
+START_TEST(test_latency_dump) {
+	latency_record(DALLOC_LATENCY_OP_FREE, 100, 42);
+
+	int fds[2];
+	ck_assert_int_eq(0, pipe(fds));
+	ck_assert(d_latency_dump(fds[1]));
+	close(fds[1]);
+	char buf[4096];
+	ssize_t len = read(fds[0], buf, sizeof(buf) - 1);
+	close(fds[0]);
+	ck_assert_int_gt(len, 0);
+	buf[len] = '\0';
+
+	ck_assert(strstr(buf, "p99.9"));
+	ck_assert(strstr(buf, "free             >=64            1         42         42         42         42         42           42\n"));
+	ck_assert(strstr(buf, "free              all            1"));
+	ck_assert(!strstr(buf, "malloc"));
+}
+END_TEST
+
+#else
+
+START_TEST(test_latency_disabled) {
+	d_free(d_malloc(32));
+	d_latency_hist_t hist;
+	ck_assert(!d_latency_histogram(DALLOC_LATENCY_OP_MALLOC, DALLOC_LATENCY_ALL_CLASSES, &hist));
+	ck_assert_uint_eq(0, hist.calls);
+	uint64_t latency;
+	ck_assert(!d_latency_percentile(DALLOC_LATENCY_OP_MALLOC, DALLOC_LATENCY_ALL_CLASSES, 50, &latency));
+	ck_assert_uint_eq(0, latency);
+	ck_assert(!d_latency_dump(STDERR_FILENO));
+}
+END_TEST
+
+#endif // DALLOC_LATENCY_STATS
+
+Suite *d_latency_test_suite() {
+	TCase *test_case = tcase_create("latency test case");
+	tcase_add_checked_fixture(test_case, latency_tests_setup, latency_tests_teardown);
+
+#ifdef DALLOC_LATENCY_STATS
+	tcase_add_test(test_case, test_latency_buckets);
+	tcase_add_test(test_case, test_latency_percentiles);
+	tcase_add_test(test_case, test_latency_calls);
+	tcase_add_test(test_case, test_latency_threads);
+	tcase_add_test(test_case, test_latency_dump);
+#else
+	tcase_add_test(test_case, test_latency_disabled);
+#endif
+
+	Suite *suite = suite_create("latency tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
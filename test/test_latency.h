@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_LATENCY_H_
+#define _DALLOC_TEST_LATENCY_H_
+
+#include <check.h>
+
+Suite *d_latency_test_suite();
+
+#endif // _DALLOC_TEST_LATENCY_H_
@@ -0,0 +1,274 @@
+#include <check.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_guard.h"
+#include "dalloc_io.h"
+#include "dalloc_lock.h"
+#include "dalloc_profile.h"
+#include "test_lock.h"
+
+#define NUM_THREADS 4
+#define OPS_PER_THREAD 20000
+#define LIVE_PER_THREAD 64
+
+void lock_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	d_heap_reset_lock_stats();
+}
+
+void lock_tests_teardown() {
+	d_profile_stop();
+	d_guard_stop();
+	set_buddy_range(0, 0);
+}
+
+static mutex_t test_mutex = MUTEX_INITIALIZER;
+static uint64_t counter = 0;
+
+static void *count_under_mutex(void *arg) {
+	for (int i = 0; i < OPS_PER_THREAD; i++) {
+		mutex_acquire(&test_mutex);
+		counter++;
+		mutex_release(&test_mutex);
+	}
+	return NULL;
+}
+
+static void *acquire_once(void *arg) {
+	mutex_acquire(&test_mutex);
+	counter++;
+	mutex_release(&test_mutex);
+	return NULL;
+}
+
+/*
+Allocate and free objects of varying sizes, checking that no other thread
+has written to them.
+*/
+static void *churn_heap(void *arg) {
+	uintptr_t id = (uintptr_t)arg;
+	unsigned seed = (unsigned)id;
+	unsigned char *live[LIVE_PER_THREAD] = { NULL };
+	size_t sizes[LIVE_PER_THREAD] = { 0 };
+	for (int i = 0; i < OPS_PER_THREAD; i++) {
+		int slot = rand_r(&seed) % LIVE_PER_THREAD;
+		if (live[slot]) {
+			for (size_t j = 0; j < sizes[slot]; j++) {
+				if (live[slot][j] != (unsigned char)(id + slot)) {
+					return (void *)1;
+				}
+			}
+			d_free(live[slot]);
+			live[slot] = NULL;
+			continue;
+		}
+		sizes[slot] = 16 + rand_r(&seed) % 1024;
+		live[slot] = d_malloc(sizes[slot]);
+		if (!live[slot]) {
+			return (void *)1;
+		}
+		memset(live[slot], (unsigned char)(id + slot), sizes[slot]);
+	}
+	for (int i = 0; i < LIVE_PER_THREAD; i++) {
+		d_free(live[i]);
+	}
+	return NULL;
+}
+
+static atomic_bool stop = false;
+
+static void *allocate_until_stopped(void *arg) {
+	while (!atomic_load(&stop)) {
+		void *ptr = d_malloc(64 + rand() % 4096);
+		void *grown = d_realloc(ptr, 8192);
+		d_free(grown);
+	}
+	return NULL;
+}
+
+START_TEST(test_mutex_stats)
+{
+	mutex_t mutex;
+	mutex_init(&mutex);
+	for (int i = 0; i < 3; i++) {
+		mutex_acquire(&mutex);
+		mutex_release(&mutex);
+	}
+
+	d_lock_stats_t stats;
+	mutex_get_stats(&mutex, &stats);
+	ck_assert_uint_eq(stats.acquisitions, 3);
+	ck_assert_uint_eq(stats.contended, 0);
+	ck_assert_uint_eq(stats.sleeps, 0);
+	ck_assert_uint_eq(stats.wait_cycles, 0);
+	ck_assert_uint_ge(stats.hold_cycles, stats.max_hold_cycles);
+
+	mutex_reset_stats(&mutex);
+	mutex_get_stats(&mutex, &stats);
+	ck_assert_uint_eq(stats.acquisitions, 0);
+	ck_assert_uint_eq(stats.hold_cycles, 0);
+}
+END_TEST
+
+START_TEST(test_mutex_exclusion)
+{
+	pthread_t threads[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_create(&threads[i], NULL, count_under_mutex, NULL);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	ck_assert_uint_eq(counter, NUM_THREADS * OPS_PER_THREAD);
+
+	d_lock_stats_t stats;
+	mutex_get_stats(&test_mutex, &stats);
+	ck_assert_uint_eq(stats.acquisitions, NUM_THREADS * OPS_PER_THREAD);
+	ck_assert_uint_le(stats.contended, stats.acquisitions);
+}
+END_TEST
+
+START_TEST(test_mutex_sleeps)
+{
+	// Hold the lock for much longer than a waiter will spin for.
+	pthread_t thread;
+	mutex_acquire(&test_mutex);
+	pthread_create(&thread, NULL, acquire_once, NULL);
+	struct timespec delay = { 0, 50 * 1000 * 1000 };
+	nanosleep(&delay, NULL);
+	ck_assert_uint_eq(counter, 0);
+	mutex_release(&test_mutex);
+	pthread_join(thread, NULL);
+	ck_assert_uint_eq(counter, 1);
+
+	d_lock_stats_t stats;
+	mutex_get_stats(&test_mutex, &stats);
+	ck_assert_uint_eq(stats.acquisitions, 2);
+	ck_assert_uint_eq(stats.contended, 1);
+	ck_assert_uint_ge(stats.sleeps, 1);
+	ck_assert_uint_gt(stats.wait_cycles, 0);
+	ck_assert_uint_eq(stats.wait_cycles, stats.max_wait_cycles);
+	// The wait only ends once the waiter has woken up, after the hold has
+	// ended, so there's no useful bound between the two.
+	ck_assert_uint_gt(stats.max_hold_cycles, 0);
+}
+END_TEST
+
+START_TEST(test_heap_threads)
+{
+	pthread_t threads[NUM_THREADS];
+	for (uintptr_t i = 0; i < NUM_THREADS; i++) {
+		pthread_create(&threads[i], NULL, churn_heap, (void *)(i * LIVE_PER_THREAD));
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		void *result;
+		pthread_join(threads[i], &result);
+		ck_assert_ptr_null(result);
+	}
+
+	d_lock_stats_t stats;
+	d_heap_get_lock_stats(&stats);
+	ck_assert_uint_ge(stats.acquisitions, NUM_THREADS * OPS_PER_THREAD);
+	ck_assert_uint_le(stats.contended, stats.acquisitions);
+	ck_assert_uint_gt(stats.hold_cycles, 0);
+}
+END_TEST
+
+START_TEST(test_heap_fork)
+{
+	pthread_t threads[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_create(&threads[i], NULL, allocate_until_stopped, NULL);
+	}
+
+	for (int i = 0; i < 20; i++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			// If the heap lock was inherited held, this deadlocks and the
+			// alarm kills the child.
+			alarm(5);
+			void *ptr = d_malloc(128);
+			d_free(d_realloc(ptr, 4096));
+			_exit(ptr ? 0 : 1);
+		}
+		int status;
+		ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+		ck_assert(WIFEXITED(status));
+		ck_assert_int_eq(WEXITSTATUS(status), 0);
+	}
+
+	atomic_store(&stop, true);
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+END_TEST
+
+START_TEST(test_allocator_fork)
+{
+	// Send allocations through the buddy allocator, the guarded pool and the
+	// profiler as well as the heap, so that all their locks are contended.
+	set_buddy_range(4096, 1 << 16);
+	ck_assert(d_guard_start(64, 4));
+	ck_assert(d_profile_start(4096));
+
+	pthread_t threads[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_create(&threads[i], NULL, allocate_until_stopped, NULL);
+	}
+
+	for (int i = 0; i < 20; i++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			// If any allocator lock was inherited held, this deadlocks and
+			// the alarm kills the child.
+			alarm(5);
+			bool ok = true;
+			for (int j = 0; j < 64; j++) {
+				void *small = d_malloc(64);
+				void *large = d_malloc(1 << 14);
+				ok = ok && small && large;
+				d_free(small);
+				d_free(large);
+			}
+			_exit(ok ? 0 : 1);
+		}
+		int status;
+		ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+		ck_assert(WIFEXITED(status));
+		ck_assert_int_eq(WEXITSTATUS(status), 0);
+	}
+
+	atomic_store(&stop, true);
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+END_TEST
+
+Suite *d_lock_test_suite() {
+	TCase *test_case = tcase_create("lock test case");
+	tcase_add_checked_fixture(test_case, lock_tests_setup, lock_tests_teardown);
+	tcase_set_timeout(test_case, 30);
+
+	tcase_add_test(test_case, test_mutex_stats);
+	tcase_add_test(test_case, test_mutex_exclusion);
+	tcase_add_test(test_case, test_mutex_sleeps);
+	tcase_add_test(test_case, test_heap_threads);
+	tcase_add_test(test_case, test_heap_fork);
+	tcase_add_test(test_case, test_allocator_fork);
+
+	Suite *suite = suite_create("lock tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_LOCK_H_
+#define _DALLOC_TEST_LOCK_H_
+
+#include <check.h>
+
+Suite *d_lock_test_suite();
+
+#endif // _DALLOC_TEST_LOCK_H_
@@ -2,6 +2,8 @@
 #include <check.h>
 #include <errno.h>
 #include <math.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,16 +12,29 @@
 
 #include "dalloc_io.h"
 #include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_os.h"
 #include "test_util.h"
 
 void malloc_tests_setup() {
 	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	// These tests check the position of the program break, so memory must
+	// be requested from and released to the OS exactly when it's needed.
+	set_trim_threshold(0);
+	set_top_pad(0);
 }
 
 void malloc_tests_teardown() {
 	
 }
 
+static bool _test_malloc_sigill_raised = false;
+
+void _test_malloc_sigill_handler(int32_t signum) {
+    ck_assert_int_eq(SIGILL, signum);
+    _test_malloc_sigill_raised = true;
+}
+
 START_TEST(allocate_zero) {
     void *res = d_malloc(0);
     ck_assert_ptr_eq(res, (void *)0);
@@ -172,6 +187,85 @@ START_TEST(test_malloc_enomem) {
 }
 END_TEST
 
+START_TEST(test_malloc_top_pad) {
+    // With a top pad, growing the heap should request extra memory from
+    // the OS, which is then used by subsequent allocations.
+    size_t pad = 1 << 14;
+    set_top_pad(pad);
+    void *ptr0 = d_malloc(16);
+    void *pbrk0 = sbrk(0);
+    ck_assert_uint_ge((uintptr_t)pbrk0, (uintptr_t)ptr0 + 16 + pad);
+
+    void *ptr1 = d_malloc(pad / 2);
+    ck_assert_ptr_nonnull(ptr1);
+    ck_assert_ptr_eq(pbrk0, sbrk(0));
+
+    d_free(ptr1);
+    d_free(ptr0);
+}
+END_TEST
+
+START_TEST(test_malloc_huge_pages) {
+    // With huge pages, the heap should grow to a huge page boundary.
+    set_huge_pages(DALLOC_HUGE_PAGES_TRANSPARENT);
+    size_t huge_page_size = os_huge_page_size();
+    void *ptr0 = d_malloc(16);
+    void *pbrk0 = sbrk(0);
+    ck_assert_uint_eq(0, (uintptr_t)pbrk0 % huge_page_size);
+
+    // The rest of the huge page is used by subsequent allocations.
+    void *ptr1 = d_malloc(1024);
+    ck_assert_ptr_eq(pbrk0, sbrk(0));
+
+    d_free(ptr1);
+    d_free(ptr0);
+    set_huge_pages(DALLOC_HUGE_PAGES_NONE);
+}
+END_TEST
+
+START_TEST(test_malloc_usable_size) {
+    ck_assert_uint_eq(0, d_malloc_usable_size(NULL));
+
+    // A chunk carved from new memory is exactly the requested size.
+    size_t size = 1000;
+    ck_assert_uint_eq(size, d_good_size(size));
+    void *ptr = d_malloc(size);
+    ck_assert_uint_eq(size, d_malloc_usable_size(ptr));
+
+    // A reused chunk which is too small to split keeps its slack, which is
+    // usable.
+    void *pin = d_malloc(16);
+    d_free(ptr);
+    void *reused = d_malloc(size - 8);
+    ck_assert_ptr_eq(ptr, reused);
+    ck_assert_uint_eq(size, d_malloc_usable_size(reused));
+    fill_memory(d_malloc_usable_size(reused), reused);
+
+    d_free(pin);
+    d_free(reused);
+}
+END_TEST
+
+START_TEST(test_malloc_usable_size_invalid) {
+    attach_signal_handler(SIGILL, _test_malloc_sigill_handler);
+
+    // A pointer into the middle of a chunk.
+    void *ptr = d_malloc(64);
+    void *pin = d_malloc(16);
+    d_malloc_usable_size(ptr + 8);
+    ck_assert(_test_malloc_sigill_raised);
+
+    // A freed chunk.
+    _test_malloc_sigill_raised = false;
+    d_free(ptr);
+    d_malloc_usable_size(ptr);
+    ck_assert(_test_malloc_sigill_raised);
+
+    detach_signal_handlers(SIGILL);
+    d_free(pin);
+}
+END_TEST
+
 Suite *d_malloc_test_suite() {
     TCase* test_case = tcase_create("malloc Test Case");
     tcase_add_checked_fixture(test_case, malloc_tests_setup, malloc_tests_teardown);
@@ -184,6 +278,10 @@ Suite *d_malloc_test_suite() {
     tcase_add_loop_test(test_case, test_malloc_used_chunk_exists, 1, 10);
     tcase_add_test(test_case, sbrk_failure);
     tcase_add_test(test_case, test_malloc_enomem);
+    tcase_add_test(test_case, test_malloc_top_pad);
+    tcase_add_test(test_case, test_malloc_huge_pages);
+    tcase_add_test(test_case, test_malloc_usable_size);
+    tcase_add_test(test_case, test_malloc_usable_size_invalid);
 
 	Suite* suite = suite_create("malloc Tests");
     suite_add_tcase(suite, test_case);
@@ -0,0 +1,241 @@
+#include <check.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dalloc.h"
+#include "dalloc_buddy.h"
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "test_mallocx.h"
+#include "test_util.h"
+
+static bool sigill_raised;
+
+void _mallocx_sigill_handler(int32_t signum) {
+	ck_assert_int_eq(SIGILL, signum);
+	sigill_raised = true;
+}
+
+void mallocx_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	set_buddy_range(0, 0);
+	sigill_raised = false;
+}
+
+void mallocx_tests_teardown() {
+	set_buddy_range(0, 0);
+}
+
+START_TEST(test_mallocx_no_flags) {
+	void *ptr = d_mallocx(100, 0);
+	ck_assert_ptr_nonnull(ptr);
+	ck_assert_uint_ge(d_malloc_usable_size(ptr), 100);
+	fill_memory(100, ptr);
+	d_dallocx(ptr, 0);
+}
+END_TEST
+
+START_TEST(test_mallocx_align) {
+	// Interleave aligned and unaligned allocations, so that the aligned ones
+	// are carved out of reused chunks as well as new ones.
+	size_t align = (size_t)1 << _i;
+	void *ptrs[16];
+	for (int i = 0; i < 16; i++) {
+		size_t size = 24 + i * 40;
+		int flags = i % 2 ? 0 : DALLOC_MALLOCX_ALIGN(align);
+		ptrs[i] = d_mallocx(size, flags);
+		ck_assert_ptr_nonnull(ptrs[i]);
+		if (flags) {
+			ck_assert_uint_eq(0, (uintptr_t)ptrs[i] % align);
+		}
+		memset(ptrs[i], i, size);
+	}
+	for (int i = 0; i < 16; i += 4) {
+		d_free(ptrs[i]);
+		ptrs[i] = d_mallocx(64, DALLOC_MALLOCX_LG_ALIGN(_i));
+		ck_assert_uint_eq(0, (uintptr_t)ptrs[i] % align);
+		memset(ptrs[i], i, 64);
+	}
+	for (int i = 0; i < 16; i++) {
+		size_t size = i % 4 ? 24 + i * 40 : 64;
+		for (size_t j = 0; j < size; j++) {
+			ck_assert_uint_eq(i, ((unsigned char *)ptrs[i])[j]);
+		}
+		d_free(ptrs[i]);
+	}
+}
+END_TEST
+
+START_TEST(test_mallocx_zero) {
+	// Dirty a chunk, then reuse it.
+	void *first = d_malloc(256);
+	void *guard = d_malloc(16);
+	memset(first, 0xff, 256);
+	d_free(first);
+
+	unsigned char *ptr = d_mallocx(256, DALLOC_MALLOCX_ZERO);
+	ck_assert_ptr_eq(first, ptr);
+	for (size_t i = 0; i < 256; i++) {
+		ck_assert_uint_eq(0, ptr[i]);
+	}
+	d_free(ptr);
+	d_free(guard);
+}
+END_TEST
+
+START_TEST(test_mallocx_arena) {
+	// Buddy blocks are served regardless of the configured range (once
+	// the region has been sized), and aligned to the alignment if it's
+	// larger than the size.
+	set_buddy_range(4096, 1 << 20);
+	d_free(d_malloc(4096));
+	set_buddy_range(0, 0);
+	void *ptr = d_mallocx(100, DALLOC_MALLOCX_ARENA(DALLOC_ARENA_BUDDY));
+	ck_assert_ptr_nonnull(ptr);
+	ck_assert(buddy_owns(ptr));
+	d_dallocx(ptr, DALLOC_MALLOCX_ARENA(DALLOC_ARENA_BUDDY));
+
+	ptr = d_mallocx(100, DALLOC_MALLOCX_ARENA(DALLOC_ARENA_BUDDY)
+		| DALLOC_MALLOCX_ALIGN(1 << 16));
+	ck_assert(buddy_owns(ptr));
+	ck_assert_uint_eq(0, (uintptr_t)ptr % (1 << 16));
+	d_free(ptr);
+
+	// And the heap is used even when the buddy allocator would be.
+	set_buddy_range(4096, 1 << 20);
+	ptr = d_mallocx(8192, DALLOC_MALLOCX_ARENA(DALLOC_ARENA_HEAP));
+	ck_assert_ptr_nonnull(ptr);
+	ck_assert(!buddy_owns(ptr));
+	d_dallocx(ptr, DALLOC_MALLOCX_ARENA(DALLOC_ARENA_HEAP));
+	ptr = d_mallocx(8192, 0);
+	ck_assert(buddy_owns(ptr));
+	d_free(ptr);
+
+	ck_assert_ptr_null(d_mallocx(100, DALLOC_MALLOCX_ARENA(7)));
+}
+END_TEST
+
+START_TEST(test_mallocx_buddy_too_large) {
+	// The largest block is fixed at the maximum of the range when the
+	// region is created, and can't satisfy a larger size or alignment.
+	set_buddy_range(4096, 1 << 20);
+	d_free(d_malloc(4096));
+	set_buddy_range(4096, 1 << 24);
+	int buddy = DALLOC_MALLOCX_ARENA(DALLOC_ARENA_BUDDY);
+	ck_assert_ptr_null(d_mallocx((1 << 20) + 1, buddy));
+	ck_assert_ptr_null(d_mallocx(100, buddy | DALLOC_MALLOCX_ALIGN(1 << 21)));
+	ck_assert_ptr_null(d_mallocx(100, buddy | DALLOC_MALLOCX_LG_ALIGN(63)));
+
+	void *ptr = d_mallocx(1 << 20, buddy);
+	ck_assert(buddy_owns(ptr));
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_dallocx_wrong_arena) {
+	attach_signal_handler(SIGILL, _mallocx_sigill_handler);
+	void *ptr = d_malloc(100);
+	d_dallocx(ptr, DALLOC_MALLOCX_ARENA(DALLOC_ARENA_BUDDY));
+	ck_assert(sigill_raised);
+	detach_signal_handlers(SIGILL);
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_rallocx_no_move) {
+	unsigned char *ptr = d_malloc(256);
+	void *after = d_malloc(16);
+	fill_memory(256, ptr);
+
+	// Growing a chunk means moving it.
+	ck_assert_ptr_null(d_rallocx(ptr, 4096, DALLOC_MALLOCX_NO_MOVE));
+	ck_assert_uint_eq(256, d_malloc_usable_size(ptr));
+
+	// Shrinking is done in place.
+	ck_assert_ptr_eq(ptr, d_rallocx(ptr, 128, DALLOC_MALLOCX_NO_MOVE));
+	ck_assert_uint_eq(128, d_malloc_usable_size(ptr));
+
+	// As is reaching an alignment the chunk already has, but not one it
+	// doesn't.
+	ck_assert_ptr_eq(ptr, d_rallocx(ptr, 128, DALLOC_MALLOCX_NO_MOVE | DALLOC_MALLOCX_ALIGN(1)));
+	int lg_align = __builtin_ctzll((uintptr_t)ptr) + 1;
+	ck_assert_ptr_null(d_rallocx(ptr, 128, DALLOC_MALLOCX_NO_MOVE
+		| DALLOC_MALLOCX_LG_ALIGN(lg_align)));
+
+	d_free(ptr);
+	d_free(after);
+}
+END_TEST
+
+START_TEST(test_rallocx_move) {
+	unsigned char *ptr = d_malloc(256);
+	void *after = d_malloc(16);
+	memset(ptr, 0xab, 256);
+
+	unsigned char *new_ptr = d_rallocx(ptr, 1024, DALLOC_MALLOCX_ZERO | DALLOC_MALLOCX_ALIGN(256));
+	ck_assert_ptr_nonnull(new_ptr);
+	ck_assert_ptr_ne(ptr, new_ptr);
+	ck_assert_uint_eq(0, (uintptr_t)new_ptr % 256);
+	for (size_t i = 0; i < 1024; i++) {
+		ck_assert_uint_eq(i < 256 ? 0xab : 0, new_ptr[i]);
+	}
+
+	ck_assert_ptr_null(d_rallocx(new_ptr, 0, 0));
+	ck_assert_ptr_null(d_rallocx(NULL, 16, 0));
+	d_dallocx(new_ptr, 0);
+	d_free(after);
+}
+END_TEST
+
+START_TEST(test_rallocx_arena) {
+	int buddy = DALLOC_MALLOCX_ARENA(DALLOC_ARENA_BUDDY);
+	int heap = DALLOC_MALLOCX_ARENA(DALLOC_ARENA_HEAP);
+	set_buddy_range(4096, 1 << 20);
+	unsigned char *ptr = d_mallocx(256, heap);
+	void *after = d_malloc(16);
+	memset(ptr, 0xab, 256);
+
+	// A resize which could be done in place still moves the allocation if
+	// it's in the wrong arena, or fails if it can't be moved.
+	ck_assert_ptr_null(d_rallocx(ptr, 128, buddy | DALLOC_MALLOCX_NO_MOVE));
+	unsigned char *new_ptr = d_rallocx(ptr, 128, buddy);
+	ck_assert(buddy_owns(new_ptr));
+	for (size_t i = 0; i < 128; i++) {
+		ck_assert_uint_eq(0xab, new_ptr[i]);
+	}
+
+	// And back again.
+	ptr = d_rallocx(new_ptr, 64, heap);
+	ck_assert_ptr_nonnull(ptr);
+	ck_assert(!buddy_owns(ptr));
+	for (size_t i = 0; i < 64; i++) {
+		ck_assert_uint_eq(0xab, ptr[i]);
+	}
+
+	// In the right arena, it's resized in place.
+	ck_assert_ptr_eq(ptr, d_rallocx(ptr, 32, heap | DALLOC_MALLOCX_NO_MOVE));
+	d_free(ptr);
+	d_free(after);
+}
+END_TEST
+
+Suite *d_mallocx_test_suite() {
+	TCase *test_case = tcase_create("mallocx test case");
+	tcase_add_checked_fixture(test_case, mallocx_tests_setup, mallocx_tests_teardown);
+
+	tcase_add_test(test_case, test_mallocx_no_flags);
+	tcase_add_loop_test(test_case, test_mallocx_align, 1, 13);
+	tcase_add_test(test_case, test_mallocx_zero);
+	tcase_add_test(test_case, test_mallocx_arena);
+	tcase_add_test(test_case, test_mallocx_buddy_too_large);
+	tcase_add_test(test_case, test_dallocx_wrong_arena);
+	tcase_add_test(test_case, test_rallocx_no_move);
+	tcase_add_test(test_case, test_rallocx_move);
+	tcase_add_test(test_case, test_rallocx_arena);
+
+	Suite *suite = suite_create("mallocx tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
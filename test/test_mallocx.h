@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_MALLOCX_H_
+#define _DALLOC_TEST_MALLOCX_H_
+
+#include <check.h>
+
+Suite *d_mallocx_test_suite();
+
+#endif // _DALLOC_TEST_MALLOCX_H_
@@ -0,0 +1,227 @@
+#include <check.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "dalloc_numa.h"
+#include "dalloc_os.h"
+#include "dalloc_pool.h"
+#include "test_numa.h"
+#include "test_util.h"
+
+void numa_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+}
+
+void numa_tests_teardown() {
+	set_numa_nodes(0);
+	set_numa_interleave_threshold(0);
+	d_numa_set_thread_node(0);
+}
+
+START_TEST(test_numa_fake_nodes) {
+	set_numa_nodes(4);
+	ck_assert_uint_eq(4, numa_num_nodes());
+
+	// More nodes than are supported share arenas.
+	set_numa_nodes(DALLOC_NUMA_MAX_NODES * 2);
+	ck_assert_uint_eq(DALLOC_NUMA_MAX_NODES, numa_num_nodes());
+
+	// The real topology always has at least one node.
+	set_numa_nodes(0);
+	ck_assert_uint_ge(numa_num_nodes(), 1);
+	ck_assert_uint_le(numa_num_nodes(), DALLOC_NUMA_MAX_NODES);
+}
+END_TEST
+
+START_TEST(test_numa_thread_node) {
+	set_numa_nodes(4);
+	ck_assert_uint_lt(numa_thread_node(), 4);
+
+	d_numa_set_thread_node(2);
+	ck_assert_uint_eq(2, numa_thread_node());
+	d_numa_set_thread_node(6);
+	ck_assert_uint_eq(2, numa_thread_node());
+
+	// Shrinking the topology mustn't leave the thread on a missing node.
+	set_numa_nodes(2);
+	ck_assert_uint_lt(numa_thread_node(), 2);
+}
+END_TEST
+
+START_TEST(test_numa_pool_node_slabs) {
+	set_numa_nodes(2);
+	d_pool_t *pool = d_pool_create(64, 0);
+	ck_assert_ptr_nonnull(pool);
+
+	d_numa_set_thread_node(0);
+	void *local = d_pool_get(pool);
+	d_numa_set_thread_node(1);
+	void *remote = d_pool_get(pool);
+	ck_assert_ptr_nonnull(local);
+	ck_assert_ptr_nonnull(remote);
+
+	// Each node gets its own slab, even though the first slab has plenty
+	// of free objects.
+	d_pool_stats_t stats;
+	d_pool_get_stats(pool, &stats);
+	ck_assert_uint_eq(2, stats.num_slabs);
+
+	// An object put by a thread on another node goes back to its own node.
+	d_pool_put(pool, local);
+	ck_assert_ptr_ne(local, d_pool_get(pool));
+	d_numa_set_thread_node(0);
+	ck_assert_ptr_eq(local, d_pool_get(pool));
+
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_numa_pool_huge_slabs) {
+	// Huge page regions are per node, so that each huge page can be bound
+	// to one node: slabs of different nodes never share a huge page, but
+	// slabs of the same node (even from different pools) do.
+	set_huge_pages(DALLOC_HUGE_PAGES_TRANSPARENT);
+	set_numa_nodes(2);
+	size_t huge_page_size = os_huge_page_size();
+	d_pool_t *pool0 = d_pool_create(64, 0);
+	d_pool_t *pool1 = d_pool_create(64, 0);
+	ck_assert_ptr_nonnull(pool0);
+	ck_assert_ptr_nonnull(pool1);
+
+	d_numa_set_thread_node(0);
+	void *node0 = d_pool_get(pool0);
+	d_numa_set_thread_node(1);
+	void *node1 = d_pool_get(pool0);
+	void *other = d_pool_get(pool1);
+	ck_assert_uint_ne((uintptr_t)node0 / huge_page_size, (uintptr_t)node1 / huge_page_size);
+	ck_assert_uint_eq((uintptr_t)node1 / huge_page_size, (uintptr_t)other / huge_page_size);
+
+	// A destroyed pool's slabs are reused on the node they were mapped for.
+	d_pool_put(pool0, node0);
+	d_pool_put(pool0, node1);
+	d_pool_destroy(pool0);
+	d_numa_set_thread_node(0);
+	d_pool_t *pool2 = d_pool_create(64, 0);
+	ck_assert_ptr_eq(node0, d_pool_get(pool2));
+
+	d_pool_destroy(pool1);
+	d_pool_destroy(pool2);
+	set_huge_pages(DALLOC_HUGE_PAGES_NONE);
+}
+END_TEST
+
+START_TEST(test_numa_pool_thread_cache_flush) {
+	set_numa_nodes(2);
+	d_pool_t *pool = d_pool_create(64, 0);
+	ck_assert_ptr_nonnull(pool);
+	ck_assert(d_pool_enable_thread_cache(pool, 16));
+
+	// A thread's cache isn't tied to a node, so flush it before moving
+	// the thread.
+	d_numa_set_thread_node(0);
+	void *local = d_pool_get(pool);
+	d_pool_flush_thread_cache(pool);
+	d_numa_set_thread_node(1);
+	void *remote = d_pool_get(pool);
+
+	// The flushed chain mixes objects from both nodes.
+	d_pool_put(pool, remote);
+	d_pool_put(pool, local);
+	d_pool_flush_thread_cache(pool);
+
+	d_pool_stats_t stats;
+	d_pool_get_stats(pool, &stats);
+	ck_assert_uint_eq(2, stats.num_slabs);
+
+	// The local object was returned to its own node, not the flushing
+	// thread's.
+	d_numa_set_thread_node(0);
+	ck_assert_ptr_eq(local, d_pool_get(pool));
+
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_numa_pool_reserve) {
+	set_numa_nodes(2);
+	d_pool_t *pool = d_pool_create(64, 0);
+	ck_assert_ptr_nonnull(pool);
+
+	d_numa_set_thread_node(0);
+	ck_assert(d_pool_reserve(pool, 1));
+	d_numa_set_thread_node(1);
+	ck_assert(d_pool_reserve(pool, 1));
+
+	// Reserving is per node, and stats are summed over nodes.
+	d_pool_stats_t stats;
+	d_pool_get_stats(pool, &stats);
+	ck_assert_uint_eq(2, stats.num_slabs);
+	ck_assert_uint_eq(0, stats.num_free % 2);
+
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_numa_pool_set_owner) {
+	set_numa_nodes(2);
+	d_pool_t *pool = d_pool_create(64, 0);
+	ck_assert_ptr_nonnull(pool);
+
+	d_numa_set_thread_node(0);
+	ck_assert(d_pool_reserve(pool, 1));
+	d_pool_stats_t before;
+	d_pool_get_stats(pool, &before);
+
+	// The owner uses objects reserved on any node before it took over.
+	d_numa_set_thread_node(1);
+	d_pool_set_owner(pool);
+	for (size_t i = 0; i < before.num_free; i++) {
+		ck_assert_ptr_nonnull(d_pool_get(pool));
+	}
+	d_pool_stats_t after;
+	d_pool_get_stats(pool, &after);
+	ck_assert_uint_eq(before.num_slabs, after.num_slabs);
+	ck_assert_uint_eq(0, after.num_free);
+
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_numa_interleave_large) {
+	// On single-node machines (and with a fake topology) interleaving is a
+	// noop, but allocations must still succeed.
+	set_numa_interleave_threshold(4096);
+	size_t size = 1 << 20;
+	void *ptr = d_malloc(size);
+	ck_assert_ptr_nonnull(ptr);
+	fill_memory(size, ptr);
+	d_free(ptr);
+
+	set_numa_nodes(4);
+	ptr = d_malloc(size);
+	ck_assert_ptr_nonnull(ptr);
+	fill_memory(size, ptr);
+	d_free(ptr);
+}
+END_TEST
+
+Suite *d_numa_test_suite() {
+	TCase *test_case = tcase_create("numa test case");
+	tcase_add_checked_fixture(test_case, numa_tests_setup, numa_tests_teardown);
+
+	tcase_add_test(test_case, test_numa_fake_nodes);
+	tcase_add_test(test_case, test_numa_thread_node);
+	tcase_add_test(test_case, test_numa_pool_node_slabs);
+	tcase_add_test(test_case, test_numa_pool_huge_slabs);
+	tcase_add_test(test_case, test_numa_pool_thread_cache_flush);
+	tcase_add_test(test_case, test_numa_pool_reserve);
+	tcase_add_test(test_case, test_numa_pool_set_owner);
+	tcase_add_test(test_case, test_numa_interleave_large);
+
+	Suite *suite = suite_create("numa tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_NUMA_H_
+#define _DALLOC_TEST_NUMA_H_
+
+#include <check.h>
+
+Suite *d_numa_test_suite();
+
+#endif // _DALLOC_TEST_NUMA_H_
@@ -0,0 +1,218 @@
+#include <check.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_frag.h"
+#include "dalloc_io.h"
+#include "test_placement.h"
+#include "test_util.h"
+
+// Number of allocations made by the random test.
+#define PLACEMENT_TEST_SLOTS 256
+#define PLACEMENT_TEST_ITERATIONS 20000
+
+static const int policies[] = {
+	DALLOC_PLACEMENT_FIRST_FIT,
+	DALLOC_PLACEMENT_NEXT_FIT,
+	DALLOC_PLACEMENT_BEST_FIT,
+	DALLOC_PLACEMENT_LIFO,
+};
+
+void placement_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	set_trim_threshold(0);
+	set_top_pad(0);
+}
+
+void placement_tests_teardown() {
+	set_placement_policy(DALLOC_PLACEMENT_FIRST_FIT);
+}
+
+/*
+Make holes of the given sizes, in address order, each followed by a small
+allocation which keeps it apart from its neighbours.
+
+@param sizes: Sizes of the holes.
+@param holes: (out) The holes' addresses.
+@param pins: (out) The small allocations.
+@param n: Number of holes.
+*/
+static void make_holes(const size_t *sizes, void **holes, void **pins, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		holes[i] = d_malloc(sizes[i]);
+		pins[i] = d_malloc(16);
+		ck_assert_ptr_nonnull(holes[i]);
+		ck_assert_ptr_nonnull(pins[i]);
+	}
+	for (size_t i = 0; i < n; i++) {
+		d_free(holes[i]);
+	}
+}
+
+static void free_all(void **ptrs, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		d_free(ptrs[i]);
+	}
+}
+
+START_TEST(test_placement_first_fit) {
+	size_t sizes[] = { 300, 100, 200 };
+	void *holes[3], *pins[3];
+	make_holes(sizes, holes, pins, 3);
+
+	void *ptr = d_malloc(150);
+	ck_assert_ptr_eq(holes[0], ptr);
+	d_free(ptr);
+	free_all(pins, 3);
+}
+END_TEST
+
+START_TEST(test_placement_best_fit) {
+	set_placement_policy(DALLOC_PLACEMENT_BEST_FIT);
+	size_t sizes[] = { 300, 100, 200, 150 };
+	void *holes[4], *pins[4];
+	make_holes(sizes, holes, pins, 4);
+
+	// An exact fit is taken even though a larger chunk comes first.
+	void *ptr0 = d_malloc(150);
+	ck_assert_ptr_eq(holes[3], ptr0);
+
+	// Otherwise, the smallest chunk which fits.
+	void *ptr1 = d_malloc(150);
+	ck_assert_ptr_eq(holes[2], ptr1);
+
+	d_free(ptr0);
+	d_free(ptr1);
+	free_all(pins, 4);
+}
+END_TEST
+
+START_TEST(test_placement_lifo) {
+	set_placement_policy(DALLOC_PLACEMENT_LIFO);
+	size_t sizes[] = { 200, 200 };
+	void *holes[2], *pins[2];
+	make_holes(sizes, holes, pins, 2);
+
+	// The most recently freed chunk is reused first.
+	void *ptr = d_malloc(200);
+	ck_assert_ptr_eq(holes[1], ptr);
+	d_free(ptr);
+	ck_assert_ptr_eq(holes[1], d_malloc(200));
+	free_all(pins, 2);
+}
+END_TEST
+
+START_TEST(test_placement_next_fit) {
+	set_placement_policy(DALLOC_PLACEMENT_NEXT_FIT);
+	size_t sizes[] = { 400 };
+	void *holes[1], *pins[1];
+	make_holes(sizes, holes, pins, 1);
+
+	// The search resumes after the last allocation, so the rest of the
+	// hole is used even though the start of the hole has been freed again.
+	void *ptr0 = d_malloc(100);
+	ck_assert_ptr_eq(holes[0], ptr0);
+	d_free(ptr0);
+	void *ptr1 = d_malloc(100);
+	ck_assert_uint_gt((uintptr_t)ptr1, (uintptr_t)ptr0);
+	ck_assert_uint_lt((uintptr_t)ptr1, (uintptr_t)pins[0]);
+
+	// Once the rest of the hole is used, the search wraps around.
+	void *ptr2 = d_malloc(400 - 2 * (100 + sizeof(chunk_t)));
+	ck_assert_ptr_nonnull(ptr2);
+	void *ptr3 = d_malloc(100);
+	ck_assert_ptr_eq(ptr0, ptr3);
+
+	d_free(ptr1);
+	d_free(ptr2);
+	d_free(ptr3);
+	free_all(pins, 1);
+}
+END_TEST
+
+START_TEST(test_placement_switch) {
+	size_t sizes[] = { 300, 100, 200 };
+	void *holes[3], *pins[3];
+	make_holes(sizes, holes, pins, 3);
+
+	// Chunks freed before switching to an indexed policy are found.
+	set_placement_policy(DALLOC_PLACEMENT_BEST_FIT);
+	void *ptr = d_malloc(150);
+	ck_assert_ptr_eq(holes[2], ptr);
+	d_free(ptr);
+
+	set_placement_policy(DALLOC_PLACEMENT_FIRST_FIT);
+	ptr = d_malloc(150);
+	ck_assert_ptr_eq(holes[0], ptr);
+	d_free(ptr);
+	free_all(pins, 3);
+}
+END_TEST
+
+START_TEST(test_placement_min_size) {
+	set_placement_policy(DALLOC_PLACEMENT_BEST_FIT);
+	ck_assert_uint_eq(16, d_good_size(1));
+	ck_assert_uint_eq(0, d_good_size(0));
+	void *ptr = d_malloc(1);
+	ck_assert_uint_eq(16, d_malloc_usable_size(ptr));
+	d_free(ptr);
+
+	set_placement_policy(DALLOC_PLACEMENT_FIRST_FIT);
+	ck_assert_uint_eq(1, d_good_size(1));
+}
+END_TEST
+
+START_TEST(test_placement_random) {
+	// Random allocations and frees, checking that no allocation is
+	// corrupted, and that the heap is released when everything's freed.
+	set_placement_policy(policies[_i]);
+	void *start = sbrk(0);
+	unsigned char *ptrs[PLACEMENT_TEST_SLOTS] = { NULL };
+	size_t sizes[PLACEMENT_TEST_SLOTS];
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	for (size_t i = 0; i < PLACEMENT_TEST_ITERATIONS; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		size_t slot = state % PLACEMENT_TEST_SLOTS;
+		if (ptrs[slot]) {
+			for (size_t j = 0; j < sizes[slot]; j++) {
+				ck_assert_uint_eq((unsigned char)slot, ptrs[slot][j]);
+			}
+			d_free(ptrs[slot]);
+			ptrs[slot] = NULL;
+		} else {
+			sizes[slot] = 1 + (state >> 32) % 2048;
+			ptrs[slot] = d_malloc(sizes[slot]);
+			ck_assert_ptr_nonnull(ptrs[slot]);
+			memset(ptrs[slot], (unsigned char)slot, sizes[slot]);
+		}
+	}
+	for (size_t slot = 0; slot < PLACEMENT_TEST_SLOTS; slot++) {
+		d_free(ptrs[slot]);
+	}
+	ck_assert_ptr_eq(start, sbrk(0));
+}
+END_TEST
+
+Suite *d_placement_test_suite() {
+	TCase *test_case = tcase_create("placement test case");
+	tcase_add_checked_fixture(test_case, placement_tests_setup, placement_tests_teardown);
+
+	tcase_add_test(test_case, test_placement_first_fit);
+	tcase_add_test(test_case, test_placement_best_fit);
+	tcase_add_test(test_case, test_placement_lifo);
+	tcase_add_test(test_case, test_placement_next_fit);
+	tcase_add_test(test_case, test_placement_switch);
+	tcase_add_test(test_case, test_placement_min_size);
+	tcase_add_loop_test(test_case, test_placement_random, 0, 4);
+
+	Suite *suite = suite_create("placement tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_PLACEMENT_H_
+#define _DALLOC_TEST_PLACEMENT_H_
+
+#include <check.h>
+
+Suite *d_placement_test_suite();
+
+#endif // _DALLOC_TEST_PLACEMENT_H_
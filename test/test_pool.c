@@ -0,0 +1,424 @@
+#include <check.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "dalloc_os.h"
+#include "dalloc_pool.h"
+#include "test_pool.h"
+#include "test_util.h"
+
+#define POOL_TEST_NUM_THREADS 4
+#define POOL_TEST_ITERATIONS 10000
+
+static bool sigill_raised;
+
+void pool_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	sigill_raised = false;
+}
+
+void pool_tests_teardown() {
+
+}
+
+void _pool_sigill_handler(int32_t signum) {
+	ck_assert_int_eq(SIGILL, signum);
+	sigill_raised = true;
+}
+
+START_TEST(test_pool_get_put) {
+	size_t size = 1 << _i;
+	d_pool_t *pool = d_pool_create(size, 0);
+	ck_assert_ptr_nonnull(pool);
+
+	void *ptr0 = d_pool_get(pool);
+	void *ptr1 = d_pool_get(pool);
+	ck_assert_ptr_nonnull(ptr0);
+	ck_assert_ptr_nonnull(ptr1);
+	ck_assert_ptr_ne(ptr0, ptr1);
+
+	// Objects mustn't overlap.
+	fill_memory(size, ptr0);
+	fill_memory(size, ptr1);
+	assert_ptr_contents_equal(size, ptr0, ptr1);
+
+	d_pool_put(pool, ptr0);
+	d_pool_put(pool, ptr1);
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_pool_alignment) {
+	size_t align = 1 << _i;
+	d_pool_t *pool = d_pool_create(24, align);
+	ck_assert_ptr_nonnull(pool);
+
+	for (int32_t i = 0; i < 64; i++) {
+		void *ptr = d_pool_get(pool);
+		ck_assert_ptr_nonnull(ptr);
+		ck_assert_uint_eq(0, (uintptr_t)ptr % align);
+	}
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_pool_invalid_alignment) {
+	ck_assert_ptr_null(d_pool_create(16, 24));
+	ck_assert_ptr_null(d_pool_create(0, 8));
+}
+END_TEST
+
+START_TEST(test_pool_reuse) {
+	// The most recently returned object should be handed out next.
+	d_pool_t *pool = d_pool_create(32, 0);
+	void *ptr0 = d_pool_get(pool);
+	void *ptr1 = d_pool_get(pool);
+	d_pool_put(pool, ptr0);
+	ck_assert_ptr_eq(ptr0, d_pool_get(pool));
+	d_pool_put(pool, ptr1);
+	ck_assert_ptr_eq(ptr1, d_pool_get(pool));
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_pool_spans_slabs) {
+	// Take many more objects than fit in a single slab, and ensure they're
+	// all distinct and writable.
+	size_t size = 512;
+	size_t count = 1024;
+	void *objs[count];
+	d_pool_t *pool = d_pool_create(size, 0);
+	for (size_t i = 0; i < count; i++) {
+		objs[i] = d_pool_get(pool);
+		ck_assert_ptr_nonnull(objs[i]);
+		fill_memory(size, objs[i]);
+	}
+	for (size_t i = 1; i < count; i++) {
+		ck_assert_ptr_ne(objs[i - 1], objs[i]);
+	}
+	for (size_t i = 0; i < count; i++) {
+		d_pool_put(pool, objs[i]);
+	}
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_pool_reserve) {
+	d_pool_t *pool = d_pool_create(64, 0);
+	ck_assert(d_pool_reserve(pool, 4096));
+	void *first = d_pool_get(pool);
+	ck_assert_ptr_nonnull(first);
+	d_pool_put(pool, first);
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_pool_put_wrong_pool) {
+	d_pool_t *pool0 = d_pool_create(16, 0);
+	d_pool_t *pool1 = d_pool_create(16, 0);
+	void *ptr = d_pool_get(pool0);
+
+	attach_signal_handler(SIGILL, _pool_sigill_handler);
+	d_pool_put(pool1, ptr);
+	detach_signal_handlers(SIGILL);
+	ck_assert_int_eq(true, sigill_raised);
+
+	d_pool_put(pool0, ptr);
+	d_pool_destroy(pool0);
+	d_pool_destroy(pool1);
+}
+END_TEST
+
+START_TEST(test_pool_thread_cache) {
+	d_pool_t *pool = d_pool_create(16, 0);
+	ck_assert(d_pool_enable_thread_cache(pool, 8));
+
+	// Overflow the cache a few times so that objects are exchanged with
+	// the shared free list.
+	void *objs[64];
+	for (int32_t i = 0; i < 64; i++) {
+		objs[i] = d_pool_get(pool);
+		ck_assert_ptr_nonnull(objs[i]);
+	}
+	for (int32_t i = 0; i < 64; i++) {
+		d_pool_put(pool, objs[i]);
+	}
+	void *ptr = d_pool_get(pool);
+	ck_assert_ptr_eq(objs[63], ptr);
+	d_pool_put(pool, ptr);
+
+	d_pool_flush_thread_cache(pool);
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_pool_thread_cache_slot_reuse) {
+	// A thread cache slot released by a destroyed pool must not leak stale
+	// objects into the next pool to use that slot.
+	d_pool_t *pool0 = d_pool_create(16, 0);
+	ck_assert(d_pool_enable_thread_cache(pool0, 8));
+	d_pool_put(pool0, d_pool_get(pool0));
+	d_pool_destroy(pool0);
+
+	d_pool_t *pool1 = d_pool_create(16, 0);
+	ck_assert(d_pool_enable_thread_cache(pool1, 8));
+	void *ptr = d_pool_get(pool1);
+	ck_assert_ptr_nonnull(ptr);
+	fill_memory(16, ptr);
+	d_pool_put(pool1, ptr);
+	d_pool_destroy(pool1);
+}
+END_TEST
+
+static void *pool_worker(void *arg) {
+	d_pool_t *pool = (d_pool_t *)arg;
+	void *objs[16];
+	for (int32_t i = 0; i < POOL_TEST_ITERATIONS; i++) {
+		for (int32_t j = 0; j < 16; j++) {
+			objs[j] = d_pool_get(pool);
+			ck_assert_ptr_nonnull(objs[j]);
+			*(int32_t *)objs[j] = j;
+		}
+		for (int32_t j = 0; j < 16; j++) {
+			ck_assert_int_eq(j, *(int32_t *)objs[j]);
+			d_pool_put(pool, objs[j]);
+		}
+	}
+	d_pool_flush_thread_cache(pool);
+	return NULL;
+}
+
+START_TEST(test_pool_threads) {
+	// _i == 1: with thread caches.
+	d_pool_t *pool = d_pool_create(sizeof(int32_t), 0);
+	if (_i) {
+		ck_assert(d_pool_enable_thread_cache(pool, 4));
+	}
+
+	pthread_t threads[POOL_TEST_NUM_THREADS];
+	for (int32_t i = 0; i < POOL_TEST_NUM_THREADS; i++) {
+		ck_assert_int_eq(0, pthread_create(&threads[i], NULL, pool_worker, pool));
+	}
+	for (int32_t i = 0; i < POOL_TEST_NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_pool_owner_get_put) {
+	// The owner gets and puts objects directly.
+	d_pool_t *pool = d_pool_create(32, 0);
+	d_pool_set_owner(pool);
+	void *ptr0 = d_pool_get(pool);
+	ck_assert_ptr_nonnull(ptr0);
+	d_pool_put(pool, ptr0);
+	ck_assert_ptr_eq(ptr0, d_pool_get(pool));
+	d_pool_put(pool, ptr0);
+
+	d_pool_stats_t stats;
+	d_pool_get_stats(pool, &stats);
+	ck_assert_uint_eq(1, stats.num_slabs);
+	ck_assert_uint_eq(0, stats.remote_frees);
+	d_pool_destroy(pool);
+}
+END_TEST
+
+static void *pool_remote_get(void *arg) {
+	return d_pool_get((d_pool_t *)arg);
+}
+
+START_TEST(test_pool_get_not_owner) {
+	// Only the owner may get objects from an owned pool.
+	d_pool_t *pool = d_pool_create(32, 0);
+	d_pool_set_owner(pool);
+
+	attach_signal_handler(SIGILL, _pool_sigill_handler);
+	pthread_t thread;
+	void *result;
+	pthread_create(&thread, NULL, pool_remote_get, pool);
+	pthread_join(thread, &result);
+	detach_signal_handlers(SIGILL);
+
+	ck_assert_int_eq(true, sigill_raised);
+	ck_assert_ptr_null(result);
+	d_pool_destroy(pool);
+}
+END_TEST
+
+typedef struct {
+	d_pool_t *pool;
+	void **objs;
+	size_t count;
+} remote_put_args_t;
+
+static void *pool_remote_put(void *arg) {
+	remote_put_args_t *args = (remote_put_args_t *)arg;
+	for (size_t i = 0; i < args->count; i++) {
+		d_pool_put(args->pool, args->objs[i]);
+	}
+	return NULL;
+}
+
+START_TEST(test_pool_remote_free) {
+	// Objects put by another thread should go to the remote free list and
+	// be reclaimed by the owner, in a single batch, once its own free list
+	// is empty.
+	size_t size = 64;
+	d_pool_t *pool = d_pool_create(size, 0);
+	d_pool_set_owner(pool);
+
+	d_pool_stats_t stats;
+	d_pool_get_stats(pool, &stats);
+	ck_assert_uint_eq(0, stats.num_slabs);
+
+	// Exhaust the first slab.
+	void *first = d_pool_get(pool);
+	d_pool_get_stats(pool, &stats);
+	size_t count = stats.num_free + 1;
+	void *objs[count];
+	objs[0] = first;
+	for (size_t i = 1; i < count; i++) {
+		objs[i] = d_pool_get(pool);
+	}
+
+	remote_put_args_t args = { pool, objs, count };
+	pthread_t thread;
+	pthread_create(&thread, NULL, pool_remote_put, &args);
+	pthread_join(thread, NULL);
+
+	d_pool_get_stats(pool, &stats);
+	ck_assert_uint_eq(count, stats.remote_frees);
+	ck_assert_uint_eq(count * size, stats.remote_free_bytes);
+	ck_assert_uint_eq(0, stats.remote_drains);
+
+	// These should all come from the remote free list, without growing.
+	for (size_t i = 0; i < count; i++) {
+		ck_assert_ptr_nonnull(d_pool_get(pool));
+	}
+	d_pool_get_stats(pool, &stats);
+	ck_assert_uint_eq(1, stats.num_slabs);
+	ck_assert_uint_eq(1, stats.remote_drains);
+	d_pool_destroy(pool);
+}
+END_TEST
+
+typedef struct {
+	d_pool_t *pool;
+	void *_Atomic *slots;
+	size_t num_slots;
+	size_t iterations;
+} producer_consumer_args_t;
+
+static void *pool_consumer(void *arg) {
+	producer_consumer_args_t *args = (producer_consumer_args_t *)arg;
+	size_t consumed = 0;
+	size_t i = 0;
+	while (consumed < args->iterations) {
+		void *obj = atomic_exchange(&args->slots[i], NULL);
+		if (obj) {
+			ck_assert_uint_eq(consumed, *(size_t *)obj);
+			d_pool_put(args->pool, obj);
+			consumed++;
+			i = (i + 1) % args->num_slots;
+		}
+	}
+	return NULL;
+}
+
+START_TEST(test_pool_producer_consumer) {
+	// The owning thread allocates objects and passes them through a ring of
+	// slots to a consumer, which frees them.
+	size_t num_slots = 64;
+	size_t iterations = 100000;
+	void *_Atomic slots[num_slots];
+	for (size_t i = 0; i < num_slots; i++) {
+		atomic_init(&slots[i], NULL);
+	}
+
+	d_pool_t *pool = d_pool_create(sizeof(size_t), 0);
+	d_pool_set_owner(pool);
+
+	producer_consumer_args_t args = { pool, slots, num_slots, iterations };
+	pthread_t consumer;
+	pthread_create(&consumer, NULL, pool_consumer, &args);
+
+	for (size_t i = 0; i < iterations; i++) {
+		size_t *obj = d_pool_get(pool);
+		ck_assert_ptr_nonnull(obj);
+		*obj = i;
+		while (atomic_load(&slots[i % num_slots])) {
+			// Wait for the consumer to catch up.
+		}
+		atomic_store(&slots[i % num_slots], obj);
+	}
+	pthread_join(consumer, NULL);
+
+	// The pool should have recycled objects rather than growing without
+	// bound.
+	d_pool_stats_t stats;
+	d_pool_get_stats(pool, &stats);
+	ck_assert_uint_eq(iterations, stats.remote_frees);
+	ck_assert_uint_gt(stats.remote_drains, 0);
+	ck_assert_uint_lt(stats.num_slabs, 4);
+	d_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(test_pool_huge_page_slabs) {
+	// With huge pages, slabs of different pools should be packed into the
+	// same huge page region.
+	set_huge_pages(DALLOC_HUGE_PAGES_TRANSPARENT);
+	size_t huge_page_size = os_huge_page_size();
+	d_pool_t *pool0 = d_pool_create(64, 0);
+	d_pool_t *pool1 = d_pool_create(64, 0);
+	void *obj0 = d_pool_get(pool0);
+	void *obj1 = d_pool_get(pool1);
+	ck_assert_uint_eq((uintptr_t)obj0 / huge_page_size, (uintptr_t)obj1 / huge_page_size);
+
+	// Destroying a pool keeps its slabs for reuse by later pools, rather
+	// than unmapping part of a huge page.
+	d_pool_put(pool0, obj0);
+	d_pool_destroy(pool0);
+	d_pool_t *pool2 = d_pool_create(64, 0);
+	void *obj2 = d_pool_get(pool2);
+	ck_assert_ptr_eq(obj0, obj2);
+
+	d_pool_put(pool1, obj1);
+	d_pool_put(pool2, obj2);
+	d_pool_destroy(pool1);
+	d_pool_destroy(pool2);
+	set_huge_pages(DALLOC_HUGE_PAGES_NONE);
+}
+END_TEST
+
+Suite *d_pool_test_suite() {
+	TCase *test_case = tcase_create("pool test case");
+	tcase_add_checked_fixture(test_case, pool_tests_setup, pool_tests_teardown);
+
+	tcase_add_loop_test(test_case, test_pool_get_put, 0, 14);
+	tcase_add_loop_test(test_case, test_pool_alignment, 0, 13);
+	tcase_add_test(test_case, test_pool_invalid_alignment);
+	tcase_add_test(test_case, test_pool_reuse);
+	tcase_add_test(test_case, test_pool_spans_slabs);
+	tcase_add_test(test_case, test_pool_reserve);
+	tcase_add_test(test_case, test_pool_put_wrong_pool);
+	tcase_add_test(test_case, test_pool_thread_cache);
+	tcase_add_test(test_case, test_pool_thread_cache_slot_reuse);
+	tcase_add_loop_test(test_case, test_pool_threads, 0, 2);
+	tcase_add_test(test_case, test_pool_owner_get_put);
+	tcase_add_test(test_case, test_pool_get_not_owner);
+	tcase_add_test(test_case, test_pool_remote_free);
+	tcase_add_test(test_case, test_pool_producer_consumer);
+	tcase_add_test(test_case, test_pool_huge_page_slabs);
+
+	Suite *suite = suite_create("pool tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
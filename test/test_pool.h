@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_POOL_H_
+#define _DALLOC_TEST_POOL_H_
+
+#include <check.h>
+
+Suite *d_pool_test_suite();
+
+#endif // _DALLOC_TEST_POOL_H_
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "test_probes.h"
+
+// Note type of a SystemTap (USDT) probe.
+#define STAPSDT_NOTE_TYPE 3
+
+// The probes documented in dalloc_probes.h.
+static const char *probe_names[] = {
+	"malloc_entry", "malloc_return", "free_entry", "free_return",
+	"realloc_entry", "realloc_return", "heap_grow", "heap_trim",
+	"mmap", "munmap", "purge", "panic"
+};
+
+#define NUM_PROBES (sizeof(probe_names) / sizeof(probe_names[0]))
+
+static size_t align4(size_t x) {
+	return (x + 3) & ~(size_t)3;
+}
+
+/*
+Count the USDT probes in the .note.stapsdt section of libdalloc.so, as
+loaded by this process. Return the total number of probes, and the number
+of each documented probe through counts.
+*/
+static size_t count_probes(size_t counts[NUM_PROBES]) {
+	Dl_info info;
+	ck_assert(dladdr((void *)d_malloc, &info));
+	int fd = open(info.dli_fname, O_RDONLY);
+	ck_assert_int_ge(fd, 0);
+	struct stat st;
+	ck_assert_int_eq(0, fstat(fd, &st));
+	uint8_t *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	ck_assert_ptr_ne(MAP_FAILED, image);
+
+	Elf64_Ehdr *ehdr = (Elf64_Ehdr *)image;
+	ck_assert_int_eq(0, memcmp(ehdr->e_ident, ELFMAG, SELFMAG));
+	ck_assert_int_eq(ELFCLASS64, ehdr->e_ident[EI_CLASS]);
+	Elf64_Shdr *sections = (Elf64_Shdr *)(image + ehdr->e_shoff);
+	const char *section_names = (const char *)image + sections[ehdr->e_shstrndx].sh_offset;
+
+	size_t total = 0;
+	for (uint32_t i = 0; i < ehdr->e_shnum; i++) {
+		if (sections[i].sh_type != SHT_NOTE
+				|| strcmp(section_names + sections[i].sh_name, ".note.stapsdt")) {
+			continue;
+		}
+		uint8_t *note = image + sections[i].sh_offset;
+		uint8_t *end = note + sections[i].sh_size;
+		while (note < end) {
+			Elf64_Nhdr *header = (Elf64_Nhdr *)note;
+			const char *name = (const char *)(header + 1);
+			const char *desc = name + align4(header->n_namesz);
+			note = (uint8_t *)desc + align4(header->n_descsz);
+			if (header->n_type != STAPSDT_NOTE_TYPE || strcmp(name, "stapsdt")) {
+				continue;
+			}
+
+			// The description holds the probe's address, the address of the
+			// .stapsdt.base section and the address of the probe's semaphore,
+			// followed by the provider, the probe name and its arguments.
+			const char *provider = desc + 3 * sizeof(Elf64_Addr);
+			const char *probe = provider + strlen(provider) + 1;
+			total++;
+			for (size_t j = 0; j < NUM_PROBES; j++) {
+				if (!strcmp(provider, "dalloc") && !strcmp(probe, probe_names[j])) {
+					counts[j]++;
+				}
+			}
+		}
+	}
+
+	munmap(image, st.st_size);
+	return total;
+}
+
+START_TEST(test_probes_notes) {
+	size_t counts[NUM_PROBES] = { 0 };
+	size_t total = count_probes(counts);
+
+#ifdef DALLOC_USDT
+	// Every documented probe should be compiled in, and every probe which
+	// is compiled in should be documented.
+	size_t documented = 0;
+	for (size_t i = 0; i < NUM_PROBES; i++) {
+		ck_assert_msg(counts[i] > 0, "missing USDT probe dalloc:%s", probe_names[i]);
+		documented += counts[i];
+	}
+	ck_assert_uint_eq(total, documented);
+#else
+	// Without DALLOC_USDT the probes compile to nothing.
+	ck_assert_uint_eq(0, total);
+#endif
+}
+END_TEST
+
+Suite *d_probes_test_suite() {
+	TCase *test_case = tcase_create("probes test case");
+
+	tcase_add_test(test_case, test_probes_notes);
+
+	Suite *suite = suite_create("probes tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
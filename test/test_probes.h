@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_PROBES_H_
+#define _DALLOC_TEST_PROBES_H_
+
+#include <check.h>
+
+Suite *d_probes_test_suite();
+
+#endif // _DALLOC_TEST_PROBES_H_
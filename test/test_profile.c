@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include <check.h>
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_io.h"
+#include "dalloc_profile.h"
+#include "test_profile.h"
+
+// Size of the allocations made by these tests. With a sample interval of
+// 1 byte, the chance of an allocation this large not being sampled is
+// negligible (e^-64).
+#define PROFILE_TEST_ALLOC_SIZE 64
+
+// Totals from the header line of a heap profile.
+typedef struct {
+	size_t live_count;
+	size_t live_bytes;
+	size_t alloc_count;
+	size_t alloc_bytes;
+	size_t interval;
+} profile_header_t;
+
+static char profile[1 << 16];
+
+void profile_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+}
+
+void profile_tests_teardown() {
+	d_profile_stop();
+}
+
+/*
+Dump the current profile into the profile buffer, and parse its header.
+
+@param header: (out) The parsed header.
+*/
+static void dump_profile(profile_header_t *header) {
+	FILE *file = tmpfile();
+	ck_assert_ptr_nonnull(file);
+	int fd = fileno(file);
+
+	ck_assert(d_profile_dump(fd));
+
+	lseek(fd, 0, SEEK_SET);
+	ssize_t n = read(fd, profile, sizeof(profile) - 1);
+	ck_assert_int_gt(n, 0);
+	profile[n] = 0;
+	fclose(file);
+
+	int matched = sscanf(profile, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu",
+		&header->live_count, &header->live_bytes,
+		&header->alloc_count, &header->alloc_bytes, &header->interval);
+	ck_assert_int_eq(5, matched);
+}
+
+START_TEST(test_profile_live_and_cumulative) {
+	ck_assert(d_profile_start(1));
+
+	void *ptrs[16];
+	for (int32_t i = 0; i < 16; i++) {
+		ptrs[i] = d_malloc(PROFILE_TEST_ALLOC_SIZE);
+		ck_assert_ptr_nonnull(ptrs[i]);
+	}
+
+	profile_header_t header;
+	dump_profile(&header);
+	ck_assert_uint_eq(16, header.live_count);
+	ck_assert_uint_eq(16 * PROFILE_TEST_ALLOC_SIZE, header.live_bytes);
+	ck_assert_uint_eq(16, header.alloc_count);
+	ck_assert_uint_eq(16 * PROFILE_TEST_ALLOC_SIZE, header.alloc_bytes);
+	ck_assert_uint_eq(1, header.interval);
+
+	// Freed allocations are removed from the live heap, but remain in the
+	// cumulative profile.
+	for (int32_t i = 0; i < 8; i++) {
+		d_free(ptrs[i]);
+	}
+	dump_profile(&header);
+	ck_assert_uint_eq(8, header.live_count);
+	ck_assert_uint_eq(8 * PROFILE_TEST_ALLOC_SIZE, header.live_bytes);
+	ck_assert_uint_eq(16, header.alloc_count);
+	ck_assert_uint_eq(16 * PROFILE_TEST_ALLOC_SIZE, header.alloc_bytes);
+
+	for (int32_t i = 8; i < 16; i++) {
+		d_free(ptrs[i]);
+	}
+	dump_profile(&header);
+	ck_assert_uint_eq(0, header.live_count);
+	ck_assert_uint_eq(0, header.live_bytes);
+	ck_assert_uint_eq(16, header.alloc_count);
+}
+END_TEST
+
+START_TEST(test_profile_format) {
+	ck_assert(d_profile_start(1));
+	void *ptr = d_malloc(PROFILE_TEST_ALLOC_SIZE);
+
+	profile_header_t header;
+	dump_profile(&header);
+
+	// Every allocation in this test comes from the same call site, so there
+	// should be exactly one record, with at least one frame.
+	char *record = strchr(profile, '\n') + 1;
+	size_t live_count, live_bytes, alloc_count, alloc_bytes;
+	int matched = sscanf(record, "%zu: %zu [%zu: %zu] @ 0x",
+		&live_count, &live_bytes, &alloc_count, &alloc_bytes);
+	ck_assert_int_eq(4, matched);
+	ck_assert_uint_eq(1, live_count);
+	ck_assert_uint_eq(PROFILE_TEST_ALLOC_SIZE, live_bytes);
+	ck_assert_ptr_nonnull(strstr(record, "@ 0x"));
+
+	// The memory map follows the records.
+	char *maps = strchr(record, '\n') + 1;
+	ck_assert_ptr_eq(maps, strstr(profile, "\nMAPPED_LIBRARIES:\n"));
+	ck_assert_ptr_nonnull(strstr(maps, "[stack]"));
+
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_profile_skips_own_frames) {
+	// Whichever entry point is used, the first recorded frame should be in
+	// the caller (this executable), not in dalloc.
+	static const char test_object;
+	Dl_info info;
+	ck_assert(dladdr(&test_object, &info));
+	void *test_base = info.dli_fbase;
+
+	ck_assert(d_profile_start(1));
+	void *ptrs[4];
+	ptrs[0] = d_malloc(PROFILE_TEST_ALLOC_SIZE);
+	ptrs[1] = d_calloc(1, PROFILE_TEST_ALLOC_SIZE);
+	ptrs[2] = d_realloc(NULL, PROFILE_TEST_ALLOC_SIZE);
+	ptrs[3] = d_mallocx(PROFILE_TEST_ALLOC_SIZE, DALLOC_MALLOCX_ZERO);
+
+	profile_header_t header;
+	dump_profile(&header);
+	ck_assert_uint_eq(4, header.live_count);
+
+	size_t records = 0;
+	char *maps = strstr(profile, "\nMAPPED_LIBRARIES:\n");
+	for (char *record = strchr(profile, '\n') + 1; record < maps; record = strchr(record, '\n') + 1) {
+		uintptr_t frame;
+		ck_assert_int_eq(1, sscanf(strstr(record, "@ "), "@ 0x%lx", &frame));
+		ck_assert(dladdr((void *)frame, &info));
+		ck_assert_ptr_eq(test_base, info.dli_fbase);
+		records++;
+	}
+	ck_assert_uint_eq(4, records);
+
+	for (int32_t i = 0; i < 4; i++) {
+		d_free(ptrs[i]);
+	}
+}
+END_TEST
+
+START_TEST(test_profile_unsampled_free_lock_free) {
+	ck_assert(d_profile_start(1));
+	void *sampled = d_malloc(PROFILE_TEST_ALLOC_SIZE);
+	d_profile_stop();
+	void *unsampled = d_malloc(PROFILE_TEST_ALLOC_SIZE);
+	ck_assert_uint_eq(1, atomic_load(&profile_live_samples));
+
+	// Freeing memory which wasn't sampled doesn't take the profile lock
+	// (this would spin forever if it did).
+	profile_fork_prepare();
+	d_free(unsampled);
+	profile_fork_finish();
+
+	d_free(sampled);
+	ck_assert_uint_eq(0, atomic_load(&profile_live_samples));
+}
+END_TEST
+
+START_TEST(test_profile_stop) {
+	ck_assert(d_profile_start(1));
+	void *sampled = d_malloc(PROFILE_TEST_ALLOC_SIZE);
+	d_profile_stop();
+	void *unsampled = d_malloc(PROFILE_TEST_ALLOC_SIZE);
+
+	// Allocations sampled before the profiler was stopped are still
+	// tracked until they're freed.
+	profile_header_t header;
+	dump_profile(&header);
+	ck_assert_uint_eq(1, header.live_count);
+	ck_assert_uint_eq(1, header.alloc_count);
+	ck_assert_uint_eq(1, header.interval);
+
+	d_free(sampled);
+	d_free(unsampled);
+	dump_profile(&header);
+	ck_assert_uint_eq(0, header.live_count);
+	ck_assert_uint_eq(1, header.alloc_count);
+}
+END_TEST
+
+START_TEST(test_profile_restart) {
+	ck_assert(d_profile_start(1));
+	void *ptr = d_malloc(PROFILE_TEST_ALLOC_SIZE);
+
+	// Restarting the profiler discards existing samples.
+	ck_assert(d_profile_start(1024));
+	profile_header_t header;
+	dump_profile(&header);
+	ck_assert_uint_eq(0, header.live_count);
+	ck_assert_uint_eq(0, header.alloc_count);
+	ck_assert_uint_eq(1024, header.interval);
+
+	d_free(ptr);
+}
+END_TEST
+
+START_TEST(test_profile_sample_rate) {
+	// 1000 * 64 bytes with a mean interval of 4KiB should give ~16 samples.
+	// The bounds are loose enough that this will essentially never fail by
+	// chance.
+	ck_assert(d_profile_start(4096));
+	void *ptrs[1000];
+	for (int32_t i = 0; i < 1000; i++) {
+		ptrs[i] = d_malloc(PROFILE_TEST_ALLOC_SIZE);
+	}
+
+	profile_header_t header;
+	dump_profile(&header);
+	ck_assert_uint_ge(header.alloc_count, 2);
+	ck_assert_uint_le(header.alloc_count, 48);
+	ck_assert_uint_eq(header.alloc_count * PROFILE_TEST_ALLOC_SIZE, header.alloc_bytes);
+
+	for (int32_t i = 0; i < 1000; i++) {
+		d_free(ptrs[i]);
+	}
+}
+END_TEST
+
+START_TEST(test_profile_invalid_interval) {
+	ck_assert(!d_profile_start(0));
+}
+END_TEST
+
+START_TEST(test_profile_dump_not_started) {
+	ck_assert(!d_profile_dump(STDOUT_FILENO));
+}
+END_TEST
+
+Suite *d_profile_test_suite() {
+	TCase *test_case = tcase_create("profile test case");
+	tcase_add_checked_fixture(test_case, profile_tests_setup, profile_tests_teardown);
+
+	tcase_add_test(test_case, test_profile_dump_not_started);
+	tcase_add_test(test_case, test_profile_live_and_cumulative);
+	tcase_add_test(test_case, test_profile_format);
+	tcase_add_test(test_case, test_profile_skips_own_frames);
+	tcase_add_test(test_case, test_profile_unsampled_free_lock_free);
+	tcase_add_test(test_case, test_profile_stop);
+	tcase_add_test(test_case, test_profile_restart);
+	tcase_add_test(test_case, test_profile_sample_rate);
+	tcase_add_test(test_case, test_profile_invalid_interval);
+
+	Suite *suite = suite_create("profile tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_PROFILE_H_
+#define _DALLOC_TEST_PROFILE_H_
+
+#include <check.h>
+
+Suite *d_profile_test_suite();
+
+#endif // _DALLOC_TEST_PROFILE_H_
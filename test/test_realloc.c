@@ -5,6 +5,7 @@
 #include <unistd.h>
 
 #include "dalloc.h"
+#include "dalloc_config.h"
 #include "dalloc_io.h"
 #include "test_realloc.h"
 #include "test_util.h"
@@ -13,6 +14,10 @@ static bool sigill_raised;
 
 void realloc_tests_setup() {
 	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	// These tests check the position of the program break, so memory must
+	// be requested from and released to the OS exactly when it's needed.
+	set_trim_threshold(0);
+	set_top_pad(0);
 	sigill_raised = false;
 }
 
@@ -0,0 +1,162 @@
+#include <check.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "dalloc_search_stats.h"
+#include "test_search_stats.h"
+
+void search_stats_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	// Memory is released to the OS as soon as possible, so that the paths
+	// taken by each call are predictable.
+	set_trim_threshold(0);
+	set_top_pad(0);
+	d_search_stats_reset();
+}
+
+void search_stats_tests_teardown() {
+
+}
+
+#ifdef DALLOC_SEARCH_STATS
+
+START_TEST(test_search_stats_paths) {
+	d_search_stats_t stats;
+	ck_assert(d_search_stats_thread(&stats));
+	ck_assert_uint_eq(0, stats.ops[DALLOC_SEARCH_OP_MALLOC].calls);
+
+	// The first allocation must grow the heap.
+	void *ptr0 = d_malloc(256);
+	void *ptr1 = d_malloc(64);
+	d_search_stats_thread(&stats);
+	d_search_op_stats_t *malloc_stats = &stats.ops[DALLOC_SEARCH_OP_MALLOC];
+	ck_assert_uint_eq(2, malloc_stats->calls);
+	ck_assert_uint_eq(2, malloc_stats->path_calls[DALLOC_SEARCH_PATH_SBRK]);
+
+	// Freeing the first chunk leaves it in the heap, and a smaller
+	// allocation reuses and splits it.
+	d_free(ptr0);
+	ptr0 = d_malloc(64);
+	d_search_stats_thread(&stats);
+	ck_assert_uint_eq(1, stats.ops[DALLOC_SEARCH_OP_FREE].calls);
+	ck_assert_uint_eq(1, stats.ops[DALLOC_SEARCH_OP_FREE].path_calls[0]);
+	ck_assert_uint_eq(1, malloc_stats->path_calls[DALLOC_SEARCH_PATH_REUSE | DALLOC_SEARCH_PATH_SPLIT]);
+
+	// Freeing the top chunk merges it with the free chunk below it, and
+	// releases both to the OS.
+	d_free(ptr1);
+	d_search_stats_thread(&stats);
+	uint32_t paths = DALLOC_SEARCH_PATH_COALESCE | DALLOC_SEARCH_PATH_TAIL_RELEASE;
+	ck_assert_uint_eq(1, stats.ops[DALLOC_SEARCH_OP_FREE].path_calls[paths]);
+
+	d_free(ptr0);
+}
+END_TEST
+
+START_TEST(test_search_stats_visits) {
+	void *ptrs[8];
+	for (int32_t i = 0; i < 8; i++) {
+		ptrs[i] = d_malloc(32);
+	}
+	d_search_stats_reset();
+
+	// Finding the last chunk means visiting every chunk.
+	d_free(ptrs[7]);
+	d_search_stats_t stats;
+	d_search_stats_thread(&stats);
+	d_search_op_stats_t *free_stats = &stats.ops[DALLOC_SEARCH_OP_FREE];
+	ck_assert_uint_eq(1, free_stats->calls);
+	ck_assert_uint_ge(free_stats->max_visits, 8);
+	ck_assert_uint_eq(free_stats->visits, free_stats->max_visits);
+	ck_assert_uint_gt(free_stats->cycles, 0);
+
+	uint64_t hist_total = 0;
+	for (int32_t i = 0; i < DALLOC_SEARCH_HIST_BUCKETS; i++) {
+		hist_total += free_stats->visits_hist[i];
+	}
+	ck_assert_uint_eq(1, hist_total);
+	ck_assert_uint_eq(1, free_stats->visits_hist[4]);
+
+	for (int32_t i = 0; i < 7; i++) {
+		d_free(ptrs[i]);
+	}
+}
+END_TEST
+
+START_TEST(test_search_stats_nested_calls) {
+	void *ptr = d_malloc(32);
+	d_search_stats_reset();
+
+	// Growing a chunk calls d_malloc() and d_free(), but only the realloc
+	// should be recorded.
+	ptr = d_realloc(ptr, 4096);
+	d_search_stats_t stats;
+	d_search_stats_thread(&stats);
+	ck_assert_uint_eq(1, stats.ops[DALLOC_SEARCH_OP_REALLOC].calls);
+	ck_assert_uint_eq(0, stats.ops[DALLOC_SEARCH_OP_MALLOC].calls);
+	ck_assert_uint_eq(0, stats.ops[DALLOC_SEARCH_OP_FREE].calls);
+	ck_assert(stats.ops[DALLOC_SEARCH_OP_REALLOC].path_calls[DALLOC_SEARCH_PATH_SBRK]
+		|| stats.ops[DALLOC_SEARCH_OP_REALLOC].path_calls[DALLOC_SEARCH_PATH_SBRK | DALLOC_SEARCH_PATH_SPLIT]);
+
+	d_free(ptr);
+}
+END_TEST
+
+static void *allocate_in_thread(void *arg) {
+	d_free(d_malloc(32));
+	return NULL;
+}
+
+START_TEST(test_search_stats_threads) {
+	d_free(d_malloc(32));
+
+	// The other thread's calls are in the total (even though it's exited),
+	// but not in this thread's statistics.
+	pthread_t thread;
+	pthread_create(&thread, NULL, allocate_in_thread, NULL);
+	pthread_join(thread, NULL);
+
+	d_search_stats_t stats;
+	d_search_stats_thread(&stats);
+	ck_assert_uint_eq(1, stats.ops[DALLOC_SEARCH_OP_MALLOC].calls);
+	ck_assert(d_search_stats_total(&stats));
+	ck_assert_uint_eq(2, stats.ops[DALLOC_SEARCH_OP_MALLOC].calls);
+	ck_assert_uint_eq(2, stats.ops[DALLOC_SEARCH_OP_FREE].calls);
+}
+END_TEST
+
+#else
+
+START_TEST(test_search_stats_disabled) {
+	d_free(d_malloc(32));
+	d_search_stats_t stats;
+	ck_assert(!d_search_stats_thread(&stats));
+	ck_assert_uint_eq(0, stats.ops[DALLOC_SEARCH_OP_MALLOC].calls);
+	ck_assert(!d_search_stats_total(&stats));
+	ck_assert_uint_eq(0, stats.ops[DALLOC_SEARCH_OP_MALLOC].calls);
+}
+END_TEST
+
+#endif // DALLOC_SEARCH_STATS
+
+Suite *d_search_stats_test_suite() {
+	TCase *test_case = tcase_create("search stats test case");
+	tcase_add_checked_fixture(test_case, search_stats_tests_setup, search_stats_tests_teardown);
+
+#ifdef DALLOC_SEARCH_STATS
+	tcase_add_test(test_case, test_search_stats_paths);
+	tcase_add_test(test_case, test_search_stats_visits);
+	tcase_add_test(test_case, test_search_stats_nested_calls);
+	tcase_add_test(test_case, test_search_stats_threads);
+#else
+	tcase_add_test(test_case, test_search_stats_disabled);
+#endif
+
+	Suite *suite = suite_create("search stats tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_SEARCH_STATS_H_
+#define _DALLOC_TEST_SEARCH_STATS_H_
+
+#include <check.h>
+
+Suite *d_search_stats_test_suite();
+
+#endif // _DALLOC_TEST_SEARCH_STATS_H_
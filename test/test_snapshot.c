@@ -0,0 +1,151 @@
+#include <check.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dalloc.h"
+#include "dalloc_config.h"
+#include "dalloc_io.h"
+#include "dalloc_snapshot.h"
+#include "dalloc_utils.h"
+#include "test_snapshot.h"
+
+#define SNAPSHOT_TEST_MAX_CHUNKS 16
+
+// Enough chunks that the snapshot doesn't fit in a pipe's buffer.
+#define SNAPSHOT_TEST_PIPE_CHUNKS 8192
+
+static d_snapshot_header_t header;
+static d_snapshot_chunk_t chunks[SNAPSHOT_TEST_MAX_CHUNKS];
+
+void snapshot_tests_setup() {
+	set_log_level(DALLOC_LOG_LEVEL_NONE);
+	// Keep the heap layout predictable: no padding at the top of the heap.
+	set_trim_threshold(0);
+	set_top_pad(0);
+}
+
+void snapshot_tests_teardown() {
+
+}
+
+/*
+Take a snapshot of the heap, and read it back. Return the number of chunks
+in the snapshot.
+*/
+static size_t take_snapshot() {
+	FILE *file = tmpfile();
+	ck_assert_ptr_nonnull(file);
+	int fd = fileno(file);
+
+	ck_assert(d_heap_snapshot(fd));
+
+	lseek(fd, 0, SEEK_SET);
+	ck_assert_int_eq(sizeof(header), read(fd, &header, sizeof(header)));
+	ssize_t n = read(fd, chunks, sizeof(chunks));
+	ck_assert_int_ge(n, 0);
+	ck_assert_int_eq(0, n % sizeof(d_snapshot_chunk_t));
+	fclose(file);
+
+	ck_assert(!memcmp(DALLOC_SNAPSHOT_MAGIC, header.magic, 4));
+	ck_assert_uint_eq(DALLOC_SNAPSHOT_VERSION, header.version);
+	ck_assert_uint_eq(sizeof(chunk_t), header.header_size);
+	ck_assert_uint_gt(header.timestamp, 0);
+	return n / sizeof(d_snapshot_chunk_t);
+}
+
+START_TEST(test_snapshot_empty_heap) {
+	ck_assert_uint_eq(0, take_snapshot());
+}
+END_TEST
+
+START_TEST(test_snapshot_chunk_map) {
+	size_t sizes[3] = { 100, 200, 5000 };
+	void *ptrs[3];
+	for (int32_t i = 0; i < 3; i++) {
+		ptrs[i] = d_malloc(sizes[i]);
+	}
+	d_free(ptrs[1]);
+
+	ck_assert_uint_eq(3, take_snapshot());
+	for (int32_t i = 0; i < 3; i++) {
+		ck_assert_uint_eq((uintptr_t)ptrs[i], chunks[i].address);
+		ck_assert_uint_eq(sizes[i], snapshot_chunk_size(&chunks[i]));
+		ck_assert_uint_eq(size_class(sizes[i]), snapshot_chunk_class(&chunks[i]));
+		ck_assert(snapshot_chunk_in_use(&chunks[i]) == (i != 1));
+	}
+
+	d_free(ptrs[0]);
+	d_free(ptrs[2]);
+}
+END_TEST
+
+/*
+Allocate once the snapshot has filled the pipe, and then drain it. Return
+the number of bytes read.
+*/
+static void *allocate_then_read(void *arg) {
+	int fd = *(int *)arg;
+	usleep(100000);
+	d_free(d_malloc(64));
+
+	char buf[4096];
+	size_t total = 0;
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		total += n;
+	}
+	return (void *)total;
+}
+
+START_TEST(test_snapshot_blocking_write) {
+	void **ptrs = d_malloc(SNAPSHOT_TEST_PIPE_CHUNKS * sizeof(void *));
+	for (int32_t i = 0; i < SNAPSHOT_TEST_PIPE_CHUNKS; i++) {
+		ptrs[i] = d_malloc(16);
+	}
+
+	// The reader allocates while the snapshot is blocked writing to the
+	// pipe, which deadlocks if the heap lock is held across the write.
+	int fds[2];
+	ck_assert_int_eq(0, pipe(fds));
+	pthread_t reader;
+	pthread_create(&reader, NULL, allocate_then_read, &fds[0]);
+	ck_assert(d_heap_snapshot(fds[1]));
+	close(fds[1]);
+
+	void *total;
+	pthread_join(reader, &total);
+	close(fds[0]);
+	ck_assert_uint_eq(sizeof(d_snapshot_header_t)
+		+ (SNAPSHOT_TEST_PIPE_CHUNKS + 1) * sizeof(d_snapshot_chunk_t), (size_t)total);
+
+	for (int32_t i = 0; i < SNAPSHOT_TEST_PIPE_CHUNKS; i++) {
+		d_free(ptrs[i]);
+	}
+	d_free(ptrs);
+}
+END_TEST
+
+START_TEST(test_snapshot_write_error) {
+	void *ptr = d_malloc(64);
+	ck_assert(!d_heap_snapshot(-1));
+	d_free(ptr);
+}
+END_TEST
+
+Suite *d_snapshot_test_suite() {
+	TCase *test_case = tcase_create("snapshot test case");
+	tcase_add_checked_fixture(test_case, snapshot_tests_setup, snapshot_tests_teardown);
+
+	tcase_add_test(test_case, test_snapshot_empty_heap);
+	tcase_add_test(test_case, test_snapshot_chunk_map);
+	tcase_add_test(test_case, test_snapshot_blocking_write);
+	tcase_add_test(test_case, test_snapshot_write_error);
+
+	Suite *suite = suite_create("snapshot tests");
+	suite_add_tcase(suite, test_case);
+	return suite;
+}
@@ -0,0 +1,8 @@
+#ifndef _DALLOC_TEST_SNAPSHOT_H_
+#define _DALLOC_TEST_SNAPSHOT_H_
+
+#include <check.h>
+
+Suite *d_snapshot_test_suite();
+
+#endif // _DALLOC_TEST_SNAPSHOT_H_
@@ -108,6 +108,30 @@ START_TEST(test_total_allocated_happy_path) {
 }
 END_TEST
 
+START_TEST(test_total_allocated_large_chunks) {
+	// Chunks over 2 GiB don't overflow the total.
+	second.size = (size_t)3 << 30;
+	fourth.size = (size_t)5 << 30;
+	size_t expected = first.size + second.size + third.size + fourth.size + 4 * sizeof(chunk_t);
+	ck_assert_uint_eq(expected, total_allocated(&first));
+}
+END_TEST
+
+START_TEST(test_find_unused_bestfit_large_chunks) {
+	// Both unused chunks are more than 2 GiB larger than the request; the
+	// smaller one is the best fit.
+	second.size = ((size_t)5 << 30) + 32;
+	fourth.size = ((size_t)3 << 30) + 32;
+	ck_assert_ptr_eq(&fourth, find_unused_chunk_bestfit(&first, 32));
+
+	// A chunk which is too small is never chosen, however large the
+	// difference.
+	second.size = 16;
+	ck_assert_ptr_eq(&fourth, find_unused_chunk_bestfit(&first, (size_t)3 << 30));
+	ck_assert_ptr_null(find_unused_chunk_bestfit(&first, (size_t)4 << 30));
+}
+END_TEST
+
 START_TEST(test_is_contiguous) {
 	void *ptr0 = d_malloc(8);
 	void *ptr1 = d_malloc(16);
@@ -132,6 +156,30 @@ START_TEST(test_is_contiguous) {
 }
 END_TEST
 
+START_TEST(test_is_power_of_two) {
+	ck_assert(is_power_of_two((size_t)1 << _i));
+	ck_assert(!is_power_of_two(((size_t)1 << _i) + 3));
+	ck_assert(!is_power_of_two(0));
+}
+END_TEST
+
+START_TEST(test_align_up) {
+	ck_assert_uint_eq(0, align_up(0, 16));
+	ck_assert_uint_eq(16, align_up(1, 16));
+	ck_assert_uint_eq(16, align_up(16, 16));
+	ck_assert_uint_eq(32, align_up(17, 16));
+	ck_assert_uint_eq(4096, align_up(4095, 4096));
+}
+END_TEST
+
+START_TEST(test_size_class) {
+	ck_assert_uint_eq(0, size_class(0));
+	ck_assert_uint_eq(0, size_class(1));
+	ck_assert_uint_eq(_i, size_class((size_t)1 << _i));
+	ck_assert_uint_eq(_i, size_class(((size_t)1 << (_i + 1)) - 1));
+}
+END_TEST
+
 Suite *d_utils_test_suite() {
 	Suite* suite;
     TCase* test_case;
@@ -149,7 +197,12 @@ Suite *d_utils_test_suite() {
 	tcase_add_test(test_case, test_find_unused_smaller_used_exists);
 	tcase_add_test(test_case, test_find_unused_bestfit_closest_in_size);
 	tcase_add_test(test_case, test_total_allocated_happy_path);
+	tcase_add_test(test_case, test_total_allocated_large_chunks);
+	tcase_add_test(test_case, test_find_unused_bestfit_large_chunks);
 	tcase_add_test(test_case, test_is_contiguous);
+	tcase_add_loop_test(test_case, test_is_power_of_two, 1, 32);
+	tcase_add_test(test_case, test_align_up);
+	tcase_add_loop_test(test_case, test_size_class, 1, 63);
 
     return suite;
 }
@@ -0,0 +1,384 @@
+/*
+dalloc-snapshot: inspect heap snapshots written by d_heap_snapshot().
+
+Usage:
+	dalloc-snapshot stats <snapshot>
+	dalloc-snapshot map <snapshot> [width]
+	dalloc-snapshot diff <old snapshot> <new snapshot>
+*/
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dalloc_snapshot.h"
+#include "dalloc_utils.h"
+
+// Default number of cells per row of the fragmentation map.
+#define MAP_DEFAULT_WIDTH 64
+
+// Number of rows in the fragmentation map.
+#define MAP_ROWS 16
+
+typedef struct {
+	d_snapshot_header_t header;
+	d_snapshot_chunk_t *chunks;
+	size_t num_chunks;
+} snapshot_t;
+
+typedef struct {
+	size_t count;
+	uint64_t bytes;
+} class_totals_t;
+
+typedef struct {
+	size_t num_chunks;
+	size_t num_used;
+	size_t num_free;
+	uint64_t used_bytes;
+	uint64_t free_bytes;
+	uint64_t overhead_bytes;
+	uint64_t largest_free;
+	class_totals_t used[DALLOC_NUM_SIZE_CLASSES];
+	class_totals_t free[DALLOC_NUM_SIZE_CLASSES];
+} summary_t;
+
+static int compare_chunks(const void *x, const void *y) {
+	uint64_t a = ((const d_snapshot_chunk_t *)x)->address;
+	uint64_t b = ((const d_snapshot_chunk_t *)y)->address;
+	return (a > b) - (a < b);
+}
+
+/*
+Read a snapshot from a file. Return false (after printing an error) if the
+file couldn't be read or isn't a valid snapshot.
+
+@param path: Path to the file.
+@param snapshot: (out) The snapshot. Chunks are sorted by address.
+*/
+static bool read_snapshot(const char *path, snapshot_t *snapshot) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		return false;
+	}
+
+	if (fread(&snapshot->header, sizeof(snapshot->header), 1, file) != 1
+			|| memcmp(snapshot->header.magic, DALLOC_SNAPSHOT_MAGIC, 4)) {
+		fprintf(stderr, "%s: not a heap snapshot\n", path);
+		fclose(file);
+		return false;
+	}
+	if (snapshot->header.version != DALLOC_SNAPSHOT_VERSION) {
+		fprintf(stderr, "%s: unsupported snapshot version %" PRIu32 "\n",
+			path, snapshot->header.version);
+		fclose(file);
+		return false;
+	}
+
+	long header_end = ftell(file);
+	fseek(file, 0, SEEK_END);
+	long file_size = ftell(file);
+	fseek(file, header_end, SEEK_SET);
+	if (header_end < 0 || file_size < header_end
+			|| (file_size - header_end) % sizeof(d_snapshot_chunk_t)) {
+		fprintf(stderr, "%s: snapshot is truncated or corrupt\n", path);
+		fclose(file);
+		return false;
+	}
+
+	snapshot->num_chunks = (file_size - header_end) / sizeof(d_snapshot_chunk_t);
+	snapshot->chunks = malloc((snapshot->num_chunks + 1) * sizeof(d_snapshot_chunk_t));
+	if (!snapshot->chunks) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		fclose(file);
+		return false;
+	}
+	size_t n = fread(snapshot->chunks, sizeof(d_snapshot_chunk_t), snapshot->num_chunks, file);
+	fclose(file);
+	if (n != snapshot->num_chunks) {
+		fprintf(stderr, "%s: unable to read snapshot\n", path);
+		free(snapshot->chunks);
+		return false;
+	}
+
+	qsort(snapshot->chunks, snapshot->num_chunks, sizeof(d_snapshot_chunk_t), compare_chunks);
+	return true;
+}
+
+static void summarise(const snapshot_t *snapshot, summary_t *summary) {
+	memset(summary, 0, sizeof(*summary));
+	summary->num_chunks = snapshot->num_chunks;
+	summary->overhead_bytes = snapshot->num_chunks * snapshot->header.header_size;
+	for (size_t i = 0; i < snapshot->num_chunks; i++) {
+		const d_snapshot_chunk_t *chunk = &snapshot->chunks[i];
+		uint64_t size = snapshot_chunk_size(chunk);
+		uint32_t class = snapshot_chunk_class(chunk) % DALLOC_NUM_SIZE_CLASSES;
+		if (snapshot_chunk_in_use(chunk)) {
+			summary->num_used++;
+			summary->used_bytes += size;
+			summary->used[class].count++;
+			summary->used[class].bytes += size;
+		} else {
+			summary->num_free++;
+			summary->free_bytes += size;
+			summary->free[class].count++;
+			summary->free[class].bytes += size;
+			if (size > summary->largest_free) {
+				summary->largest_free = size;
+			}
+		}
+	}
+}
+
+/*
+Write the range of sizes in a size class, e.g. "[64, 128)".
+*/
+static void format_class_range(uint32_t class, char *buf, size_t size) {
+	unsigned long long lo = class ? 1ULL << class : 0;
+	if (class + 1 < DALLOC_NUM_SIZE_CLASSES) {
+		snprintf(buf, size, "[%llu, %llu)", lo, 1ULL << (class + 1));
+	} else {
+		snprintf(buf, size, "[%llu, inf)", lo);
+	}
+}
+
+/*
+Return the fragmentation index of the free space: 0 if it's all in one
+block, approaching 1 as it's split into many small blocks.
+*/
+static double fragmentation(const summary_t *summary) {
+	if (!summary->free_bytes) {
+		return 0;
+	}
+	return 1.0 - (double)summary->largest_free / summary->free_bytes;
+}
+
+static void print_summary(const summary_t *summary) {
+	printf("chunks:          %zu\n", summary->num_chunks);
+	printf("in use:          %zu chunks, %" PRIu64 " bytes\n", summary->num_used, summary->used_bytes);
+	printf("free:            %zu chunks, %" PRIu64 " bytes\n", summary->num_free, summary->free_bytes);
+	printf("overhead:        %" PRIu64 " bytes\n", summary->overhead_bytes);
+	printf("largest free:    %" PRIu64 " bytes\n", summary->largest_free);
+	printf("fragmentation:   %.3f\n", fragmentation(summary));
+	printf("\n%-24s %10s %14s %10s %14s\n", "size class", "used", "used bytes", "free", "free bytes");
+	for (uint32_t i = 0; i < DALLOC_NUM_SIZE_CLASSES; i++) {
+		if (!summary->used[i].count && !summary->free[i].count) {
+			continue;
+		}
+		char range[48];
+		format_class_range(i, range, sizeof(range));
+		printf("%-24s %10zu %14" PRIu64 " %10zu %14" PRIu64 "\n", range,
+			summary->used[i].count, summary->used[i].bytes,
+			summary->free[i].count, summary->free[i].bytes);
+	}
+}
+
+static int cmd_stats(const char *path) {
+	snapshot_t snapshot;
+	if (!read_snapshot(path, &snapshot)) {
+		return 1;
+	}
+	summary_t summary;
+	summarise(&snapshot, &summary);
+	print_summary(&summary);
+	free(snapshot.chunks);
+	return 0;
+}
+
+/*
+Add a range of bytes to the cells of the map which it overlaps.
+*/
+static void add_to_cells(uint64_t *cells, uint64_t lo, uint64_t cell_size,
+		uint64_t start, uint64_t end) {
+	while (start < end) {
+		uint64_t cell = (start - lo) / cell_size;
+		uint64_t cell_end = lo + (cell + 1) * cell_size;
+		uint64_t n = (end < cell_end ? end : cell_end) - start;
+		cells[cell] += n;
+		start += n;
+	}
+}
+
+static int cmd_map(const char *path, size_t width) {
+	snapshot_t snapshot;
+	if (!read_snapshot(path, &snapshot)) {
+		return 1;
+	}
+	if (!snapshot.num_chunks) {
+		printf("(empty heap)\n");
+		free(snapshot.chunks);
+		return 0;
+	}
+
+	uint64_t header_size = snapshot.header.header_size;
+	uint64_t lo = snapshot.chunks[0].address - header_size;
+	uint64_t hi = 0;
+	for (size_t i = 0; i < snapshot.num_chunks; i++) {
+		uint64_t end = snapshot.chunks[i].address + snapshot_chunk_size(&snapshot.chunks[i]);
+		if (end > hi) {
+			hi = end;
+		}
+	}
+
+	size_t num_cells = width * MAP_ROWS;
+	uint64_t cell_size = (hi - lo + num_cells - 1) / num_cells;
+	num_cells = (hi - lo + cell_size - 1) / cell_size;
+	uint64_t *used = calloc(num_cells, sizeof(uint64_t));
+	uint64_t *unused = calloc(num_cells, sizeof(uint64_t));
+	if (!used || !unused) {
+		fprintf(stderr, "out of memory\n");
+		free(used);
+		free(unused);
+		free(snapshot.chunks);
+		return 1;
+	}
+
+	for (size_t i = 0; i < snapshot.num_chunks; i++) {
+		const d_snapshot_chunk_t *chunk = &snapshot.chunks[i];
+		uint64_t start = chunk->address;
+		uint64_t end = start + snapshot_chunk_size(chunk);
+		// Chunk metadata counts as used space.
+		add_to_cells(used, lo, cell_size, start - header_size, start);
+		add_to_cells(snapshot_chunk_in_use(chunk) ? used : unused, lo, cell_size, start, end);
+	}
+
+	printf("%" PRIu64 " bytes per cell. '#' in use, '+' mostly in use, ':' mostly free, '.' free, ' ' not heap\n\n",
+		cell_size);
+	for (size_t row = 0; row * width < num_cells; row++) {
+		printf("0x%012" PRIx64 " ", lo + row * width * cell_size);
+		for (size_t col = 0; col < width && row * width + col < num_cells; col++) {
+			size_t cell = row * width + col;
+			char c = ' ';
+			if (used[cell] && !unused[cell]) {
+				c = '#';
+			} else if (unused[cell] && !used[cell]) {
+				c = '.';
+			} else if (used[cell]) {
+				c = used[cell] >= unused[cell] ? '+' : ':';
+			}
+			putchar(c);
+		}
+		putchar('\n');
+	}
+
+	summary_t summary;
+	summarise(&snapshot, &summary);
+	printf("\n");
+	print_summary(&summary);
+
+	free(used);
+	free(unused);
+	free(snapshot.chunks);
+	return 0;
+}
+
+static void print_chunk_change(char kind, const d_snapshot_chunk_t *chunk, const char *what) {
+	printf("%c 0x%012" PRIx64 " %12" PRIu64 " %s\n", kind, chunk->address,
+		snapshot_chunk_size(chunk), what);
+}
+
+static void print_delta(const char *name, int64_t old_value, int64_t new_value) {
+	printf("%-16s %14" PRId64 " %14" PRId64 " %+14" PRId64 "\n", name,
+		old_value, new_value, new_value - old_value);
+}
+
+static int cmd_diff(const char *old_path, const char *new_path) {
+	snapshot_t old_snapshot, new_snapshot;
+	if (!read_snapshot(old_path, &old_snapshot)) {
+		return 1;
+	}
+	if (!read_snapshot(new_path, &new_snapshot)) {
+		free(old_snapshot.chunks);
+		return 1;
+	}
+
+	summary_t old_summary, new_summary;
+	summarise(&old_snapshot, &old_summary);
+	summarise(&new_snapshot, &new_summary);
+
+	printf("%-16s %14s %14s %14s\n", "", "old", "new", "delta");
+	print_delta("chunks", old_summary.num_chunks, new_summary.num_chunks);
+	print_delta("in use chunks", old_summary.num_used, new_summary.num_used);
+	print_delta("in use bytes", old_summary.used_bytes, new_summary.used_bytes);
+	print_delta("free chunks", old_summary.num_free, new_summary.num_free);
+	print_delta("free bytes", old_summary.free_bytes, new_summary.free_bytes);
+	print_delta("largest free", old_summary.largest_free, new_summary.largest_free);
+	printf("%-16s %14.3f %14.3f %+14.3f\n", "fragmentation", fragmentation(&old_summary),
+		fragmentation(&new_summary), fragmentation(&new_summary) - fragmentation(&old_summary));
+
+	printf("\n%-24s %12s %16s %12s %16s\n", "size class", "used delta", "used bytes delta",
+		"free delta", "free bytes delta");
+	for (uint32_t i = 0; i < DALLOC_NUM_SIZE_CLASSES; i++) {
+		int64_t used = (int64_t)new_summary.used[i].count - old_summary.used[i].count;
+		int64_t used_bytes = (int64_t)new_summary.used[i].bytes - old_summary.used[i].bytes;
+		int64_t unused = (int64_t)new_summary.free[i].count - old_summary.free[i].count;
+		int64_t unused_bytes = (int64_t)new_summary.free[i].bytes - old_summary.free[i].bytes;
+		if (!used && !used_bytes && !unused && !unused_bytes) {
+			continue;
+		}
+		char range[48];
+		format_class_range(i, range, sizeof(range));
+		printf("%-24s %+12" PRId64 " %+16" PRId64 " %+12" PRId64 " %+16" PRId64 "\n",
+			range, used, used_bytes, unused, unused_bytes);
+	}
+
+	// Both snapshots are sorted by address, so changed chunks can be found
+	// by merging them.
+	printf("\nchanged chunks ('+' allocated, '-' freed, '~' resized, '>' new, '<' removed):\n");
+	size_t i = 0, j = 0;
+	while (i < old_snapshot.num_chunks || j < new_snapshot.num_chunks) {
+		const d_snapshot_chunk_t *old_chunk = i < old_snapshot.num_chunks ? &old_snapshot.chunks[i] : NULL;
+		const d_snapshot_chunk_t *new_chunk = j < new_snapshot.num_chunks ? &new_snapshot.chunks[j] : NULL;
+		if (old_chunk && (!new_chunk || old_chunk->address < new_chunk->address)) {
+			print_chunk_change('<', old_chunk, snapshot_chunk_in_use(old_chunk) ? "in use" : "free");
+			i++;
+		} else if (new_chunk && (!old_chunk || new_chunk->address < old_chunk->address)) {
+			print_chunk_change('>', new_chunk, snapshot_chunk_in_use(new_chunk) ? "in use" : "free");
+			j++;
+		} else {
+			bool was_used = snapshot_chunk_in_use(old_chunk);
+			bool is_used = snapshot_chunk_in_use(new_chunk);
+			if (was_used != is_used) {
+				print_chunk_change(is_used ? '+' : '-', new_chunk, is_used ? "in use" : "free");
+			} else if (snapshot_chunk_size(old_chunk) != snapshot_chunk_size(new_chunk)) {
+				print_chunk_change('~', new_chunk, is_used ? "in use" : "free");
+			}
+			i++;
+			j++;
+		}
+	}
+
+	free(old_snapshot.chunks);
+	free(new_snapshot.chunks);
+	return 0;
+}
+
+static int usage(const char *program) {
+	fprintf(stderr,
+		"Usage:\n"
+		"  %s stats <snapshot>\n"
+		"  %s map <snapshot> [width]\n"
+		"  %s diff <old snapshot> <new snapshot>\n",
+		program, program, program);
+	return 2;
+}
+
+int main(int argc, char **argv) {
+	if (argc == 3 && !strcmp(argv[1], "stats")) {
+		return cmd_stats(argv[2]);
+	}
+	if ((argc == 3 || argc == 4) && !strcmp(argv[1], "map")) {
+		long width = argc == 4 ? strtol(argv[3], NULL, 10) : MAP_DEFAULT_WIDTH;
+		if (width <= 0) {
+			return usage(argv[0]);
+		}
+		return cmd_map(argv[2], width);
+	}
+	if (argc == 4 && !strcmp(argv[1], "diff")) {
+		return cmd_diff(argv[2], argv[3]);
+	}
+	return usage(argv[0]);
+}